@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+# Persistent worker for the cgi_workers directive, e.g.
+#   cgi         .py /usr/bin/python3;
+#   cgi_workers .py adapters/python_cgi_worker.py 2 8 1000;
+#
+# The server talks to it over a socket on stdin. A request is
+#   REQUEST <env count> <body length>\n, one NAME=value\n line per variable, then the body.
+# The script output is sent back as CHUNK <length>\n<bytes> frames followed by DONE <exit status>\n.
+# Scripts run unchanged: they find their request in os.environ, sys.stdin and sys.argv and print to sys.stdout.
+import io
+import os
+import socket
+import sys
+import traceback
+
+connection = socket.socket(fileno=0)
+incoming = connection.makefile("rb")
+base_environ = dict(os.environ)
+compiled_scripts = {}
+
+
+class ChunkWriter(io.RawIOBase):
+    def writable(self):
+        return True
+
+    def write(self, data):
+        data = bytes(data)
+        if data:
+            connection.sendall(b"CHUNK %d\n" % len(data) + data)
+        return len(data)
+
+
+class BodyReader(io.RawIOBase):
+    def __init__(self, length):
+        self.remaining = length
+
+    def readable(self):
+        return True
+
+    def readinto(self, buffer):
+        if self.remaining == 0:
+            return 0
+        data = incoming.read1(min(len(buffer), self.remaining))
+        if not data:
+            raise EOFError("server closed the connection during a request")
+        buffer[:len(data)] = data
+        self.remaining -= len(data)
+        return len(data)
+
+    # the next request starts right after the body, whatever the script left unread is skipped
+    def drain(self):
+        while self.remaining > 0:
+            data = incoming.read1(min(65536, self.remaining))
+            if not data:
+                raise EOFError("server closed the connection during a request")
+            self.remaining -= len(data)
+
+
+def load_script(path):
+    modified = os.stat(path).st_mtime_ns
+    cached = compiled_scripts.get(path)
+    if cached and cached[0] == modified:
+        return cached[1]
+    with open(path, "rb") as script:
+        code = compile(script.read(), path, "exec")
+    compiled_scripts[path] = (modified, code)
+    return code
+
+
+def exit_status(code):
+    if code is None:
+        return 0
+    return code if isinstance(code, int) else 1
+
+
+def run_script(env, body):
+    path = env.get("SCRIPT_FILENAME", "")
+    os.environ.clear()
+    os.environ.update(base_environ)
+    os.environ.update(env)
+
+    stdout = io.TextIOWrapper(io.BufferedWriter(ChunkWriter(), 65536), encoding="utf-8")
+    sys.stdout = stdout
+    sys.stdin = io.TextIOWrapper(io.BufferedReader(body), encoding="utf-8")
+    sys.argv = [path]
+    status = 0
+    try:
+        os.chdir(os.path.dirname(path) or ".")
+        exec(load_script(path), {"__name__": "__main__", "__file__": path, "__builtins__": __builtins__})
+    except SystemExit as exit_request:
+        status = exit_status(exit_request.code)
+    except Exception:
+        traceback.print_exc()
+        status = 1
+    finally:
+        try:
+            stdout.flush()
+        except Exception:
+            traceback.print_exc()
+        sys.stdout = sys.__stdout__
+        sys.stdin = sys.__stdin__
+    return status
+
+
+def read_request():
+    head = incoming.readline()
+    if not head:
+        return None
+    command, count, length = head.split()
+    if command != b"REQUEST":
+        raise ValueError("unexpected request line: %r" % head)
+
+    env = {}
+    for _ in range(int(count)):
+        line = incoming.readline().rstrip(b"\n").decode("utf-8", "surrogateescape")
+        name, _, value = line.partition("=")
+        env[name] = value
+    return env, int(length)
+
+
+def main():
+    while True:
+        request = read_request()
+        if request is None:
+            return
+        env, length = request
+        body = BodyReader(length)
+        status = run_script(env, body)
+        body.drain()
+        connection.sendall(b"DONE %d\n" % status)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,82 @@
+// SmartBuffer throughput: appends a body in read-sized pieces and drains it through peek()/consume(),
+// once in memory and once spilled to a file, and reports the buffer pool traffic it caused.
+// Build with `make bench`, run ./bench/bin/buffer_bench [size], size is in megabytes or ends in b, kb, mb or gb.
+// Small sizes are repeated until 64MB went through and are reported per round.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <server/buffer/SmartBuffer.h>
+#include <server/buffer/BufferPool.h>
+#include <server/handler/MetricHandler.h>
+
+static double drain(const size_t total, const bool spill) {
+    std::vector<char> piece(READ_BUFFER_SIZE, 'x');
+    const auto start = std::chrono::steady_clock::now();
+
+    SmartBuffer buffer(spill ? 0 : total);
+    if (spill)
+        buffer.switchToFile();
+    size_t appended = 0;
+    size_t drained = 0;
+    iovec spans[SmartBuffer::MAX_SPANS];
+    while (drained < total) {
+        if (appended < total) {
+            const size_t length = std::min(piece.size(), total - appended);
+            buffer.append(piece.data(), length);
+            appended += length;
+        }
+        buffer.read(READ_BUFFER_SIZE);
+        size_t spanCount = SmartBuffer::MAX_SPANS;
+        const size_t bytes = buffer.peek(spans, spanCount);
+        buffer.consume(bytes);
+        drained += bytes;
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// a bare number keeps meaning megabytes, 0 when the suffix is unknown
+static size_t parseSize(const std::string &value) {
+    char *suffix = nullptr;
+    const size_t number = std::strtoul(value.c_str(), &suffix, 10);
+    const std::string unit = suffix;
+    if (unit.empty() || unit == "mb" || unit == "MB")
+        return number * 1024 * 1024;
+    if (unit == "b" || unit == "B")
+        return number;
+    if (unit == "kb" || unit == "KB")
+        return number * 1024;
+    if (unit == "gb" || unit == "GB")
+        return number * 1024 * 1024 * 1024;
+    return 0;
+}
+
+int main(const int argc, char **argv) {
+    const std::string size = argc > 1 ? argv[1] : "50";
+    const size_t total = parseSize(size);
+    if (total == 0) {
+        std::cerr << "Usage: " << argv[0] << " [size], e.g. 1kb, 64kb or 50" << std::endl;
+        return 1;
+    }
+    constexpr size_t MIN_BYTES = 64 * 1024 * 1024;
+    const size_t rounds = total < MIN_BYTES ? MIN_BYTES / total : 1;
+    SmartBuffer::configure(SIZE_MAX, "/tmp");
+
+    constexpr auto ACQUIRES = static_cast<size_t>(Metric::BUFFER_POOL_ACQUIRES);
+    constexpr auto SLABS = static_cast<size_t>(Metric::BUFFER_POOL_SLAB_ALLOCATIONS);
+    for (const bool spill: {false, true}) {
+        const MetricHandler::Values before = MetricHandler::getTotals();
+        double seconds = 0;
+        for (size_t round = 0; round < rounds; ++round)
+            seconds += drain(total, spill);
+        BufferPool::publishMetrics();
+        const MetricHandler::Values after = MetricHandler::getTotals();
+        const double megabytes = static_cast<double>(total) * rounds / (1024 * 1024);
+        std::cout << (spill ? "file   " : "memory ") << total << " bytes x" << rounds << ": "
+                  << seconds * 1e6 / rounds << "us per round, " << megabytes / seconds << "MB/s, pool acquires "
+                  << after[ACQUIRES] - before[ACQUIRES] << ", slabs " << after[SLABS] - before[SLABS] << std::endl;
+    }
+    return 0;
+}
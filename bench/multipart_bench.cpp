@@ -0,0 +1,69 @@
+// MultipartParser scan throughput: parses a multi-file body fed in randomly sized pieces and checks that
+// every payload byte came out once, in order. Build with `make bench`,
+// run ./bench/bin/multipart_bench [megabytes per file] [files]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <webserv.h>
+#include <parser/multipart/MultipartParser.h>
+
+int main(const int argc, char **argv) {
+    const size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    const size_t files = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4;
+    const std::string boundary = "----benchBoundary7MA4YWxkTrZu0gW";
+
+    // payload bytes that keep resembling the delimiter, the worst case for the skip table
+    std::string payload(megabytes * 1024 * 1024, '\0');
+    std::mt19937 random(42);
+    for (size_t i = 0; i < payload.size(); ++i)
+        payload[i] = random() % 8 == 0 ? '-' : static_cast<char>('a' + random() % 26);
+
+    std::string body;
+    for (size_t i = 0; i < files; ++i) {
+        body += "--" + boundary + "\r\nContent-Disposition: form-data; name=\"file" + std::to_string(i) +
+                "\"; filename=\"bench_" + std::to_string(i) + ".bin\"\r\n"
+                "Content-Type: application/octet-stream\r\n\r\n";
+        body += payload;
+        body += "\r\n";
+    }
+    body += "--" + boundary + "--\r\n";
+
+    size_t parts = 0;
+    size_t received = 0;
+    bool matches = true;
+    MultipartParser parser(boundary, {
+                               [&parts, &received](const MultipartParser::Part &) {
+                                   ++parts;
+                                   received = 0;
+                                   return true;
+                               },
+                               [&received, &matches, &payload](const char *data, const size_t length) {
+                                   matches = matches && received + length <= payload.size() &&
+                                             payload.compare(received, length, data, length) == 0;
+                                   received += length;
+                                   return true;
+                               },
+                               [&received, &matches, &payload]() {
+                                   matches = matches && received == payload.size();
+                                   return true;
+                               }
+                           });
+
+    std::uniform_int_distribution<size_t> pieceSize(1, 2 * READ_BUFFER_SIZE);
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t offset = 0; offset < body.size() && !parser.hasError();) {
+        const size_t length = std::min(pieceSize(random), body.size() - offset);
+        parser.feed(body.data() + offset, length);
+        offset += length;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const double totalMegabytes = static_cast<double>(body.size()) / (1024 * 1024);
+    std::cout << files << "x" << megabytes << "MB: " << seconds * 1000 << "ms, " << totalMegabytes / seconds
+              << "MB/s, " << parts << " parts, " << (parser.isComplete() && matches ? "ok" : "MISMATCH")
+              << std::endl;
+    return parser.isComplete() && matches && parts == files ? 0 : 1;
+}
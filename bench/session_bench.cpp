@@ -0,0 +1,78 @@
+// SessionManager ownership cost: records files for one session and spread over 1000 sessions, looks them up
+// through ownsFile(), folds the journal into a snapshot and loads it back. Each run works in its own
+// temporary directory. Build with `make bench`, run ./bench/bin/session_bench [files]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <webserv.h>
+#include <common/SessionManager.h>
+
+static double since(const std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool run(const size_t files, const size_t sessionCount) {
+    char directory[] = "/tmp/session_bench.XXXXXX";
+    if (!mkdtemp(directory) || chdir(directory) != 0) {
+        std::cerr << "Failed to create a temporary directory" << std::endl;
+        return false;
+    }
+    SessionManager::configure(0, 0, 0);
+    SessionManager::load();
+
+    std::vector<std::string> sessions(sessionCount);
+    for (std::string &sessionId: sessions) {
+        bool isNew = false;
+        sessionId = SessionManager::getSessionId("", isNew);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < files; ++i)
+        SessionManager::addUploadedFile(sessions[i % sessionCount], "www/upload/bench_" + std::to_string(i) + ".bin");
+    const double added = since(start);
+
+    // every file once as its owner and once as another session
+    size_t owned = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < files; ++i) {
+        const std::string filename = "www/upload/bench_" + std::to_string(i) + ".bin";
+        owned += SessionManager::ownsFile(sessions[i % sessionCount], filename);
+        owned += SessionManager::ownsFile(sessions[(i + 1) % sessionCount], filename);
+    }
+    const double looked = since(start);
+
+    start = std::chrono::steady_clock::now();
+    SessionManager::compactIfNeeded();
+    SessionManager::cleanUp();
+    const double compacted = since(start);
+
+    start = std::chrono::steady_clock::now();
+    SessionManager::load();
+    const double loaded = since(start);
+    const SessionManager::Stats stats = SessionManager::getStats();
+    SessionManager::cleanUp();
+
+    unlink(SESSION_SNAPSHOT_FILE);
+    unlink(SESSION_JOURNAL_FILE);
+    unlink(SESSION_COMPACTING_FILE);
+    rmdir(directory);
+
+    const size_t expected = sessionCount == 1 ? 2 * files : files;
+    const bool matches = owned == expected && stats.files == files && stats.sessions == sessionCount;
+    std::cout << files << " files in " << sessionCount << " sessions: add " << added * 1e9 / files
+              << "ns, ownsFile " << looked * 1e9 / (2 * files) << "ns, snapshot " << compacted * 1000
+              << "ms, load " << loaded * 1000 << "ms, " << stats.memoryBytes / (1024 * 1024) << "MB, "
+              << (matches ? "ok" : "MISMATCH") << std::endl;
+    return matches;
+}
+
+int main(const int argc, char **argv) {
+    const size_t files = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    const bool single = run(files, 1);
+    const bool spread = run(files, 1000);
+    return single && spread ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+#!/bin/bash
+# End-to-end transfer times against a freshly started server with config.yaml:
+# GET and multipart upload of a random file and a CGI POST of a 3MB form body.
+# Usage: bench/transfer.sh [megabytes] [files per upload]
+cd "$(dirname "$0")/.." || exit 1
+SIZE=${1:-50}
+FILES=${2:-1}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# the upload must fit in the body limit, whatever size is benchmarked
+sed "s/client_max_body_size .*/client_max_body_size $((SIZE * FILES + 1))MB;/" config.yaml > "$TMP/bench.yaml"
+./webserv "$TMP/bench.yaml" > "$TMP/webserv.log" 2>&1 &
+SERVER=$!
+# only the server started here, a developer's own webserv keeps running
+trap 'kill "$SERVER" 2>/dev/null; wait "$SERVER" 2>/dev/null; rm -rf "$TMP"' EXIT
+sleep 1
+
+FORM=()
+for i in $(seq 1 "$FILES"); do
+    head -c $((SIZE * 1024 * 1024)) /dev/urandom > "$TMP/bench_$i.bin"
+    FORM+=(-F "file$i=@$TMP/bench_$i.bin")
+    rm -f "www/upload/bench_$i.bin"
+done
+
+echo "multipart ${FILES}x${SIZE}MB $(curl -s -o /dev/null -w '%{http_code} %{time_total}s' -c "$TMP/cookies" "${FORM[@]}" localhost:8080/upload)"
+echo "get ${SIZE}MB          $(curl -s -o /dev/null -w '%{http_code} %{time_total}s' localhost:8080/upload/bench_1.bin)"
+for i in $(seq 1 "$FILES"); do
+    curl -s -o /dev/null -b "$TMP/cookies" -X DELETE "localhost:8080/upload/bench_$i.bin"
+done
+
+python3 -c "print('x=' + 'a' * 3000000)" > "$TMP/form.txt"
+echo "cgi post 3MB       $(curl -s -o /dev/null -w '%{http_code} %{time_total}s' --data-binary @"$TMP/form.txt" localhost:8080/cgi/test.py)"
@@ -0,0 +1,353 @@
+#include "SessionJournal.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <array>
+#include "Logger.h"
+
+std::mutex SessionJournal::mutex;
+int SessionJournal::fd = -1;
+std::string SessionJournal::path;
+size_t SessionJournal::size = 0;
+
+static constexpr char SNAPSHOT_MAGIC[8] = {'W', 'S', 'S', 'E', 'S', 'S', '0', '2'};
+static constexpr size_t RECORD_HEADER_SIZE = 4 + 1 + 4 + 4;
+static constexpr uint32_t MAX_NAME_LENGTH = 4096;
+
+static uint32_t crc32(const char *data, const size_t length, uint32_t crc = 0) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> values{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit)
+                value = (value & 1) ? 0xEDB88320 ^ (value >> 1) : value >> 1;
+            values[i] = value;
+        }
+        return values;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i)
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void putInt(std::string &out, uint64_t value, const size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+        out += static_cast<char>(value & 0xFF);
+        value >>= 8;
+    }
+}
+
+static uint64_t getInt(const char *in, const size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = bytes; i > 0; --i)
+        value = (value << 8) | static_cast<uint8_t>(in[i - 1]);
+    return value;
+}
+
+static bool readFile(const std::string &filePath, std::string &content) {
+    const int fileFd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fileFd == -1)
+        return false;
+    struct stat fileStat{};
+    if (fstat(fileFd, &fileStat) == -1) {
+        ::close(fileFd);
+        return false;
+    }
+    content.resize(fileStat.st_size);
+    size_t done = 0;
+    while (done < content.size()) {
+        const ssize_t result = read(fileFd, content.data() + done, content.size() - done);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            break;
+        done += result;
+    }
+    content.resize(done);
+    ::close(fileFd);
+    return true;
+}
+
+static bool writeAll(const int fileFd, const std::string &data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        const ssize_t result = write(fileFd, data.data() + done, data.size() - done);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return false;
+        done += result;
+    }
+    return true;
+}
+
+bool SessionJournal::open(const std::string &journalPath) {
+    std::lock_guard<std::mutex> lock(mutex);
+    fd = ::open(journalPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        Logger::log(LogLevel::ERROR, "Failed to open session journal " + journalPath + ": " + strerror(errno));
+        return false;
+    }
+    path = journalPath;
+    struct stat fileStat{};
+    size = fstat(fd, &fileStat) == 0 ? fileStat.st_size : 0;
+    return true;
+}
+
+void SessionJournal::append(const Op op, const std::string &sessionId, const std::string &filename) {
+    std::string record;
+    record.reserve(RECORD_HEADER_SIZE + sessionId.size() + filename.size());
+    putInt(record, 0, 4);
+    putInt(record, static_cast<uint8_t>(op), 1);
+    putInt(record, sessionId.size(), 4);
+    putInt(record, filename.size(), 4);
+    record += sessionId;
+    record += filename;
+    const uint32_t crc = crc32(record.data() + 4, record.size() - 4);
+    for (size_t i = 0; i < 4; ++i)
+        record[i] = static_cast<char>((crc >> (8 * i)) & 0xFF);
+
+    // one write per record, a crash can only tear the last one
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd == -1)
+        return;
+    if (!writeAll(fd, record)) {
+        Logger::log(LogLevel::ERROR, "Failed to append to session journal: " + std::string(strerror(errno)));
+        return;
+    }
+    size += record.size();
+}
+
+size_t SessionJournal::getSize() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return size;
+}
+
+bool SessionJournal::rotate(const std::string &rotatedPath) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd == -1 || rename(path.c_str(), rotatedPath.c_str()) == -1)
+        return false;
+    ::close(fd);
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    size = 0;
+    if (fd == -1) {
+        Logger::log(LogLevel::ERROR, "Failed to reopen session journal " + path + ": " + strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void SessionJournal::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd != -1)
+        ::close(fd);
+    fd = -1;
+    size = 0;
+}
+
+void SessionJournal::apply(Sessions &sessions, const Op op, const std::string &sessionId,
+                           const std::string &filename) {
+    switch (op) {
+        case Op::CREATE_SESSION: {
+            StoredSession &session = sessions[sessionId];
+            try {
+                session.created = std::stoll(filename);
+            } catch (...) {
+                session.created = 0;
+            }
+            break;
+        }
+        case Op::ADD_FILE:
+            sessions[sessionId].files.insert(filename);
+            break;
+        case Op::REMOVE_FILE: {
+            const auto it = sessions.find(sessionId);
+            if (it != sessions.end())
+                it->second.files.erase(filename);
+            break;
+        }
+        case Op::REMOVE_SESSION:
+            sessions.erase(sessionId);
+            break;
+    }
+}
+
+SessionJournal::ReplayResult SessionJournal::replay(const std::string &journalPath, Sessions &sessions) {
+    ReplayResult result;
+    std::string content;
+    if (!readFile(journalPath, content))
+        return result;
+
+    size_t pos = 0;
+    bool resynced = true; // false right after a skipped record, its lengths may have been the corrupt part
+    while (content.size() - pos >= RECORD_HEADER_SIZE) {
+        const char *record = content.data() + pos;
+        const uint32_t crc = getInt(record, 4);
+        const auto op = static_cast<Op>(getInt(record + 4, 1));
+        const uint32_t sessionLength = getInt(record + 5, 4);
+        const uint32_t fileLength = getInt(record + 9, 4);
+        if (sessionLength > MAX_NAME_LENGTH || fileLength > MAX_NAME_LENGTH) {
+            result.unreadable = true;
+            break;
+        }
+        const size_t recordSize = RECORD_HEADER_SIZE + sessionLength + fileLength;
+        // a record cut short by the end of the file is the torn tail of a crash
+        if (content.size() - pos < recordSize) {
+            result.unreadable = !resynced;
+            break;
+        }
+        if (crc32(record + 4, recordSize - 4) != crc ||
+            (op != Op::CREATE_SESSION && op != Op::ADD_FILE && op != Op::REMOVE_FILE && op != Op::REMOVE_SESSION)) {
+            // the last record was torn, one in the middle was damaged after it was written
+            if (content.size() - pos == recordSize)
+                break;
+            ++result.skipped;
+            resynced = false;
+            pos += recordSize;
+            continue;
+        }
+        apply(sessions, op, std::string(record + RECORD_HEADER_SIZE, sessionLength),
+              std::string(record + RECORD_HEADER_SIZE + sessionLength, fileLength));
+        resynced = true;
+        pos += recordSize;
+    }
+    result.length = pos;
+    return result;
+}
+
+bool SessionJournal::loadSnapshot(const std::string &snapshotPath, Sessions &sessions) {
+    std::string content;
+    if (!readFile(snapshotPath, content) || content.size() < sizeof(SNAPSHOT_MAGIC) + 8 + 4 ||
+        std::memcmp(content.data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+        return false;
+    const size_t end = content.size() - 4;
+    if (crc32(content.data(), end) != getInt(content.data() + end, 4))
+        return false;
+
+    // the checksum matched, the bounds checks only guard against a snapshot of a different format
+    size_t pos = sizeof(SNAPSHOT_MAGIC);
+    auto readName = [&content, &pos, end](std::string &name) {
+        if (end - pos < 4)
+            return false;
+        const uint32_t length = getInt(content.data() + pos, 4);
+        pos += 4;
+        if (length > MAX_NAME_LENGTH || end - pos < length)
+            return false;
+        name.assign(content.data() + pos, length);
+        pos += length;
+        return true;
+    };
+    Sessions loaded;
+    uint64_t sessionCount = getInt(content.data() + pos, 8);
+    pos += 8;
+    for (; sessionCount > 0; --sessionCount) {
+        std::string sessionId;
+        if (!readName(sessionId) || end - pos < 16)
+            return false;
+        StoredSession &session = loaded[sessionId];
+        session.created = static_cast<int64_t>(getInt(content.data() + pos, 8));
+        uint64_t fileCount = getInt(content.data() + pos + 8, 8);
+        pos += 16;
+        for (; fileCount > 0; --fileCount) {
+            std::string filename;
+            if (!readName(filename))
+                return false;
+            session.files.insert(std::move(filename));
+        }
+    }
+    sessions = std::move(loaded);
+    return true;
+}
+
+bool SessionJournal::loadLegacy(const std::string &legacyPath, Sessions &sessions) {
+    std::string content;
+    if (!readFile(legacyPath, content))
+        return false;
+
+    // the old dump was written by this machine, its size_t fields are native and it has no checksum
+    size_t pos = 0;
+    auto readCount = [&content, &pos](size_t &value) {
+        if (content.size() - pos < sizeof(value))
+            return false;
+        std::memcpy(&value, content.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    };
+    auto readName = [&content, &pos, &readCount](std::string &name) {
+        size_t length = 0;
+        if (!readCount(length) || length > MAX_NAME_LENGTH || content.size() - pos < length)
+            return false;
+        name.assign(content.data() + pos, length);
+        pos += length;
+        return true;
+    };
+    Sessions loaded;
+    size_t sessionCount = 0;
+    if (!readCount(sessionCount))
+        return false;
+    for (; sessionCount > 0; --sessionCount) {
+        std::string sessionId;
+        size_t fileCount = 0;
+        if (!readName(sessionId) || !readCount(fileCount))
+            return false;
+        // creation times were not stored, load() starts their lifetime now
+        StoredSession &session = loaded[sessionId];
+        for (; fileCount > 0; --fileCount) {
+            std::string filename;
+            if (!readName(filename))
+                return false;
+            session.files.insert(std::move(filename));
+        }
+    }
+    if (pos != content.size())
+        return false;
+    sessions = std::move(loaded);
+    return true;
+}
+
+bool SessionJournal::writeSnapshot(const std::string &snapshotPath, const Sessions &sessions) {
+    std::string content(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    putInt(content, sessions.size(), 8);
+    for (const auto &[sessionId, session]: sessions) {
+        putInt(content, sessionId.size(), 4);
+        content += sessionId;
+        putInt(content, static_cast<uint64_t>(session.created), 8);
+        putInt(content, session.files.size(), 8);
+        for (const std::string &filename: session.files) {
+            putInt(content, filename.size(), 4);
+            content += filename;
+        }
+    }
+    putInt(content, crc32(content.data(), content.size()), 4);
+
+    const std::string tempPath = snapshotPath + ".tmp";
+    const int tempFd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (tempFd == -1)
+        return false;
+    const bool written = writeAll(tempFd, content) && fsync(tempFd) == 0;
+    ::close(tempFd);
+    if (!written || rename(tempPath.c_str(), snapshotPath.c_str()) == -1) {
+        unlink(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SessionJournal::compact(const std::string &snapshotPath, const std::string &journalPath) {
+    Sessions sessions;
+    // a corrupt snapshot is kept for inspection instead of being replaced by the journal alone
+    if (!loadSnapshot(snapshotPath, sessions) && access(snapshotPath.c_str(), F_OK) == 0)
+        return false;
+    const ReplayResult replayed = replay(journalPath, sessions);
+    if (!writeSnapshot(snapshotPath, sessions))
+        return false;
+    if (replayed.unreadable)
+        rename(journalPath.c_str(), (journalPath + ".corrupt").c_str());
+    else
+        unlink(journalPath.c_str());
+    return true;
+}
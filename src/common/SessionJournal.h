@@ -0,0 +1,78 @@
+#ifndef SESSIONJOURNAL_H
+#define SESSIONJOURNAL_H
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <cstdint>
+
+// Session persistence: every change is appended to a journal as one checksummed record, a compaction folds
+// a rotated journal into a checksummed snapshot. Both files use little-endian fixed size integers.
+//   journal record: crc32 | op u8 | session length u32 | file length u32 | session | file
+//   snapshot:       magic | session count u64 | (length u32 | session | created i64 | file count u64 |
+//                   (length u32 | file)...)... | crc32
+// A CREATE_SESSION record carries the creation time as decimal text in its file field.
+class SessionJournal {
+public:
+    enum class Op : uint8_t {
+        CREATE_SESSION = 1,
+        ADD_FILE = 2,
+        REMOVE_FILE = 3,
+        REMOVE_SESSION = 4
+    };
+
+    struct StoredSession {
+        int64_t created = 0; // unix time, 0 when unknown
+        std::unordered_set<std::string> files;
+    };
+
+    typedef std::unordered_map<std::string, StoredSession> Sessions;
+
+    struct ReplayResult {
+        size_t length = 0; // end of the last record that was read, only a torn record can follow it
+        size_t skipped = 0; // complete records in the middle whose checksum did not match
+        bool unreadable = false; // a record in the middle could not be framed, nothing behind it was read
+    };
+
+private:
+    static std::mutex mutex;
+    static int fd;
+    static std::string path;
+    static size_t size;
+
+public:
+    static bool open(const std::string &journalPath);
+
+    // appends one record, safe to call from any thread
+    static void append(Op op, const std::string &sessionId, const std::string &filename = "");
+
+    [[nodiscard]] static size_t getSize();
+
+    // renames the journal to rotatedPath and continues in an empty one
+    static bool rotate(const std::string &rotatedPath);
+
+    static void close();
+
+    static void apply(Sessions &sessions, Op op, const std::string &sessionId, const std::string &filename);
+
+    // applies every intact record. A torn last record ends the replay, a corrupt record in the middle is skipped
+    // by its length as long as its lengths are plausible.
+    static ReplayResult replay(const std::string &journalPath, Sessions &sessions);
+
+    // false when the snapshot is missing or its checksum does not match
+    static bool loadSnapshot(const std::string &snapshotPath, Sessions &sessions);
+
+    // reads the full dump older versions kept in SESSION_LEGACY_FILE, false when it is truncated or malformed
+    static bool loadLegacy(const std::string &legacyPath, Sessions &sessions);
+
+    // writes a temp file, syncs it and renames it over the snapshot
+    static bool writeSnapshot(const std::string &snapshotPath, const Sessions &sessions);
+
+    // folds a rotated journal into the snapshot and removes it, touches nothing but the two files.
+    // A journal that could not be read to its end is kept as journalPath.corrupt instead.
+    static bool compact(const std::string &snapshotPath, const std::string &journalPath);
+};
+
+
+#endif //SESSIONJOURNAL_H
@@ -9,26 +9,111 @@
 #include <vector>
 #include <string>
 #include <iterator>
-#include <fcntl.h>
-#include <iostream>
 #include <unistd.h>
-#include <poll.h>
+#include <sys/stat.h>
+#include <webserv.h>
+#include "Logger.h"
+#include "SessionJournal.h"
 
-std::unordered_map<std::string, std::vector<std::string> > SessionManager::sessions;
-std::mutex SessionManager::mutex_;
+std::array<SessionManager::Shard, SessionManager::SHARD_COUNT> SessionManager::shards;
+std::thread SessionManager::compaction;
+std::atomic<bool> SessionManager::compactionDone{false};
+std::atomic<bool> SessionManager::compactionSucceeded{true};
+size_t SessionManager::idleTimeout = DEFAULT_SESSION_IDLE_TIMEOUT;
+size_t SessionManager::lifetime = DEFAULT_SESSION_LIFETIME;
+size_t SessionManager::maxCount = DEFAULT_SESSION_MAX_COUNT;
+time_t SessionManager::lastExpiry = 0;
+std::atomic<size_t> SessionManager::expiredCount{0};
+std::atomic<size_t> SessionManager::evictedCount{0};
+
+// heap use of one entry: the string contents plus a hash node with its bucket, the session also has a list node
+static size_t sessionCost(const std::string &sessionId) {
+    return sessionId.size() + sizeof(std::string) + sizeof(std::unordered_set<std::string>) + 2 * sizeof(time_t) +
+           8 * sizeof(void *);
+}
+
+static size_t fileCost(const std::string &filename) {
+    return filename.size() + sizeof(std::string) + 3 * sizeof(void *);
+}
 
 static std::string generateSessionId() {
-    static std::random_device rd;
-    static std::mt19937_64 eng(rd());
-    static std::uniform_int_distribution<uint64_t> dist;
+    // every thread has its own engine, ids are created without a lock
+    thread_local std::random_device rd;
+    thread_local std::mt19937_64 eng(rd());
+    thread_local std::uniform_int_distribution<uint64_t> dist;
     uint64_t val = dist(eng);
     std::stringstream ss;
     ss << std::hex << std::setw(16) << std::setfill('0') << val;
     return ss.str();
 }
 
+SessionManager::Shard &SessionManager::shardOf(const std::string &sessionId) {
+    return shards[std::hash<std::string>{}(sessionId) % SHARD_COUNT];
+}
+
+// the caller holds every shard lock
+void SessionManager::clear() {
+    for (Shard &shard: shards) {
+        shard.recent.clear();
+        shard.sessions.clear();
+        shard.memoryBytes = 0;
+    }
+}
+
+void SessionManager::configure(const size_t idleTimeout, const size_t lifetime, const size_t maxCount) {
+    SessionManager::idleTimeout = idleTimeout;
+    SessionManager::lifetime = lifetime;
+    SessionManager::maxCount = maxCount;
+}
+
+bool SessionManager::isExpired(const Session &session, const time_t now) {
+    return (idleTimeout > 0 && now - session.lastSeen >= static_cast<time_t>(idleTimeout)) ||
+           (lifetime > 0 && now - session.created >= static_cast<time_t>(lifetime));
+}
+
+SessionManager::SessionMap::iterator SessionManager::insert(Shard &shard, const std::string &sessionId,
+                                                            const time_t created, const time_t now) {
+    const auto it = shard.sessions.try_emplace(sessionId).first;
+    it->second.created = created;
+    it->second.lastSeen = now;
+    shard.recent.push_front(&it->first);
+    it->second.recent = shard.recent.begin();
+    shard.memoryBytes += sessionCost(sessionId);
+    return it;
+}
+
+void SessionManager::touch(Shard &shard, const SessionMap::iterator it, const time_t now) {
+    it->second.lastSeen = now;
+    shard.recent.splice(shard.recent.begin(), shard.recent, it->second.recent);
+}
+
+// the files stay on disk, nobody owns them anymore
+void SessionManager::erase(Shard &shard, const SessionMap::iterator it) {
+    SessionJournal::append(SessionJournal::Op::REMOVE_SESSION, it->first);
+    for (const std::string &filename: it->second.files)
+        shard.memoryBytes -= fileCost(filename);
+    shard.memoryBytes -= sessionCost(it->first);
+    shard.recent.erase(it->second.recent);
+    shard.sessions.erase(it);
+}
+
+// a session that owns files is never evicted, its owner would lose the right to delete them
+bool SessionManager::evictOne(Shard &shard) {
+    size_t scanned = 0;
+    for (auto position = shard.recent.rbegin(); position != shard.recent.rend() && scanned < EVICTION_SCAN_LIMIT;
+         ++position, ++scanned) {
+        const auto it = shard.sessions.find(**position);
+        if (it->second.files.empty()) {
+            erase(shard, it);
+            ++evictedCount;
+            return true;
+        }
+    }
+    return false;
+}
+
 std::string SessionManager::getSessionId(const std::string &cookieHeader, bool &isNew) {
-    std::lock_guard<std::mutex> lk(mutex_);
+    const time_t now = time(nullptr);
     isNew = false;
     // look for “sessionId=…”
     auto pos = cookieHeader.find("sessionId=");
@@ -36,164 +121,215 @@ std::string SessionManager::getSessionId(const std::string &cookieHeader, bool &
         pos += strlen("sessionId=");
         auto end = cookieHeader.find(';', pos);
         std::string id = cookieHeader.substr(pos, end - pos);
-        if (sessions.count(id)) return id;
+        Shard &shard = shardOf(id);
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        const auto it = shard.sessions.find(id);
+        if (it != shard.sessions.end()) {
+            // the loop only expires from the tail, an old session can still be found here
+            if (!isExpired(it->second, now)) {
+                touch(shard, it, now);
+                return id;
+            }
+            erase(shard, it);
+            ++expiredCount;
+        }
     }
     // else create
     std::string newId = generateSessionId();
-    sessions[newId] = {};
+    Shard &shard = shardOf(newId);
+    std::lock_guard<std::mutex> lk(shard.mutex);
+    // the cap is split over the shards, when every candidate owns files the shard grows past it
+    if (maxCount > 0 && shard.sessions.size() >= std::max<size_t>(maxCount / SHARD_COUNT, 1))
+        evictOne(shard);
+    insert(shard, newId, now, now);
+    SessionJournal::append(SessionJournal::Op::CREATE_SESSION, newId, std::to_string(now));
     isNew = true;
     return newId;
 }
 
 void SessionManager::addUploadedFile(const std::string &sid, const std::string &fn) {
-    std::lock_guard<std::mutex> lk(mutex_);
-    sessions[sid].push_back(fn);
+    const time_t now = time(nullptr);
+    Shard &shard = shardOf(sid);
+    std::lock_guard<std::mutex> lk(shard.mutex);
+    auto it = shard.sessions.find(sid);
+    // a resumable upload can finish after the session that started it expired
+    if (it == shard.sessions.end()) {
+        it = insert(shard, sid, now, now);
+        SessionJournal::append(SessionJournal::Op::CREATE_SESSION, sid, std::to_string(now));
+    } else
+        touch(shard, it, now);
+    if (it->second.files.insert(fn).second) {
+        shard.memoryBytes += fileCost(fn);
+        SessionJournal::append(SessionJournal::Op::ADD_FILE, sid, fn);
+    }
 }
 
 bool SessionManager::ownsFile(const std::string &sid, const std::string &fn) {
-    std::lock_guard<std::mutex> lk(mutex_);
-    auto it = sessions.find(sid);
-    if (it == sessions.end()) return false;
-    auto &v = it->second;
-    return std::find(v.begin(), v.end(), fn) != v.end();
+    Shard &shard = shardOf(sid);
+    std::lock_guard<std::mutex> lk(shard.mutex);
+    auto it = shard.sessions.find(sid);
+    if (it == shard.sessions.end()) return false;
+    return it->second.files.count(fn) > 0;
 }
 
 bool SessionManager::removeFile(const std::string &sessionId, const std::string &filename) {
-    std::lock_guard<std::mutex> lk(mutex_);
-    auto it = sessions.find(sessionId);
-    if (it == sessions.end()) return false;
-    auto &v = it->second;
-    auto fileIt = std::find(v.begin(), v.end(), filename);
-    if (fileIt != v.end()) {
-        v.erase(fileIt);
-        return true;
-    }
-    return false;
+    Shard &shard = shardOf(sessionId);
+    std::lock_guard<std::mutex> lk(shard.mutex);
+    auto it = shard.sessions.find(sessionId);
+    if (it == shard.sessions.end()) return false;
+    if (it->second.files.erase(filename) == 0)
+        return false;
+    shard.memoryBytes -= fileCost(filename);
+    SessionJournal::append(SessionJournal::Op::REMOVE_FILE, sessionId, filename);
+    return true;
 }
 
-void SessionManager::serialize(const std::string &filename) {
-    std::lock_guard<std::mutex> lk(mutex_);
-    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0) return;
-
-    pollfd pfd = {fd, POLLOUT, 0};
-    if (poll(&pfd, 1, 1000) <= 0) {
-        close(fd);
+void SessionManager::expire() {
+    const time_t now = time(nullptr);
+    if (now == lastExpiry || (idleTimeout == 0 && lifetime == 0))
         return;
-    }
+    lastExpiry = now;
 
-    auto safeWrite = [fd](const void *data, size_t size) -> bool {
-        size_t written = 0;
-        while (written < size) {
-            ssize_t result = write(fd, static_cast<const char *>(data) + written, size - written);
-            if (result <= 0)
-                return false;
-            written += result;
+    size_t expired = 0;
+    for (Shard &shard: shards) {
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        // the tail holds the longest idle session, the lifetime of the others is checked on their next request
+        while (!shard.recent.empty()) {
+            const auto it = shard.sessions.find(*shard.recent.back());
+            if (!isExpired(it->second, now))
+                break;
+            erase(shard, it);
+            ++expired;
         }
-        return true;
-    };
-
-    size_t sessionCount = sessions.size();
-    if (!safeWrite(&sessionCount, sizeof(sessionCount))) {
-        close(fd);
-        return;
     }
+    expiredCount += expired;
+}
 
-    for (const auto &pair: sessions) {
-        size_t sidLen = pair.first.size();
-        if (!safeWrite(&sidLen, sizeof(sidLen)) ||
-            !safeWrite(pair.first.data(), sidLen)) {
-            close(fd);
-            return;
-        }
-
-        size_t fileCount = pair.second.size();
-        if (!safeWrite(&fileCount, sizeof(fileCount))) {
-            close(fd);
-            return;
-        }
-
-        for (const std::string &fn: pair.second) {
-            size_t fnLen = fn.size();
-            if (!safeWrite(&fnLen, sizeof(fnLen)) ||
-                !safeWrite(fn.data(), fnLen)) {
-                close(fd);
-                return;
-            }
-        }
+SessionManager::Stats SessionManager::getStats() {
+    Stats stats{0, 0, 0, expiredCount.load(), evictedCount.load()};
+    for (Shard &shard: shards) {
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        stats.sessions += shard.sessions.size();
+        for (const auto &[sessionId, session]: shard.sessions)
+            stats.files += session.files.size();
+        stats.memoryBytes += shard.memoryBytes;
     }
+    return stats;
+}
 
-    close(fd);
+// every shard in the same order, so two callers cannot deadlock
+std::vector<std::unique_lock<std::mutex> > SessionManager::lockShards() {
+    std::vector<std::unique_lock<std::mutex> > locks;
+    for (auto &shard: shards)
+        locks.emplace_back(shard.mutex);
+    return locks;
 }
 
-void SessionManager::deserialize(const std::string &filename) {
-    std::lock_guard<std::mutex> lk(mutex_);
-    int fd = open(filename.c_str(), O_RDONLY);
-    if (fd < 0) return;
-    struct pollfd pfd = {fd, POLLIN, 0};
-    if (poll(&pfd, 1, 1000) <= 0) {
-        close(fd);
+// runs only before the first start with journaling, later starts never look at the old dump again
+void SessionManager::importLegacy() {
+    if (access(SESSION_SNAPSHOT_FILE, F_OK) == 0 || access(SESSION_JOURNAL_FILE, F_OK) == 0 ||
+        access(SESSION_COMPACTING_FILE, F_OK) == 0 || access(SESSION_LEGACY_FILE, F_OK) != 0)
+        return;
+    SessionJournal::Sessions sessions;
+    if (!SessionJournal::loadLegacy(SESSION_LEGACY_FILE, sessions)) {
+        Logger::log(LogLevel::ERROR, std::string(SESSION_LEGACY_FILE) + " is malformed, it is kept as " +
+                                     SESSION_LEGACY_FILE ".corrupt");
+        rename(SESSION_LEGACY_FILE, SESSION_LEGACY_FILE ".corrupt");
         return;
     }
-    sessions.clear();
-    size_t sessionCount = 0;
-    ssize_t r = read(fd, &sessionCount, sizeof(sessionCount));
-    if (r != (ssize_t) sizeof(sessionCount)) {
-        close(fd);
+    // the old file goes only once its sessions are safe in the snapshot
+    if (!SessionJournal::writeSnapshot(SESSION_SNAPSHOT_FILE, sessions)) {
+        Logger::log(LogLevel::ERROR, "Failed to import " + std::string(SESSION_LEGACY_FILE) + ", it is retried at the next start");
         return;
     }
-    for (size_t i = 0; i < sessionCount; ++i) {
-        size_t sidLen = 0;
-        if (read(fd, &sidLen, sizeof(sidLen)) != (ssize_t) sizeof(sidLen)) {
-            close(fd);
-            sessions.clear();
-            return;
-        }
-        if (sidLen > 4096) {
-            close(fd);
-            sessions.clear();
-            return;
-        } // sanity check
-        std::string sid(sidLen, '\0');
-        if (read(fd, &sid[0], sidLen) != (ssize_t) sidLen) {
-            close(fd);
-            sessions.clear();
-            return;
-        }
-        size_t fileCount = 0;
-        if (read(fd, &fileCount, sizeof(fileCount)) != (ssize_t) sizeof(fileCount)) {
-            close(fd);
-            sessions.clear();
-            return;
+    unlink(SESSION_LEGACY_FILE);
+    Logger::log(LogLevel::INFO, "Imported " + std::to_string(sessions.size()) + " sessions from " +
+                                SESSION_LEGACY_FILE);
+}
+
+void SessionManager::load() {
+    importLegacy();
+
+    // a compaction that did not finish before the last shutdown or crash
+    if (access(SESSION_COMPACTING_FILE, F_OK) == 0 && !SessionJournal::compact(SESSION_SNAPSHOT_FILE,
+                                                                               SESSION_COMPACTING_FILE))
+        Logger::log(LogLevel::ERROR, "Failed to compact " + std::string(SESSION_COMPACTING_FILE));
+
+    SessionJournal::Sessions sessions;
+    if (!SessionJournal::loadSnapshot(SESSION_SNAPSHOT_FILE, sessions) && access(SESSION_SNAPSHOT_FILE, F_OK) == 0) {
+        Logger::log(LogLevel::ERROR, "Session snapshot is corrupt, it is kept as " +
+                                     std::string(SESSION_SNAPSHOT_FILE) + ".corrupt");
+        rename(SESSION_SNAPSHOT_FILE, SESSION_SNAPSHOT_FILE ".corrupt");
+    }
+    const SessionJournal::ReplayResult replayed = SessionJournal::replay(SESSION_JOURNAL_FILE, sessions);
+    if (replayed.skipped > 0)
+        Logger::log(LogLevel::ERROR, "Skipped " + std::to_string(replayed.skipped) +
+                                     " corrupt records in the session journal");
+    struct stat journalStat{};
+    if (replayed.unreadable) {
+        // nothing behind the damage can be framed, what was read goes to the snapshot and the journal starts over
+        Logger::log(LogLevel::ERROR, "Session journal is corrupt after byte " + std::to_string(replayed.length) +
+                                     ", it is kept as " + SESSION_JOURNAL_FILE ".corrupt");
+        if (SessionJournal::writeSnapshot(SESSION_SNAPSHOT_FILE, sessions))
+            rename(SESSION_JOURNAL_FILE, SESSION_JOURNAL_FILE ".corrupt");
+        else
+            Logger::log(LogLevel::ERROR, "Failed to write the session snapshot, the journal stays in place");
+    } else if (stat(SESSION_JOURNAL_FILE, &journalStat) == 0 &&
+               static_cast<size_t>(journalStat.st_size) > replayed.length) {
+        // new records must not end up behind a record that was torn by a crash
+        Logger::log(LogLevel::WARNING, "Dropping a torn record at the end of the session journal");
+        truncate(SESSION_JOURNAL_FILE, static_cast<off_t>(replayed.length));
+    }
+
+    // idle time is not persisted, every session gets a full idle timeout after a restart
+    const time_t now = time(nullptr);
+    const auto locks = lockShards();
+    clear();
+    SessionJournal::open(SESSION_JOURNAL_FILE);
+    size_t sessionCount = 0;
+    size_t fileCount = 0;
+    for (auto &[sessionId, stored]: sessions) {
+        const time_t created = stored.created > 0 ? static_cast<time_t>(stored.created) : now;
+        if (lifetime > 0 && now - created >= static_cast<time_t>(lifetime)) {
+            SessionJournal::append(SessionJournal::Op::REMOVE_SESSION, sessionId);
+            continue;
         }
-        if (fileCount > 10000) {
-            close(fd);
-            sessions.clear();
+        Shard &shard = shardOf(sessionId);
+        const auto it = insert(shard, sessionId, created, now);
+        for (const std::string &filename: stored.files)
+            shard.memoryBytes += fileCost(filename);
+        it->second.files = std::move(stored.files);
+        fileCount += it->second.files.size();
+        ++sessionCount;
+    }
+    Logger::log(LogLevel::INFO, "Loaded " + std::to_string(sessionCount) + " sessions with " +
+                                std::to_string(fileCount) + " files");
+}
+
+void SessionManager::compactIfNeeded() {
+    if (compaction.joinable()) {
+        if (!compactionDone.load())
             return;
-        } // sanity check
-        std::vector<std::string> files;
-        for (size_t j = 0; j < fileCount; ++j) {
-            size_t fnLen = 0;
-            if (read(fd, &fnLen, sizeof(fnLen)) != (ssize_t) sizeof(fnLen)) {
-                close(fd);
-                sessions.clear();
-                return;
-            }
-            if (fnLen > 4096) {
-                close(fd);
-                sessions.clear();
-                return;
-            } // sanity check
-            std::string fn(fnLen, '\0');
-            if (read(fd, &fn[0], fnLen) != (ssize_t) fnLen) {
-                close(fd);
-                sessions.clear();
-                return;
-            }
-            files.push_back(fn);
-        }
-        sessions[sid] = files;
+        compaction.join();
+        if (!compactionSucceeded.load())
+            Logger::log(LogLevel::ERROR, "Failed to compact the session journal, it is retried at the next start");
     }
+    // a failed compaction left its journal behind, rotating again would overwrite it
+    if (SessionJournal::getSize() < SESSION_JOURNAL_COMPACT_SIZE || access(SESSION_COMPACTING_FILE, F_OK) == 0)
+        return;
+    if (!SessionJournal::rotate(SESSION_COMPACTING_FILE))
+        return;
+
+    // only the files are involved, the sessions in memory stay untouched
+    compactionDone.store(false);
+    compaction = std::thread([] {
+        compactionSucceeded.store(SessionJournal::compact(SESSION_SNAPSHOT_FILE, SESSION_COMPACTING_FILE));
+        compactionDone.store(true);
+    });
+}
 
-    close(fd);
+void SessionManager::cleanUp() {
+    if (compaction.joinable())
+        compaction.join();
+    SessionJournal::close();
 }
@@ -3,15 +3,37 @@
 
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <array>
+#include <list>
 #include <vector>
+#include <ctime>
 #include <mutex>
+#include <thread>
+#include <atomic>
 
+// Sessions are spread over shards by their id, each shard has its own lock,
+// so requests of different sessions do not wait for each other.
+// Every change is appended to the SessionJournal, a background thread folds the journal into a snapshot.
+// Each shard keeps its sessions in a list ordered by their last request, the event loop expires idle ones
+// from its tail and a full shard evicts the least recently used session that owns no files.
 class SessionManager {
 public:
+    struct Stats {
+        size_t sessions;
+        size_t files;
+        size_t memoryBytes; // estimate of ids, file names and container nodes
+        size_t expired;
+        size_t evicted;
+    };
+
+    // limits in seconds and sessions, 0 disables each of them
+    static void configure(size_t idleTimeout, size_t lifetime, size_t maxCount);
+
     // Parse “Cookie:” header, return sessionId.  If a new session is created, isNew=true.
     static std::string getSessionId(const std::string &cookieHeader, bool &isNew);
 
-    // record that sessionId uploaded “filename”
+    // record that sessionId uploaded “filename”, recording it twice is harmless
     static void addUploadedFile(const std::string &sessionId, const std::string &filename);
 
     // does sessionId own filename?
@@ -19,16 +41,70 @@ public:
 
     static bool removeFile(const std::string &sessionId, const std::string &filename);
 
-    // Serialize all sessions to a binary file
-    static void serialize(const std::string &filename);
-    // Load all sessions from a binary file
-    static void deserialize(const std::string &filename);
+    // drops idle and too old sessions, called by the event loop and runs at most once a second
+    static void expire();
+
+    [[nodiscard]] static Stats getStats();
+
+    // snapshot plus journal, then new changes go to the journal.
+    // A SESSION_LEGACY_FILE from older versions is imported when neither of them exists yet.
+    static void load();
 
+    // starts a background compaction once the journal grew past SESSION_JOURNAL_COMPACT_SIZE
+    static void compactIfNeeded();
 
+    // waits for a running compaction, the journal already holds every change
+    static void cleanUp();
 
 private:
-    static std::unordered_map<std::string, std::vector<std::string>> sessions;
-    static std::mutex mutex_;
+    static constexpr size_t SHARD_COUNT = 16;
+    static constexpr size_t EVICTION_SCAN_LIMIT = 64; // sessions looked at from the tail for one without files
+
+    // map keys do not move on a rehash, the list points at them instead of copying every id
+    typedef std::list<const std::string *> RecentList;
+
+    struct Session {
+        std::unordered_set<std::string> files;
+        time_t created = 0;
+        time_t lastSeen = 0;
+        RecentList::iterator recent; // position in Shard::recent
+    };
+
+    typedef std::unordered_map<std::string, Session> SessionMap;
+
+    struct Shard {
+        std::mutex mutex;
+        SessionMap sessions;
+        RecentList recent; // most recently seen first
+        size_t memoryBytes = 0;
+    };
+
+    static std::array<Shard, SHARD_COUNT> shards;
+    static size_t idleTimeout;
+    static size_t lifetime;
+    static size_t maxCount;
+    static time_t lastExpiry;
+    static std::atomic<size_t> expiredCount;
+    static std::atomic<size_t> evictedCount;
+    static std::thread compaction;
+    static std::atomic<bool> compactionDone;
+    static std::atomic<bool> compactionSucceeded;
+
+    static Shard &shardOf(const std::string &sessionId);
+
+    [[nodiscard]] static bool isExpired(const Session &session, time_t now);
+
+    // the caller holds the shard lock for the following
+    static SessionMap::iterator insert(Shard &shard, const std::string &sessionId, time_t created, time_t now);
+    static void touch(Shard &shard, SessionMap::iterator it, time_t now);
+    static void erase(Shard &shard, SessionMap::iterator it);
+    static bool evictOne(Shard &shard);
+
+    static std::vector<std::unique_lock<std::mutex> > lockShards();
+
+    static void clear();
+
+    static void importLegacy();
 };
 
-#endif // SESSIONMANAGER_H
\ No newline at end of file
+#endif // SESSIONMANAGER_H
@@ -22,6 +22,7 @@
 #include <map>
 #include <functional>
 #include <memory>
+#include <optional>
 
 class HttpRequest;
 class HttpResponse;
@@ -43,6 +44,26 @@ enum class LocationType {
     REGEX_IGNORE_CASE,
 };
 
+typedef struct {
+    std::string adapter; // script the cgi interpreter runs to serve requests over the worker protocol
+    size_t min_workers; // spawned at startup and kept alive
+    size_t max_workers; // requests beyond this fall back to a process per request
+    size_t max_requests; // a worker is replaced after serving this many requests
+} CgiWorkerConfig;
+
+typedef struct {
+    bool enabled;
+    size_t valid; // seconds a response stays fresh when the script sends neither Cache-Control nor Expires
+    size_t stale; // seconds an expired response is still served while one request refreshes it
+    std::vector<std::string> key_headers; // lowercase request headers that are part of the cache key
+} CgiCacheConfig;
+
+typedef struct {
+    size_t max_concurrency; // scripts running at once, 0 = unlimited
+    size_t queue_length; // requests waiting for a free slot before new ones get a 503
+    size_t queue_timeout; // seconds a request waits for a slot before it gets a 503
+} CgiLimitConfig;
+
 typedef struct {
     std::string location;
     LocationType type;
@@ -54,6 +75,15 @@ typedef struct {
     std::map<int, std::string> error_pages; // Status code to page path
     bool deny_all; // Access control
     std::map<std::string, std::string> cgi_params;
+    std::map<std::string, std::string> fastcgi_pass; // extension to FastCGI upstream, "unix:/path" or "host:port"
+    std::map<std::string, CgiWorkerConfig> cgi_workers; // extension to a pool of persistent workers
+    CgiCacheConfig cgi_cache; // GET/HEAD responses of cgi, FastCGI and worker scripts
+    CgiLimitConfig cgi_limit; // concurrent script executions of this location
+    bool put_fsync; // sync PUT bodies and their directory to disk before answering
+    size_t resumable_upload_max_size; // largest tus upload, 0 = resumable uploads off
+    size_t resumable_upload_expire; // seconds an unfinished upload is kept after its last PATCH, 0 = forever
+    size_t resumable_upload_max_count; // unfinished uploads per upload directory, 0 = no limit
+    std::optional<size_t> slow_request_threshold; // milliseconds, unset uses the http one, 0 = off
     std::pair<int, std::string> return_directive;
     std::function<HttpResponse(const std::shared_ptr<HttpRequest> &request)> internalHandler;
 // Redirects
@@ -65,9 +95,17 @@ typedef struct  {
     size_t client_max_header_count; // Max number of headers
 } ClientHeaderConfig;
 
+typedef struct {
+    int backlog; // listen() queue length, 0 = DEFAULT_LISTEN_BACKLOG
+    bool reuseport; // SO_REUSEPORT
+    bool deferred; // TCP_DEFER_ACCEPT, wake up only once data arrived
+    int fastopen; // TCP_FASTOPEN queue length, 0 = off
+} ListenOptions;
+
 typedef struct {
     int port;
     std::string host;
+    ListenOptions listenOptions;
     std::vector<std::string> server_names;
     std::string root;
     std::vector<RouteConfig> routes;
@@ -78,15 +116,33 @@ typedef struct {
     // Connection settings
     size_t client_body_timeout; // In seconds
     size_t client_max_body_size; // In bytes
+    size_t client_body_buffer_size; // bytes kept in memory before the body spills to a file
     size_t keepalive_timeout; // In seconds
     size_t cgi_timeout; // In seconds
     size_t keepalive_requests; // Max requests per connection
     bool internal_api; // Enable internal API
 } ServerConfig;
 
+// configs are immutable once loaded; connections and handlers share them by pointer
+typedef std::shared_ptr<const ServerConfig> ServerConfigPtr;
+
 typedef struct {
     ClientHeaderConfig headerConfig;
     size_t max_request_line_size;
+    bool buffer_pool_hugepages; // back I/O buffer slabs with transparent huge pages
+    size_t buffer_memory_budget; // buffered bytes of all connections before buffers spill to files
+    std::string client_body_temp_path; // directory for spill files
+    size_t cgi_cache_memory_size; // cached cgi responses kept in memory
+    size_t cgi_cache_disk_size; // cached cgi response bodies too big for memory, in client_body_temp_path
+    size_t io_threads; // threads writing uploads to disk, 0 writes on the event loop
+    size_t session_idle_timeout; // seconds without a request before a session expires, 0 never
+    size_t session_lifetime; // seconds after its creation a session expires, 0 never
+    size_t session_max_count; // sessions without files are evicted past this count, 0 unlimited
+    std::vector<double> latency_percentiles; // reported by /metrics/latency unless the query names others
+    std::string access_log; // file for one JSON line per response, empty disables it
+    bool access_log_phases; // add the time of each request phase to the access log lines
+    size_t slow_request_threshold; // milliseconds before a request is written to the slow request log, 0 = off
+    std::string slow_request_log; // file for the slow request lines
 }HttpConfig;
 
 #endif //CONFIG_H
@@ -9,7 +9,7 @@
 #include <unistd.h>
 #include <chrono>
 #include <cstring>
-#include <regex>
+#include <strings.h>
 #include <webserv.h>
 #include <sys/stat.h>
 #include <iostream>
@@ -20,7 +20,8 @@
 
 CgiParser::CgiParser()
     : state(CgiParseState::HEADERS) {
-    result.body = std::make_shared<SmartBuffer>();
+    // room for the whole backlog a paused cgi pipe leaves behind, so streamed output stays in memory
+    result.body = std::make_shared<SmartBuffer>(static_cast<size_t>(CGI_OUTPUT_BACKLOG_LIMIT + CGI_PIPE_CHUNK_SIZE));
     contentLength = -1;
 }
 
@@ -28,69 +29,90 @@ bool CgiParser::parse(const char *data, const size_t length) {
     if (state == CgiParseState::COMPLETE || state == CgiParseState::ERROR)
         return false;
 
-    buffer.append(data, length);
-
-    if (state == CgiParseState::HEADERS) {
-        if (!parseHeaders())
-            return false;
-        state = CgiParseState::BODY;
+    if (state == CgiParseState::BODY) {
+        if (appendToBody(data, length))
+            state = CgiParseState::COMPLETE;
+        return isComplete();
     }
 
-    if (state == CgiParseState::BODY) {
-        if (!appendToBody(buffer))
-            return false;
-        state = CgiParseState::COMPLETE;
+    buffer.append(data, length);
+    if (!parseHeaders()) {
+        if (buffer.size() > MAX_HEADER_SIZE) {
+            Logger::log(LogLevel::ERROR, "CGI output headers exceed " + std::to_string(MAX_HEADER_SIZE) + " bytes");
+            state = CgiParseState::ERROR;
+        }
+        return false;
     }
+    if (state == CgiParseState::ERROR)
+        return false;
 
+    state = CgiParseState::BODY;
+    const std::string rest = std::move(buffer);
+    buffer.clear();
+    if (appendToBody(rest.data(), rest.size()))
+        state = CgiParseState::COMPLETE;
     return isComplete();
 }
 
+// consumes complete lines only, a line split across reads is finished by a later call
 bool CgiParser::parseHeaders() {
-    std::istringstream stream(buffer);
-    std::string line;
-    size_t pos = 0;
-    std::regex headerRegex(R"(([^:]+):\s*(.*?)\s*$)");
-    std::smatch matches;
-
-    while (std::getline(stream, line)) {
-        pos += line.size() + 1;
-
+    size_t lineStart = 0;
+    size_t newline;
+    while ((newline = buffer.find('\n', lineStart)) != std::string::npos) {
+        std::string line = buffer.substr(lineStart, newline - lineStart);
+        lineStart = newline + 1;
         if (!line.empty() && line.back() == '\r')
             line.pop_back();
 
         if (line.empty()) {
-            buffer.erase(0, pos);
-            auto it = result.headers.find("Content-Length");
+            buffer.erase(0, lineStart);
+            // CGI header names are case-insensitive
+            const auto it = std::find_if(result.headers.begin(), result.headers.end(), [](const auto &header) {
+                return strcasecmp(header.first.c_str(), "Content-Length") == 0;
+            });
             if (it != result.headers.end()) {
-                contentLength = std::stol(it->second);
+                try {
+                    contentLength = std::stol(it->second);
+                } catch (const std::exception &) {
+                    contentLength = -2;
+                }
+                if (contentLength < 0) {
+                    Logger::log(LogLevel::ERROR, "Invalid Content-Length in CGI output: " + it->second);
+                    state = CgiParseState::ERROR;
+                }
             }
             return true;
         }
-
-
-        if (std::regex_match(line, matches, headerRegex)) {
-            if (matches[1] == "Set-Cookie") {
-                result.setCookies.push_back(matches[2]);
-            } else
-                result.headers[matches[1]] = matches[2];
-        }
+        parseHeaderLine(line);
     }
+    buffer.erase(0, lineStart);
     return false;
 }
 
-bool CgiParser::appendToBody(std::string data) {
-    const bool hasEnd = data.find("\r\n") != std::string::npos;
+void CgiParser::parseHeaderLine(const std::string &line) {
+    const size_t colon = line.find(':');
+    if (colon == std::string::npos || colon == 0)
+        return;
 
-    if (hasEnd)
-        data = data.substr(0, data.find("\r\n"));
+    const std::string name = line.substr(0, colon);
+    const size_t valueStart = line.find_first_not_of(" \t", colon + 1);
+    const size_t valueEnd = line.find_last_not_of(" \t");
+    const std::string value = valueStart == std::string::npos ? "" : line.substr(valueStart, valueEnd - valueStart + 1);
 
-    result.body->append(data.c_str(), data.length());
+    if (strcasecmp(name.c_str(), "Set-Cookie") == 0)
+        result.setCookies.push_back(value);
+    else
+        result.headers[name] = value;
+}
 
-    if (contentLength != -1 && result.body->getSize() >= static_cast<size_t>(contentLength)) {
-        state = CgiParseState::COMPLETE;
-        return true;
-    }
+// without a Content-Length the body ends when the script closes its output, bytes past it are dropped
+bool CgiParser::appendToBody(const char *data, size_t length) {
+    if (contentLength != -1)
+        length = std::min(length, static_cast<size_t>(contentLength) - bodyLength);
+    result.body->append(data, length);
+    bodyLength += length;
+    if (bodyListener && length > 0)
+        bodyListener(data, length);
 
-    buffer.clear();
-    return hasEnd;
+    return contentLength != -1 && bodyLength >= static_cast<size_t>(contentLength);
 }
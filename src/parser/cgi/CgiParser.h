@@ -13,6 +13,7 @@
 #include <cstdio>
 #include <server/buffer/SmartBuffer.h>
 #include <vector>
+#include <functional>
 
 enum class CgiParseState {
     HEADERS,
@@ -30,22 +31,39 @@ public:
     };
 
 private:
+    static constexpr size_t MAX_HEADER_SIZE = 65536;
+
     CgiParseState state;
-    std::string buffer;
+    std::string buffer; // header lines that are not complete yet
     CgiResult result;
     ssize_t contentLength;
+    size_t bodyLength = 0; // the body buffer is consumed while it is sent, so it can not count for itself
+    std::function<void(const char *data, size_t length)> bodyListener;
 
     bool parseHeaders();
 
-    bool appendToBody(std::string data);
+    void parseHeaderLine(const std::string &line);
+
+    bool appendToBody(const char *data, size_t length);
 
 public:
     CgiParser();
 
+    // body bytes are appended to the result as they arrive, so it can be sent while the script still runs
     bool parse(const char *data, size_t length);
 
+    // sees every body byte before it is sent, e.g. to keep a copy for the cgi cache
+    void setBodyListener(std::function<void(const char *data, size_t length)> listener) {
+        bodyListener = std::move(listener);
+    }
+
     bool isComplete() const { return state == CgiParseState::COMPLETE; }
+    bool hasHeaders() const { return state == CgiParseState::BODY || state == CgiParseState::COMPLETE; }
     bool hasError() const { return state == CgiParseState::ERROR; }
+    // body bytes the script announced but did not send yet, SIZE_MAX without a Content-Length
+    size_t getRemainingBody() const {
+        return contentLength < 0 ? SIZE_MAX : static_cast<size_t>(contentLength) - bodyLength;
+    }
     const CgiResult &getResult() const { return result; }
 };
 
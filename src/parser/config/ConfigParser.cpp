@@ -7,9 +7,13 @@
 #include <unistd.h>
 #include <common/Logger.h>
 #include <parser/cgi/CgiParser.h>
+#include <server/fastcgi/FastCgiConnection.h>
+#include <server/handler/LatencyMetrics.h>
+#include <server/handler/SlowRequestLog.h>
 #include <parser/http/HttpParser.h>
 #include <sys/unistd.h>
 #include <filesystem>
+#include <webserv.h>
 #include <server/requestHandler/InternalApi.h>
 
 ConfigParser::ConfigParser() : rootBlock{"root", {}, {}}, currentLine(0), currentFilename(""), parseSuccessful(true) {
@@ -29,6 +33,84 @@ ConfigParser::ConfigParser() : rootBlock{"root", {}, {}}, currentLine(0), curren
         {
             .name = "max_request_line_size",
             .type = Directive::SIZE,
+        },
+        {
+            .name = "buffer_pool_hugepages",
+            .type = Directive::TOGGLE,
+        },
+        {
+            .name = "buffer_memory_budget",
+            .type = Directive::SIZE,
+        },
+        {
+            .name = "client_body_temp_path",
+            .type = Directive::LIST,
+        },
+        {
+            .name = "cgi_cache_memory_size",
+            .type = Directive::SIZE,
+        },
+        {
+            .name = "cgi_cache_disk_size",
+            .type = Directive::SIZE,
+        },
+        {
+            .name = "io_threads",
+            .type = Directive::COUNT,
+        },
+        {
+            .name = "session_idle_timeout",
+            .type = Directive::TIME,
+        },
+        {
+            .name = "session_lifetime",
+            .type = Directive::TIME,
+        },
+        {
+            .name = "session_max_count",
+            .type = Directive::COUNT,
+        },
+        {
+            .name = "latency_percentiles",
+            .type = Directive::LIST,
+            .min_arg = 1,
+            .max_arg = 10,
+            .validate = [this](const std::vector<std::string> &tokens) {
+                double percent;
+                for (const std::string &token: tokens) {
+                    if (!LatencyMetrics::parsePercentile(token, percent)) {
+                        reportError("Invalid latency_percentiles value: " + token + " - expected a number in (0, 100]");
+                        return false;
+                    }
+                }
+                return true;
+            },
+        },
+        {
+            .name = "access_log",
+            .type = Directive::LIST,
+            .min_arg = 1,
+            .max_arg = 2,
+            .validate = [this](const std::vector<std::string> &tokens) {
+                if (tokens.size() == 2 && tokens[1] != "phases") {
+                    reportError("Invalid access_log option: " + tokens[1] + " - expected phases");
+                    return false;
+                }
+                return true;
+            },
+        },
+        {
+            .name = "slow_request_threshold",
+            .type = Directive::LIST,
+            .min_arg = 1,
+            .max_arg = 1,
+            .validate = [this](const std::vector<std::string> &tokens) {
+                return validateSlowRequestThreshold(tokens[0]);
+            },
+        },
+        {
+            .name = "slow_request_log",
+            .type = Directive::LIST,
         }
     };
 
@@ -36,6 +118,8 @@ ConfigParser::ConfigParser() : rootBlock{"root", {}, {}}, currentLine(0), curren
         {
             .name = "listen",
             .type = Directive::LIST,
+            .min_arg = 1,
+            .max_arg = 5,
             .validate = [this](const std::vector<std::string> &tokens) {
                 return validateListenValue(tokens);
             },
@@ -54,6 +138,10 @@ ConfigParser::ConfigParser() : rootBlock{"root", {}, {}}, currentLine(0), curren
             .name = "index",
             .type = Directive::LIST,
         },
+        {
+            .name = "client_body_buffer_size",
+            .type = Directive::SIZE,
+        },
         {
             .name = "client_max_body_size",
             .type = Directive::SIZE,
@@ -145,6 +233,82 @@ ConfigParser::ConfigParser() : rootBlock{"root", {}, {}}, currentLine(0), curren
             .type = Directive::LIST,
             .min_arg = 2,
             .max_arg = 2,
+        },
+        {
+            .name = "fastcgi_pass",
+            .type = Directive::LIST,
+            .min_arg = 2,
+            .max_arg = 2,
+            .validate = [this](const std::vector<std::string> &tokens) {
+                if (FastCgiConnection::isValidAddress(tokens[1]))
+                    return true;
+                reportError("Invalid fastcgi_pass address: " + tokens[1] + " - expected unix:/path or ip:port");
+                return false;
+            },
+        },
+        {
+            .name = "cgi_workers",
+            .type = Directive::LIST,
+            .min_arg = 4,
+            .max_arg = 5,
+            .validate = [this](const std::vector<std::string> &tokens) {
+                for (size_t i = 2; i < tokens.size(); ++i) {
+                    if (!validateDigitsOnly(tokens[i], "cgi_workers"))
+                        return false;
+                }
+                if (std::stoul(tokens[3]) == 0 || std::stoul(tokens[2]) > std::stoul(tokens[3])) {
+                    reportError("Invalid cgi_workers pool size: min must not exceed max and max must be positive");
+                    return false;
+                }
+                return true;
+            },
+        },
+        {
+            .name = "cgi_cache",
+            .type = Directive::LIST,
+            .min_arg = 2,
+            .max_arg = 10,
+            .validate = [this](const std::vector<std::string> &tokens) {
+                return validateDigitsOnly(tokens[0], "cgi_cache") && validateDigitsOnly(tokens[1], "cgi_cache");
+            },
+        },
+        {
+            .name = "cgi_max_concurrency",
+            .type = Directive::LIST,
+            .min_arg = 1,
+            .max_arg = 3,
+            .validate = [this](const std::vector<std::string> &tokens) {
+                for (const std::string &token: tokens) {
+                    if (!validateDigitsOnly(token, "cgi_max_concurrency"))
+                        return false;
+                }
+                return true;
+            },
+        },
+        {
+            .name = "put_fsync",
+            .type = Directive::TOGGLE,
+        },
+        {
+            .name = "resumable_upload_max_size",
+            .type = Directive::SIZE,
+        },
+        {
+            .name = "resumable_upload_expire",
+            .type = Directive::TIME,
+        },
+        {
+            .name = "resumable_upload_max_count",
+            .type = Directive::COUNT,
+        },
+        {
+            .name = "slow_request_threshold",
+            .type = Directive::LIST,
+            .min_arg = 1,
+            .max_arg = 1,
+            .validate = [this](const std::vector<std::string> &tokens) {
+                return validateSlowRequestThreshold(tokens[0]);
+            },
         }
     };
 }
@@ -212,6 +376,16 @@ bool ConfigParser::validateDigitsOnly(const std::string &value, const std::strin
     return true;
 }
 
+bool ConfigParser::validateSlowRequestThreshold(const std::string &value) {
+    size_t milliseconds;
+    if (!SlowRequestLog::parseThreshold(value, milliseconds)) {
+        reportError("Invalid value for slow_request_threshold: '" + value + "' - expected seconds or a number with ms or s");
+        parseSuccessful = false;
+        return false;
+    }
+    return true;
+}
+
 bool ConfigParser::isValidServerConfigs(const std::vector<ServerConfig> &configs) const {
     if (configs.empty()) {
         Logger::log(LogLevel::ERROR, "No server configurations found.");
@@ -277,7 +451,7 @@ HttpConfig ConfigParser::getHttpConfig() const {
         }
     }
 
-    return HttpConfig(); // to return nothing
+    return parseHttpBlock(ConfigBlock{"http", {}, {}}); // defaults for every http directive
 }
 
 void ConfigParser::printServerConfig(ServerConfig config)const {
@@ -287,6 +461,10 @@ void ConfigParser::printServerConfig(ServerConfig config)const {
     std::cout << MAGENTA BOLD << "ServerConfig:" << RESET << std::endl;
     std::cout << "  Port: " << config.port << std::endl;
     std::cout << "  Host: " << config.host << std::endl;
+    std::cout << "  Listen Options: backlog=" << config.listenOptions.backlog
+            << (config.listenOptions.reuseport ? " reuseport" : "")
+            << (config.listenOptions.deferred ? " deferred" : "")
+            << " fastopen=" << config.listenOptions.fastopen << std::endl;
     std::cout << "  Server Names: ";
     for (const auto &name: config.server_names) {
         std::cout << name << " ";
@@ -295,6 +473,7 @@ void ConfigParser::printServerConfig(ServerConfig config)const {
     std::cout << "  Root: " << config.root << std::endl;
     std::cout << "  Index: " << config.index << std::endl;
     std::cout << "  Client Max Body Size: " << config.client_max_body_size << std::endl;
+    std::cout << "  Client Body Buffer Size: " << config.client_body_buffer_size << std::endl;
     std::cout << "  Client Max Header Size: " << config.headerConfig.client_max_header_size << std::endl;
     std::cout << "  Client Max Header Count: " << config.headerConfig.client_max_header_count << std::endl;
     std::cout << "  Client Header Timeout: " << config.headerConfig.client_header_timeout << std::endl;
@@ -333,12 +512,14 @@ ServerConfig ConfigParser::parseServerBlock(const ConfigBlock &block) const {
             config.port = std::stoi(listenValue);
         }
     }
+    parseListenOptions(listen, config.listenOptions);
 
     config.server_names = block.getDirective("server_name");
 
     config.root = block.getStringValue(getValidDirective("root", block.name), "/var/www/html");
     config.index = block.getStringValue(getValidDirective("index", block.name), "index.html");
     config.client_max_body_size = block.getSizeValue(getValidDirective("client_max_body_size", block.name), 1 * 1024 * 1024);
+    config.client_body_buffer_size = block.getSizeValue(getValidDirective("client_body_buffer_size", block.name), DEFAULT_CLIENT_BODY_BUFFER_SIZE);
     config.headerConfig.client_max_header_size = block.getSizeValue(getValidDirective("client_max_header_size", block.name), 8192);
     config.headerConfig.client_header_timeout = block.getSizeValue(getValidDirective("client_header_timeout", block.name), 60);
     config.headerConfig.client_max_header_count = block.getSizeValue(getValidDirective("client_max_header_count", block.name), 100);
@@ -373,6 +554,23 @@ void ConfigParser::printHttpConfig(HttpConfig httpConfig) const {
     std::cout << "  Client Header Timeout: " << httpConfig.headerConfig.client_header_timeout << std::endl;
     std::cout << "  Client Max Header Size: " << httpConfig.headerConfig.client_max_header_size << std::endl;
     std::cout << "  Client Max Header Count: " << httpConfig.headerConfig.client_max_header_count << std::endl;
+    std::cout << "  Buffer Pool Hugepages: " << (httpConfig.buffer_pool_hugepages ? "on" : "off") << std::endl;
+    std::cout << "  Buffer Memory Budget: " << httpConfig.buffer_memory_budget << std::endl;
+    std::cout << "  Client Body Temp Path: " << httpConfig.client_body_temp_path << std::endl;
+    std::cout << "  CGI Cache Memory Size: " << httpConfig.cgi_cache_memory_size << std::endl;
+    std::cout << "  CGI Cache Disk Size: " << httpConfig.cgi_cache_disk_size << std::endl;
+    std::cout << "  I/O Threads: " << httpConfig.io_threads << std::endl;
+    std::cout << "  Session Idle Timeout: " << httpConfig.session_idle_timeout << std::endl;
+    std::cout << "  Session Lifetime: " << httpConfig.session_lifetime << std::endl;
+    std::cout << "  Session Max Count: " << httpConfig.session_max_count << std::endl;
+    std::cout << "  Latency Percentiles:";
+    for (const double percent: httpConfig.latency_percentiles)
+        std::cout << " " << percent;
+    std::cout << std::endl;
+    std::cout << "  Access Log: " << (httpConfig.access_log.empty() ? "off" : httpConfig.access_log)
+              << (httpConfig.access_log_phases ? " (phases)" : "") << std::endl;
+    std::cout << "  Slow Request Threshold: " << httpConfig.slow_request_threshold << "ms" << std::endl;
+    std::cout << "  Slow Request Log: " << httpConfig.slow_request_log << std::endl;
 
     std::cout << std::endl;
     std::cout << "----------------------------------------" << std::endl;
@@ -390,6 +588,32 @@ HttpConfig ConfigParser::parseHttpBlock(const ConfigBlock& block) const
 
     httpConfig.headerConfig = headerConfig;
     httpConfig.max_request_line_size = block.getSizeValue(getValidDirective("max_request_line_size", block.name), 1024);
+    httpConfig.buffer_pool_hugepages = (block.getStringValue(getValidDirective("buffer_pool_hugepages", block.name), "off") == "on");
+    httpConfig.buffer_memory_budget = block.getSizeValue(getValidDirective("buffer_memory_budget", block.name), DEFAULT_BUFFER_MEMORY_BUDGET);
+    httpConfig.client_body_temp_path = block.getStringValue(getValidDirective("client_body_temp_path", block.name), TEMP_DIR_NAME);
+    httpConfig.cgi_cache_memory_size = block.getSizeValue(getValidDirective("cgi_cache_memory_size", block.name), DEFAULT_CGI_CACHE_MEMORY_SIZE);
+    httpConfig.cgi_cache_disk_size = block.getSizeValue(getValidDirective("cgi_cache_disk_size", block.name), DEFAULT_CGI_CACHE_DISK_SIZE);
+    httpConfig.io_threads = block.getSizeValue(getValidDirective("io_threads", block.name), DEFAULT_IO_THREADS);
+    httpConfig.session_idle_timeout = block.getSizeValue(getValidDirective("session_idle_timeout", block.name), DEFAULT_SESSION_IDLE_TIMEOUT);
+    httpConfig.session_lifetime = block.getSizeValue(getValidDirective("session_lifetime", block.name), DEFAULT_SESSION_LIFETIME);
+    httpConfig.session_max_count = block.getSizeValue(getValidDirective("session_max_count", block.name), DEFAULT_SESSION_MAX_COUNT);
+    httpConfig.latency_percentiles.assign(LatencyMetrics::DEFAULT_PERCENTILES.begin(), LatencyMetrics::DEFAULT_PERCENTILES.end());
+    if (const auto percentiles = block.getDirective("latency_percentiles"); !percentiles.empty()) {
+        httpConfig.latency_percentiles.clear();
+        for (const std::string &token: percentiles) {
+            double percent = 0;
+            if (LatencyMetrics::parsePercentile(token, percent))
+                httpConfig.latency_percentiles.push_back(percent);
+        }
+    }
+
+    const auto accessLog = block.getDirective("access_log");
+    httpConfig.access_log = accessLog.empty() ? "" : accessLog[0];
+    httpConfig.access_log_phases = accessLog.size() == 2;
+    httpConfig.slow_request_threshold = 0;
+    if (const auto threshold = block.getDirective("slow_request_threshold"); !threshold.empty())
+        (void) SlowRequestLog::parseThreshold(threshold[0], httpConfig.slow_request_threshold);
+    httpConfig.slow_request_log = block.getStringValue(getValidDirective("slow_request_log", block.name), DEFAULT_SLOW_REQUEST_LOG);
 
     printHttpConfig(httpConfig);
 
@@ -411,6 +635,13 @@ RouteConfig ConfigParser::parseRouteBlock(const ConfigBlock &block, const Server
 
     route.autoindex = false;
     route.deny_all = false;
+    route.cgi_cache = {false, 0, 0, {}};
+    route.cgi_limit = {0, 0, 0};
+    route.put_fsync = false;
+    route.resumable_upload_max_size = 0;
+    route.resumable_upload_expire = DEFAULT_RESUMABLE_UPLOAD_EXPIRE;
+    route.resumable_upload_max_count = DEFAULT_RESUMABLE_UPLOAD_MAX_COUNT;
+    route.slow_request_threshold = std::nullopt;
 
     const auto params = block.getDirective("_parameters");
     if (params.empty())
@@ -427,6 +658,16 @@ RouteConfig ConfigParser::parseRouteBlock(const ConfigBlock &block, const Server
     route.autoindex = (block.getStringValue(getValidDirective("autoindex", block.name), "off") == "on");
     route.alias = block.getStringValue(getValidDirective("alias", block.name));
     route.deny_all = (block.getStringValue(getValidDirective("deny", block.name), "") == "all");
+    route.put_fsync = (block.getStringValue(getValidDirective("put_fsync", block.name), "off") == "on");
+    route.resumable_upload_max_size = block.getSizeValue(getValidDirective("resumable_upload_max_size", block.name), 0);
+    route.resumable_upload_expire = block.getSizeValue(getValidDirective("resumable_upload_expire", block.name),
+                                                       DEFAULT_RESUMABLE_UPLOAD_EXPIRE);
+    route.resumable_upload_max_count = block.getSizeValue(getValidDirective("resumable_upload_max_count", block.name),
+                                                          DEFAULT_RESUMABLE_UPLOAD_MAX_COUNT);
+    const auto slowRequestThreshold = block.getDirective("slow_request_threshold");
+    if (size_t threshold = 0; !slowRequestThreshold.empty() &&
+                              SlowRequestLog::parseThreshold(slowRequestThreshold[0], threshold))
+        route.slow_request_threshold = threshold;
 
     const auto methods = block.getDirective("allowed_methods");
     if (!methods.empty()) {
@@ -444,13 +685,45 @@ RouteConfig ConfigParser::parseRouteBlock(const ConfigBlock &block, const Server
     const auto errorPages = block.getDirective("error_page");
     parseErrorPages(errorPages, route.error_pages);
 
-    auto cgiParams = block.findDirectivesByPrefix("cgi");
-    for (const auto &[key, values]: cgiParams) {
-        if (values.size() >= 2) {
-            route.cgi_params[values[0]] = values[1];
+    const auto cgiParams = block.getDirective("cgi");
+    if (cgiParams.size() >= 2)
+        route.cgi_params[cgiParams[0]] = cgiParams[1];
+
+    const auto cgiWorkers = block.getDirective("cgi_workers");
+    if (cgiWorkers.size() >= 4) {
+        route.cgi_workers[cgiWorkers[0]] = {
+            .adapter = cgiWorkers[1],
+            .min_workers = std::stoul(cgiWorkers[2]),
+            .max_workers = std::stoul(cgiWorkers[3]),
+            .max_requests = cgiWorkers.size() > 4 ? std::stoul(cgiWorkers[4]) : CGI_WORKER_MAX_REQUESTS,
+        };
+    }
+
+    // cgi_cache <valid seconds> <stale seconds> [request header ...]
+    const auto cgiCache = block.getDirective("cgi_cache");
+    if (cgiCache.size() >= 2) {
+        route.cgi_cache.enabled = true;
+        route.cgi_cache.valid = std::stoul(cgiCache[0]);
+        route.cgi_cache.stale = std::stoul(cgiCache[1]);
+        for (size_t i = 2; i < cgiCache.size(); ++i) {
+            std::string header = cgiCache[i];
+            std::transform(header.begin(), header.end(), header.begin(), ::tolower);
+            route.cgi_cache.key_headers.push_back(header);
         }
     }
 
+    // cgi_max_concurrency <max> [queue length] [queue timeout seconds]
+    const auto cgiLimit = block.getDirective("cgi_max_concurrency");
+    if (!cgiLimit.empty()) {
+        route.cgi_limit.max_concurrency = std::stoul(cgiLimit[0]);
+        route.cgi_limit.queue_length = cgiLimit.size() > 1 ? std::stoul(cgiLimit[1]) : route.cgi_limit.max_concurrency;
+        route.cgi_limit.queue_timeout = cgiLimit.size() > 2 ? std::stoul(cgiLimit[2]) : DEFAULT_CGI_QUEUE_TIMEOUT;
+    }
+
+    const auto fastCgiPass = block.getDirective("fastcgi_pass");
+    if (fastCgiPass.size() >= 2)
+        route.fastcgi_pass[fastCgiPass[0]] = fastCgiPass[1];
+
     const auto returnDir = block.getDirective("return");
     if (returnDir.size() >= 2) {
         const int statusCode = std::stoi(returnDir[0]);
@@ -498,11 +771,16 @@ bool ConfigParser::validateErrorPage(const std::vector<std::string> &tokens) {
 }
 
 bool ConfigParser::validateListenValue(const std::vector<std::string> &tokens) {
-    if (tokens.size() != 1) {
-        reportError("Invalid listen directive: " + tokens[0] + " - expected format: listen <port> or listen <host>:<port>");
+    if (tokens.empty()) {
+        reportError("Invalid listen directive - expected format: listen <port> or listen <host>:<port> [options]");
         return false;
     }
 
+    for (size_t i = 1; i < tokens.size(); ++i) {
+        if (!validateListenOption(tokens[i]))
+            return false;
+    }
+
     const std::string &listenValue = tokens[0];
     size_t colonPos = listenValue.find(':');
 
@@ -533,6 +811,38 @@ bool ConfigParser::validateListenValue(const std::vector<std::string> &tokens) {
 
 }
 
+bool ConfigParser::validateListenOption(const std::string &option) {
+    if (option == "reuseport" || option == "deferred")
+        return true;
+
+    const size_t equalPos = option.find('=');
+    const std::string name = option.substr(0, equalPos);
+    if (equalPos == std::string::npos || (name != "backlog" && name != "fastopen")) {
+        reportError("Invalid listen option: " + option + " - expected backlog=<n>, fastopen=<n>, reuseport or deferred");
+        return false;
+    }
+
+    return validateDigitsOnly(option.substr(equalPos + 1), "listen " + name);
+}
+
+void ConfigParser::parseListenOptions(const std::vector<std::string> &tokens, ListenOptions &options) const {
+    options.backlog = 0;
+    options.reuseport = false;
+    options.deferred = false;
+    options.fastopen = 0;
+
+    for (size_t i = 1; i < tokens.size(); ++i) {
+        const std::string &option = tokens[i];
+        if (option == "reuseport")
+            options.reuseport = true;
+        else if (option == "deferred")
+            options.deferred = true;
+        else if (option.compare(0, 8, "backlog=") == 0)
+            tryParseInt(option.substr(8), options.backlog);
+        else if (option.compare(0, 9, "fastopen=") == 0)
+            tryParseInt(option.substr(9), options.fastopen);
+    }
+}
 
 bool ConfigParser::parseBlock(std::ifstream &file, ConfigBlock &block) {
     std::string line;
@@ -32,8 +32,12 @@ private:
 
     std::optional<Directive> getValidDirective(const std::string key, const std::string& blockType) const;
     bool validateDigitsOnly(const std::string& value, const std::string& directive);
+    bool validateSlowRequestThreshold(const std::string& value);
     bool validateErrorPage(const std::vector<std::string> &tokens);
     bool validateListenValue(const std::vector<std::string> &tokens);
+    bool validateListenOption(const std::string &option);
+
+    void parseListenOptions(const std::vector<std::string> &tokens, ListenOptions &options) const;
 
     [[nodiscard]] ServerConfig parseServerBlock(const ConfigBlock& block) const;
 
@@ -15,6 +15,7 @@
 #include <sys/stat.h>
 #include <cstring>
 #include <server/ServerPool.h>
+#include <server/ClientConnection.h>
 
 ssize_t HttpParser::tmpFileCount = 0;
 
@@ -75,6 +76,9 @@ bool HttpParser::parse(const char *data, const size_t length) {
                 break;
 
             case ParseState::COMPLETE:
+                clientConnection->timing.mark(RequestPhase::BODY_COMPLETE);
+                if (request->body)
+                    request->body->setStreaming(false);
                 return true;
 
             case ParseState::ERROR:
@@ -145,8 +149,8 @@ bool HttpParser::parseHeaders() {
     size_t client_max_header_size;
 
     while (true) {
-        max_header_count = clientConnection->config.headerConfig.client_max_header_count;
-        client_max_header_size = clientConnection->config.headerConfig.client_max_header_size;
+        max_header_count = clientConnection->config->headerConfig.client_max_header_count;
+        client_max_header_size = clientConnection->config->headerConfig.client_max_header_size;
 
         const size_t endPos = buffer.find("\r\n");
         if (endPos == std::string::npos)
@@ -180,6 +184,7 @@ bool HttpParser::parseHeaders() {
 
             std::string transferEncoding = request->getHeader("Transfer-Encoding");
             chunkedTransfer = (transferEncoding == "chunked");
+            clientConnection->timing.mark(RequestPhase::HEADERS_COMPLETE);
 
             if (contentLength > 0 || chunkedTransfer) {
                 bodyStart = std::time(nullptr);
@@ -241,7 +246,7 @@ bool HttpParser::parseHeaders() {
 
 // TODO: handle chunkedTransfer in a separate function so the code is cleaner
 bool HttpParser::parseBody() {
-    size_t client_max_body_size = clientConnection->config.client_max_body_size;
+    size_t client_max_body_size = clientConnection->config->client_max_body_size;
     if (!chunkedTransfer && client_max_body_size > 0 &&
         contentLength > client_max_body_size) {
         Logger::log(LogLevel::ERROR, "Content-Length exceeds maximum allowed body size");
@@ -264,7 +269,7 @@ bool HttpParser::parseBody() {
 }
 
 bool HttpParser::parseChunkedBody() {
-    size_t client_max_body_size = clientConnection->config.client_max_body_size;
+    size_t client_max_body_size = clientConnection->config->client_max_body_size;
     while (true) {
         if (!hasChunkSize) {
             const size_t sizeEndPos = buffer.find("\r\n");
@@ -326,7 +331,7 @@ bool HttpParser::parseChunkedBody() {
 }
 
 bool HttpParser::appendToBody(const std::string &data) {
-    size_t client_max_body_size = clientConnection->config.client_max_body_size;
+    size_t client_max_body_size = clientConnection->config->client_max_body_size;
     if (client_max_body_size > 0 &&
         request->totalBodySize > client_max_body_size) {
         Logger::log(LogLevel::ERROR, "Body exceeds maximum allowed size");
@@ -336,6 +341,8 @@ bool HttpParser::appendToBody(const std::string &data) {
     }
 
     request->totalBodySize += data.length();
+    if (!request->body)
+        request->body = std::make_shared<SmartBuffer>(clientConnection->config->client_body_buffer_size);
     request->body->append(data.data(), data.length());
 
     return request->totalBodySize >= contentLength;
@@ -354,6 +361,12 @@ std::optional<HttpMethod> HttpParser::stringToMethod(const std::string &method)
     return std::nullopt;
 }
 
+void HttpParser::streamBody() {
+    if (!request->body)
+        request->body = std::make_shared<SmartBuffer>(clientConnection->config->client_body_buffer_size);
+    request->body->setStreaming(true);
+}
+
 std::shared_ptr<HttpRequest> HttpParser::getRequest() const {
     return request;
 }
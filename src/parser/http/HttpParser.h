@@ -58,6 +58,9 @@ public:
 
     bool appendToBody(const std::string &data);
 
+    // creates the body now, so a handler can consume it while it arrives, it streams until the request is complete
+    void streamBody();
+
     static std::optional<HttpMethod> stringToMethod(const std::string &method);
 
 
@@ -19,12 +19,11 @@ public:
     std::string uri;
     std::string version;
     std::unordered_map<std::string, std::string> headers;
-    std::shared_ptr<SmartBuffer> body;
+    std::shared_ptr<SmartBuffer> body; // created by the parser once body bytes arrive, null for bodiless requests
     size_t totalBodySize = 0;
     size_t headerCount = 0;
 
     HttpRequest() : method(GET) {
-        body = std::make_shared<SmartBuffer>();
     }
 
 
@@ -0,0 +1,245 @@
+#include "MultipartParser.h"
+
+#include <cstring>
+#include <algorithm>
+
+static std::string toLower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value;
+}
+
+static std::string trim(const std::string &value) {
+    const size_t start = value.find_first_not_of(" \t");
+    if (start == std::string::npos)
+        return "";
+    return value.substr(start, value.find_last_not_of(" \t") - start + 1);
+}
+
+// value of a parameter like name="x" in a header value such as Content-Disposition or Content-Type
+static std::string parameterOf(const std::string &value, const std::string &parameter) {
+    size_t position = value.find(';');
+    while (position != std::string::npos) {
+        const size_t equals = value.find('=', position + 1);
+        if (equals == std::string::npos)
+            break;
+        const std::string key = toLower(trim(value.substr(position + 1, equals - position - 1)));
+
+        std::string result;
+        size_t end = value.find_first_not_of(" \t", equals + 1);
+        if (end != std::string::npos && value[end] == '"') {
+            // quoted values may contain ';', browsers percent-encode a '"' in file names
+            const size_t closing = value.find('"', end + 1);
+            result = value.substr(end + 1, closing == std::string::npos ? std::string::npos : closing - end - 1);
+            end = closing == std::string::npos ? closing : value.find(';', closing);
+        } else {
+            end = value.find(';', equals);
+            result = trim(value.substr(equals + 1, end == std::string::npos ? end : end - equals - 1));
+        }
+        if (key == parameter)
+            return result;
+        position = end;
+    }
+    return "";
+}
+
+MultipartParser::MultipartParser(const std::string &boundary, Callbacks callbacks)
+    : delimiter("\r\n--" + boundary), carry("\r\n"), callbacks(std::move(callbacks)) {
+    const size_t length = delimiter.size();
+    std::fill(std::begin(skip), std::end(skip), length);
+    for (size_t i = 0; i + 1 < length; ++i)
+        skip[static_cast<unsigned char>(delimiter[i])] = length - 1 - i;
+}
+
+std::string MultipartParser::boundaryOf(const std::string &contentType) {
+    const std::string boundary = parameterOf(contentType, "boundary");
+    // RFC 2046 limits the boundary to 70 characters
+    if (boundary.empty() || boundary.size() > 70)
+        return "";
+    return boundary;
+}
+
+size_t MultipartParser::findDelimiter(const char *data, const size_t length) const {
+    const size_t delimiterLength = delimiter.size();
+    const char last = delimiter.back();
+    size_t position = 0;
+    while (position + delimiterLength <= length) {
+        const char current = data[position + delimiterLength - 1];
+        if (current == last && std::memcmp(data + position, delimiter.data(), delimiterLength - 1) == 0)
+            return position;
+        position += skip[static_cast<unsigned char>(current)];
+    }
+    return std::string::npos;
+}
+
+// length of the longest end of data that is the beginning of a delimiter
+size_t MultipartParser::partialDelimiterAt(const char *data, const size_t length) const {
+    for (size_t kept = std::min(length, delimiter.size() - 1); kept > 0; --kept) {
+        if (data[length - kept] == '\r' && std::memcmp(data + length - kept, delimiter.data(), kept) == 0)
+            return kept;
+    }
+    return 0;
+}
+
+bool MultipartParser::emit(const char *data, const size_t length) {
+    // the preamble before the first delimiter is dropped
+    if (state != MultipartParseState::BODY || length == 0)
+        return true;
+    if (!callbacks.onPartData(data, length)) {
+        state = MultipartParseState::ERROR;
+        return false;
+    }
+    return true;
+}
+
+bool MultipartParser::enterBoundary() {
+    if (state == MultipartParseState::BODY && !callbacks.onPartEnd()) {
+        state = MultipartParseState::ERROR;
+        return false;
+    }
+    state = MultipartParseState::BOUNDARY_LINE;
+    buffer.clear();
+    return true;
+}
+
+// the carried bytes start a delimiter or turn out to be payload once the next piece arrives,
+// only a delimiter that begins inside the carry is looked for here, parseBody finds the others
+size_t MultipartParser::resumeCarry(const char *data, const size_t length) {
+    const size_t delimiterLength = delimiter.size();
+    const std::string window = carry + std::string(data, std::min(length, delimiterLength - 1));
+    // the carry changes below, the payload handed out of it has to outlive this call
+    const std::string &payload = released.emplace_back(std::move(carry));
+    carry.clear();
+
+    for (size_t start = 0; start < payload.size(); ++start) {
+        const size_t compared = std::min(window.size() - start, delimiterLength);
+        if (window.compare(start, compared, delimiter, 0, compared) != 0)
+            continue;
+        if (!emit(payload.data(), start))
+            return length;
+        // still only the beginning of a delimiter, which means the whole piece is in the window
+        if (compared < delimiterLength) {
+            carry = window.substr(start);
+            return length;
+        }
+        enterBoundary();
+        return start + delimiterLength - payload.size();
+    }
+
+    emit(payload.data(), payload.size());
+    return 0;
+}
+
+size_t MultipartParser::parseBody(const char *data, const size_t length) {
+    const size_t position = findDelimiter(data, length);
+    if (position == std::string::npos) {
+        const size_t kept = partialDelimiterAt(data, length);
+        if (emit(data, length - kept))
+            carry.assign(data + length - kept, kept);
+        return length;
+    }
+    if (emit(data, position))
+        enterBoundary();
+    return position + delimiter.size();
+}
+
+size_t MultipartParser::parseBoundaryLine(const char *data, const size_t length) {
+    size_t consumed = 0;
+    while (consumed < length && buffer.size() < 2) {
+        const char current = data[consumed++];
+        // transport padding after the boundary
+        if (buffer.empty() && (current == ' ' || current == '\t'))
+            continue;
+        buffer += current;
+    }
+    if (buffer.size() < 2)
+        return consumed;
+
+    if (buffer == "--")
+        state = MultipartParseState::COMPLETE;
+    else if (buffer == "\r\n")
+        state = MultipartParseState::HEADERS; // the CRLF stays, a part without headers starts with the empty line
+    else
+        state = MultipartParseState::ERROR;
+    return consumed;
+}
+
+size_t MultipartParser::parseHeaders(const char *data, const size_t length) {
+    const size_t previous = buffer.size();
+    buffer.append(data, std::min(length, MAX_HEADER_SIZE + 4 - previous));
+
+    const size_t end = buffer.find("\r\n\r\n", previous >= 3 ? previous - 3 : 0);
+    if (end == std::string::npos) {
+        if (buffer.size() >= MAX_HEADER_SIZE + 4)
+            state = MultipartParseState::ERROR;
+        return buffer.size() - previous;
+    }
+
+    const std::string headers = buffer.substr(2, end > 2 ? end - 2 : 0);
+    buffer.clear();
+    beginPart(headers);
+    return end + 4 - previous;
+}
+
+bool MultipartParser::beginPart(const std::string &headers) {
+    Part part;
+    size_t start = 0;
+    while (start < headers.size()) {
+        size_t end = headers.find("\r\n", start);
+        if (end == std::string::npos)
+            end = headers.size();
+        const std::string line = headers.substr(start, end - start);
+        start = end + 2;
+
+        const size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        const std::string name = toLower(trim(line.substr(0, colon)));
+        const std::string value = trim(line.substr(colon + 1));
+        if (name == "content-disposition") {
+            part.name = parameterOf(value, "name");
+            part.filename = parameterOf(value, "filename");
+        } else if (name == "content-type")
+            part.contentType = value;
+    }
+
+    state = MultipartParseState::BODY;
+    if (!callbacks.onPartBegin(part)) {
+        state = MultipartParseState::ERROR;
+        return false;
+    }
+    return true;
+}
+
+bool MultipartParser::feed(const char *data, const size_t length) {
+    released.clear();
+    size_t offset = 0;
+    while (offset < length && state != MultipartParseState::COMPLETE && state != MultipartParseState::ERROR) {
+        switch (state) {
+            case MultipartParseState::PREAMBLE:
+            case MultipartParseState::BODY:
+                offset += carry.empty()
+                              ? parseBody(data + offset, length - offset)
+                              : resumeCarry(data + offset, length - offset);
+                break;
+            case MultipartParseState::BOUNDARY_LINE:
+                offset += parseBoundaryLine(data + offset, length - offset);
+                break;
+            case MultipartParseState::HEADERS:
+                offset += parseHeaders(data + offset, length - offset);
+                break;
+            default:
+                break;
+        }
+    }
+    return state != MultipartParseState::ERROR;
+}
+
+bool MultipartParser::feed(const iovec *spans, const size_t spanCount) {
+    std::list<std::string> kept;
+    for (size_t i = 0; i < spanCount && state != MultipartParseState::ERROR; ++i) {
+        feed(static_cast<const char *>(spans[i].iov_base), spans[i].iov_len);
+        kept.splice(kept.end(), released);
+    }
+    released = std::move(kept);
+    return state != MultipartParseState::ERROR;
+}
@@ -0,0 +1,82 @@
+#ifndef MULTIPARTPARSER_H
+#define MULTIPARTPARSER_H
+
+#include <string>
+#include <list>
+#include <functional>
+#include <cstddef>
+#include <sys/uio.h>
+
+enum class MultipartParseState {
+    PREAMBLE,
+    BOUNDARY_LINE, // after a delimiter, "--" ends the body and CRLF starts a part
+    HEADERS,
+    BODY,
+    COMPLETE,
+    ERROR
+};
+
+// Streaming multipart/form-data parser. The body is fed in pieces of any size, part payloads are handed
+// to the callbacks as pointers into the fed data, only a delimiter prefix at the end of a piece is kept back.
+// Every payload pointer stays valid until the next feed(), so the caller can batch them into one writev.
+class MultipartParser {
+public:
+    struct Part {
+        std::string name;
+        std::string filename; // empty for plain form fields
+        std::string contentType;
+    };
+
+    // a callback returning false stops the parser with an error
+    struct Callbacks {
+        std::function<bool(const Part &part)> onPartBegin;
+        std::function<bool(const char *data, size_t length)> onPartData;
+        std::function<bool()> onPartEnd;
+    };
+
+private:
+    static constexpr size_t MAX_HEADER_SIZE = 8192;
+
+    MultipartParseState state = MultipartParseState::PREAMBLE;
+    std::string delimiter; // CRLF "--" boundary, the first one has no CRLF in front
+    size_t skip[256]; // Boyer-Moore-Horspool shift per byte
+    std::string carry; // end of the last piece that may be the start of a delimiter
+    std::list<std::string> released; // carried bytes that turned out to be payload, kept for the caller
+    std::string buffer; // boundary line or part headers that are not complete yet
+    Callbacks callbacks;
+
+    [[nodiscard]] size_t findDelimiter(const char *data, size_t length) const;
+
+    [[nodiscard]] size_t partialDelimiterAt(const char *data, size_t length) const;
+
+    bool emit(const char *data, size_t length);
+
+    bool enterBoundary();
+
+    size_t resumeCarry(const char *data, size_t length);
+
+    size_t parseBody(const char *data, size_t length);
+
+    size_t parseBoundaryLine(const char *data, size_t length);
+
+    size_t parseHeaders(const char *data, size_t length);
+
+    bool beginPart(const std::string &headers);
+
+public:
+    MultipartParser(const std::string &boundary, Callbacks callbacks);
+
+    // the boundary parameter of a multipart Content-Type, empty when it is missing or invalid
+    [[nodiscard]] static std::string boundaryOf(const std::string &contentType);
+
+    // false once the body turned out to be malformed or a callback failed
+    bool feed(const char *data, size_t length);
+
+    bool feed(const iovec *spans, size_t spanCount);
+
+    [[nodiscard]] bool isComplete() const { return state == MultipartParseState::COMPLETE; }
+    [[nodiscard]] bool hasError() const { return state == MultipartParseState::ERROR; }
+};
+
+
+#endif //MULTIPARTPARSER_H
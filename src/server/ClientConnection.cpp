@@ -9,6 +9,7 @@
 #include <common/Logger.h>
 
 #include "FdHandler.h"
+#include "buffer/BufferPool.h"
 #include "requestHandler/RequestHandler.h"
 #include <execinfo.h>
 #include <iostream>
@@ -17,10 +18,17 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <cstring>
+#include <sys/ioctl.h>
 #include <common/SessionManager.h>
 
 #include "ServerPool.h"
+#include "Server.h"
 #include "handler/MetricHandler.h"
+#include "handler/LatencyMetrics.h"
+#include "handler/AccessLog.h"
+#include "handler/SlowRequestLog.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
 
@@ -32,15 +40,11 @@ ClientConnection::ClientConnection(const int clientFd,
                                    const sockaddr_in clientAddr,
                                    const Server *connectedServer): fd(clientFd),
                                                                    clientAddr(clientAddr), parser(this),
-                                                                   connectedServer(connectedServer) {
-    config.client_body_timeout = 0;
-    config.keepalive_timeout = 0;
-    config.keepalive_requests = 0;
-    config.headerConfig.client_header_timeout = ServerPool::getHttpConfig().headerConfig.client_header_timeout;
-    config.headerConfig.client_max_header_size = ServerPool::getHttpConfig().headerConfig.client_max_header_size;
-    config.headerConfig.client_max_header_count = ServerPool::getHttpConfig().headerConfig.client_max_header_count;
-    config.client_max_body_size = 1 * 1024 * 1024; // 1 MB
-
+                                                                   connectedServer(connectedServer),
+                                                                   virtualHosts(connectedServer
+                                                                                    ? &connectedServer->getVirtualHosts(clientFd)
+                                                                                    : nullptr),
+                                                                   config(ServerPool::getDefaultConfig()) {
 #if defined(__APPLE__)
     int opt = 1;
     setsockopt(clientFd, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof(opt));
@@ -57,7 +61,9 @@ ClientConnection::ClientConnection(const int clientFd,
             this->handleOutput();
         return false;
     });
-    MetricHandler::incrementMetric("new_connections", 1);
+    MetricHandler::incrementMetric(Metric::NEW_CONNECTIONS, 1);
+    MetricHandler::addGauge(Gauge::CONNECTIONS, 1);
+    timing.mark(RequestPhase::ACCEPTED);
 }
 
 ClientConnection::~ClientConnection() {
@@ -72,13 +78,14 @@ ClientConnection::~ClientConnection() {
     }
     delete requestHandler;
     requestHandler = nullptr;
-    MetricHandler::incrementMetric("disconnects", 1);
+    MetricHandler::incrementMetric(Metric::DISCONNECTS, 1);
+    MetricHandler::addGauge(Gauge::CONNECTIONS, -1);
 }
 
 void ClientConnection::handleInput() {
-    // TODO: fix magic number
-    char buffer[60001];
-    const ssize_t bytesRead = read(fd, buffer, 60000);
+    const BufferPool::Block block(READ_BUFFER_SIZE);
+    char *buffer = block.data();
+    const ssize_t bytesRead = read(fd, buffer, block.size() - 1);
     if (bytesRead < 0) {
         Logger::log(LogLevel::ERROR, "Failed to read from client fd: " + std::to_string(fd));
         shouldClose = true;
@@ -89,50 +96,81 @@ void ClientConnection::handleInput() {
         shouldClose = true;
         return;
     }
+    if (discardInput)
+        return;
 
     buffer[bytesRead] = '\0';
+    timing.mark(RequestPhase::FIRST_BYTE);
 
     // so it doasn't timeout while reading the request
     lastPackageSend = 0;
-    MetricHandler::incrementMetric("bytes_received", bytesRead);
+    MetricHandler::incrementMetric(Metric::BYTES_RECEIVED, bytesRead);
 
     if (parser.parse(buffer, bytesRead)) {
-        const auto request = parser.getRequest();
-        keepAlive = request->getHeader("Connection") == "keep-alive";
-        request->printRequest();
-
-        Logger::log(LogLevel::DEBUG, "Request Parsed");
-        MetricHandler::incrementMetric("requests", 1);
-
-        try {
-            delete requestHandler;
-            requestHandler = new RequestHandler(this, request, config);
-            requestHandler->execute();
-        } catch (std::exception &e) {
-            Logger::log(LogLevel::ERROR, "Error handling request: " + std::string(e.what()));
-            const HttpResponse response = HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR);
-            setResponse(RequestHandler::handleCustomErrorPage(response, config, std::nullopt));
-        }
+        if (!streamingRequest)
+            startRequest();
+        else if (requestHandler && requestHandler->isWaitingForBody())
+            runRequestHandler();
+        streamingRequest = false;
 
         parser.reset();
         debugBuffer.clear();
         return;
     }
 
+    // a PUT or a tus PATCH is written to its file while the body still arrives, instead of buffering all of it first
+    if (parser.getState() == ParseState::BODY && !streamingRequest &&
+        (parser.getRequest()->method == PUT || parser.getRequest()->method == PATCH)) {
+        parser.streamBody();
+        streamingRequest = true;
+        startRequest();
+        return;
+    }
+
     if (parser.hasError()) {
+        abortStreamingRequest();
         const HttpResponse response = HttpResponse::html(parser.getErrorCode());
-        setResponse(RequestHandler::handleCustomErrorPage(response, config, std::nullopt));
+        setResponse(RequestHandler::handleCustomErrorPage(response, *config, nullptr));
         parser.reset();
         debugBuffer.clear();
     }
 }
 
+void ClientConnection::startRequest() {
+    request = parser.getRequest();
+    keepAlive = request->getHeader("Connection") == "keep-alive";
+    request->printRequest();
+
+    Logger::log(LogLevel::DEBUG, "Request Parsed");
+    MetricHandler::incrementMetric(Metric::REQUESTS, 1);
+    runRequestHandler();
+}
+
+void ClientConnection::runRequestHandler() {
+    try {
+        route = nullptr;
+        delete requestHandler;
+        requestHandler = new RequestHandler(this, request, config);
+        requestHandler->execute();
+    } catch (std::exception &e) {
+        Logger::log(LogLevel::ERROR, "Error handling request: " + std::string(e.what()));
+        const HttpResponse response = HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR);
+        setResponse(RequestHandler::handleCustomErrorPage(response, *config, nullptr));
+    }
+}
+
+void ClientConnection::abortStreamingRequest() {
+    if (!streamingRequest)
+        return;
+    streamingRequest = false;
+    delete requestHandler;
+    requestHandler = nullptr;
+}
+
 void ClientConnection::handleOutput() {
     if (hasPendingResponse()) {
         lastPackageSend = 0;
         HttpResponse &response = getResponse().value();
-        if (response.getBody()->isStillWriting())
-            return;
         if (keepAlive)
             response.setHeader("Connection", "keep-alive");
         else
@@ -142,68 +180,152 @@ void ClientConnection::handleOutput() {
     }
 }
 
-void ClientConnection::handleFileOutput() {
-    if (!response.value().alreadySendHeader) {
-        const std::string header = response.value().toHeaderString();
-        Logger::log(LogLevel::DEBUG, "Sending response header: " + header);
-        Logger::log(LogLevel::INFO, "status code: " + std::to_string(response->getStatus()));
-        if (send(fd, header.c_str(), header.length(), MSG_NOSIGNAL) <= 0) {
-            Logger::log(LogLevel::ERROR, "Failed to write header to client");
+void ClientConnection::queueNextChunk(SmartBuffer &body) {
+    body.read(SEND_CHUNK_SIZE);
+
+    size_t available = std::min(body.getReadableSize(), static_cast<size_t>(SEND_CHUNK_SIZE));
+    chunkFromPipe = false;
+    if (available == 0 && body.isDrained() && body.hasSpliceSource()) {
+        available = pendingSpliceBytes(body);
+        chunkFromPipe = available > 0;
+    }
+    if (available > 0) {
+        std::stringstream chunkHeader;
+        chunkHeader << std::hex << available << "\r\n";
+        chunkPrefix += chunkHeader.str();
+        chunkDataLeft = available;
+        chunkSuffixLeft = 2;
+        return;
+    }
+
+    if (body.isDrained() && !body.isStreaming()) {
+        chunkPrefix += "0\r\n\r\n";
+        finalChunkQueued = true;
+    }
+}
+
+// the pipe's fill level sizes the chunk, its bytes stay in the kernel until they are spliced
+size_t ClientConnection::pendingSpliceBytes(SmartBuffer &body) {
+    SmartBuffer::SpliceSource &source = body.getSpliceSource();
+    int pending = 0;
+    if (source.remaining > 0 && ioctl(source.fd, FIONREAD, &pending) == 0 && pending > 0)
+        return std::min({static_cast<size_t>(pending), source.remaining, static_cast<size_t>(SEND_CHUNK_SIZE)});
+
+    // an empty pipe ends the body once the script closed it, a missing Content-Length makes that the regular end
+    pollfd pipe{source.fd, POLLIN, 0};
+    if (source.remaining == 0)
+        body.endSplice(true);
+    else if (poll(&pipe, 1, 0) > 0 && (pipe.revents & (POLLHUP | POLLERR)))
+        body.endSplice(source.remaining == SIZE_MAX);
+    return 0;
+}
+
+void ClientConnection::sendSplicedChunk(SmartBuffer &body) {
+#ifdef SPLICE_F_MOVE
+    if (!chunkPrefix.empty()) {
+        const ssize_t bytesSent = send(fd, chunkPrefix.data(), chunkPrefix.length(), MSG_NOSIGNAL | MSG_MORE);
+        if (bytesSent <= 0) {
+            Logger::log(LogLevel::ERROR, "Failed to write response to client");
             clearResponse();
             return;
         }
-        MetricHandler::incrementMetric("bytes_send", header.length());
-        response.value().alreadySendHeader = true;
+        countSent(bytesSent);
+        chunkPrefix.erase(0, bytesSent);
+        if (!chunkPrefix.empty())
+            return;
+    }
+
+    SmartBuffer::SpliceSource &source = body.getSpliceSource();
+    const ssize_t bytesSent = splice(source.fd, nullptr, fd, nullptr, chunkDataLeft,
+                                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+    if (bytesSent < 0 && errno == EAGAIN)
+        return;
+    if (bytesSent <= 0) {
+        Logger::log(LogLevel::ERROR, "Failed to splice response to client: " + std::string(strerror(errno)));
+        // the chunk is cut off, the connection can not carry another response
+        shouldClose = true;
+        clearResponse();
         return;
     }
+    countSent(bytesSent);
+    MetricHandler::incrementMetric(Metric::BYTES_SPLICED, bytesSent);
+    chunkDataLeft -= bytesSent;
+    if (source.remaining != SIZE_MAX)
+        source.remaining -= bytesSent;
+    if (chunkDataLeft == 0)
+        chunkFromPipe = false;
+#else
+    (void) body;
+#endif
+}
 
+// header, chunk size line, chunk data and CRLF leave in a single sendmsg, partial sends resume where they stopped
+void ClientConnection::handleFileOutput() {
+    HttpResponse &currentResponse = response.value();
+    if (!currentResponse.alreadySendHeader) {
+        chunkPrefix = currentResponse.toHeaderString();
+        Logger::log(LogLevel::DEBUG, "Sending response header: " + chunkPrefix);
+        Logger::log(LogLevel::INFO, "status code: " + std::to_string(currentResponse.getStatus()));
+        currentResponse.alreadySendHeader = true;
+        // the header alone is the whole response
+        if (currentResponse.isBodyOmitted())
+            finalChunkQueued = true;
+    }
 
-    std::shared_ptr<SmartBuffer> body = response->getBody();
-    // TODO: fix magic number number should probably be higher
-    body->read(4000);
+    const std::shared_ptr<SmartBuffer> body = currentResponse.getBody();
+    if (chunkDataLeft == 0 && chunkSuffixLeft == 0 && !finalChunkQueued)
+        queueNextChunk(*body);
 
-    const std::string readBuffer = body->getReadBuffer();
+    // the CRLF after a spliced chunk goes out with the next sendmsg
+    if (chunkFromPipe) {
+        sendSplicedChunk(*body);
+        return;
+    }
 
-    if (!readBuffer.empty()) {
-        std::stringstream chunkHeader;
-        chunkHeader << std::hex << readBuffer.length() << "\r\n";
-        const std::string chunkHeaderStr = chunkHeader.str();
+    iovec spans[SmartBuffer::MAX_SPANS + 2];
+    size_t spanCount = 0;
+    if (!chunkPrefix.empty())
+        spans[spanCount++] = {chunkPrefix.data(), chunkPrefix.length()};
 
-        // Write the chunk header
-        if (send(fd, chunkHeaderStr.c_str(), chunkHeaderStr.length(), MSG_NOSIGNAL) <= 0) {
-            Logger::log(LogLevel::ERROR, "Failed to write chunk header to client");
-            clearResponse();
-            return;
-        }
-        MetricHandler::incrementMetric("bytes_send", chunkHeaderStr.length());
+    size_t bodySpanCount = SmartBuffer::MAX_SPANS;
+    const size_t bodyBytes = chunkDataLeft > 0 ? body->peek(spans + spanCount, bodySpanCount, chunkDataLeft) : 0;
+    if (bodyBytes > 0)
+        spanCount += bodySpanCount;
 
+    if (chunkDataLeft == 0 && chunkSuffixLeft > 0)
+        spans[spanCount++] = {const_cast<char *>("\r\n") + (2 - chunkSuffixLeft), chunkSuffixLeft};
 
-        ssize_t bytesWritten = send(fd, readBuffer.c_str(), readBuffer.length(), MSG_NOSIGNAL);
-        // Write the chunk data
-        if (bytesWritten <= 0) {
-            Logger::log(LogLevel::ERROR, "Failed to write chunk data to client");
-            clearResponse();
-            return;
-        }
-        MetricHandler::incrementMetric("bytes_send", bytesWritten);
+    if (spanCount == 0)
+        return;
 
+    msghdr message{};
+    message.msg_iov = spans;
+    message.msg_iovlen = spanCount;
+    const ssize_t bytesSent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    if (bytesSent <= 0) {
+        Logger::log(LogLevel::ERROR, "Failed to write response to client");
+        clearResponse();
+        return;
+    }
+    countSent(bytesSent);
 
-        body->cleanReadBuffer(bytesWritten);
+    size_t remaining = bytesSent;
+    const size_t prefixSent = std::min(remaining, chunkPrefix.length());
+    chunkPrefix.erase(0, prefixSent);
+    remaining -= prefixSent;
 
-        // Write the trailing CRLF
-        if (send(fd, "\r\n", 2, MSG_NOSIGNAL) <= 0) {
-            Logger::log(LogLevel::ERROR, "Failed to write chunk trailing CRLF to client");
-            clearResponse();
-        }
-        MetricHandler::incrementMetric("bytes_send", 2);
-    }
+    const size_t bodySent = std::min(remaining, bodyBytes);
+    body->consume(bodySent);
+    chunkDataLeft -= bodySent;
+    remaining -= bodySent;
 
+    if (chunkDataLeft == 0)
+        chunkSuffixLeft -= std::min(remaining, chunkSuffixLeft);
 
-    if (body->getReadPos() >= body->getSize()) {
-        if (send(fd, "0\r\n\r\n", 5, MSG_NOSIGNAL) <= 0)
-            Logger::log(LogLevel::ERROR, "Failed to write final chunk to client");
+    if (finalChunkQueued && chunkPrefix.empty()) {
         lastPackageSend = std::time(nullptr);
-        MetricHandler::incrementMetric("responses", 1);
+        MetricHandler::incrementMetric(Metric::RESPONSES, 1);
+        finishRequest(currentResponse.getStatus());
         Logger::log(LogLevel::INFO, "Client response sent");
         clearResponse();
     }
@@ -213,8 +335,8 @@ void ClientConnection::handleFileOutput() {
 void ClientConnection::clearResponse() {
     cgiProcessStart = 0;
     response.reset();
-    if (!keepAlive || requestCount > config.
-        keepalive_requests) {
+    resetChunkState();
+    if (!keepAlive || requestCount > config->keepalive_requests) {
         shouldClose = true;
     }
 
@@ -230,10 +352,47 @@ void ClientConnection::setResponse(HttpResponse response) {
 
     cgiProcessStart = 0;
     this->response = response;
+    resetChunkState();
+    // an answer before the end of the body leaves the rest of it on the wire, the connection can not be reused
+    if (parser.getState() == ParseState::BODY) {
+        keepAlive = false;
+        discardInput = true;
+    }
     parser.reset();
     requestCount++;
 }
 
-void ClientConnection::setConfig(const ServerConfig &config) {
+void ClientConnection::resetChunkState() {
+    chunkPrefix.clear();
+    chunkDataLeft = 0;
+    chunkSuffixLeft = 0;
+    finalChunkQueued = false;
+    chunkFromPipe = false;
+}
+
+void ClientConnection::setConfig(const ServerConfigPtr &config) {
     this->config = config;
 }
+
+void ClientConnection::countSent(const size_t bytes) {
+    MetricHandler::incrementMetric(Metric::BYTES_SEND, bytes);
+    responseBytesSent += bytes;
+    timing.mark(RequestPhase::FIRST_RESPONSE_BYTE);
+}
+
+// a response without a request, like a timeout, has no latency and no log lines
+void ClientConnection::finishRequest(const int status) {
+    timing.mark(RequestPhase::LAST_BYTE);
+    if (timing.has(RequestPhase::FIRST_BYTE)) {
+        const LatencyMetrics::Target &target = LatencyMetrics::record(connectedServer, config.get(), route, status,
+                                                                      timing);
+        AccessLog::log(*this, status, target);
+        SlowRequestLog::log(*this, status, target);
+    }
+    timing.reset();
+    route = nullptr;
+    request.reset();
+    responseBytesSent = 0;
+    cgiPid = -1;
+    cgiFromWorker = false;
+}
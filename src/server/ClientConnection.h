@@ -11,12 +11,15 @@
 #include <optional>
 #include <string>
 #include <ctime>
+#include <memory>
 
 #include "requestHandler/RequestHandler.h"
 #include "response/HttpResponse.h"
+#include "handler/RequestTiming.h"
 #include <iostream>
 
 class Server;
+class VirtualHostIndex;
 
 class ClientConnection {
 public:
@@ -28,16 +31,32 @@ public:
     bool keepAlive = false;
     bool shouldClose = false;
     const Server *connectedServer;
+    const VirtualHostIndex *virtualHosts; // the server blocks of the address the client connected to
     std::time_t cgiProcessStart = 0;
     std::string sessionId;
     bool isNewSession = false;
-    ServerConfig config;
+    ServerConfigPtr config;
+    const RouteConfig *route = nullptr; // matched location of the current request, set by the RequestHandler
+    std::shared_ptr<HttpRequest> request; // the current request once it is parsed, for the access log
+    RequestTiming timing; // phases of the current request, reset once its response is sent
+    size_t responseBytesSent = 0; // header and body bytes of the current response
+    pid_t cgiPid = -1; // script process of the current request, for the slow request log
+    bool cgiFromWorker = false; // the pid is a pooled worker that outlives the request
 
 private:
     std::optional<HttpResponse> response = std::nullopt;
     RequestHandler *requestHandler = nullptr;
+    bool streamingRequest = false; // the handler of the request in the parser started before its body was complete
+    bool discardInput = false; // the response went out before the request body ended, the rest of it is dropped
     std::string debugBuffer;
 
+    // chunked framing of the response that is currently being sent
+    std::string chunkPrefix; // header and/or chunk size line not yet sent
+    size_t chunkDataLeft = 0; // body bytes of the current chunk not yet sent
+    size_t chunkSuffixLeft = 0; // bytes of the chunk's trailing CRLF not yet sent
+    bool finalChunkQueued = false;
+    bool chunkFromPipe = false; // the chunk's data is spliced from the body's pipe instead of peeked
+
 public:
     ClientConnection() = delete;
 
@@ -63,7 +82,27 @@ public:
         return response;
     }
 
-    void setConfig(const ServerConfig &config);
+    void setConfig(const ServerConfigPtr &config);
+
+    // drops the handler of a request whose body stopped arriving, whatever it stored so far goes with it
+    void abortStreamingRequest();
+
+private:
+    void startRequest();
+
+    void runRequestHandler();
+
+    void queueNextChunk(SmartBuffer &body);
+
+    [[nodiscard]] size_t pendingSpliceBytes(SmartBuffer &body);
+
+    void sendSplicedChunk(SmartBuffer &body);
+
+    void resetChunkState();
+
+    void countSent(size_t bytes);
+
+    void finishRequest(int status);
 };
 
 
@@ -4,16 +4,17 @@
 
 #include "FdHandler.h"
 #include <common/Logger.h>
+#include <algorithm>
 
 std::vector<pollfd> FdHandler::pollfds;
 std::unordered_map<int, std::function<bool(int, short)> > FdHandler::fdCallbacks;
-std::queue<pollfd> FdHandler::fdQueue;
+std::deque<pollfd> FdHandler::fdQueue;
 
 void FdHandler::addFd(const int fd, const short events, const std::function<bool(int, short)> &callback) {
     pollfd pfd{};
     pfd.fd = fd;
     pfd.events = events;
-    fdQueue.push(pfd);
+    fdQueue.push_back(pfd);
     fdCallbacks[fd] = callback;
 }
 
@@ -30,11 +31,31 @@ std::vector<pollfd>::iterator FdHandler::removeFd(const int fd) {
     return pollfds.end();
 }
 
+// keeps the callback of a registration that reused the fd number while it waits in the queue
+std::vector<pollfd>::iterator FdHandler::removePolled(const std::vector<pollfd>::iterator it) {
+    const int fd = it->fd;
+    if (std::none_of(fdQueue.begin(), fdQueue.end(), [fd](const pollfd &pfd) { return pfd.fd == fd; }))
+        fdCallbacks.erase(fd);
+    return pollfds.erase(it);
+}
+
+void FdHandler::setEvents(const int fd, const short events) {
+    for (pollfd &pfd: pollfds) {
+        if (pfd.fd == fd) {
+            pfd.events = events;
+            return;
+        }
+    }
+    for (pollfd &pfd: fdQueue) {
+        if (pfd.fd == fd)
+            pfd.events = events;
+    }
+}
 
 void FdHandler::pollFds() {
     while (!fdQueue.empty() && pollfds.size() < 1024) {
         pollfds.push_back(fdQueue.front());
-        fdQueue.pop();
+        fdQueue.pop_front();
     }
 
     const int ret = poll(pollfds.data(), pollfds.size(), 100);
@@ -48,7 +69,16 @@ void FdHandler::pollFds() {
         if (it->revents & POLLERR) {
             Logger::log(LogLevel::ERROR, "Poll error on fd: " + std::to_string(it->fd));
             Logger::log(LogLevel::ERROR, "Error: " + std::string(strerror(errno)));
-            it = removeFd(it->fd);
+            // the owner still gets to see the error, e.g. a refused non-blocking connect
+            if (const auto callback = fdCallbacks.find(it->fd); callback != fdCallbacks.end()) {
+                try {
+                    const auto handler = callback->second;
+                    handler(it->fd, it->revents);
+                } catch (std::exception &e) {
+                    Logger::log(LogLevel::ERROR, e.what());
+                }
+            }
+            it = removePolled(it);
             continue;
         }
         if (it->revents & POLLNVAL) {
@@ -56,14 +86,17 @@ void FdHandler::pollFds() {
             continue;
         }
         if (it->revents & POLLIN || it->revents & POLLOUT || it->revents & POLLHUP) {
-            if (auto fdCallbacksIt = fdCallbacks.find(it->fd); fdCallbacksIt == fdCallbacks.end()) {
+            const auto fdCallbacksIt = fdCallbacks.find(it->fd);
+            if (fdCallbacksIt == fdCallbacks.end()) {
                 it = removeFd(it->fd);
                 continue;
             }
 
             try {
-                if (fdCallbacks[it->fd](it->fd, it->revents)) {
-                    it = removeFd(it->fd);
+                // a copy, the callback may close its fd and register a new one under the same number
+                const auto handler = fdCallbacksIt->second;
+                if (handler(it->fd, it->revents)) {
+                    it = removePolled(it);
                     continue;
                 }
             }catch (std::exception &e) {
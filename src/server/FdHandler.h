@@ -11,7 +11,7 @@
 #include <poll.h>
 #include <unordered_map>
 #include <functional>
-#include <queue>
+#include <deque>
 #include <cerrno>
 #include <cstring>
 
@@ -20,11 +20,15 @@ class FdHandler {
 private:
     static std::vector<pollfd> pollfds;
     static std::unordered_map<int, std::function<bool(int, short)> > fdCallbacks;
-    static std::queue<pollfd> fdQueue;
+    static std::deque<pollfd> fdQueue;
+
+    static std::vector<pollfd>::iterator removePolled(std::vector<pollfd>::iterator it);
 
 public:
     static void addFd(int fd, short events, const std::function<bool(int, short)> &callback);
     static std::vector<pollfd>::iterator removeFd(int fd);
+    // changes the events an already added fd is polled for
+    static void setEvents(int fd, short events);
 
     static void pollFds();
 };
@@ -6,15 +6,20 @@
 #include "common/Logger.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 
 #include "FdHandler.h"
 #include "ServerPool.h"
+#include "webserv.h"
 #include "requestHandler/RequestHandler.h"
 #include "response/HttpResponse.h"
 
-Server::Server(const int port, std::string host, const ServerConfig &config) : port(port), host(host), config(config) {
+Server::Server(const int port, std::string host, ServerConfigPtr config) : port(port), host(host),
+                                                                         config(std::move(config)) {
+    options = this->config->listenOptions;
     Logger::log(LogLevel::DEBUG, "Server created with config: " + host + ":" + std::to_string(port));
 }
 
@@ -28,6 +33,7 @@ bool Server::createSocket() {
         Logger::log(LogLevel::ERROR, "Failed to create socket");
         return false;
     }
+    fcntl(serverFd, F_SETFD, FD_CLOEXEC);
 
     constexpr int opt = 1;
     if (setsockopt(serverFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
@@ -42,14 +48,49 @@ bool Server::createSocket() {
     serverAddr.sin_port = htons(port);
     serverAddr.sin_addr.s_addr = custom_inet_addr(host.c_str());
 
-    if (bind(serverFd, reinterpret_cast<struct sockaddr *>(&serverAddr), sizeof(serverAddr)) < 0)
+    applySocketOptions();
+
+    if (bind(serverFd, reinterpret_cast<struct sockaddr *>(&serverAddr), sizeof(serverAddr)) < 0) {
+        Logger::log(LogLevel::ERROR, "Failed to bind " + host + ":" + std::to_string(port) + ": " + strerror(errno));
+        close(serverFd);
+        serverFd = -1;
         return false;
+    }
 
     return true;
 }
 
+// option failures are not fatal, the listener just runs without them
+void Server::applySocketOptions() const {
+    constexpr int opt = 1;
+    if (options.reuseport && setsockopt(serverFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+        Logger::log(LogLevel::WARNING, "Failed to set SO_REUSEPORT: " + std::string(strerror(errno)));
+
+#ifdef TCP_DEFER_ACCEPT
+    if (options.deferred) {
+        const int timeout = static_cast<int>(config->headerConfig.client_header_timeout);
+        if (setsockopt(serverFd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &timeout, sizeof(timeout)) < 0)
+            Logger::log(LogLevel::WARNING, "Failed to set TCP_DEFER_ACCEPT: " + std::string(strerror(errno)));
+    }
+#endif
+
+#ifdef TCP_FASTOPEN
+    if (options.fastopen > 0 &&
+        setsockopt(serverFd, IPPROTO_TCP, TCP_FASTOPEN, &options.fastopen, sizeof(options.fastopen)) < 0)
+        Logger::log(LogLevel::WARNING, "Failed to set TCP_FASTOPEN: " + std::string(strerror(errno)));
+#endif
+}
+
+void Server::mergeListenOptions(const ListenOptions &listenOptions) {
+    if (options.backlog == 0)
+        options.backlog = listenOptions.backlog;
+    options.reuseport = options.reuseport || listenOptions.reuseport;
+    options.deferred = options.deferred || listenOptions.deferred;
+    options.fastopen = std::max(options.fastopen, listenOptions.fastopen);
+}
+
 bool Server::listen() const {
-    if (::listen(serverFd, 5024) < 0) {
+    if (::listen(serverFd, options.backlog > 0 ? options.backlog : DEFAULT_LISTEN_BACKLOG) < 0) {
         Logger::log(LogLevel::DEBUG, "Failed to listen on socket");
         return false;
     }
@@ -65,6 +106,46 @@ bool Server::listen() const {
     return true;
 }
 
+bool Server::acceptsConfig(const ServerConfig &serverConfig) const {
+    return serverConfig.port == port &&
+           (host == "0.0.0.0" || serverConfig.host == host || serverConfig.host == "0.0.0.0");
+}
+
+void Server::addVirtualHost(const ServerConfigPtr &serverConfig) {
+    if (host == "0.0.0.0" && serverConfig->host != "0.0.0.0")
+        addressHosts[custom_inet_addr(serverConfig->host.c_str())].addServer(serverConfig);
+    else
+        virtualHosts.addServer(serverConfig);
+}
+
+const VirtualHostIndex &Server::getVirtualHosts(const int clientFd) const {
+    if (addressHosts.empty())
+        return virtualHosts;
+    sockaddr_in localAddr{};
+    socklen_t addrLen = sizeof(localAddr);
+    if (getsockname(clientFd, reinterpret_cast<struct sockaddr *>(&localAddr), &addrLen) < 0)
+        return virtualHosts;
+    const auto hosts = addressHosts.find(localAddr.sin_addr.s_addr);
+    return hosts != addressHosts.end() ? hosts->second : virtualHosts;
+}
+
+ServerConfigPtr Server::matchVirtualHost(const VirtualHostIndex &hosts, const std::string_view hostname) const {
+    if (ServerConfigPtr config = hosts.matchName(hostname))
+        return config;
+    // a name only the wildcard blocks know is still served by them, the address keeps its own default
+    if (&hosts != &virtualHosts)
+        if (ServerConfigPtr config = virtualHosts.matchName(hostname))
+            return config;
+    return hosts.getDefaultServer();
+}
+
+size_t Server::getNameCount() const {
+    size_t count = virtualHosts.getNameCount();
+    for (const auto &[address, hosts]: addressHosts)
+        count += hosts.getNameCount();
+    return count;
+}
+
 void Server::handleNewConnections() const {
     sockaddr_in clientAddr{};
     socklen_t addrLen = sizeof(clientAddr);
@@ -74,6 +155,8 @@ void Server::handleNewConnections() const {
         return;
     }
 
+    // cgi processes must not keep client connections open
+    fcntl(clientFd, F_SETFD, FD_CLOEXEC);
     constexpr int opt = 1;
     setsockopt(clientFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 
@@ -11,6 +11,7 @@
 
 #include "config/config.h"
 #include "ClientConnection.h"
+#include "VirtualHostIndex.h"
 #include <unordered_map>
 #include <common/Logger.h>
 
@@ -21,10 +22,14 @@ private:
     int serverFd{};
     const int port;
     const std::string host;
-    const ServerConfig config;
+    const ServerConfigPtr config;
+    VirtualHostIndex virtualHosts;
+    // blocks on a specific address folded into this wildcard listener, they serve that address first
+    std::unordered_map<in_addr_t, VirtualHostIndex> addressHosts;
+    ListenOptions options;
 
 public:
-    Server(int port, std::string host, const ServerConfig &config);
+    Server(int port, std::string host, ServerConfigPtr config);
 
     ~Server();
 
@@ -42,11 +47,29 @@ public:
 
     [[nodiscard]] const std::string &getHost() const { return host; }
 
-    [[nodiscard]] const ServerConfig &getConfig() const { return config; }
+    [[nodiscard]] const ServerConfigPtr &getConfig() const { return config; }
+
+    [[nodiscard]] const VirtualHostIndex &getVirtualHosts() const { return virtualHosts; }
+
+    // the blocks serving the local address a client connected to
+    [[nodiscard]] const VirtualHostIndex &getVirtualHosts(int clientFd) const;
+
+    // the block for a Host header among hosts, names of the wildcard blocks are tried before the default
+    [[nodiscard]] ServerConfigPtr matchVirtualHost(const VirtualHostIndex &hosts, std::string_view hostname) const;
+
+    [[nodiscard]] size_t getNameCount() const;
+
+    [[nodiscard]] bool acceptsConfig(const ServerConfig &serverConfig) const;
+
+    void addVirtualHost(const ServerConfigPtr &serverConfig);
+
+    void mergeListenOptions(const ListenOptions &listenOptions);
 
 private:
     void handleNewConnections() const;
 
+    void applySocketOptions() const;
+
     static in_addr_t custom_inet_addr(const char *ip_address);
 };
 
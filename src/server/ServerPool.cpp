@@ -11,6 +11,9 @@
 #include <cerrno>
 #include <cstring>
 #include <algorithm>
+#include <map>
+#include <set>
+#include <filesystem>
 #include <webserv.h>
 #include <common/SessionManager.h>
 #include <parser/config/ConfigParser.h>
@@ -18,11 +21,23 @@
 #include "handler/CallbackHandler.h"
 #include "FdHandler.h"
 #include "handler/MetricHandler.h"
+#include "handler/AccessLog.h"
+#include "handler/SlowRequestLog.h"
+#include "buffer/BufferPool.h"
+#include "buffer/SmartBuffer.h"
+#include "fastcgi/FastCgiPool.h"
+#include "cgi/CgiWorkerPool.h"
+#include "cgi/CgiProcess.h"
+#include "cgi/CgiCache.h"
+#include "cgi/CgiLimiter.h"
+#include "io/IoPool.h"
+#include "io/ResumableUpload.h"
 
 std::vector<std::shared_ptr<Server> > ServerPool::servers;
 std::atomic<bool> ServerPool::running{false};
 std::unordered_map<int, std::shared_ptr<ClientConnection> > ServerPool::clients;
-std::vector<ServerConfig> ServerPool::configs;
+std::vector<ServerConfigPtr> ServerPool::configs;
+ServerConfigPtr ServerPool::defaultConfig;
 std::time_t ServerPool::startTime = 0;
 HttpConfig ServerPool::httpConfig;
 
@@ -31,77 +46,18 @@ void ServerPool::registerClient(int clientFd, const sockaddr_in &clientAddr, con
 }
 
 void ServerPool::matchVirtualServer(ClientConnection *client, const std::string &hostHeader) {
-    if (!client || !client->connectedServer) {
+    if (!client || !client->virtualHosts) {
         return;
     }
 
-    std::string hostname = hostHeader;
-    size_t colonPos = hostname.find(':');
-    if (colonPos != std::string::npos) {
+    std::string_view hostname = hostHeader;
+    const size_t colonPos = hostname.find(':');
+    if (colonPos != std::string_view::npos) {
         hostname = hostname.substr(0, colonPos);
     }
 
-    const int port = client->connectedServer->getPort();
-    const std::string connectedHost = client->connectedServer->getHost();
-
-    ServerConfig *defaultServer = nullptr;
-    ServerConfig *wildcardPrefixMatch = nullptr;
-    ServerConfig *wildcardSuffixMatch = nullptr;
-    size_t longestPrefixMatch = 0;
-    size_t longestSuffixMatch = 0;
-
-    for (auto &serverConfig: configs) {
-        if (serverConfig.port != port ||
-            (connectedHost != "0.0.0.0" && serverConfig.host != connectedHost && serverConfig.host != "0.0.0.0")) {
-            continue;
-        }
-
-        if (!defaultServer)
-            defaultServer = &serverConfig;
-
-        for (const std::string &serverName: serverConfig.server_names) {
-            if (serverName == hostname) {
-                client->setConfig(serverConfig);
-                return;
-            }
-
-            if (serverName.size() > 2 && serverName[0] == '*' && serverName[1] == '.') {
-                std::string suffix = serverName.substr(1);
-                if (hostname.size() >= suffix.size() &&
-                    hostname.compare(hostname.size() - suffix.size(), suffix.size(), suffix) == 0) {
-                    if (suffix.size() > longestPrefixMatch) {
-                        longestPrefixMatch = suffix.size();
-                        wildcardPrefixMatch = &serverConfig;
-                    }
-                }
-            }
-
-            if (serverName.size() > 2 && serverName.back() == '*' && serverName[serverName.size() - 2] == '.') {
-                std::string prefix = serverName.substr(0, serverName.size() - 1);
-                if (hostname.size() >= prefix.size() &&
-                    hostname.compare(0, prefix.size(), prefix) == 0) {
-                    if (prefix.size() > longestSuffixMatch) {
-                        longestSuffixMatch = prefix.size();
-                        wildcardSuffixMatch = &serverConfig;
-                    }
-                }
-            }
-        }
-    }
-
-    if (wildcardPrefixMatch) {
-        client->setConfig(*wildcardPrefixMatch);
-        Logger::log(LogLevel::INFO,
-                    "Matched wildcard prefix: " + wildcardPrefixMatch->host);
-    } else if (wildcardSuffixMatch) {
-        client->setConfig(*wildcardSuffixMatch);
-        Logger::log(LogLevel::INFO,
-                    "Matched wildcard suffix: " + wildcardSuffixMatch->host);
-    } else if (defaultServer) {
-        client->setConfig(*defaultServer);
-        Logger::log(LogLevel::INFO,
-                    "Using default server: " + defaultServer->host);
-    }
+    if (const ServerConfigPtr config = client->connectedServer->matchVirtualHost(*client->virtualHosts, hostname))
+        client->setConfig(config);
 }
 
 bool ServerPool::loadConfig(const std::string &configFile) {
@@ -115,33 +71,114 @@ bool ServerPool::loadConfig(const std::string &configFile) {
     }
 
     httpConfig = parser.getHttpConfig();
-    configs = parser.getServerConfigs();
+    BufferPool::setHugePages(httpConfig.buffer_pool_hugepages);
+    std::error_code error;
+    std::filesystem::create_directories(httpConfig.client_body_temp_path, error);
+    if (error) {
+        Logger::log(LogLevel::ERROR, "Cannot create client_body_temp_path " + httpConfig.client_body_temp_path + ": " +
+                                     error.message());
+        return false;
+    }
+    SmartBuffer::configure(httpConfig.buffer_memory_budget, httpConfig.client_body_temp_path);
+    CgiCache::configure(httpConfig.cgi_cache_memory_size, httpConfig.cgi_cache_disk_size,
+                        httpConfig.client_body_temp_path);
+    SessionManager::configure(httpConfig.session_idle_timeout, httpConfig.session_lifetime,
+                              httpConfig.session_max_count);
+    defaultConfig = createDefaultConfig(httpConfig);
+
+    for (auto &serverConfig: parser.getServerConfigs())
+        configs.push_back(std::make_shared<const ServerConfig>(std::move(serverConfig)));
 
     if (configs.empty()) {
         Logger::log(LogLevel::ERROR, "No valid server configurations found in the file: " + configFile);
         return false;
     }
 
+    // workers are forked before any listening socket exists
     for (const auto &serverConfig: configs) {
-        auto server = std::make_shared<Server>(serverConfig.port, serverConfig.host, serverConfig);
+        for (const RouteConfig &route: serverConfig->routes) {
+            // uploads left by an earlier run expire even if no client asks for them again
+            if (route.resumable_upload_max_size != 0)
+                ResumableUpload::watch((std::filesystem::path(route.alias.empty() ? route.root : route.alias) /
+                                        ResumableUpload::DIRECTORY).string());
+            for (const auto &[extension, workerConfig]: route.cgi_workers) {
+                const auto interpreter = route.cgi_params.find(extension);
+                if (interpreter == route.cgi_params.end()) {
+                    Logger::log(LogLevel::WARNING, "cgi_workers " + extension + " in location " + route.location +
+                                                   " has no cgi mapping and is ignored");
+                    continue;
+                }
+                CgiWorkerPool::configure(interpreter->second, workerConfig);
+            }
+        }
+    }
+
+    // one socket per endpoint; a wildcard listener also accepts for specific addresses on its port and picks
+    // their server blocks by the local address of each connection
+    std::set<int> wildcardPorts;
+    for (const auto &serverConfig: configs) {
+        if (serverConfig->host == "0.0.0.0")
+            wildcardPorts.insert(serverConfig->port);
+    }
+
+    std::map<std::pair<std::string, int>, std::shared_ptr<Server> > listeners;
+    for (const auto &serverConfig: configs) {
+        std::string host = serverConfig->host;
+        if (wildcardPorts.count(serverConfig->port))
+            host = "0.0.0.0";
+
+        auto &listener = listeners[{host, serverConfig->port}];
+        if (listener) {
+            listener->mergeListenOptions(serverConfig->listenOptions);
+            continue;
+        }
+        listener = std::make_shared<Server>(serverConfig->port, host, serverConfig);
+    }
+
+    for (const auto &[endpoint, server]: listeners) {
         if (!server->createSocket()) {
             continue;
         }
 
-        Logger::log(LogLevel::DEBUG, "Socket created on port: " + std::to_string(serverConfig.port) +
-                                     " with host: " + serverConfig.host);
+        Logger::log(LogLevel::DEBUG, "Socket created on port: " + std::to_string(endpoint.second) +
+                                     " with host: " + endpoint.first);
         servers.emplace_back(server);
     }
+
+    for (const auto &server: servers) {
+        for (const auto &serverConfig: configs) {
+            if (server->acceptsConfig(*serverConfig))
+                server->addVirtualHost(serverConfig);
+        }
+        Logger::log(LogLevel::DEBUG, "Indexed " + std::to_string(server->getNameCount()) +
+                                     " server names for " + server->getHost() + ":" +
+                                     std::to_string(server->getPort()));
+    }
     return true;
 }
 
+// used by connections until the Host header selected a virtual server
+ServerConfigPtr ServerPool::createDefaultConfig(const HttpConfig &httpConfig) {
+    auto config = std::make_shared<ServerConfig>();
+    config->port = 0;
+    config->client_body_timeout = 0;
+    config->keepalive_timeout = 0;
+    config->keepalive_requests = 0;
+    config->cgi_timeout = 0;
+    config->internal_api = false;
+    config->headerConfig = httpConfig.headerConfig;
+    config->client_max_body_size = 1 * 1024 * 1024; // 1 MB
+    config->client_body_buffer_size = DEFAULT_CLIENT_BODY_BUFFER_SIZE;
+    return config;
+}
+
 void ServerPool::start() {
     if (running.load()) {
         Logger::log(LogLevel::INFO, "Server pool is already running.");
         return;
     }
 
-    SessionManager::deserialize(SESSION_SAVE_FILE);
+    SessionManager::load();
     startTime = std::time(nullptr);
 
     int startedServers = 0;
@@ -151,7 +188,9 @@ void ServerPool::start() {
         }
     }
 
-    if (startedServers == 0) {
+    if (startedServers == 0 || !IoPool::start(httpConfig.io_threads) ||
+        !AccessLog::start(httpConfig.access_log, httpConfig.access_log_phases) ||
+        !SlowRequestLog::start(httpConfig.slow_request_log, httpConfig.slow_request_threshold, configs)) {
         Logger::log(LogLevel::ERROR, "Server pool could not be started.");
         cleanUp();
         return;
@@ -175,6 +214,12 @@ void ServerPool::serverLoop() {
         closeConnections();
         FdHandler::pollFds();
         CallbackHandler::executeCallbacks();
+        BufferPool::publishMetrics();
+        CgiProcess::reapExited();
+        CgiLimiter::expireWaiting();
+        SessionManager::expire();
+        SessionManager::compactIfNeeded();
+        ResumableUpload::sweep();
         MetricHandler::resetMetrics();
     }
     cleanUp();
@@ -190,33 +235,40 @@ void ServerPool::closeConnections() {
         }
 
         if (client->keepAlive && !client->hasPendingResponse() && client->lastPackageSend != 0 &&
-            currentTime - client->lastPackageSend > static_cast<long>(client->config.keepalive_timeout)) {
+            currentTime - client->lastPackageSend > static_cast<long>(client->config->keepalive_timeout)) {
             clientsToClose.push_back(fd);
             Logger::log(LogLevel::INFO, "Client connection timed out");
             continue;
         }
 
         if (client->parser.headerStart != 0 &&
-            currentTime - client->parser.headerStart > static_cast<long>(client->config.headerConfig.
+            currentTime - client->parser.headerStart > static_cast<long>(client->config->headerConfig.
                 client_header_timeout)) {
             client->setResponse(RequestHandler::handleCustomErrorPage(
-                HttpResponse::html(HttpResponse::StatusCode::REQUEST_TIMEOUT), client->config, std::nullopt));
+                HttpResponse::html(HttpResponse::StatusCode::REQUEST_TIMEOUT), *client->config, nullptr));
             client->keepAlive = false;
             continue;
         }
 
         if (client->parser.getState() == ParseState::BODY && client->parser.bodyStart != 0 &&
-            currentTime - client->parser.bodyStart > static_cast<long>(client->config.client_body_timeout)) {
+            currentTime - client->parser.bodyStart > static_cast<long>(client->config->client_body_timeout)) {
+            client->abortStreamingRequest();
             client->setResponse(RequestHandler::handleCustomErrorPage(
-                HttpResponse::html(HttpResponse::StatusCode::REQUEST_TIMEOUT), client->config, std::nullopt));
+                HttpResponse::html(HttpResponse::StatusCode::REQUEST_TIMEOUT), *client->config, nullptr));
             client->keepAlive = false;
             Logger::log(LogLevel::INFO, "Client connection body timed out");
         }
 
         if (client->cgiProcessStart != 0 &&
-            currentTime - client->cgiProcessStart > static_cast<long>(client->config.cgi_timeout)) {
+            currentTime - client->cgiProcessStart > static_cast<long>(client->config->cgi_timeout)) {
+            // the headers of a streamed response are already out, only cutting the connection is left
+            if (client->hasPendingResponse()) {
+                clientsToClose.push_back(fd);
+                Logger::log(LogLevel::INFO, "Client connection CGI process timed out while streaming");
+                continue;
+            }
             client->setResponse(RequestHandler::handleCustomErrorPage(
-                HttpResponse::html(HttpResponse::StatusCode::GATEWAY_TIMEOUT), client->config, std::nullopt));
+                HttpResponse::html(HttpResponse::StatusCode::GATEWAY_TIMEOUT), *client->config, nullptr));
             client->keepAlive = false;
             Logger::log(LogLevel::INFO, "Client connection CGI process timed out");
         }
@@ -234,7 +286,14 @@ void ServerPool::cleanUp() {
     clients.clear();
     configs.clear();
     servers.clear();
-    SessionManager::serialize(SESSION_SAVE_FILE);
+    FastCgiPool::cleanUp();
+    CgiWorkerPool::cleanUp();
+    CgiCache::cleanUp();
+    CgiLimiter::cleanUp();
+    IoPool::cleanUp();
+    SessionManager::cleanUp();
+    AccessLog::cleanUp();
+    SlowRequestLog::cleanUp();
     Logger::log(LogLevel::INFO, "Server pool cleaned up.");
 }
 
@@ -249,3 +308,7 @@ std::time_t ServerPool::getStartTime() {
 HttpConfig &ServerPool::getHttpConfig() {
     return httpConfig;
 }
+
+ServerConfigPtr ServerPool::getDefaultConfig() {
+    return defaultConfig;
+}
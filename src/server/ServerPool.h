@@ -18,7 +18,8 @@ private:
     static std::vector<std::shared_ptr<Server> > servers;
     static std::atomic<bool> running;
     static std::unordered_map<int, std::shared_ptr<ClientConnection> > clients;
-    static std::vector<ServerConfig> configs;
+    static std::vector<ServerConfigPtr> configs;
+    static ServerConfigPtr defaultConfig;
     static std::time_t startTime;
     static HttpConfig httpConfig;
 
@@ -39,6 +40,8 @@ public:
 
     static HttpConfig& getHttpConfig();
 
+    static ServerConfigPtr getDefaultConfig();
+
 private:
     static void serverLoop();
 
@@ -46,6 +49,8 @@ private:
 
     static void closeConnections();
 
+    static ServerConfigPtr createDefaultConfig(const HttpConfig &httpConfig);
+
 };
 
 
@@ -0,0 +1,132 @@
+#include "VirtualHostIndex.h"
+
+VirtualHostIndex::LabelNode *VirtualHostIndex::LabelNode::getOrCreateChild(const std::string_view childLabel) {
+    if (const auto it = children.find(childLabel); it != children.end())
+        return it->second.get();
+
+    auto child = std::make_unique<LabelNode>();
+    child->label = std::string(childLabel);
+    LabelNode *rawChild = child.get();
+    children.emplace(std::string_view(rawChild->label), std::move(child));
+    return rawChild;
+}
+
+std::string VirtualHostIndex::toLower(const std::string_view value) {
+    std::string lower(value);
+    for (char &c: lower) {
+        if (c >= 'A' && c <= 'Z')
+            c = static_cast<char>(c - 'A' + 'a');
+    }
+    return lower;
+}
+
+void VirtualHostIndex::insertLeadingWildcard(LabelNode &root, const std::string_view suffix,
+                                             const ServerConfigPtr &config) {
+    LabelNode *node = &root;
+    size_t end = suffix.size();
+    while (true) {
+        const size_t dot = end == 0 ? std::string_view::npos : suffix.rfind('.', end - 1);
+        const size_t start = dot == std::string_view::npos ? 0 : dot + 1;
+        node = node->getOrCreateChild(suffix.substr(start, end - start));
+        if (dot == std::string_view::npos)
+            break;
+        end = dot;
+    }
+    if (!node->config)
+        node->config = config;
+}
+
+void VirtualHostIndex::insertTrailingWildcard(LabelNode &root, const std::string_view prefix,
+                                              const ServerConfigPtr &config) {
+    LabelNode *node = &root;
+    size_t start = 0;
+    while (true) {
+        const size_t dot = prefix.find('.', start);
+        const size_t end = dot == std::string_view::npos ? prefix.size() : dot;
+        node = node->getOrCreateChild(prefix.substr(start, end - start));
+        if (dot == std::string_view::npos)
+            break;
+        start = dot + 1;
+    }
+    if (!node->config)
+        node->config = config;
+}
+
+void VirtualHostIndex::addServer(const ServerConfigPtr &config) {
+    if (!defaultServer)
+        defaultServer = config;
+
+    for (const std::string &serverName: config->server_names) {
+        const std::string name = toLower(serverName);
+        exactNames.emplace(name, config);
+        nameCount++;
+
+        if (name.size() > 2 && name[0] == '*' && name[1] == '.')
+            insertLeadingWildcard(leadingWildcards, std::string_view(name).substr(2), config);
+
+        if (name.size() > 2 && name.back() == '*' && name[name.size() - 2] == '.')
+            insertTrailingWildcard(trailingWildcards, std::string_view(name).substr(0, name.size() - 2), config);
+    }
+}
+
+// the wildcard must cover at least one label, so the leftmost label is never consumed
+const ServerConfigPtr *VirtualHostIndex::findLeadingWildcard(const LabelNode &root, const std::string_view hostname) {
+    const ServerConfigPtr *longestMatch = nullptr;
+    const LabelNode *node = &root;
+    size_t end = hostname.size();
+    while (true) {
+        const size_t dot = end == 0 ? std::string_view::npos : hostname.rfind('.', end - 1);
+        if (dot == std::string_view::npos)
+            return longestMatch;
+
+        const auto it = node->children.find(hostname.substr(dot + 1, end - dot - 1));
+        if (it == node->children.end())
+            return longestMatch;
+
+        node = it->second.get();
+        if (node->config)
+            longestMatch = &node->config;
+        end = dot;
+    }
+}
+
+const ServerConfigPtr *VirtualHostIndex::findTrailingWildcard(const LabelNode &root, const std::string_view hostname) {
+    const ServerConfigPtr *longestMatch = nullptr;
+    const LabelNode *node = &root;
+    size_t start = 0;
+    while (true) {
+        const size_t dot = hostname.find('.', start);
+        if (dot == std::string_view::npos)
+            return longestMatch;
+
+        const auto it = node->children.find(hostname.substr(start, dot - start));
+        if (it == node->children.end())
+            return longestMatch;
+
+        node = it->second.get();
+        if (node->config)
+            longestMatch = &node->config;
+        start = dot + 1;
+    }
+}
+
+ServerConfigPtr VirtualHostIndex::match(const std::string_view hostname) const {
+    if (ServerConfigPtr config = matchName(hostname))
+        return config;
+    return defaultServer;
+}
+
+ServerConfigPtr VirtualHostIndex::matchName(const std::string_view hostname) const {
+    const std::string lowerHostname = toLower(hostname);
+
+    if (const auto it = exactNames.find(lowerHostname); it != exactNames.end())
+        return it->second;
+
+    if (const ServerConfigPtr *config = findLeadingWildcard(leadingWildcards, lowerHostname))
+        return *config;
+
+    if (const ServerConfigPtr *config = findTrailingWildcard(trailingWildcards, lowerHostname))
+        return *config;
+
+    return nullptr;
+}
@@ -0,0 +1,55 @@
+#ifndef VIRTUALHOSTINDEX_H
+#define VIRTUALHOSTINDEX_H
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include "config/config.h"
+
+// Resolves a Host header to the server block of one listener.
+// Precedence: exact name, longest "*.example.com", longest "example.*", first server block.
+class VirtualHostIndex {
+private:
+    struct LabelNode {
+        std::string label;
+        ServerConfigPtr config;
+        // keys are views into the child's own label
+        std::unordered_map<std::string_view, std::unique_ptr<LabelNode> > children;
+
+        LabelNode *getOrCreateChild(std::string_view childLabel);
+    };
+
+    ServerConfigPtr defaultServer;
+    std::unordered_map<std::string, ServerConfigPtr> exactNames;
+    LabelNode leadingWildcards; // "*.example.com", labels stored right to left
+    LabelNode trailingWildcards; // "example.*", labels stored left to right
+    size_t nameCount = 0;
+
+    static const ServerConfigPtr *findLeadingWildcard(const LabelNode &root, std::string_view hostname);
+
+    static const ServerConfigPtr *findTrailingWildcard(const LabelNode &root, std::string_view hostname);
+
+    static void insertLeadingWildcard(LabelNode &root, std::string_view suffix, const ServerConfigPtr &config);
+
+    static void insertTrailingWildcard(LabelNode &root, std::string_view prefix, const ServerConfigPtr &config);
+
+public:
+    void addServer(const ServerConfigPtr &config);
+
+    [[nodiscard]] ServerConfigPtr match(std::string_view hostname) const;
+
+    // like match() without the default server, nullptr when no name matches
+    [[nodiscard]] ServerConfigPtr matchName(std::string_view hostname) const;
+
+    [[nodiscard]] const ServerConfigPtr &getDefaultServer() const { return defaultServer; }
+
+    [[nodiscard]] size_t getNameCount() const { return nameCount; }
+
+    [[nodiscard]] bool empty() const { return defaultServer == nullptr; }
+
+    static std::string toLower(std::string_view value);
+};
+
+
+#endif //VIRTUALHOSTINDEX_H
@@ -0,0 +1,133 @@
+#include "BufferPool.h"
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <common/Logger.h>
+#include <server/handler/MetricHandler.h>
+
+BufferPool::SizeClass BufferPool::classes[] = {
+    {4096, nullptr, 0, 0, 0, 0},
+    {16384, nullptr, 0, 0, 0, 0},
+    {65536, nullptr, 0, 0, 0, 0},
+};
+std::vector<void *> BufferPool::slabs;
+bool BufferPool::hugePages = false;
+size_t BufferPool::oversizedAcquires = 0;
+size_t BufferPool::publishedAcquires = 0;
+size_t BufferPool::publishedSlabs = 0;
+
+BufferPool::Block::Block(const size_t size) : block(acquire(size)), blockSize(blockSizeFor(size)) {
+}
+
+BufferPool::Block::~Block() {
+    release(block, blockSize);
+}
+
+BufferPool::SizeClass *BufferPool::findClass(const size_t size) {
+    for (SizeClass &sizeClass: classes) {
+        if (size <= sizeClass.blockSize)
+            return &sizeClass;
+    }
+    return nullptr;
+}
+
+size_t BufferPool::blockSizeFor(const size_t size) {
+    const SizeClass *sizeClass = findClass(size);
+    return sizeClass ? sizeClass->blockSize : size;
+}
+
+bool BufferPool::refill(SizeClass &sizeClass) {
+    void *slab = nullptr;
+    if (posix_memalign(&slab, SLAB_SIZE, SLAB_SIZE) != 0) {
+        Logger::log(LogLevel::ERROR, "Failed to allocate buffer pool slab: " + std::string(strerror(errno)));
+        return false;
+    }
+#ifdef MADV_HUGEPAGE
+    if (hugePages && madvise(slab, SLAB_SIZE, MADV_HUGEPAGE) < 0)
+        Logger::log(LogLevel::WARNING, "madvise(MADV_HUGEPAGE) failed: " + std::string(strerror(errno)));
+#endif
+    slabs.push_back(slab);
+
+    char *base = static_cast<char *>(slab);
+    const size_t blockCount = SLAB_SIZE / sizeClass.blockSize;
+    for (size_t i = blockCount; i > 0; --i) {
+        auto *freeBlock = reinterpret_cast<FreeBlock *>(base + (i - 1) * sizeClass.blockSize);
+        freeBlock->next = sizeClass.freeList;
+        sizeClass.freeList = freeBlock;
+    }
+    sizeClass.totalBlocks += blockCount;
+    sizeClass.freeBlocks += blockCount;
+    return true;
+}
+
+char *BufferPool::acquire(const size_t size) {
+    SizeClass *sizeClass = findClass(size);
+    if (!sizeClass) {
+        oversizedAcquires++;
+        return new char[size];
+    }
+
+    if (!sizeClass->freeList && !refill(*sizeClass))
+        throw std::bad_alloc();
+
+    FreeBlock *block = sizeClass->freeList;
+    sizeClass->freeList = block->next;
+    sizeClass->freeBlocks--;
+    sizeClass->acquires++;
+    return reinterpret_cast<char *>(block);
+}
+
+void BufferPool::release(char *block, const size_t size) {
+    if (!block)
+        return;
+
+    SizeClass *sizeClass = findClass(size);
+    if (!sizeClass) {
+        delete[] block;
+        return;
+    }
+
+    auto *freeBlock = reinterpret_cast<FreeBlock *>(block);
+    freeBlock->next = sizeClass->freeList;
+    sizeClass->freeList = freeBlock;
+    sizeClass->freeBlocks++;
+    sizeClass->releases++;
+}
+
+std::shared_ptr<char> BufferPool::acquireShared(const size_t size) {
+    const size_t blockSize = blockSizeFor(size);
+    return {acquire(blockSize), [blockSize](char *block) { release(block, blockSize); }};
+}
+
+void BufferPool::setHugePages(const bool enabled) {
+    hugePages = enabled;
+#ifndef MADV_HUGEPAGE
+    if (enabled)
+        Logger::log(LogLevel::WARNING, "Huge pages are not supported on this platform, buffer pool uses normal pages");
+#endif
+}
+
+void BufferPool::publishMetrics() {
+    size_t acquires = oversizedAcquires;
+    for (const SizeClass &sizeClass: classes)
+        acquires += sizeClass.acquires;
+
+    if (acquires != publishedAcquires) {
+        MetricHandler::incrementMetric(Metric::BUFFER_POOL_ACQUIRES, acquires - publishedAcquires);
+        publishedAcquires = acquires;
+    }
+    if (slabs.size() != publishedSlabs) {
+        MetricHandler::incrementMetric(Metric::BUFFER_POOL_SLAB_ALLOCATIONS, slabs.size() - publishedSlabs);
+        publishedSlabs = slabs.size();
+    }
+}
+
+std::vector<BufferPool::ClassStats> BufferPool::getStats() {
+    std::vector<ClassStats> stats;
+    for (const SizeClass &sizeClass: classes) {
+        stats.push_back({
+            sizeClass.blockSize, sizeClass.totalBlocks, sizeClass.freeBlocks, sizeClass.acquires, sizeClass.releases
+        });
+    }
+    return stats;
+}
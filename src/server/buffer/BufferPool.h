@@ -0,0 +1,88 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Size-classed free lists for I/O buffers. Blocks are carved out of slabs that are never given back,
+// so steady-state traffic reuses the same memory instead of going through malloc for every read.
+class BufferPool {
+public:
+    static constexpr size_t SLAB_SIZE = 2 * 1024 * 1024;
+
+    struct ClassStats {
+        size_t blockSize;
+        size_t totalBlocks;
+        size_t freeBlocks;
+        size_t acquires;
+        size_t releases;
+    };
+
+    // owns one block for the lifetime of a scope
+    class Block {
+    private:
+        char *block;
+        size_t blockSize;
+
+    public:
+        explicit Block(size_t size);
+
+        ~Block();
+
+        Block(const Block &) = delete;
+
+        Block &operator=(const Block &) = delete;
+
+        [[nodiscard]] char *data() const { return block; }
+        [[nodiscard]] size_t size() const { return blockSize; }
+    };
+
+private:
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    struct SizeClass {
+        size_t blockSize;
+        FreeBlock *freeList;
+        size_t totalBlocks;
+        size_t freeBlocks;
+        size_t acquires;
+        size_t releases;
+    };
+
+    static SizeClass classes[];
+    static std::vector<void *> slabs;
+    static bool hugePages;
+    static size_t oversizedAcquires;
+    static size_t publishedAcquires;
+    static size_t publishedSlabs;
+
+    static SizeClass *findClass(size_t size);
+
+    static bool refill(SizeClass &sizeClass);
+
+public:
+    // returns a block of at least size bytes, larger than the biggest class falls back to the heap
+    static char *acquire(size_t size);
+
+    static void release(char *block, size_t size);
+
+    // the block goes back to the pool once the last owner drops it
+    static std::shared_ptr<char> acquireShared(size_t size);
+
+    [[nodiscard]] static size_t blockSizeFor(size_t size);
+
+    static void setHugePages(bool enabled);
+
+    // adds the allocations since the last call to the current metric window
+    static void publishMetrics();
+
+    [[nodiscard]] static std::vector<ClassStats> getStats();
+
+    [[nodiscard]] static size_t getReservedBytes() { return slabs.size() * SLAB_SIZE; }
+};
+
+
+#endif //BUFFERPOOL_H
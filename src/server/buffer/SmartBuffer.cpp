@@ -1,17 +1,17 @@
 #include "SmartBuffer.h"
+#include "BufferPool.h"
 #include <unistd.h>
 #include <fcntl.h>
 #include <iostream>
 #include <algorithm>
+#include <cstring>
 #include <common/Logger.h>
 #include <sys/stat.h>
-#include <filesystem>
-#include <vector>
+#include <sys/mman.h>
 
-#include "../FdHandler.h"
-#include "webserv.h"
-
-size_t SmartBuffer::tmpFileCount = 0;
+size_t SmartBuffer::residentBytes = 0;
+size_t SmartBuffer::memoryBudget = DEFAULT_BUFFER_MEMORY_BUDGET;
+std::string SmartBuffer::spillDirectory = TEMP_DIR_NAME;
 
 SmartBuffer::SmartBuffer(const size_t maxMemorySize)
     : maxMemorySize(maxMemorySize) {
@@ -25,14 +25,19 @@ SmartBuffer::SmartBuffer(const int fd): fd(fd) {
     }
     size = fileStat.st_size;
     isFile = true;
-    FdHandler::addFd(fd, POLLIN | POLLOUT, [this](const int fd, const short events) {
-        return this->onFileEvent(fd, events);
-    });
-    fdCallbackRegistered = true;
 }
 
 SmartBuffer::~SmartBuffer() {
-    unregisterCallback();
+    residentBytes -= readableSize;
+    closeFile();
+}
+
+void SmartBuffer::configure(const size_t memoryBudget, const std::string &spillDirectory) {
+    SmartBuffer::memoryBudget = memoryBudget;
+    SmartBuffer::spillDirectory = spillDirectory;
+}
+
+void SmartBuffer::closeFile() {
     if (isFile && fd >= 0) {
         Logger::log(LogLevel::DEBUG, "Closing file descriptor: " + std::to_string(fd));
         if (close(fd) < 0)
@@ -40,82 +45,158 @@ SmartBuffer::~SmartBuffer() {
                         "Failed to close file descriptor: " + std::to_string(fd) + ": " + strerror(errno));
         fd = -1;
     }
+}
+
+void SmartBuffer::fail(const int error) {
+    if (this->error == 0)
+        this->error = error != 0 ? error : EIO;
+    closeFile();
+}
+
+void SmartBuffer::appendToChain(std::deque<Span> &chain, const char *data, size_t length) {
+    while (length > 0) {
+        // a segment shared with another buffer is never written to again
+        if (chain.empty() || chain.back().end == SEGMENT_SIZE || chain.back().segment.use_count() > 1)
+            chain.push_back({BufferPool::acquireShared(SEGMENT_SIZE), 0, 0});
+
+        Span &tail = chain.back();
+        const size_t toCopy = std::min(length, SEGMENT_SIZE - tail.end);
+        std::memcpy(tail.segment.get() + tail.end, data, toCopy);
+        tail.end += toCopy;
+        data += toCopy;
+        length -= toCopy;
+    }
+}
 
-    if (!tmpFileName.empty() && std::filesystem::exists(tmpFileName)) {
-        try {
-            Logger::log(LogLevel::DEBUG, "Removing temporary file: " + tmpFileName);
-            std::filesystem::remove(tmpFileName);
-        } catch (const std::filesystem::filesystem_error &e) {
-            Logger::log(LogLevel::ERROR, "Failed to remove temporary file: " + tmpFileName + ": " + e.what());
+size_t SmartBuffer::collectSpans(const std::deque<Span> &chain, iovec *spans, size_t &spanCount,
+                                 const size_t maxBytes) {
+    const size_t maxSpans = spanCount;
+    size_t bytes = 0;
+    spanCount = 0;
+    for (const Span &span: chain) {
+        if (spanCount >= maxSpans || bytes >= maxBytes)
+            break;
+        const size_t length = std::min(span.end - span.start, maxBytes - bytes);
+        spans[spanCount].iov_base = span.segment.get() + span.start;
+        spans[spanCount].iov_len = length;
+        spanCount++;
+        bytes += length;
+    }
+    return bytes;
+}
+
+void SmartBuffer::consumeChain(std::deque<Span> &chain, size_t length) {
+    while (length > 0 && !chain.empty()) {
+        Span &head = chain.front();
+        const size_t available = head.end - head.start;
+        if (length < available) {
+            head.start += length;
+            return;
         }
+        length -= available;
+        chain.pop_front();
     }
 }
 
-void SmartBuffer::unregisterCallback() {
-    if (fdCallbackRegistered) {
-        FdHandler::removeFd(fd);
-        fdCallbackRegistered = false;
+// the file has no name, so nothing is left behind when the buffer or the whole process goes away
+int SmartBuffer::openSpillFile() {
+#ifdef O_TMPFILE
+    int fd = open(spillDirectory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0)
+        return fd;
+    // not every filesystem supports O_TMPFILE
+#endif
+    std::string path = spillDirectory + "/smartbuffer_XXXXXX";
+    const int tmpFd = mkstemp(path.data());
+    if (tmpFd >= 0) {
+        unlink(path.c_str());
+        fcntl(tmpFd, F_SETFD, FD_CLOEXEC);
+        return tmpFd;
     }
+    Logger::log(LogLevel::ERROR, "Failed to create spill file in " + spillDirectory + ": " + strerror(errno));
+#ifdef MFD_CLOEXEC
+    // keeps the request working, the bytes just stay in (swappable) memory
+    return memfd_create("smartbuffer", MFD_CLOEXEC);
+#else
+    return -1;
+#endif
 }
 
-bool SmartBuffer::onFileEvent(const int fd, const short events) {
-    if (events & POLLOUT && !writeBuffer.empty()) {
-        const ssize_t bytesWritten = ::write(fd, writeBuffer.data(), writeBuffer.length());
+bool SmartBuffer::writeToFile(const char *data, size_t length) {
+    while (length > 0) {
+        const ssize_t bytesWritten = pwrite(fd, data, length, static_cast<off_t>(size));
+        if (bytesWritten < 0 && errno == EINTR)
+            continue;
         if (bytesWritten <= 0) {
-            close(fd);
-            this->fd = -1;
-            Logger::log(LogLevel::ERROR, "Failed to write to file: " + std::to_string(fd) + ": " + strerror(errno));
-            return true;
+            const int writeError = bytesWritten < 0 ? errno : EIO;
+            Logger::log(LogLevel::ERROR, "Failed to write to file: " + std::to_string(fd) + ": " +
+                                         strerror(writeError));
+            fail(writeError);
+            return false;
         }
         size += bytesWritten;
-        writeBuffer.erase(0, bytesWritten);
+        data += bytesWritten;
+        length -= bytesWritten;
+    }
+    return true;
+}
+
+bool SmartBuffer::loadFromFile(const size_t wanted) {
+    const size_t segmentCount = std::min((wanted + SEGMENT_SIZE - 1) / SEGMENT_SIZE, static_cast<size_t>(4));
+
+    std::shared_ptr<char> segments[4];
+    iovec spans[4];
+    for (size_t i = 0; i < segmentCount; ++i) {
+        segments[i] = BufferPool::acquireShared(SEGMENT_SIZE);
+        spans[i].iov_base = segments[i].get();
+        spans[i].iov_len = SEGMENT_SIZE;
     }
-    if (events & POLLIN && toRead > 0) {
-        if (lseek(fd, readPos, SEEK_SET) < 0) {
-            Logger::log(LogLevel::ERROR, "Failed to seek in file: " + std::to_string(fd) + ": " + strerror(errno));
-            return false;
-        }
-        toRead = std::min(toRead, static_cast<size_t>(60000));
-        std::vector<char> buf(toRead + 1);
-        const ssize_t bytesRead = ::read(fd, buf.data(), toRead);
-        if (bytesRead <= 0) {
-            close(fd);
-            this->fd = -1;
-            return true;
-        }
 
-        buf[bytesRead] = '\0';
-        readBuffer.append(buf.data(), bytesRead);
-        readPos += bytesRead;
-        toRead -= bytesRead;
+    const ssize_t bytesRead = preadv(fd, spans, static_cast<int>(segmentCount), static_cast<off_t>(readPos));
+    if (bytesRead <= 0) {
+        // the file is shorter than the bytes written to it
+        if (bytesRead == 0)
+            errno = EIO;
+        return false;
     }
-    return false;
+
+    size_t remaining = bytesRead;
+    for (size_t i = 0; i < segmentCount && remaining > 0; ++i) {
+        const size_t length = std::min(remaining, SEGMENT_SIZE);
+        readable.push_back({segments[i], 0, length});
+        remaining -= length;
+    }
+    readableSize += bytesRead;
+    residentBytes += bytesRead;
+    readPos += bytesRead;
+    return true;
 }
 
 
 void SmartBuffer::switchToFile() {
-    if (isFile)
+    // one failed attempt is enough, retrying on every append would only flood the log
+    if (isFile || spillFailed)
         return;
 
-    size = 0;
-    Logger::log(LogLevel::DEBUG, "Switching SmartBuffer to file mode");
-
-    tmpFileName = TEMP_DIR_NAME "/smartbuffer_" + std::to_string(tmpFileCount++);
-    fd = open(tmpFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    fd = openSpillFile();
     if (fd < 0) {
-        Logger::log(LogLevel::ERROR, "Failed to create temporary file: " + tmpFileName);
+        Logger::log(LogLevel::ERROR, "Failed to create spill file, keeping buffer in memory");
+        spillFailed = true;
         return;
     }
-    Logger::log(LogLevel::DEBUG, "Created temporary file: " + tmpFileName);
-
-    writeBuffer.append(buffer);
-    buffer.clear();
+    Logger::log(LogLevel::DEBUG, "Switching SmartBuffer to file mode, fd: " + std::to_string(fd));
 
+    // the unconsumed bytes become the start of the file
     isFile = true;
-    FdHandler::addFd(fd, POLLIN | POLLOUT, [this](const int fd, const short events) {
-        return this->onFileEvent(fd, events);
-    });
-    fdCallbackRegistered = true;
+    size = 0;
+    readPos = 0;
+    for (const Span &span: readable) {
+        if (!writeToFile(span.segment.get() + span.start, span.end - span.start))
+            break;
+    }
+    residentBytes -= readableSize;
+    readable.clear();
+    readableSize = 0;
 }
 
 
@@ -123,39 +204,88 @@ void SmartBuffer::append(const char *data, const size_t length) {
     if (!data || length == 0)
         return;
 
-    if (isFile && fd >= 0)
-        writeBuffer.append(data, length);
-    else {
-        buffer.append(data, length);
-        size += length;
+    if (isFile) {
+        // once a write failed the stream has a hole, later bytes are dropped as well
+        if (fd < 0)
+            fail(EIO);
+        else
+            writeToFile(data, length);
+        return;
     }
 
-    if (size > maxMemorySize)
+    appendToChain(readable, data, length);
+    readableSize += length;
+    residentBytes += length;
+    size += length;
+    readPos += length;
+
+    if (readableSize > maxMemorySize || (residentBytes > memoryBudget && readableSize >= SEGMENT_SIZE))
         switchToFile();
 }
 
 void SmartBuffer::read(const size_t length) {
-    if (length == 0 || size == 0)
-        return;
-
-    if (isFile && fd >= 0) {
-        toRead += length;
+    if (!isFile || fd < 0)
         return;
+    while (readableSize < length && readPos < size) {
+        if (!loadFromFile(length - readableSize)) {
+            const int readError = errno;
+            Logger::log(LogLevel::ERROR, "Failed to read from file: " + std::to_string(fd) + ": " + strerror(readError));
+            fail(readError);
+            size = readPos; // end the stream instead of waiting for bytes that never come
+            return;
+        }
     }
+}
 
-    if (readPos >= size)
-        return;
+size_t SmartBuffer::peek(iovec *spans, size_t &spanCount, const size_t maxBytes) const {
+    return collectSpans(readable, spans, spanCount, maxBytes);
+}
 
-    const size_t available = size - readPos;
-    const size_t toRead = std::min(length, available);
+size_t SmartBuffer::peekShared(iovec *spans, std::shared_ptr<char> *segments, size_t &spanCount,
+                               const size_t maxBytes) const {
+    const size_t bytes = collectSpans(readable, spans, spanCount, maxBytes);
+    for (size_t i = 0; i < spanCount; ++i)
+        segments[i] = readable[i].segment;
+    return bytes;
+}
 
-    readBuffer.append(buffer.substr(readPos, toRead));
-    readPos = std::min(readPos + toRead, size);
+void SmartBuffer::consume(size_t length) {
+    length = std::min(length, readableSize);
+    consumeChain(readable, length);
+    readableSize -= length;
+    residentBytes -= length;
 }
 
-void SmartBuffer::cleanReadBuffer(size_t length) {
-    if (length > readBuffer.length())
-        length = readBuffer.length();
+ssize_t SmartBuffer::spliceTo(const int pipeFd, const size_t maxBytes) {
+#ifdef SPLICE_F_MOVE
+    if (!isFile || fd < 0 || readableSize > 0 || readPos >= size || spliceUnsupported)
+        return 0;
+    loff_t offset = static_cast<loff_t>(readPos);
+    const ssize_t moved = splice(fd, &offset, pipeFd, nullptr, std::min(maxBytes, size - readPos),
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (moved > 0) {
+        readPos += moved;
+        return moved;
+    }
+    if (moved < 0 && errno == EINVAL) {
+        spliceUnsupported = true;
+        return 0;
+    }
+    return moved;
+#else
+    (void) pipeFd;
+    (void) maxBytes;
+    return 0;
+#endif
+}
+
+void SmartBuffer::setSpliceSource(const int fd, const size_t remaining, std::function<void(bool complete)> onEnd) {
+    spliceSource = {fd, remaining, std::move(onEnd)};
+}
 
-    readBuffer.erase(0, length);
+void SmartBuffer::endSplice(const bool complete) {
+    const auto onEnd = std::move(spliceSource.onEnd);
+    spliceSource = {};
+    if (onEnd)
+        onEnd(complete);
 }
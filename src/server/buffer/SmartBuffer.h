@@ -6,50 +6,127 @@
 #define SMARTBUFFER_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <cerrno>
 #include <string>
 #include <functional>
+#include <memory>
+#include <deque>
+#include <webserv.h>
 
+// Byte stream stored as a chain of fixed-size segments, spilled to an anonymous file once it gets too big.
+// Readers peek() at the buffered bytes as iovecs and consume() what they used, nothing is copied.
 class SmartBuffer {
+public:
+    static constexpr size_t SEGMENT_SIZE = 16384;
+    static constexpr size_t MAX_SPANS = 16;
+
+    // a pipe the stream continues from once everything buffered is consumed, its bytes are spliced
+    // into the socket by the reader and never copied through user space
+    struct SpliceSource {
+        int fd = -1;
+        size_t remaining = SIZE_MAX; // bytes the stream may still take from the pipe
+        std::function<void(bool complete)> onEnd; // the pipe ran dry for good or remaining reached 0
+    };
+
 private:
+    struct Span {
+        std::shared_ptr<char> segment; // SEGMENT_SIZE bytes from the BufferPool
+        size_t start;
+        size_t end;
+    };
+
     int fd = -1;
-    size_t size = 0;
+    size_t size = 0; // bytes appended (memory mode) or in the file (file mode)
     size_t maxMemorySize = 0;
     bool isFile = false;
-    std::string buffer;
-    std::string writeBuffer;
-    std::string readBuffer;
-    size_t readPos = 0;
-    size_t toRead = 0;
-    bool fdCallbackRegistered = false;
-    static size_t tmpFileCount;
-    std::string tmpFileName;
+    bool spillFailed = false; // no spill file could be opened, the buffer stays in memory
+    std::deque<Span> readable;
+    size_t readableSize = 0;
+    size_t readPos = 0; // file offset of the next byte to load into readable
+    bool streaming = false;
+    bool spliceUnsupported = false; // the file system of the spill file can not splice
+    int error = 0; // errno of the first failed spill file write or read, bytes were lost from then on
+    SpliceSource spliceSource;
+
+    // readable bytes of all buffers, checked against memoryBudget before a buffer grows in memory
+    static size_t residentBytes;
+    static size_t memoryBudget;
+    static std::string spillDirectory;
+
+    static void appendToChain(std::deque<Span> &chain, const char *data, size_t length);
+
+    static size_t collectSpans(const std::deque<Span> &chain, iovec *spans, size_t &spanCount, size_t maxBytes);
+
+    static void consumeChain(std::deque<Span> &chain, size_t length);
+
+    static int openSpillFile();
+
+    bool writeToFile(const char *data, size_t length);
+
+    bool loadFromFile(size_t wanted);
+
+    void closeFile();
+
+    // keeps the first error, the stream stays incomplete after the file is closed
+    void fail(int error);
 
 public:
-    SmartBuffer(size_t maxMemorySize = 40000);
+    SmartBuffer(size_t maxMemorySize = DEFAULT_CLIENT_BODY_BUFFER_SIZE);
 
     SmartBuffer(int fd);
 
     ~SmartBuffer();
 
-    void switchToFile();
+    static void configure(size_t memoryBudget, const std::string &spillDirectory);
 
-    bool onFileEvent(int fd, short events);
+    void switchToFile();
 
     void append(const char *data, size_t length);
 
+    // makes up to length bytes readable, file backed buffers load them from the file
     void read(size_t length);
 
-    void unregisterCallback();
+    // fills at most spanCount iovecs with readable bytes, spanCount is updated, returns the byte count
+    size_t peek(iovec *spans, size_t &spanCount, size_t maxBytes = SIZE_MAX) const;
+
+    // peek() that also hands out the segment behind each span, whoever holds one may keep using its bytes
+    // after consume(), the buffer never writes to a shared segment again
+    size_t peekShared(iovec *spans, std::shared_ptr<char> *segments, size_t &spanCount,
+                      size_t maxBytes = SIZE_MAX) const;
+
+    void consume(size_t length);
 
-    void cleanReadBuffer(size_t length);
+    // moves bytes that are still in the file straight into a pipe, 0 when there are none or splice is not
+    // available, the caller then falls back to read() and peek()
+    ssize_t spliceTo(int pipeFd, size_t maxBytes);
 
-    [[nodiscard]] std::string getReadBuffer() const { return readBuffer; }
-    [[nodiscard]] size_t getReadPos() const { return readPos; }
+    void setSpliceSource(int fd, size_t remaining, std::function<void(bool complete)> onEnd);
+
+    // detaches the pipe and tells its owner whether the stream got all its bytes
+    void endSplice(bool complete);
+
+    void clearSpliceSource() { spliceSource = {}; }
+    [[nodiscard]] bool hasSpliceSource() const { return spliceSource.fd >= 0; }
+    [[nodiscard]] SpliceSource &getSpliceSource() { return spliceSource; }
+
+    [[nodiscard]] size_t getReadableSize() const { return readableSize; }
     [[nodiscard]] size_t getSize() const { return size; }
     [[nodiscard]] bool isFileBuffer() const { return isFile; }
+    // bytes were lost in the spill file, consumers must not treat a drained buffer as the complete stream
+    [[nodiscard]] bool hasFailed() const { return error != 0; }
+    [[nodiscard]] bool isOutOfSpace() const { return error == ENOSPC || error == EDQUOT; }
     [[nodiscard]] int getFd() const { return fd; }
-    [[nodiscard]] std::string getTmpFileName() const { return tmpFileName; }
-    [[nodiscard]] bool isStillWriting() const { return !writeBuffer.empty(); }
+    // everything appended has been loaded and consumed
+    [[nodiscard]] bool isDrained() const { return readPos >= size && readableSize == 0; }
+    // appended but not yet consumed, including what still waits in the file
+    [[nodiscard]] size_t getPendingSize() const { return readableSize + (size - readPos); }
+
+    // a producer still appends, so running dry is not the end of the stream
+    void setStreaming(bool streaming) { this->streaming = streaming; }
+    [[nodiscard]] bool isStreaming() const { return streaming; }
+
+    [[nodiscard]] static size_t getResidentBytes() { return residentBytes; }
 };
 
 #endif //SMARTBUFFER_H
@@ -0,0 +1,318 @@
+#include "CgiCache.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+#include <algorithm>
+#include <webserv.h>
+#include <common/Logger.h>
+#include <server/handler/MetricHandler.h>
+
+std::unordered_map<std::string, CgiCache::Entry> CgiCache::entries;
+std::list<std::string> CgiCache::lru;
+std::unordered_map<std::string, std::vector<CgiCache::Waiter> > CgiCache::fills;
+size_t CgiCache::nextWaiterId = 0;
+size_t CgiCache::memoryLimit = DEFAULT_CGI_CACHE_MEMORY_SIZE;
+size_t CgiCache::diskLimit = DEFAULT_CGI_CACHE_DISK_SIZE;
+size_t CgiCache::memoryUsed = 0;
+size_t CgiCache::diskUsed = 0;
+std::string CgiCache::directory = TEMP_DIR_NAME;
+
+static std::string toLower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value;
+}
+
+static std::string trim(const std::string &value) {
+    const size_t start = value.find_first_not_of(" \t");
+    if (start == std::string::npos)
+        return "";
+    return value.substr(start, value.find_last_not_of(" \t") - start + 1);
+}
+
+// header names are kept as the client or script wrote them
+template<typename Map>
+static std::string findHeader(const Map &headers, const std::string &lowerName) {
+    for (const auto &[name, value]: headers) {
+        if (toLower(name) == lowerName)
+            return value;
+    }
+    return "";
+}
+
+// -1 when the directive is missing
+static long cacheControlValue(const std::string &cacheControl, const std::string &directive) {
+    size_t position = 0;
+    while ((position = cacheControl.find(directive + "=", position)) != std::string::npos) {
+        if (position == 0 || cacheControl[position - 1] == ' ' || cacheControl[position - 1] == ',')
+            return std::strtol(cacheControl.c_str() + position + directive.size() + 1, nullptr, 10);
+        position += directive.size();
+    }
+    return -1;
+}
+
+void CgiCache::configure(const size_t memoryLimit, const size_t diskLimit, const std::string &directory) {
+    CgiCache::memoryLimit = memoryLimit;
+    CgiCache::diskLimit = diskLimit;
+    CgiCache::directory = directory;
+}
+
+std::string CgiCache::keyFor(const HttpRequest &request, const ServerConfig &serverConfig,
+                             const CgiCacheConfig &config) {
+    std::string key = serverConfig.host + ":" + std::to_string(serverConfig.port) + " " +
+                      findHeader(request.headers, "host") + " " + request.uri;
+    for (const std::string &header: config.key_headers)
+        key += "\n" + header + ": " + findHeader(request.headers, header);
+    return key;
+}
+
+CgiCache::Result CgiCache::lookup(const std::string &key, const bool canFill) {
+    const std::time_t now = std::time(nullptr);
+    auto it = entries.find(key);
+    if (it != entries.end() && now >= it->second.staleUntil) {
+        erase(key);
+        it = entries.end();
+    }
+    const bool filling = fills.count(key) > 0;
+
+    if (it != entries.end()) {
+        Entry &entry = it->second;
+        lru.splice(lru.begin(), lru, entry.lruPosition);
+        if (now < entry.freshUntil) {
+            MetricHandler::incrementMetric(Metric::CGI_CACHE_HITS, 1);
+            return {Lookup::HIT, toResponse(entry, "HIT")};
+        }
+        if (filling || !canFill) {
+            MetricHandler::incrementMetric(Metric::CGI_CACHE_STALE, 1);
+            return {Lookup::STALE, toResponse(entry, "STALE")};
+        }
+    } else if (filling) {
+        MetricHandler::incrementMetric(Metric::CGI_CACHE_COLLAPSED, 1);
+        return {Lookup::WAIT, std::nullopt};
+    } else if (!canFill) {
+        return {Lookup::BYPASS, std::nullopt};
+    }
+
+    fills[key];
+    MetricHandler::incrementMetric(Metric::CGI_CACHE_MISSES, 1);
+    return {Lookup::MISS, std::nullopt};
+}
+
+size_t CgiCache::wait(const std::string &key, std::function<void(bool stored)> callback) {
+    fills[key].push_back({++nextWaiterId, std::move(callback)});
+    return nextWaiterId;
+}
+
+void CgiCache::cancelWait(const std::string &key, const size_t waiterId) {
+    const auto it = fills.find(key);
+    if (it == fills.end())
+        return;
+    auto &waiters = it->second;
+    waiters.erase(std::remove_if(waiters.begin(), waiters.end(),
+                                 [waiterId](const Waiter &waiter) { return waiter.id == waiterId; }),
+                  waiters.end());
+}
+
+HttpResponse CgiCache::toResponse(const Entry &entry, const char *cacheStatus) {
+    HttpResponse response(HttpResponse::StatusCode::OK);
+    response.setStatus(entry.status);
+    for (const auto &[name, value]: entry.headers)
+        response.setHeader(name, value);
+    response.setHeader("Age", std::to_string(std::time(nullptr) - entry.storedAt));
+    response.setHeader("X-Cache-Status", cacheStatus);
+
+    if (entry.fd < 0) {
+        response.setBody(entry.body);
+        return response;
+    }
+    // every response reads the shared file through its own descriptor
+    const int fd = fcntl(entry.fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        Logger::log(LogLevel::ERROR, "Failed to open cached CGI response: " + std::string(strerror(errno)));
+        return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR);
+    }
+    response.enableChunkedEncoding(std::make_shared<SmartBuffer>(fd));
+    return response;
+}
+
+// false when the response must not be cached
+bool CgiCache::computeLifetime(const int status, const std::map<std::string, std::string> &headers,
+                               const std::vector<std::string> &setCookies, const CgiCacheConfig &config,
+                               const std::time_t now, std::time_t &freshUntil, std::time_t &staleUntil) {
+    static const int cacheableStatuses[] = {200, 203, 204, 301, 404, 410};
+    if (!setCookies.empty() ||
+        std::find(std::begin(cacheableStatuses), std::end(cacheableStatuses), status) == std::end(cacheableStatuses))
+        return false;
+
+    const std::string cacheControl = toLower(findHeader(headers, "cache-control"));
+    if (cacheControl.find("no-store") != std::string::npos || cacheControl.find("no-cache") != std::string::npos ||
+        cacheControl.find("private") != std::string::npos)
+        return false;
+
+    long valid = static_cast<long>(config.valid);
+    long stale = static_cast<long>(config.stale);
+    if (const long sharedMaxAge = cacheControlValue(cacheControl, "s-maxage"); sharedMaxAge >= 0)
+        valid = sharedMaxAge;
+    else if (const long maxAge = cacheControlValue(cacheControl, "max-age"); maxAge >= 0)
+        valid = maxAge;
+    else if (const std::string expires = findHeader(headers, "expires"); !expires.empty()) {
+        // an Expires that can not be parsed means already expired
+        std::tm time{};
+        const char *end = strptime(expires.c_str(), "%a, %d %b %Y %H:%M:%S", &time);
+        valid = end ? static_cast<long>(timegm(&time) - now) : 0;
+    }
+    if (const long staleWhileRevalidate = cacheControlValue(cacheControl, "stale-while-revalidate");
+        staleWhileRevalidate >= 0)
+        stale = staleWhileRevalidate;
+    if (valid <= 0)
+        return false;
+
+    // the key only tells requests apart by the configured headers
+    std::string vary = findHeader(headers, "vary");
+    size_t start = 0;
+    while (start < vary.size()) {
+        size_t end = vary.find(',', start);
+        if (end == std::string::npos)
+            end = vary.size();
+        const std::string header = toLower(trim(vary.substr(start, end - start)));
+        if (header == "*" || (!header.empty() &&
+                              std::find(config.key_headers.begin(), config.key_headers.end(), header) ==
+                              config.key_headers.end()))
+            return false;
+        start = end + 1;
+    }
+
+    freshUntil = now + valid;
+    staleUntil = freshUntil + std::max(stale, 0L);
+    return true;
+}
+
+bool CgiCache::writeBody(Entry &entry, const std::string &body) {
+    int fd = -1;
+#ifdef O_TMPFILE
+    fd = open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+    if (fd < 0) {
+        std::string path = directory + "/cgicache_XXXXXX";
+        fd = mkstemp(path.data());
+        if (fd >= 0) {
+            unlink(path.c_str());
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+    if (fd < 0) {
+        Logger::log(LogLevel::ERROR, "Failed to create CGI cache file in " + directory + ": " + strerror(errno));
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < body.size()) {
+        const ssize_t result = pwrite(fd, body.data() + written, body.size() - written, static_cast<off_t>(written));
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0) {
+            Logger::log(LogLevel::ERROR, "Failed to write CGI cache file: " + std::string(strerror(errno)));
+            close(fd);
+            return false;
+        }
+        written += result;
+    }
+    entry.fd = fd;
+    return true;
+}
+
+// evicts the least recently used entries stored the same way until size fits
+bool CgiCache::makeRoom(const bool onDisk, const size_t size) {
+    const size_t limit = onDisk ? diskLimit : memoryLimit;
+    const size_t &used = onDisk ? diskUsed : memoryUsed;
+    if (size > limit)
+        return false;
+
+    auto it = lru.end();
+    while (used + size > limit && it != lru.begin()) {
+        --it;
+        if ((entries.at(*it).fd >= 0) != onDisk)
+            continue;
+        const std::string victim = *it;
+        ++it;
+        erase(victim);
+        MetricHandler::incrementMetric(Metric::CGI_CACHE_EVICTIONS, 1);
+    }
+    return used + size <= limit;
+}
+
+bool CgiCache::store(const std::string &key, const CgiCacheConfig &config,
+                     const std::map<std::string, std::string> &headers, const std::vector<std::string> &setCookies,
+                     const std::string &body) {
+    // whatever was cached is outdated now, even if the new response can not be stored
+    erase(key);
+
+    Entry entry;
+    entry.status = HttpResponse::StatusCode::OK;
+    size_t headerSize = 0;
+    for (const auto &[name, value]: headers) {
+        if (name == "Status") {
+            entry.status = std::atoi(value.substr(0, 3).c_str());
+            continue;
+        }
+        entry.headers[name] = value;
+        headerSize += name.size() + value.size();
+    }
+
+    entry.storedAt = std::time(nullptr);
+    const bool onDisk = body.size() > CGI_CACHE_MEMORY_ENTRY_LIMIT;
+    entry.accountedSize = onDisk ? body.size() : body.size() + headerSize;
+    if (!computeLifetime(entry.status, headers, setCookies, config, entry.storedAt, entry.freshUntil,
+                         entry.staleUntil) || !makeRoom(onDisk, entry.accountedSize) ||
+        (onDisk && !writeBody(entry, body))) {
+        finishFill(key, false);
+        return false;
+    }
+
+    if (!onDisk)
+        entry.body = body;
+    entry.bodySize = body.size();
+    (onDisk ? diskUsed : memoryUsed) += entry.accountedSize;
+    lru.push_front(key);
+    entry.lruPosition = lru.begin();
+    entries.emplace(key, std::move(entry));
+    MetricHandler::incrementMetric(Metric::CGI_CACHE_STORES, 1);
+    Logger::log(LogLevel::DEBUG, "Cached CGI response for " + key.substr(0, key.find('\n')));
+
+    finishFill(key, true);
+    return true;
+}
+
+void CgiCache::abandon(const std::string &key) {
+    finishFill(key, false);
+}
+
+void CgiCache::finishFill(const std::string &key, const bool stored) {
+    const auto it = fills.find(key);
+    if (it == fills.end())
+        return;
+    const std::vector<Waiter> waiters = std::move(it->second);
+    fills.erase(it);
+    for (const Waiter &waiter: waiters)
+        waiter.callback(stored);
+}
+
+void CgiCache::erase(const std::string &key) {
+    const auto it = entries.find(key);
+    if (it == entries.end())
+        return;
+    Entry &entry = it->second;
+    if (entry.fd >= 0) {
+        close(entry.fd);
+        diskUsed -= entry.accountedSize;
+    } else
+        memoryUsed -= entry.accountedSize;
+    lru.erase(entry.lruPosition);
+    entries.erase(it);
+}
+
+void CgiCache::cleanUp() {
+    while (!lru.empty())
+        erase(lru.back());
+    fills.clear();
+}
@@ -0,0 +1,108 @@
+#ifndef CGICACHE_H
+#define CGICACHE_H
+
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+#include <ctime>
+#include <config/config.h>
+#include <parser/http/HttpRequest.h>
+#include <server/response/HttpResponse.h>
+
+// Complete cgi responses of cgi_cache locations, keyed by server, path, query and the configured request headers.
+// Small bodies stay in memory, bigger ones in unlinked files, both bounded and evicted least recently used first.
+// Only one request per key runs the script, the others wait for its result or get the stale copy meanwhile.
+class CgiCache {
+public:
+    enum class Lookup {
+        HIT, // fresh copy in the response
+        STALE, // expired copy in the response, another request is refreshing it
+        MISS, // the caller runs the script and has to store or abandon the result
+        WAIT, // another request is running the script, the caller waits for it
+        BYPASS // nothing cached, the caller runs the script without storing
+    };
+
+    struct Result {
+        Lookup lookup;
+        std::optional<HttpResponse> response;
+    };
+
+private:
+    struct Entry {
+        int status;
+        std::map<std::string, std::string> headers;
+        std::string body; // memory entries
+        int fd = -1; // disk entries
+        size_t bodySize = 0;
+        size_t accountedSize = 0;
+        std::time_t storedAt;
+        std::time_t freshUntil;
+        std::time_t staleUntil;
+        std::list<std::string>::iterator lruPosition;
+    };
+
+    struct Waiter {
+        size_t id;
+        std::function<void(bool stored)> callback;
+    };
+
+    static std::unordered_map<std::string, Entry> entries;
+    static std::list<std::string> lru; // most recently used first
+    // keys whose script is running, with the requests waiting for it
+    static std::unordered_map<std::string, std::vector<Waiter> > fills;
+    static size_t nextWaiterId;
+    static size_t memoryLimit;
+    static size_t diskLimit;
+    static size_t memoryUsed;
+    static size_t diskUsed;
+    static std::string directory;
+
+    static HttpResponse toResponse(const Entry &entry, const char *cacheStatus);
+
+    static bool computeLifetime(int status, const std::map<std::string, std::string> &headers,
+                                const std::vector<std::string> &setCookies, const CgiCacheConfig &config,
+                                std::time_t now, std::time_t &freshUntil, std::time_t &staleUntil);
+
+    static bool writeBody(Entry &entry, const std::string &body);
+
+    static bool makeRoom(bool onDisk, size_t size);
+
+    static void erase(const std::string &key);
+
+    static void finishFill(const std::string &key, bool stored);
+
+public:
+    static void configure(size_t memoryLimit, size_t diskLimit, const std::string &directory);
+
+    [[nodiscard]] static std::string keyFor(const HttpRequest &request, const ServerConfig &serverConfig,
+                                            const CgiCacheConfig &config);
+
+    // a MISS makes the caller the only request running the script for this key
+    static Result lookup(const std::string &key, bool canFill);
+
+    // the callback runs once the running request stored or abandoned its result, returns the id for cancelWait
+    static size_t wait(const std::string &key, std::function<void(bool stored)> callback);
+
+    static void cancelWait(const std::string &key, size_t waiterId);
+
+    // stores the script's output if its headers allow it and releases the waiting requests
+    static bool store(const std::string &key, const CgiCacheConfig &config,
+                      const std::map<std::string, std::string> &headers, const std::vector<std::string> &setCookies,
+                      const std::string &body);
+
+    // the script failed or its output can not be cached, the waiting requests run it themselves
+    static void abandon(const std::string &key);
+
+    [[nodiscard]] static size_t getEntryCount() { return entries.size(); }
+    [[nodiscard]] static size_t getMemoryUsed() { return memoryUsed; }
+    [[nodiscard]] static size_t getDiskUsed() { return diskUsed; }
+
+    static void cleanUp();
+};
+
+
+#endif //CGICACHE_H
@@ -0,0 +1,96 @@
+#include "CgiLimiter.h"
+
+#include <algorithm>
+#include <common/Logger.h>
+#include <server/handler/MetricHandler.h>
+
+std::unordered_map<const RouteConfig *, CgiLimiter::Limiter> CgiLimiter::limiters;
+size_t CgiLimiter::nextTicket = 0;
+
+CgiLimiter::Admission CgiLimiter::admit(const RouteConfig *route, std::function<void(bool admitted)> callback,
+                                        size_t &ticket) {
+    Limiter &limiter = limiters[route];
+    limiter.config = route->cgi_limit;
+
+    const size_t max = limiter.config.max_concurrency;
+    if (max == 0 || (limiter.active < max && limiter.queue.empty())) {
+        limiter.active++;
+        return Admission::RUN;
+    }
+    if (limiter.queue.size() >= limiter.config.queue_length) {
+        Logger::log(LogLevel::WARNING, "CGI queue of " + route->location + " is full, rejecting request");
+        MetricHandler::incrementMetric(Metric::CGI_REJECTED, 1);
+        return Admission::REJECTED;
+    }
+
+    ticket = ++nextTicket;
+    limiter.queue.push_back({ticket, std::chrono::steady_clock::now(), std::move(callback)});
+    MetricHandler::incrementMetric(Metric::CGI_QUEUED_TOTAL, 1);
+    return Admission::QUEUED;
+}
+
+// a callback may release its slot right away, so the queue is re-checked after each one
+void CgiLimiter::admitWaiting(Limiter &limiter) {
+    const size_t max = limiter.config.max_concurrency;
+    while (!limiter.queue.empty() && (max == 0 || limiter.active < max)) {
+        Waiter waiter = std::move(limiter.queue.front());
+        limiter.queue.pop_front();
+        limiter.active++;
+        const auto waited = std::chrono::steady_clock::now() - waiter.enqueued;
+        MetricHandler::incrementMetric(Metric::CGI_QUEUE_WAIT_US,
+                                       std::chrono::duration_cast<std::chrono::microseconds>(waited).count());
+        waiter.callback(true);
+    }
+}
+
+void CgiLimiter::release(const RouteConfig *route) {
+    const auto it = limiters.find(route);
+    if (it == limiters.end())
+        return;
+    Limiter &limiter = it->second;
+    if (limiter.active > 0)
+        limiter.active--;
+    admitWaiting(limiter);
+}
+
+void CgiLimiter::cancel(const RouteConfig *route, const size_t ticket) {
+    const auto it = limiters.find(route);
+    if (it == limiters.end())
+        return;
+    auto &queue = it->second.queue;
+    queue.erase(std::remove_if(queue.begin(), queue.end(),
+                               [ticket](const Waiter &waiter) { return waiter.ticket == ticket; }), queue.end());
+}
+
+void CgiLimiter::expireWaiting() {
+    const auto now = std::chrono::steady_clock::now();
+    for (auto &[route, limiter]: limiters) {
+        const auto timeout = std::chrono::seconds(limiter.config.queue_timeout);
+        // the queue is in arrival order, only its head can be the oldest
+        while (!limiter.queue.empty() && now - limiter.queue.front().enqueued >= timeout) {
+            Waiter waiter = std::move(limiter.queue.front());
+            limiter.queue.pop_front();
+            MetricHandler::incrementMetric(Metric::CGI_REJECTED, 1);
+            MetricHandler::incrementMetric(Metric::CGI_QUEUE_TIMEOUTS, 1);
+            waiter.callback(false);
+        }
+    }
+}
+
+size_t CgiLimiter::getActiveCount() {
+    size_t count = 0;
+    for (const auto &[route, limiter]: limiters)
+        count += limiter.active;
+    return count;
+}
+
+size_t CgiLimiter::getQueuedCount() {
+    size_t count = 0;
+    for (const auto &[route, limiter]: limiters)
+        count += limiter.queue.size();
+    return count;
+}
+
+void CgiLimiter::cleanUp() {
+    limiters.clear();
+}
@@ -0,0 +1,59 @@
+#ifndef CGILIMITER_H
+#define CGILIMITER_H
+
+#include <deque>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <config/config.h>
+
+// Bounds the scripts running per location. Requests over the limit wait in a FIFO queue,
+// a full queue or a wait longer than queue_timeout sheds them with a 503.
+class CgiLimiter {
+public:
+    enum class Admission {
+        RUN, // the caller holds a slot until it calls release
+        QUEUED, // the callback runs once a slot is free or the wait timed out
+        REJECTED
+    };
+
+private:
+    struct Waiter {
+        size_t ticket;
+        std::chrono::steady_clock::time_point enqueued;
+        std::function<void(bool admitted)> callback;
+    };
+
+    struct Limiter {
+        CgiLimitConfig config;
+        size_t active = 0;
+        std::deque<Waiter> queue;
+    };
+
+    // routes live as long as their server config, which outlives every request
+    static std::unordered_map<const RouteConfig *, Limiter> limiters;
+    static size_t nextTicket;
+
+    static void admitWaiting(Limiter &limiter);
+
+public:
+    // on QUEUED the ticket identifies the waiting request for cancel
+    static Admission admit(const RouteConfig *route, std::function<void(bool admitted)> callback, size_t &ticket);
+
+    // the script of a request that got a slot finished
+    static void release(const RouteConfig *route);
+
+    static void cancel(const RouteConfig *route, size_t ticket);
+
+    // sheds requests that waited longer than queue_timeout, called once per loop
+    static void expireWaiting();
+
+    [[nodiscard]] static size_t getActiveCount();
+
+    [[nodiscard]] static size_t getQueuedCount();
+
+    static void cleanUp();
+};
+
+
+#endif //CGILIMITER_H
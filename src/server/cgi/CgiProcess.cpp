@@ -0,0 +1,149 @@
+#include "CgiProcess.h"
+
+#include <spawn.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <common/Logger.h>
+#include <server/FdHandler.h>
+#include <server/handler/MetricHandler.h>
+
+std::unordered_set<pid_t> CgiProcess::running;
+std::vector<pid_t> CgiProcess::polled;
+std::unordered_map<pid_t, CgiProcess::ExitCallback> CgiProcess::exitCallbacks;
+std::array<std::pair<pid_t, int>, 64> CgiProcess::recentExits{};
+size_t CgiProcess::nextRecentExit = 0;
+
+pid_t CgiProcess::spawn(const SpawnOptions &options) {
+    std::vector<char *> argv;
+    for (const std::string &argument: options.arguments)
+        argv.push_back(const_cast<char *>(argument.c_str()));
+    argv.push_back(nullptr);
+
+    std::vector<char *> envp;
+    for (const std::string &variable: options.environment)
+        envp.push_back(const_cast<char *>(variable.c_str()));
+    envp.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (options.stdinFd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, options.stdinFd, STDIN_FILENO);
+    if (options.stdoutFd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, options.stdoutFd, STDOUT_FILENO);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 34)
+    // listening and client sockets are not close-on-exec
+    posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+#endif
+    if (!options.workingDirectory.empty()) {
+        // in the server's directory the relative paths of the script would point somewhere else
+#if defined(__APPLE__) || (defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 29))
+        const int chdirError = posix_spawn_file_actions_addchdir_np(&actions, options.workingDirectory.c_str());
+#else
+        const int chdirError = ENOSYS;
+#endif
+        if (chdirError != 0) {
+            Logger::log(LogLevel::ERROR, "Failed to start " + options.path + " in " + options.workingDirectory + ": " +
+                                         strerror(chdirError));
+            posix_spawn_file_actions_destroy(&actions);
+            return -1;
+        }
+    }
+
+    // we ignore SIGPIPE, the script should not inherit that
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t defaultSignals;
+    sigemptyset(&defaultSignals);
+    sigaddset(&defaultSignals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &defaultSignals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+
+    const auto start = std::chrono::steady_clock::now();
+    pid_t pid = -1;
+    const int error = posix_spawn(&pid, options.path.c_str(), &actions, &attributes, argv.data(), envp.data());
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    if (error != 0) {
+        Logger::log(LogLevel::ERROR, "Failed to start " + options.path + ": " + strerror(error));
+        return -1;
+    }
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    MetricHandler::incrementMetric(Metric::CGI_PROCESSES_SPAWNED, 1);
+    MetricHandler::incrementMetric(Metric::CGI_SPAWN_TIME_US,
+                                   std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    watch(pid);
+    return pid;
+}
+
+void CgiProcess::watch(const pid_t pid) {
+    running.insert(pid);
+#ifdef SYS_pidfd_open
+    // pidfds are always close-on-exec
+    if (const int pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0)); pidfd >= 0) {
+        FdHandler::addFd(pidfd, POLLIN, [pid](const int fd, const short events) {
+            (void) events;
+            reap(pid);
+            close(fd);
+            return true;
+        });
+        return;
+    }
+#endif
+    polled.push_back(pid);
+}
+
+bool CgiProcess::reap(const pid_t pid) {
+    int status = 0;
+    if (waitpid(pid, &status, WNOHANG) <= 0)
+        return false;
+    running.erase(pid);
+    recentExits[nextRecentExit] = {pid, status};
+    nextRecentExit = (nextRecentExit + 1) % recentExits.size();
+    if (const auto callback = exitCallbacks.find(pid); callback != exitCallbacks.end()) {
+        const ExitCallback onExit = std::move(callback->second);
+        exitCallbacks.erase(callback);
+        onExit(status);
+    }
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+        Logger::log(LogLevel::WARNING, "Process " + std::to_string(pid) + " exited with code " +
+                                       std::to_string(WEXITSTATUS(status)));
+    else if (WIFSIGNALED(status))
+        Logger::log(LogLevel::DEBUG, "Process " + std::to_string(pid) + " was killed by signal " +
+                                     std::to_string(WTERMSIG(status)));
+    return true;
+}
+
+void CgiProcess::terminate(const pid_t pid) {
+    if (isRunning(pid))
+        kill(pid, SIGTERM);
+}
+
+bool CgiProcess::onExit(const pid_t pid, ExitCallback callback) {
+    if (isRunning(pid)) {
+        exitCallbacks[pid] = std::move(callback);
+        return true;
+    }
+    for (const auto &[exitedPid, status]: recentExits) {
+        if (exitedPid == pid) {
+            callback(status);
+            return true;
+        }
+    }
+    return false;
+}
+
+void CgiProcess::reapExited() {
+    if (polled.empty())
+        return;
+    polled.erase(std::remove_if(polled.begin(), polled.end(), reap), polled.end());
+}
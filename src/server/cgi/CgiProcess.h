@@ -0,0 +1,60 @@
+#ifndef CGIPROCESS_H
+#define CGIPROCESS_H
+
+#include <array>
+#include <functional>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/types.h>
+
+// Starts cgi interpreters with posix_spawn and reaps them when their pidfd turns readable in the event loop.
+// posix_spawn shares the parent's address space until exec, so starting a process does not copy our page tables.
+class CgiProcess {
+public:
+    struct SpawnOptions {
+        std::string path;
+        std::vector<std::string> arguments; // including argv[0]
+        std::vector<std::string> environment; // NAME=value
+        std::string workingDirectory; // empty keeps ours
+        int stdinFd; // -1 keeps ours
+        int stdoutFd; // -1 keeps ours
+    };
+
+private:
+    static std::unordered_set<pid_t> running;
+    // processes without a pidfd, waited for once per loop
+    static std::vector<pid_t> polled;
+
+    typedef std::function<void(int status)> ExitCallback;
+    static std::unordered_map<pid_t, ExitCallback> exitCallbacks;
+    // waitpid statuses of the last reaped processes, the oldest one is overwritten first
+    static std::array<std::pair<pid_t, int>, 64> recentExits;
+    static size_t nextRecentExit;
+
+    static void watch(pid_t pid);
+
+    static bool reap(pid_t pid);
+
+public:
+    // returns -1 when the process could not be started, a started process is reaped once it exits
+    static pid_t spawn(const SpawnOptions &options);
+
+    // SIGTERM for a process that was not reaped yet, so the pid can not belong to someone else
+    static void terminate(pid_t pid);
+
+    [[nodiscard]] static bool isRunning(pid_t pid) { return running.count(pid) > 0; }
+
+    // calls back with the waitpid status once the process is reaped, right away when it was reaped recently,
+    // false when the process is unknown
+    static bool onExit(pid_t pid, ExitCallback callback);
+
+    // only has work on systems without pidfd_open
+    static void reapExited();
+
+    [[nodiscard]] static size_t getRunningCount() { return running.size(); }
+};
+
+
+#endif //CGIPROCESS_H
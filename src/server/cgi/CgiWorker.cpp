@@ -0,0 +1,285 @@
+#include "CgiWorker.h"
+#include "CgiWorkerPool.h"
+#include "CgiProcess.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+#include <sys/socket.h>
+#include <webserv.h>
+#include <common/Logger.h>
+#include <server/FdHandler.h>
+#include <server/buffer/BufferPool.h>
+#include <server/handler/MetricHandler.h>
+
+CgiWorker::CgiWorker(std::string poolKey, const pid_t pid, const int fd) : poolKey(std::move(poolKey)), pid(pid),
+                                                                           fd(fd), outgoing(SIZE_MAX) {
+}
+
+CgiWorker::~CgiWorker() {
+    if (fd >= 0)
+        ::close(fd);
+}
+
+std::shared_ptr<CgiWorker> CgiWorker::spawn(const std::string &poolKey, const std::string &interpreter,
+                                            const std::string &adapter) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0) {
+        Logger::log(LogLevel::ERROR, "Failed to create CGI worker socket: " + std::string(strerror(errno)));
+        return nullptr;
+    }
+
+    const std::string adapterPath = std::filesystem::absolute(adapter).lexically_normal().string();
+    const char *path = std::getenv("PATH");
+    CgiProcess::SpawnOptions options{
+        interpreter, {interpreter, adapterPath},
+        {"PATH=" + std::string(path ? path : "/usr/local/bin:/usr/bin:/bin")}, "", sockets[1], -1
+    };
+    const pid_t pid = CgiProcess::spawn(options);
+    if (pid < 0) {
+        ::close(sockets[0]);
+        ::close(sockets[1]);
+        return nullptr;
+    }
+
+    ::close(sockets[1]);
+    fcntl(sockets[0], F_SETFL, O_NONBLOCK);
+    Logger::log(LogLevel::DEBUG, "CGI worker started with PID: " + std::to_string(pid));
+
+    auto worker = std::make_shared<CgiWorker>(poolKey, pid, sockets[0]);
+    // the registration keeps the worker alive until its socket is closed
+    FdHandler::addFd(worker->fd, POLLIN, [worker](const int fd, const short events) {
+        (void) fd;
+        return worker->onEvent(events);
+    });
+    return worker;
+}
+
+void CgiWorker::begin(const std::unordered_map<std::string, std::string> &env, std::shared_ptr<SmartBuffer> body,
+                      const size_t bodySize, Callbacks callbacks) {
+    this->callbacks = std::move(callbacks);
+    stdinBody = std::move(body);
+    stdinRemaining = stdinBody ? bodySize : 0;
+    chunkRemaining = 0;
+    line.clear();
+    requestStart = std::chrono::steady_clock::now();
+
+    std::string head = "REQUEST " + std::to_string(env.size()) + " " + std::to_string(stdinRemaining) + "\n";
+    for (const auto &[name, value]: env) {
+        std::string variable = name + "=" + value;
+        std::replace(variable.begin(), variable.end(), '\n', ' ');
+        head += variable + "\n";
+    }
+    outgoing.append(head.data(), head.size());
+
+    state = State::ACTIVE;
+    updateEvents();
+}
+
+void CgiWorker::updateEvents() {
+    if (state == State::CLOSED)
+        return;
+    const bool wantsWrite = state == State::ACTIVE && (!outgoing.isDrained() || stdinRemaining > 0);
+    const short events = wantsWrite ? POLLIN | POLLOUT : POLLIN;
+    if (events != polledEvents) {
+        FdHandler::setEvents(fd, events);
+        polledEvents = events;
+    }
+}
+
+void CgiWorker::abort() {
+    callbacks = {};
+    if (state == State::CLOSED)
+        return;
+    if (state == State::ACTIVE)
+        CgiProcess::terminate(pid);
+    aborted = true;
+    FdHandler::removeFd(fd);
+    close();
+}
+
+void CgiWorker::close() {
+    if (state == State::CLOSED)
+        return;
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    state = State::CLOSED;
+    CgiWorkerPool::remove(*this);
+}
+
+void CgiWorker::fail(const std::string &reason) {
+    Logger::log(LogLevel::ERROR, "CGI worker " + std::to_string(pid) + ": " + reason);
+    const bool requestPending = state == State::ACTIVE;
+    // the stream can not be resynchronised, a worker that is still running would answer the wrong request
+    CgiProcess::terminate(pid);
+    close();
+    if (requestPending)
+        finishRequest(false);
+}
+
+bool CgiWorker::onEvent(const short events) {
+    if (state == State::CLOSED)
+        return true;
+
+    if (events & POLLERR) {
+        fail("socket error");
+        return true;
+    }
+
+    if (events & (POLLIN | POLLHUP) && !readIncoming())
+        return true;
+
+    if (state == State::ACTIVE && events & POLLOUT && !flushOutgoing())
+        return true;
+    updateEvents();
+    return state == State::CLOSED;
+}
+
+// sends the request head first, then the body straight from the request's buffer
+bool CgiWorker::flushOutgoing() {
+    SmartBuffer *source = &outgoing;
+    size_t limit = SEND_CHUNK_SIZE;
+    if (outgoing.isDrained()) {
+        if (stdinRemaining == 0)
+            return true;
+        source = stdinBody.get();
+        limit = std::min(limit, stdinRemaining);
+    }
+
+    source->read(limit);
+    if (source != &outgoing && source->hasFailed()) {
+        fail("request body was lost");
+        return false;
+    }
+    iovec spans[SmartBuffer::MAX_SPANS];
+    size_t spanCount = SmartBuffer::MAX_SPANS;
+    if (source->peek(spans, spanCount, limit) == 0) {
+        if (source != &outgoing) {
+            Logger::log(LogLevel::WARNING, "CGI worker " + std::to_string(pid) + ": request body ended early");
+            stdinRemaining = 0;
+        }
+        return true;
+    }
+
+    msghdr message{};
+    message.msg_iov = spans;
+    message.msg_iovlen = spanCount;
+    const ssize_t bytesSent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    if (bytesSent <= 0) {
+        fail("write failed");
+        return false;
+    }
+    source->consume(bytesSent);
+    if (source != &outgoing)
+        stdinRemaining -= bytesSent;
+    return true;
+}
+
+bool CgiWorker::readIncoming() {
+    const BufferPool::Block block(READ_BUFFER_SIZE);
+    const ssize_t bytesRead = read(fd, block.data(), block.size());
+    if (bytesRead < 0)
+        return true;
+
+    if (bytesRead == 0) {
+        if (state == State::ACTIVE)
+            fail("exited during a request");
+        else {
+            Logger::log(LogLevel::DEBUG, "CGI worker " + std::to_string(pid) + " exited");
+            close();
+        }
+        return false;
+    }
+
+    processIncoming(block.data(), bytesRead);
+    return state != State::CLOSED;
+}
+
+bool CgiWorker::processIncoming(const char *data, size_t length) {
+    while (length > 0) {
+        if (chunkRemaining > 0) {
+            const size_t chunkLength = std::min(length, chunkRemaining);
+            if (callbacks.onStdout)
+                callbacks.onStdout(data, chunkLength);
+            data += chunkLength;
+            length -= chunkLength;
+            chunkRemaining -= chunkLength;
+            continue;
+        }
+
+        if (state != State::ACTIVE) {
+            fail("unexpected output outside of a request");
+            return false;
+        }
+
+        const auto *newline = static_cast<const char *>(std::memchr(data, '\n', length));
+        const size_t lineLength = newline ? newline - data : length;
+        line.append(data, lineLength);
+        if (line.size() > MAX_LINE_LENGTH) {
+            fail("protocol line too long");
+            return false;
+        }
+        if (!newline)
+            return true;
+        data += lineLength + 1;
+        length -= lineLength + 1;
+        if (!processLine())
+            return false;
+    }
+    return true;
+}
+
+bool CgiWorker::processLine() {
+    std::istringstream stream(line);
+    std::string command;
+    long long value = -1;
+    stream >> command >> value;
+
+    if (command == "CHUNK" && value > 0) {
+        line.clear();
+        chunkRemaining = value;
+        return true;
+    }
+
+    if (command == "DONE" && !stream.fail()) {
+        line.clear();
+        // the adapter reads the whole body before it ends a request
+        if (stdinRemaining > 0 || !outgoing.isDrained()) {
+            fail("request ended before its body was sent");
+            return false;
+        }
+        if (value != 0)
+            Logger::log(LogLevel::WARNING, "CGI script exited with status " + std::to_string(value));
+        finishRequest(true);
+        return state != State::CLOSED;
+    }
+
+    fail("invalid protocol line: " + line);
+    return false;
+}
+
+void CgiWorker::finishRequest(const bool success) {
+    const auto elapsed = std::chrono::steady_clock::now() - requestStart;
+    MetricHandler::incrementMetric(Metric::CGI_WORKER_REQUESTS, 1);
+    MetricHandler::incrementMetric(Metric::CGI_WORKER_TIME_US,
+                                   std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    if (!success)
+        MetricHandler::incrementMetric(Metric::CGI_WORKER_ERRORS, 1);
+
+    stdinBody.reset();
+    const auto onComplete = std::move(callbacks.onComplete);
+    callbacks = {};
+
+    if (success) {
+        requestsServed++;
+        state = State::IDLE;
+        CgiWorkerPool::release(shared_from_this());
+    }
+    if (onComplete)
+        onComplete(success);
+}
@@ -0,0 +1,99 @@
+#ifndef CGIWORKER_H
+#define CGIWORKER_H
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <chrono>
+#include <poll.h>
+#include <sys/types.h>
+#include <server/buffer/SmartBuffer.h>
+
+// A long-lived interpreter process running a worker adapter, connected through a socketpair on its stdin.
+// Requests are framed with a small line protocol:
+//   server -> worker: "REQUEST <env count> <body length>\n", one "NAME=value\n" line per variable, the body
+//   worker -> server: "CHUNK <length>\n" followed by that many bytes of cgi output, then "DONE <exit status>\n"
+class CgiWorker : public std::enable_shared_from_this<CgiWorker> {
+public:
+    struct Callbacks {
+        std::function<void(const char *data, size_t length)> onStdout;
+        // false when the worker died or broke the protocol before finishing the request
+        std::function<void(bool success)> onComplete;
+    };
+
+    enum class State {
+        IDLE,
+        ACTIVE,
+        CLOSED
+    };
+
+private:
+    static constexpr size_t MAX_LINE_LENGTH = 64;
+
+    std::string poolKey;
+    pid_t pid = -1;
+    int fd = -1;
+    State state = State::IDLE;
+    short polledEvents = POLLIN;
+    size_t requestsServed = 0;
+    bool aborted = false;
+
+    SmartBuffer outgoing;
+    std::string line;
+    size_t chunkRemaining = 0;
+
+    std::shared_ptr<SmartBuffer> stdinBody;
+    size_t stdinRemaining = 0;
+
+    Callbacks callbacks;
+    std::chrono::steady_clock::time_point requestStart;
+
+    bool onEvent(short events);
+
+    bool flushOutgoing();
+
+    bool readIncoming();
+
+    bool processIncoming(const char *data, size_t length);
+
+    bool processLine();
+
+    void finishRequest(bool success);
+
+    void fail(const std::string &reason);
+
+    void updateEvents();
+
+public:
+    CgiWorker(std::string poolKey, pid_t pid, int fd);
+
+    ~CgiWorker();
+
+    CgiWorker(const CgiWorker &) = delete;
+
+    CgiWorker &operator=(const CgiWorker &) = delete;
+
+    // starts the interpreter running the adapter and registers the worker socket, returns nullptr on failure
+    static std::shared_ptr<CgiWorker> spawn(const std::string &poolKey, const std::string &interpreter,
+                                            const std::string &adapter);
+
+    void begin(const std::unordered_map<std::string, std::string> &env, std::shared_ptr<SmartBuffer> body,
+               size_t bodySize, Callbacks callbacks);
+
+    // drops the running request and kills the process, its output can not be told apart from the next request's
+    void abort();
+
+    // closes the socket, the adapter exits once it reads the end of its input
+    void close();
+
+    [[nodiscard]] bool isIdle() const { return state == State::IDLE; }
+    [[nodiscard]] bool isClosed() const { return state == State::CLOSED; }
+    [[nodiscard]] size_t getRequestsServed() const { return requestsServed; }
+    [[nodiscard]] bool wasAborted() const { return aborted; }
+    [[nodiscard]] const std::string &getPoolKey() const { return poolKey; }
+    [[nodiscard]] pid_t getPid() const { return pid; }
+};
+
+
+#endif //CGIWORKER_H
@@ -0,0 +1,147 @@
+#include "CgiWorkerPool.h"
+
+#include <algorithm>
+#include <webserv.h>
+#include <common/Logger.h>
+#include <server/handler/MetricHandler.h>
+
+std::unordered_map<std::string, CgiWorkerPool::Pool> CgiWorkerPool::pools;
+
+std::string CgiWorkerPool::keyFor(const std::string &interpreter, const CgiWorkerConfig &config) {
+    return interpreter + " " + config.adapter + " " + std::to_string(config.min_workers) + " " +
+           std::to_string(config.max_workers) + " " + std::to_string(config.max_requests);
+}
+
+CgiWorkerPool::Pool &CgiWorkerPool::getPool(const std::string &interpreter, const CgiWorkerConfig &config) {
+    const std::string key = keyFor(interpreter, config);
+    auto it = pools.find(key);
+    if (it == pools.end())
+        it = pools.emplace(key, Pool{interpreter, config, {}, false, 0, 0}).first;
+    return it->second;
+}
+
+bool CgiWorkerPool::retry(const std::string &key, Pool &pool) {
+    if (!pool.broken || std::time(nullptr) < pool.retryAt)
+        return false;
+    Logger::log(LogLevel::INFO, "Retrying CGI workers for " + key);
+    pool.broken = false;
+    replenish(key, pool);
+    if (pool.workers.empty())
+        (void) spawn(key, pool);
+    return true;
+}
+
+std::shared_ptr<CgiWorker> CgiWorkerPool::spawn(const std::string &key, Pool &pool) {
+    auto worker = CgiWorker::spawn(key, pool.interpreter, pool.config.adapter);
+    if (!worker)
+        return nullptr;
+    MetricHandler::incrementMetric(Metric::CGI_WORKER_SPAWNED, 1);
+    pool.workers.push_back(worker);
+    return worker;
+}
+
+void CgiWorkerPool::replenish(const std::string &key, Pool &pool) {
+    while (!pool.broken && pool.workers.size() < pool.config.min_workers) {
+        if (!spawn(key, pool))
+            return;
+    }
+}
+
+void CgiWorkerPool::configure(const std::string &interpreter, const CgiWorkerConfig &config) {
+    const std::string key = keyFor(interpreter, config);
+    if (pools.count(key))
+        return;
+
+    Pool &pool = getPool(interpreter, config);
+    replenish(key, pool);
+    Logger::log(LogLevel::INFO, "Started " + std::to_string(pool.workers.size()) + " CGI workers for " + key);
+}
+
+std::shared_ptr<CgiWorker> CgiWorkerPool::acquire(const std::string &interpreter, const CgiWorkerConfig &config) {
+    const std::string key = keyFor(interpreter, config);
+    Pool &pool = getPool(interpreter, config);
+    // the request that triggers a retry does not bet on the new workers, it runs in a process of its own
+    if (retry(key, pool))
+        return nullptr;
+    for (const auto &worker: pool.workers) {
+        if (worker->isIdle())
+            return worker;
+    }
+
+    if (pool.broken)
+        return nullptr;
+    if (pool.workers.size() >= pool.config.max_workers) {
+        MetricHandler::incrementMetric(Metric::CGI_WORKER_POOL_EXHAUSTED, 1);
+        return nullptr;
+    }
+    return spawn(key, pool);
+}
+
+void CgiWorkerPool::release(const std::shared_ptr<CgiWorker> &worker) {
+    const auto it = pools.find(worker->getPoolKey());
+    if (it == pools.end()) {
+        worker->close();
+        return;
+    }
+
+    it->second.failures = 0;
+    if (worker->getRequestsServed() >= it->second.config.max_requests) {
+        Logger::log(LogLevel::DEBUG, "Recycling CGI worker " + std::to_string(worker->getPid()) + " after " +
+                                     std::to_string(worker->getRequestsServed()) + " requests");
+        MetricHandler::incrementMetric(Metric::CGI_WORKER_RECYCLED, 1);
+        worker->close();
+    }
+}
+
+void CgiWorkerPool::remove(const CgiWorker &worker) {
+    const pid_t pid = worker.getPid();
+    const bool crashed = worker.getRequestsServed() == 0 && !worker.wasAborted();
+
+    const auto it = pools.find(worker.getPoolKey());
+    if (it == pools.end())
+        return;
+
+    // the caller holds its own reference, the worker outlives this erase
+    Pool &pool = it->second;
+    pool.workers.erase(std::remove_if(pool.workers.begin(), pool.workers.end(),
+                                      [&worker](const std::shared_ptr<CgiWorker> &candidate) {
+                                          return candidate.get() == &worker;
+                                      }), pool.workers.end());
+
+    if (crashed && !pool.broken) {
+        const std::time_t delay = std::min<std::time_t>(
+            static_cast<std::time_t>(CGI_WORKER_RETRY_DELAY) << std::min(pool.failures, 16u),
+            CGI_WORKER_MAX_RETRY_DELAY);
+        Logger::log(LogLevel::ERROR, "CGI worker " + std::to_string(pid) +
+                                     " exited before serving a request, " + it->first +
+                                     " falls back to a process per request for " + std::to_string(delay) + "s");
+        pool.broken = true;
+        pool.retryAt = std::time(nullptr) + delay;
+        ++pool.failures;
+    }
+    replenish(it->first, pool);
+}
+
+size_t CgiWorkerPool::getWorkerCount() {
+    size_t count = 0;
+    for (const auto &[key, pool]: pools)
+        count += pool.workers.size();
+    return count;
+}
+
+size_t CgiWorkerPool::getIdleCount() {
+    size_t count = 0;
+    for (const auto &[key, pool]: pools)
+        count += std::count_if(pool.workers.begin(), pool.workers.end(),
+                               [](const std::shared_ptr<CgiWorker> &worker) { return worker->isIdle(); });
+    return count;
+}
+
+void CgiWorkerPool::cleanUp() {
+    auto closing = std::move(pools);
+    pools.clear();
+    for (auto &[key, pool]: closing) {
+        for (const auto &worker: pool.workers)
+            worker->close();
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef CGIWORKERPOOL_H
+#define CGIWORKERPOOL_H
+
+#include <ctime>
+#include <string>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <config/config.h>
+#include "CgiWorker.h"
+
+// Persistent workers per cgi interpreter and adapter, so warm requests skip fork, exec and interpreter startup.
+class CgiWorkerPool {
+private:
+    struct Pool {
+        std::string interpreter;
+        CgiWorkerConfig config;
+        std::vector<std::shared_ptr<CgiWorker> > workers;
+        // a worker exited before serving anything, requests fall back to a process each until retryAt
+        bool broken;
+        std::time_t retryAt;
+        // crashes since a worker last served a request, each one doubles the wait before the next spawn
+        unsigned failures;
+    };
+
+    static std::unordered_map<std::string, Pool> pools;
+
+    // mappings that share an adapter but differ in their limits get pools of their own
+    static std::string keyFor(const std::string &interpreter, const CgiWorkerConfig &config);
+
+    // clears the broken state once its backoff ran out and spawns workers to probe the adapter,
+    // true when it did so
+    static bool retry(const std::string &key, Pool &pool);
+
+    static Pool &getPool(const std::string &interpreter, const CgiWorkerConfig &config);
+
+    static std::shared_ptr<CgiWorker> spawn(const std::string &key, Pool &pool);
+
+    static void replenish(const std::string &key, Pool &pool);
+
+public:
+    // spawns the minimum number of workers for a cgi_workers mapping
+    static void configure(const std::string &interpreter, const CgiWorkerConfig &config);
+
+    // an idle worker, a new one while the pool is below max_workers, nullptr once every worker is busy
+    // or the adapter failed and its backoff has not run out
+    static std::shared_ptr<CgiWorker> acquire(const std::string &interpreter, const CgiWorkerConfig &config);
+
+    // takes back a worker that finished a request, recycles it once it served max_requests
+    static void release(const std::shared_ptr<CgiWorker> &worker);
+
+    // forgets a closed worker, its process is reaped by CgiProcess
+    static void remove(const CgiWorker &worker);
+
+    [[nodiscard]] static size_t getWorkerCount();
+
+    [[nodiscard]] static size_t getIdleCount();
+
+    static void cleanUp();
+};
+
+
+#endif //CGIWORKERPOOL_H
@@ -0,0 +1,356 @@
+#include "FastCgiConnection.h"
+#include "FastCgiRecord.h"
+#include "FastCgiPool.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <cstring>
+#include <webserv.h>
+#include <common/Logger.h>
+#include <server/FdHandler.h>
+#include <server/buffer/BufferPool.h>
+#include <server/handler/MetricHandler.h>
+
+FastCgiConnection::FastCgiConnection(std::string address) : address(std::move(address)), outgoing(SIZE_MAX) {
+}
+
+FastCgiConnection::~FastCgiConnection() {
+    if (fd >= 0)
+        ::close(fd);
+}
+
+static bool resolveAddress(const std::string &address, sockaddr_storage &storage, socklen_t &length) {
+    storage = {};
+    if (address.rfind("unix:", 0) == 0) {
+        const std::string path = address.substr(5);
+        auto *unixAddr = reinterpret_cast<sockaddr_un *>(&storage);
+        if (path.empty() || path.size() >= sizeof(unixAddr->sun_path))
+            return false;
+        unixAddr->sun_family = AF_UNIX;
+        std::memcpy(unixAddr->sun_path, path.c_str(), path.size() + 1);
+        length = sizeof(sockaddr_un);
+        return true;
+    }
+
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon + 1 == address.size())
+        return false;
+    std::string host = address.substr(0, colon);
+    const std::string port = address.substr(colon + 1);
+    if (host == "localhost")
+        host = "127.0.0.1";
+    if (port.find_first_not_of("0123456789") != std::string::npos || port.size() > 5 || std::stoi(port) > 65535)
+        return false;
+
+    auto *inetAddr = reinterpret_cast<sockaddr_in *>(&storage);
+    inetAddr->sin_family = AF_INET;
+    inetAddr->sin_port = htons(static_cast<uint16_t>(std::stoi(port)));
+    if (inet_pton(AF_INET, host.c_str(), &inetAddr->sin_addr) != 1)
+        return false;
+    length = sizeof(sockaddr_in);
+    return true;
+}
+
+bool FastCgiConnection::isValidAddress(const std::string &address) {
+    sockaddr_storage storage{};
+    socklen_t length = 0;
+    return resolveAddress(address, storage, length);
+}
+
+bool FastCgiConnection::openSocket() {
+    sockaddr_storage storage{};
+    socklen_t length = 0;
+    if (!resolveAddress(address, storage, length)) {
+        Logger::log(LogLevel::ERROR, "Invalid FastCGI upstream address: " + address);
+        return false;
+    }
+
+    fd = socket(storage.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        Logger::log(LogLevel::ERROR, "Failed to create FastCGI socket: " + std::string(strerror(errno)));
+        return false;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (storage.ss_family == AF_INET) {
+        constexpr int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    }
+
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&storage), length) == 0) {
+        state = State::IDLE;
+        return true;
+    }
+    if (errno == EINPROGRESS) {
+        state = State::CONNECTING;
+        return true;
+    }
+
+    Logger::log(LogLevel::ERROR, "Failed to connect to FastCGI upstream " + address + ": " + strerror(errno));
+    close();
+    return false;
+}
+
+std::shared_ptr<FastCgiConnection> FastCgiConnection::connect(const std::string &address) {
+    auto connection = std::make_shared<FastCgiConnection>(address);
+    if (!connection->openSocket())
+        return nullptr;
+
+    // the registration keeps the connection alive until its socket is closed
+    FdHandler::addFd(connection->fd, POLLIN | POLLOUT, [connection](const int fd, const short events) {
+        (void) fd;
+        return connection->onEvent(events);
+    });
+    return connection;
+}
+
+void FastCgiConnection::begin(const std::unordered_map<std::string, std::string> &params,
+                              std::shared_ptr<SmartBuffer> body, const size_t bodySize, Callbacks callbacks) {
+    this->callbacks = std::move(callbacks);
+    stdinBody = std::move(body);
+    stdinRemaining = stdinBody ? bodySize : 0;
+    stdinClosed = false;
+    receivedStdout = false;
+    incoming.clear();
+    requestPending = true;
+    requestStart = std::chrono::steady_clock::now();
+
+    std::string paramBlock;
+    for (const auto &[name, value]: params)
+        FastCgiRecord::appendNameValue(paramBlock, name, value);
+
+    std::string head;
+    FastCgiRecord::appendBeginRequest(head, REQUEST_ID, true);
+    FastCgiRecord::appendRecord(head, FastCgiRecordType::PARAMS, REQUEST_ID, paramBlock.data(), paramBlock.size());
+    FastCgiRecord::appendHeader(head, FastCgiRecordType::PARAMS, REQUEST_ID, 0);
+    outgoing.append(head.data(), head.size());
+
+    if (state == State::IDLE)
+        state = State::ACTIVE;
+    updateEvents();
+}
+
+void FastCgiConnection::updateEvents() {
+    if (state == State::CLOSED)
+        return;
+    const bool wantsWrite = state == State::CONNECTING ||
+                            (state == State::ACTIVE && (!stdinClosed || !outgoing.isDrained()));
+    const short events = wantsWrite ? POLLIN | POLLOUT : POLLIN;
+    if (events != polledEvents) {
+        FdHandler::setEvents(fd, events);
+        polledEvents = events;
+    }
+}
+
+void FastCgiConnection::abort() {
+    callbacks = {};
+    requestPending = false;
+    if (state == State::CLOSED)
+        return;
+    if (fd >= 0)
+        FdHandler::removeFd(fd);
+    close();
+}
+
+void FastCgiConnection::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    state = State::CLOSED;
+}
+
+void FastCgiConnection::fail(const std::string &reason) {
+    Logger::log(LogLevel::ERROR, "FastCGI upstream " + address + ": " + reason);
+    close();
+    if (requestPending)
+        finishRequest(false);
+}
+
+bool FastCgiConnection::finishConnect() {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+        fail("connect failed: " + std::string(strerror(error)));
+        return false;
+    }
+    state = requestPending ? State::ACTIVE : State::IDLE;
+    return true;
+}
+
+bool FastCgiConnection::onEvent(const short events) {
+    if (state == State::CLOSED)
+        return true;
+
+    if (state == State::CONNECTING) {
+        if (!(events & (POLLOUT | POLLHUP | POLLERR)))
+            return false;
+        if (!finishConnect())
+            return true;
+    }
+
+    if (events & (POLLIN | POLLHUP) && !readIncoming())
+        return true;
+
+    if (state == State::ACTIVE && events & POLLOUT) {
+        if (!pumpStdin() || !flushOutgoing())
+            return true;
+    }
+    updateEvents();
+    return state == State::CLOSED;
+}
+
+// keeps at most one pipe chunk of stdin records queued, the body is pulled as the upstream reads it,
+// false when the body lost bytes and the request failed
+bool FastCgiConnection::pumpStdin() {
+    while (!stdinClosed && outgoing.getReadableSize() < CGI_PIPE_CHUNK_SIZE) {
+        if (stdinRemaining == 0) {
+            std::string end;
+            FastCgiRecord::appendHeader(end, FastCgiRecordType::STDIN, REQUEST_ID, 0);
+            outgoing.append(end.data(), end.size());
+            stdinClosed = true;
+            return true;
+        }
+
+        stdinBody->read(CGI_PIPE_CHUNK_SIZE);
+        if (stdinBody->hasFailed()) {
+            fail("request body was lost");
+            return false;
+        }
+        iovec spans[SmartBuffer::MAX_SPANS];
+        size_t spanCount = SmartBuffer::MAX_SPANS;
+        const size_t length = stdinBody->peek(spans, spanCount,
+                                              std::min(stdinRemaining, FastCgiRecord::MAX_CONTENT_LENGTH));
+        if (length == 0)
+            return true;
+
+        std::string header;
+        FastCgiRecord::appendHeader(header, FastCgiRecordType::STDIN, REQUEST_ID, length);
+        outgoing.append(header.data(), header.size());
+        for (size_t i = 0; i < spanCount; ++i)
+            outgoing.append(static_cast<const char *>(spans[i].iov_base), spans[i].iov_len);
+        stdinBody->consume(length);
+        stdinRemaining -= length;
+    }
+    return true;
+}
+
+bool FastCgiConnection::flushOutgoing() {
+    outgoing.read(SEND_CHUNK_SIZE);
+    iovec spans[SmartBuffer::MAX_SPANS];
+    size_t spanCount = SmartBuffer::MAX_SPANS;
+    if (outgoing.peek(spans, spanCount, SEND_CHUNK_SIZE) == 0)
+        return true;
+
+    msghdr message{};
+    message.msg_iov = spans;
+    message.msg_iovlen = spanCount;
+    const ssize_t bytesSent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    if (bytesSent <= 0) {
+        fail("write failed");
+        return false;
+    }
+    outgoing.consume(bytesSent);
+    return true;
+}
+
+bool FastCgiConnection::readIncoming() {
+    const BufferPool::Block block(READ_BUFFER_SIZE);
+    const ssize_t bytesRead = read(fd, block.data(), block.size());
+    if (bytesRead < 0)
+        return true;
+
+    if (bytesRead == 0) {
+        if (state == State::IDLE) {
+            Logger::log(LogLevel::DEBUG, "FastCGI upstream " + address + " closed an idle connection");
+            close();
+        } else
+            fail("connection closed during a request");
+        return false;
+    }
+
+    if (state != State::ACTIVE) {
+        fail("unexpected data on an idle connection");
+        return false;
+    }
+
+    incoming.append(block.data(), bytesRead);
+    if (!processRecords())
+        return false;
+    return state != State::CLOSED;
+}
+
+bool FastCgiConnection::processRecords() {
+    size_t offset = 0;
+    while (incoming.size() - offset >= FastCgiRecord::HEADER_SIZE) {
+        FastCgiRecord::Header header{};
+        if (!FastCgiRecord::parseHeader(incoming.data() + offset, header)) {
+            fail("invalid record version");
+            return false;
+        }
+
+        const size_t recordSize = FastCgiRecord::HEADER_SIZE + header.contentLength + header.paddingLength;
+        if (incoming.size() - offset < recordSize)
+            break;
+        const char *content = incoming.data() + offset + FastCgiRecord::HEADER_SIZE;
+        offset += recordSize;
+
+        // management records use request id 0
+        if (header.requestId != REQUEST_ID)
+            continue;
+
+        if (header.type == FastCgiRecordType::STDOUT && header.contentLength > 0) {
+            if (!receivedStdout) {
+                receivedStdout = true;
+                const auto elapsed = std::chrono::steady_clock::now() - requestStart;
+                MetricHandler::incrementMetric(Metric::FASTCGI_FIRST_BYTE_TIME_US,
+                                               std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+            }
+            if (callbacks.onStdout)
+                callbacks.onStdout(content, header.contentLength);
+        } else if (header.type == FastCgiRecordType::STDERR && header.contentLength > 0) {
+            Logger::log(LogLevel::WARNING, "FastCGI stderr: " + std::string(content, header.contentLength));
+        } else if (header.type == FastCgiRecordType::END_REQUEST) {
+            incoming.erase(0, offset);
+            const bool complete = header.contentLength >= 5 &&
+                                  static_cast<uint8_t>(content[4]) == FastCgiRecord::REQUEST_COMPLETE;
+            if (!complete) {
+                fail("request was rejected");
+                return false;
+            }
+            finishRequest(true);
+            return true;
+        }
+    }
+    incoming.erase(0, offset);
+    return true;
+}
+
+void FastCgiConnection::finishRequest(const bool success) {
+    const auto elapsed = std::chrono::steady_clock::now() - requestStart;
+    MetricHandler::incrementMetric(Metric::FASTCGI_REQUESTS, 1);
+    MetricHandler::incrementMetric(Metric::FASTCGI_UPSTREAM_TIME_US,
+                                   std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    if (!success)
+        MetricHandler::incrementMetric(Metric::FASTCGI_ERRORS, 1);
+
+    requestPending = false;
+    stdinBody.reset();
+    const auto onComplete = std::move(callbacks.onComplete);
+    callbacks = {};
+
+    // stdin the upstream never read would be taken for the next request's records
+    if (success && stdinClosed && outgoing.isDrained()) {
+        state = State::IDLE;
+        FastCgiPool::release(shared_from_this());
+    } else if (state != State::CLOSED)
+        close();
+    if (onComplete)
+        onComplete(success);
+}
@@ -0,0 +1,98 @@
+#ifndef FASTCGICONNECTION_H
+#define FASTCGICONNECTION_H
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <chrono>
+#include <poll.h>
+#include <server/buffer/SmartBuffer.h>
+
+// One socket to a FastCGI upstream ("unix:/path" or "host:port") running one request at a time.
+// Connections are kept open (FCGI_KEEP_CONN) and handed out again by the FastCgiPool.
+class FastCgiConnection : public std::enable_shared_from_this<FastCgiConnection> {
+public:
+    struct Callbacks {
+        std::function<void(const char *data, size_t length)> onStdout;
+        // false when the upstream failed or closed the connection before ending the request
+        std::function<void(bool success)> onComplete;
+    };
+
+    enum class State {
+        CONNECTING,
+        IDLE,
+        ACTIVE,
+        CLOSED
+    };
+
+private:
+    static constexpr uint16_t REQUEST_ID = 1;
+
+    std::string address;
+    int fd = -1;
+    State state = State::CONNECTING;
+    short polledEvents = POLLIN | POLLOUT;
+    bool requestPending = false;
+
+    SmartBuffer outgoing;
+    std::string incoming;
+
+    std::shared_ptr<SmartBuffer> stdinBody;
+    size_t stdinRemaining = 0;
+    bool stdinClosed = false;
+
+    Callbacks callbacks;
+    std::chrono::steady_clock::time_point requestStart;
+    bool receivedStdout = false;
+
+    bool openSocket();
+
+    bool onEvent(short events);
+
+    bool finishConnect();
+
+    bool pumpStdin();
+
+    bool flushOutgoing();
+
+    bool readIncoming();
+
+    bool processRecords();
+
+    void finishRequest(bool success);
+
+    void fail(const std::string &reason);
+
+    // POLLOUT only while connecting or while there is something to send, idle sockets wait for POLLIN
+    void updateEvents();
+
+public:
+    explicit FastCgiConnection(std::string address);
+
+    ~FastCgiConnection();
+
+    FastCgiConnection(const FastCgiConnection &) = delete;
+
+    FastCgiConnection &operator=(const FastCgiConnection &) = delete;
+
+    // opens a non-blocking socket and registers it with the FdHandler, returns nullptr on failure
+    static std::shared_ptr<FastCgiConnection> connect(const std::string &address);
+
+    void begin(const std::unordered_map<std::string, std::string> &params, std::shared_ptr<SmartBuffer> body,
+               size_t bodySize, Callbacks callbacks);
+
+    // drops the running request, the connection can not be reused afterwards
+    void abort();
+
+    // called from inside the connection's own events, the FdHandler entry is removed once the event returns
+    void close();
+
+    [[nodiscard]] bool isIdle() const { return state == State::IDLE; }
+    [[nodiscard]] const std::string &getAddress() const { return address; }
+
+    static bool isValidAddress(const std::string &address);
+};
+
+
+#endif //FASTCGICONNECTION_H
@@ -0,0 +1,46 @@
+#include "FastCgiPool.h"
+
+#include <webserv.h>
+#include <common/Logger.h>
+#include <server/handler/MetricHandler.h>
+
+std::unordered_map<std::string, std::vector<std::shared_ptr<FastCgiConnection> > > FastCgiPool::idleConnections;
+
+std::shared_ptr<FastCgiConnection> FastCgiPool::acquire(const std::string &address) {
+    auto &idle = idleConnections[address];
+    while (!idle.empty()) {
+        std::shared_ptr<FastCgiConnection> connection = std::move(idle.back());
+        idle.pop_back();
+        // a connection only referenced from here was dropped by the FdHandler after a socket error
+        if (connection->isIdle() && connection.use_count() > 1) {
+            MetricHandler::incrementMetric(Metric::FASTCGI_CONNECTIONS_REUSED, 1);
+            return connection;
+        }
+    }
+
+    auto connection = FastCgiConnection::connect(address);
+    if (connection)
+        MetricHandler::incrementMetric(Metric::FASTCGI_CONNECTIONS_OPENED, 1);
+    return connection;
+}
+
+void FastCgiPool::release(const std::shared_ptr<FastCgiConnection> &connection) {
+    auto &idle = idleConnections[connection->getAddress()];
+    if (idle.size() >= FASTCGI_MAX_IDLE_CONNECTIONS) {
+        Logger::log(LogLevel::DEBUG, "FastCGI pool for " + connection->getAddress() + " is full, closing connection");
+        connection->close();
+        return;
+    }
+    idle.push_back(connection);
+}
+
+size_t FastCgiPool::getIdleCount() {
+    size_t count = 0;
+    for (const auto &[address, idle]: idleConnections)
+        count += idle.size();
+    return count;
+}
+
+void FastCgiPool::cleanUp() {
+    idleConnections.clear();
+}
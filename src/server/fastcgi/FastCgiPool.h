@@ -0,0 +1,27 @@
+#ifndef FASTCGIPOOL_H
+#define FASTCGIPOOL_H
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include "FastCgiConnection.h"
+
+// Kept-alive upstream connections per FastCGI address, requests take an idle one or open a new one.
+class FastCgiPool {
+private:
+    static std::unordered_map<std::string, std::vector<std::shared_ptr<FastCgiConnection> > > idleConnections;
+
+public:
+    // returns nullptr when no connection to the upstream could be opened
+    static std::shared_ptr<FastCgiConnection> acquire(const std::string &address);
+
+    static void release(const std::shared_ptr<FastCgiConnection> &connection);
+
+    [[nodiscard]] static size_t getIdleCount();
+
+    static void cleanUp();
+};
+
+
+#endif //FASTCGIPOOL_H
@@ -0,0 +1,63 @@
+#include "FastCgiRecord.h"
+
+#include <algorithm>
+
+void FastCgiRecord::appendHeader(std::string &out, const FastCgiRecordType type, const uint16_t requestId,
+                                 const size_t contentLength) {
+    out += static_cast<char>(VERSION);
+    out += static_cast<char>(type);
+    out += static_cast<char>(requestId >> 8);
+    out += static_cast<char>(requestId & 0xFF);
+    out += static_cast<char>(contentLength >> 8);
+    out += static_cast<char>(contentLength & 0xFF);
+    out += '\0'; // padding length
+    out += '\0'; // reserved
+}
+
+void FastCgiRecord::appendRecord(std::string &out, const FastCgiRecordType type, const uint16_t requestId,
+                                 const char *data, size_t length) {
+    while (length > 0) {
+        const size_t chunk = std::min(length, MAX_CONTENT_LENGTH);
+        appendHeader(out, type, requestId, chunk);
+        out.append(data, chunk);
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+void FastCgiRecord::appendBeginRequest(std::string &out, const uint16_t requestId, const bool keepConnection) {
+    appendHeader(out, FastCgiRecordType::BEGIN_REQUEST, requestId, 8);
+    out += static_cast<char>(ROLE_RESPONDER >> 8);
+    out += static_cast<char>(ROLE_RESPONDER & 0xFF);
+    out += static_cast<char>(keepConnection ? FLAG_KEEP_CONN : 0);
+    out.append(5, '\0');
+}
+
+static void appendLength(std::string &out, const size_t length) {
+    if (length < 128) {
+        out += static_cast<char>(length);
+        return;
+    }
+    out += static_cast<char>(((length >> 24) & 0x7F) | 0x80);
+    out += static_cast<char>((length >> 16) & 0xFF);
+    out += static_cast<char>((length >> 8) & 0xFF);
+    out += static_cast<char>(length & 0xFF);
+}
+
+void FastCgiRecord::appendNameValue(std::string &out, const std::string &name, const std::string &value) {
+    appendLength(out, name.size());
+    appendLength(out, value.size());
+    out += name;
+    out += value;
+}
+
+bool FastCgiRecord::parseHeader(const char *data, Header &header) {
+    const auto *bytes = reinterpret_cast<const unsigned char *>(data);
+    if (bytes[0] != VERSION)
+        return false;
+    header.type = static_cast<FastCgiRecordType>(bytes[1]);
+    header.requestId = static_cast<uint16_t>(bytes[2] << 8 | bytes[3]);
+    header.contentLength = static_cast<uint16_t>(bytes[4] << 8 | bytes[5]);
+    header.paddingLength = bytes[6];
+    return true;
+}
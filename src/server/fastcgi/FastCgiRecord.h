@@ -0,0 +1,50 @@
+#ifndef FASTCGIRECORD_H
+#define FASTCGIRECORD_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+enum class FastCgiRecordType : uint8_t {
+    BEGIN_REQUEST = 1,
+    ABORT_REQUEST = 2,
+    END_REQUEST = 3,
+    PARAMS = 4,
+    STDIN = 5,
+    STDOUT = 6,
+    STDERR = 7,
+};
+
+// Encoding and decoding of FastCGI 1.0 records, see the FastCGI specification section 3.
+class FastCgiRecord {
+public:
+    static constexpr size_t HEADER_SIZE = 8;
+    static constexpr size_t MAX_CONTENT_LENGTH = 65535;
+    static constexpr uint8_t VERSION = 1;
+    static constexpr uint16_t ROLE_RESPONDER = 1;
+    static constexpr uint8_t FLAG_KEEP_CONN = 1;
+    static constexpr uint8_t REQUEST_COMPLETE = 0;
+
+    struct Header {
+        FastCgiRecordType type;
+        uint16_t requestId;
+        uint16_t contentLength;
+        uint8_t paddingLength;
+    };
+
+    static void appendHeader(std::string &out, FastCgiRecordType type, uint16_t requestId, size_t contentLength);
+
+    // splits content into as many records as needed, streams are ended by an empty record from appendHeader()
+    static void appendRecord(std::string &out, FastCgiRecordType type, uint16_t requestId, const char *data,
+                             size_t length);
+
+    static void appendBeginRequest(std::string &out, uint16_t requestId, bool keepConnection);
+
+    static void appendNameValue(std::string &out, const std::string &name, const std::string &value);
+
+    // data must hold at least HEADER_SIZE bytes, returns false for an unknown protocol version
+    static bool parseHeader(const char *data, Header &header);
+};
+
+
+#endif //FASTCGIRECORD_H
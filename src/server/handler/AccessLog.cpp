@@ -0,0 +1,105 @@
+#include "AccessLog.h"
+
+#include <arpa/inet.h>
+#include <ctime>
+#include <server/ClientConnection.h>
+
+std::unique_ptr<LogWriter> AccessLog::writer;
+bool AccessLog::withPhases = false;
+
+bool AccessLog::start(const std::string &path, const bool phases) {
+    withPhases = phases;
+    if (path.empty())
+        return true;
+    writer = LogWriter::open(path);
+    return writer != nullptr;
+}
+
+void AccessLog::cleanUp() {
+    writer.reset();
+}
+
+void AccessLog::log(const ClientConnection &client, const int status, const LatencyMetrics::Target &target) {
+    if (!writer)
+        return;
+
+    char address[INET_ADDRSTRLEN] = "";
+    inet_ntop(AF_INET, &client.clientAddr.sin_addr, address, sizeof(address));
+
+    std::string line;
+    line.reserve(256);
+    line += "{\"time\":";
+    appendTime(line);
+    line += ",\"client\":\"";
+    line += address;
+    line += "\",\"listener\":";
+    appendString(line, target.listener);
+    line += ",\"vhost\":";
+    appendString(line, target.vhost);
+    line += ",\"method\":";
+    appendString(line, client.request ? client.request->getMethodString() : "-");
+    line += ",\"uri\":";
+    appendString(line, client.request ? client.request->uri : "-");
+    line += ",\"location\":";
+    appendString(line, target.location);
+    line += ",\"status\":" + std::to_string(status);
+    line += ",\"bytes_sent\":" + std::to_string(client.responseBytesSent);
+    line += ",\"duration_us\":" + std::to_string(
+        client.timing.between(RequestPhase::FIRST_BYTE, RequestPhase::LAST_BYTE));
+    if (withPhases) {
+        line += ",\"phases\":";
+        appendPhases(line, client.timing);
+    }
+    line += "}\n";
+    writer->write(line);
+}
+
+void AccessLog::appendString(std::string &out, const std::string &value) {
+    static constexpr char HEX[] = "0123456789abcdef";
+    out += '"';
+    for (const char c: value) {
+        switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out += "\\u00";
+                    out += HEX[c >> 4];
+                    out += HEX[c & 0xf];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+// only the spans the request went through, a keep-alive request has no accept span
+void AccessLog::appendPhases(std::string &out, const RequestTiming &timing) {
+    out += '{';
+    bool first = true;
+    for (const RequestTiming::Span &span: RequestTiming::SPANS) {
+        if (!timing.has(span))
+            continue;
+        if (!first)
+            out += ',';
+        first = false;
+        out += '"';
+        out += span.name;
+        out += "_us\":" + std::to_string(timing.between(span));
+    }
+    out += '}';
+}
+
+void AccessLog::appendTime(std::string &out) {
+    const std::time_t now = std::time(nullptr);
+    std::tm utc{};
+    gmtime_r(&now, &utc);
+    char buffer[32];
+    const size_t length = std::strftime(buffer, sizeof(buffer), "\"%Y-%m-%dT%H:%M:%SZ\"", &utc);
+    out.append(buffer, length);
+}
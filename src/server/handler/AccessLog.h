@@ -0,0 +1,35 @@
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+#include <memory>
+#include <string>
+#include "LatencyMetrics.h"
+#include "LogWriter.h"
+
+class ClientConnection;
+
+// One JSON line per response, written by a LogWriter so the loop never waits on the disk.
+// Configured with access_log <path> [phases], the phases add the time spent in every RequestTiming span.
+class AccessLog {
+private:
+    static std::unique_ptr<LogWriter> writer;
+    static bool withPhases;
+
+public:
+    // true when logging is off or the file could be opened
+    static bool start(const std::string &path, bool phases);
+
+    static void cleanUp();
+
+    static void log(const ClientConnection &client, int status, const LatencyMetrics::Target &target);
+
+    // the fields the access log and other structured logs share
+    static void appendString(std::string &out, const std::string &value);
+
+    static void appendPhases(std::string &out, const RequestTiming &timing);
+
+    static void appendTime(std::string &out);
+};
+
+
+#endif //ACCESSLOG_H
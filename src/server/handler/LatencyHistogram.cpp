@@ -0,0 +1,41 @@
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+void LatencyHistogram::add(const LatencyHistogram &other) {
+    for (size_t i = 0; i < BUCKET_COUNT; ++i)
+        buckets[i] += other.buckets[i];
+    count += other.count;
+    sum += other.sum;
+    if (other.max > max)
+        max = other.max;
+}
+
+void LatencyHistogram::clear() {
+    buckets.fill(0);
+    count = 0;
+    sum = 0;
+    max = 0;
+}
+
+uint64_t LatencyHistogram::percentile(const double percent) const {
+    if (count == 0)
+        return 0;
+    const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percent / 100.0 * count)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        seen += buckets[i];
+        if (seen >= rank)
+            return std::min(upperBoundOf(i), max);
+    }
+    return max;
+}
+
+uint64_t LatencyHistogram::upperBoundOf(const size_t bucket) {
+    if (bucket < SUB_BUCKET_COUNT)
+        return bucket;
+    const size_t shift = bucket / SUB_BUCKET_COUNT - 1;
+    const uint64_t subBucket = bucket % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+    return ((subBucket + 1) << shift) - 1;
+}
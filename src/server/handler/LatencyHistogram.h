@@ -0,0 +1,61 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// HDR style log-linear histogram of microseconds: values below SUB_BUCKET_COUNT get a bucket each,
+// every further power of two is split into SUB_BUCKET_COUNT buckets, so a bucket spans at most 1/16
+// of its values. Recording is an index computation and two additions.
+class LatencyHistogram {
+public:
+    static constexpr size_t SUB_BUCKET_BITS = 4;
+    static constexpr size_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static constexpr size_t MAX_EXPONENT = 39; // about 12 days, longer values land in the last bucket
+    static constexpr size_t BUCKET_COUNT = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKET_COUNT;
+
+private:
+    std::array<uint64_t, BUCKET_COUNT> buckets{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+public:
+    void record(uint64_t value) {
+        ++buckets[bucketOf(value)];
+        ++count;
+        sum += value;
+        if (value > max)
+            max = value;
+    }
+
+    void add(const LatencyHistogram &other);
+
+    void clear();
+
+    // the upper bound of the bucket holding the percentile, never more than the largest recorded value
+    [[nodiscard]] uint64_t percentile(double percent) const;
+
+    [[nodiscard]] uint64_t getCount() const { return count; }
+
+    [[nodiscard]] uint64_t getSum() const { return sum; }
+
+    [[nodiscard]] uint64_t getMax() const { return max; }
+
+    [[nodiscard]] const std::array<uint64_t, BUCKET_COUNT> &getBuckets() const { return buckets; }
+
+    [[nodiscard]] static size_t bucketOf(uint64_t value) {
+        if (value < SUB_BUCKET_COUNT)
+            return value;
+        if (value >> (MAX_EXPONENT + 1))
+            return BUCKET_COUNT - 1;
+        const size_t shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKET_COUNT + (value >> shift) - SUB_BUCKET_COUNT;
+    }
+
+    [[nodiscard]] static uint64_t upperBoundOf(size_t bucket);
+};
+
+
+#endif //LATENCYHISTOGRAM_H
@@ -0,0 +1,76 @@
+#include "LatencyMetrics.h"
+
+#include <cstdlib>
+#include <server/Server.h>
+
+LatencyMetrics::Targets LatencyMetrics::targets;
+LatencyMetrics::Phases LatencyMetrics::phases;
+
+const LatencyMetrics::Target &LatencyMetrics::record(const Server *listener, const ServerConfig *vhost, const RouteConfig *route,
+                            const int status, const RequestTiming &timing) {
+    const Key key{listener, vhost, route};
+    auto it = targets.find(key);
+    if (it == targets.end()) {
+        it = targets.try_emplace(key).first;
+        Target &target = it->second;
+        if (listener)
+            target.listener = listener->getHost() + ":" + std::to_string(listener->getPort());
+        if (vhost && !vhost->server_names.empty())
+            target.vhost = vhost->server_names.front();
+        if (route)
+            target.location = route->location;
+    }
+
+    std::unique_ptr<StatusClass> &statusClass = it->second.statusClasses[statusClassOf(status)];
+    if (!statusClass)
+        statusClass = std::make_unique<StatusClass>();
+    statusClass->current.firstByte.record(timing.between(RequestPhase::FIRST_BYTE, RequestPhase::FIRST_RESPONSE_BYTE));
+    statusClass->current.total.record(timing.between(RequestPhase::FIRST_BYTE, RequestPhase::LAST_BYTE));
+
+    for (size_t i = 0; i < RequestTiming::SPANS.size(); ++i) {
+        if (timing.has(RequestTiming::SPANS[i]))
+            phases[i].current.record(timing.between(RequestTiming::SPANS[i]));
+    }
+    return it->second;
+}
+
+void LatencyMetrics::resetWindow() {
+    for (auto &[key, target]: targets) {
+        for (const std::unique_ptr<StatusClass> &statusClass: target.statusClasses) {
+            if (!statusClass)
+                continue;
+            std::swap(statusClass->lastWindow, statusClass->current);
+            statusClass->current.firstByte.clear();
+            statusClass->current.total.clear();
+            statusClass->merged.firstByte.add(statusClass->lastWindow.firstByte);
+            statusClass->merged.total.add(statusClass->lastWindow.total);
+        }
+    }
+    for (Phase &phase: phases) {
+        std::swap(phase.lastWindow, phase.current);
+        phase.current.clear();
+        phase.merged.add(phase.lastWindow);
+    }
+}
+
+const LatencyMetrics::Targets &LatencyMetrics::getTargets() {
+    return targets;
+}
+
+const LatencyMetrics::Phases &LatencyMetrics::getPhases() {
+    return phases;
+}
+
+size_t LatencyMetrics::statusClassOf(const int status) {
+    if (status < 100 || status >= 600)
+        return STATUS_CLASS_COUNT - 1;
+    return status / 100 - 1;
+}
+
+bool LatencyMetrics::parsePercentile(const std::string &text, double &percent) {
+    if (text.empty() || text.find_first_not_of("0123456789.") != std::string::npos)
+        return false;
+    char *end = nullptr;
+    percent = std::strtod(text.c_str(), &end);
+    return *end == '\0' && percent > 0 && percent <= 100;
+}
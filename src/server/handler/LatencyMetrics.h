@@ -0,0 +1,94 @@
+#ifndef LATENCYMETRICS_H
+#define LATENCYMETRICS_H
+
+#include <array>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <config/config.h>
+#include "LatencyHistogram.h"
+#include "RequestTiming.h"
+
+class Server;
+
+// Response latencies per listener, virtual host, location and status class and the time spent in each phase
+// of a request over all of them, used on the loop thread only.
+// Like the counters of the MetricHandler, the JSON API reports the last full RESET_INTERVAL,
+// the Prometheus endpoint reports everything since the start.
+class LatencyMetrics {
+public:
+    static constexpr size_t STATUS_CLASS_COUNT = 5; // 1xx to 5xx
+    static constexpr std::array<double, 3> DEFAULT_PERCENTILES = {50, 90, 99};
+
+    struct Series {
+        LatencyHistogram firstByte; // request start until the first response byte was sent
+        LatencyHistogram total; // request start until the last response byte was sent
+    };
+
+    struct StatusClass {
+        Series current;
+        Series lastWindow;
+        Series merged; // every window before the current one
+    };
+
+    struct Target {
+        // configs live as long as the server, the labels are built once from them
+        std::string listener; // host:port
+        std::string vhost; // first server_name
+        std::string location; // empty for requests that matched no route
+        std::array<std::unique_ptr<StatusClass>, STATUS_CLASS_COUNT> statusClasses;
+    };
+
+    struct Key {
+        const Server *listener;
+        const ServerConfig *vhost;
+        const RouteConfig *route;
+
+        bool operator==(const Key &other) const {
+            return listener == other.listener && vhost == other.vhost && route == other.route;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            const std::hash<const void *> hash;
+            return hash(key.listener) ^ (hash(key.vhost) << 1) ^ (hash(key.route) << 2);
+        }
+    };
+
+    typedef std::unordered_map<Key, Target, KeyHash> Targets;
+
+    struct Phase {
+        LatencyHistogram current;
+        LatencyHistogram lastWindow;
+        LatencyHistogram merged;
+    };
+
+    typedef std::array<Phase, RequestTiming::SPANS.size()> Phases; // indexed like RequestTiming::SPANS
+
+private:
+    static Targets targets;
+    static Phases phases;
+
+public:
+    // first byte and total time run from the first request byte, phases that were never reached are skipped,
+    // returns the target so the access log can reuse its labels
+    static const Target &record(const Server *listener, const ServerConfig *vhost, const RouteConfig *route, int status,
+                       const RequestTiming &timing);
+
+    // called by the MetricHandler whenever its window ends
+    static void resetWindow();
+
+    [[nodiscard]] static const Targets &getTargets();
+
+    [[nodiscard]] static const Phases &getPhases();
+
+    [[nodiscard]] static size_t statusClassOf(int status);
+
+    // a number above 0 and at most 100, like 99.9
+    [[nodiscard]] static bool parsePercentile(const std::string &text, double &percent);
+};
+
+
+#endif //LATENCYMETRICS_H
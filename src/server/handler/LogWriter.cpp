@@ -0,0 +1,79 @@
+#include "LogWriter.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <webserv.h>
+#include <common/Logger.h>
+#include "MetricHandler.h"
+
+LogWriter::LogWriter(const int fd, std::string path): fd(fd), path(std::move(path)) {
+    thread = std::thread(&LogWriter::run, this);
+}
+
+LogWriter::~LogWriter() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+    close(fd);
+    reportWriteError();
+}
+
+std::unique_ptr<LogWriter> LogWriter::open(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        Logger::log(LogLevel::ERROR, "Failed to open log " + path + ": " + strerror(errno));
+        return nullptr;
+    }
+    return std::make_unique<LogWriter>(fd, path);
+}
+
+void LogWriter::write(const std::string &line) {
+    reportWriteError();
+    {
+        std::lock_guard lock(mutex);
+        if (pending.size() + line.size() > LOG_BUFFER_SIZE) {
+            MetricHandler::incrementMetric(Metric::LOG_LINES_DROPPED, 1);
+            return;
+        }
+        pending += line;
+    }
+    wake.notify_one();
+}
+
+void LogWriter::reportWriteError() {
+    const int error = writeError.exchange(0);
+    if (error != 0)
+        Logger::log(LogLevel::ERROR, "Failed to write log " + path + ": " + strerror(error));
+}
+
+void LogWriter::run() {
+    std::string writing;
+    std::unique_lock lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty())
+            return;
+        writing.swap(pending);
+        lock.unlock();
+
+        // O_APPEND keeps lines whole even when another process writes to the same file
+        size_t done = 0;
+        while (done < writing.size()) {
+            const ssize_t result = ::write(fd, writing.data() + done, writing.size() - done);
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result <= 0) {
+                writeError.store(result < 0 ? errno : EIO);
+                break;
+            }
+            done += result;
+        }
+        writing.clear();
+        lock.lock();
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef LOGWRITER_H
+#define LOGWRITER_H
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+// Appends lines to a file from its own thread, the loop only copies a line into a buffer.
+// When the disk cannot keep up and LOG_BUFFER_SIZE bytes are waiting, new lines are dropped instead of
+// blocking the loop, the drops are counted in the log_lines_dropped metric.
+class LogWriter {
+private:
+    int fd;
+    std::string path;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::string pending;
+    bool stopping = false;
+    // errno of the last failed write, the writer thread must not touch the Logger
+    std::atomic<int> writeError{0};
+    std::thread thread;
+
+    void run();
+
+    // logs a failure of the writer thread, runs on the loop thread
+    void reportWriteError();
+
+public:
+    LogWriter(int fd, std::string path);
+
+    // writes what is still pending and closes the file
+    ~LogWriter();
+
+    LogWriter(const LogWriter &) = delete;
+
+    LogWriter &operator=(const LogWriter &) = delete;
+
+    // nullptr when the file cannot be opened
+    static std::unique_ptr<LogWriter> open(const std::string &path);
+
+    // line must end with a newline
+    void write(const std::string &line);
+};
+
+
+#endif //LOGWRITER_H
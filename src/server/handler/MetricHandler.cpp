@@ -3,23 +3,134 @@
 //
 
 #include "MetricHandler.h"
+#include "LatencyMetrics.h"
 
-std::unordered_map<std::string, size_t> MetricHandler::metrics;
-std::unordered_map<std::string, size_t> MetricHandler::lastFullMetrics;
+std::atomic<MetricHandler::Counters *> MetricHandler::threads{nullptr};
+std::array<std::atomic<ssize_t>, MetricHandler::GAUGE_COUNT> MetricHandler::gauges{};
+MetricHandler::Values MetricHandler::lastTotals{};
+MetricHandler::Values MetricHandler::lastFullMetrics{};
 std::time_t MetricHandler::lastResetTime = std::time(nullptr);
 
-void MetricHandler::incrementMetric(const std::string &metricName, size_t value) {
-    metrics[metricName] += value;
+static constexpr std::array<const char *, MetricHandler::METRIC_COUNT> METRIC_NAMES = {
+    "new_connections",
+    "disconnects",
+    "requests",
+    "responses",
+    "bytes_received",
+    "bytes_send",
+    "bytes_spliced",
+    "put_bytes",
+    "resumable_upload_bytes",
+    "resumable_uploads",
+    "resumable_uploads_expired",
+    "io_writes",
+    "io_write_bytes",
+    "io_write_errors",
+    "buffer_pool_acquires",
+    "buffer_pool_slab_allocations",
+    "fastcgi_requests",
+    "fastcgi_errors",
+    "fastcgi_first_byte_time_us",
+    "fastcgi_upstream_time_us",
+    "fastcgi_connections_opened",
+    "fastcgi_connections_reused",
+    "cgi_processes_spawned",
+    "cgi_spawn_time_us",
+    "cgi_worker_spawned",
+    "cgi_worker_recycled",
+    "cgi_worker_pool_exhausted",
+    "cgi_worker_requests",
+    "cgi_worker_errors",
+    "cgi_worker_time_us",
+    "cgi_cache_hits",
+    "cgi_cache_stale",
+    "cgi_cache_collapsed",
+    "cgi_cache_misses",
+    "cgi_cache_stores",
+    "cgi_cache_evictions",
+    "cgi_queued_total",
+    "cgi_queue_wait_us",
+    "cgi_queue_timeouts",
+    "cgi_rejected",
+    "log_lines_dropped",
+    "slow_requests",
+};
+
+static constexpr std::array<const char *, MetricHandler::GAUGE_COUNT> GAUGE_NAMES = {
+    "connection_count",
+    "io_writes_pending",
+};
+
+static_assert(METRIC_NAMES.back() != nullptr, "every Metric needs a name");
+static_assert(GAUGE_NAMES.back() != nullptr, "every Gauge needs a name");
+
+MetricHandler::Counters &MetricHandler::local() {
+    // hands the block back when the thread exits, its counts stay part of the totals
+    struct Owner {
+        Counters *counters = nullptr;
+
+        ~Owner() {
+            if (counters)
+                counters->inUse.store(false, std::memory_order_release);
+        }
+    };
+    thread_local Owner owner;
+    if (owner.counters)
+        return *owner.counters;
+
+    for (Counters *counters = threads.load(std::memory_order_acquire); counters; counters = counters->next) {
+        bool expected = false;
+        if (counters->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            owner.counters = counters;
+            return *counters;
+        }
+    }
+    // blocks are never freed, a scrape can walk the list without a lock
+    auto *counters = new Counters();
+    counters->next = threads.load(std::memory_order_relaxed);
+    while (!threads.compare_exchange_weak(counters->next, counters, std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+    }
+    owner.counters = counters;
+    return *counters;
+}
+
+ssize_t MetricHandler::getGauge(const Gauge gauge) {
+    return gauges[static_cast<size_t>(gauge)].load(std::memory_order_relaxed);
+}
+
+const char *MetricHandler::getName(const Metric metric) {
+    return METRIC_NAMES[static_cast<size_t>(metric)];
+}
+
+const char *MetricHandler::getName(const Gauge gauge) {
+    return GAUGE_NAMES[static_cast<size_t>(gauge)];
+}
+
+MetricHandler::Values MetricHandler::getTotals() {
+    Values totals{};
+    for (Counters *counters = threads.load(std::memory_order_acquire); counters; counters = counters->next) {
+        for (size_t i = 0; i < METRIC_COUNT; ++i)
+            totals[i] += counters->values[i].load(std::memory_order_relaxed);
+    }
+    return totals;
 }
 
-std::unordered_map<std::string, size_t> &MetricHandler::getAllFullMetric() {
+const MetricHandler::Values &MetricHandler::getAllFullMetric() {
     return lastFullMetrics;
 }
 
+size_t MetricHandler::getFullMetric(const Metric metric) {
+    return lastFullMetrics[static_cast<size_t>(metric)];
+}
+
 void MetricHandler::resetMetrics() {
     if (std::time(nullptr) - lastResetTime > RESET_INTERVAL) {
-        lastFullMetrics = metrics;
-        metrics.clear();
+        const Values totals = getTotals();
+        for (size_t i = 0; i < METRIC_COUNT; ++i)
+            lastFullMetrics[i] = totals[i] - lastTotals[i];
+        lastTotals = totals;
+        LatencyMetrics::resetWindow();
         lastResetTime = std::time(nullptr);
     }
 }
@@ -27,5 +138,3 @@ void MetricHandler::resetMetrics() {
 std::time_t MetricHandler::getLastResetTime() {
     return lastResetTime;
 }
-
-
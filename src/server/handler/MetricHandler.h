@@ -5,23 +5,122 @@
 #ifndef METRICHANDLER_H
 #define METRICHANDLER_H
 
-#include <string>
-#include <unordered_map>
-#include <iostream>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <ctime>
+#include <sys/types.h>
 
 #define RESET_INTERVAL 10
 
+// counters only grow, the dashboard shows how much they grew in the last RESET_INTERVAL
+enum class Metric : uint8_t {
+    NEW_CONNECTIONS,
+    DISCONNECTS,
+    REQUESTS,
+    RESPONSES,
+    BYTES_RECEIVED,
+    BYTES_SEND,
+    BYTES_SPLICED,
+    PUT_BYTES,
+    RESUMABLE_UPLOAD_BYTES,
+    RESUMABLE_UPLOADS,
+    RESUMABLE_UPLOADS_EXPIRED,
+    IO_WRITES,
+    IO_WRITE_BYTES,
+    IO_WRITE_ERRORS,
+    BUFFER_POOL_ACQUIRES,
+    BUFFER_POOL_SLAB_ALLOCATIONS,
+    FASTCGI_REQUESTS,
+    FASTCGI_ERRORS,
+    FASTCGI_FIRST_BYTE_TIME_US,
+    FASTCGI_UPSTREAM_TIME_US,
+    FASTCGI_CONNECTIONS_OPENED,
+    FASTCGI_CONNECTIONS_REUSED,
+    CGI_PROCESSES_SPAWNED,
+    CGI_SPAWN_TIME_US,
+    CGI_WORKER_SPAWNED,
+    CGI_WORKER_RECYCLED,
+    CGI_WORKER_POOL_EXHAUSTED,
+    CGI_WORKER_REQUESTS,
+    CGI_WORKER_ERRORS,
+    CGI_WORKER_TIME_US,
+    CGI_CACHE_HITS,
+    CGI_CACHE_STALE,
+    CGI_CACHE_COLLAPSED,
+    CGI_CACHE_MISSES,
+    CGI_CACHE_STORES,
+    CGI_CACHE_EVICTIONS,
+    CGI_QUEUED_TOTAL,
+    CGI_QUEUE_WAIT_US,
+    CGI_QUEUE_TIMEOUTS,
+    CGI_REJECTED,
+    LOG_LINES_DROPPED,
+    SLOW_REQUESTS,
+    COUNT
+};
+
+// gauges hold a current value, they are reported as they are
+enum class Gauge : uint8_t {
+    CONNECTIONS,
+    IO_WRITES_PENDING,
+    COUNT
+};
+
+// Every thread increments its own block of counters, so an increment is a plain add on a cache line
+// no other thread writes. A scrape sums the blocks of all threads.
 class MetricHandler {
+public:
+    static constexpr size_t METRIC_COUNT = static_cast<size_t>(Metric::COUNT);
+    static constexpr size_t GAUGE_COUNT = static_cast<size_t>(Gauge::COUNT);
+
+    typedef std::array<size_t, METRIC_COUNT> Values;
+
 private:
-    static std::unordered_map<std::string, size_t> metrics;
-    static std::unordered_map<std::string, size_t> lastFullMetrics;
+    struct alignas(64) Counters {
+        std::array<std::atomic<size_t>, METRIC_COUNT> values{};
+        std::atomic<bool> inUse{true}; // cleared when the thread exits, the next new thread takes the block over
+        Counters *next = nullptr;
+    };
+
+    static std::atomic<Counters *> threads;
+    static std::array<std::atomic<ssize_t>, GAUGE_COUNT> gauges;
+    static Values lastTotals;
+    static Values lastFullMetrics;
     static std::time_t lastResetTime;
 
+    static Counters &local();
+
 public:
-    static void incrementMetric(const std::string &metricName, size_t value);
+    // safe to call from any thread
+    static void incrementMetric(const Metric metric, const size_t value) {
+        // only this thread writes the block, a relaxed load and store cannot lose an increment
+        std::atomic<size_t> &counter = local().values[static_cast<size_t>(metric)];
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    static void setGauge(const Gauge gauge, const ssize_t value) {
+        gauges[static_cast<size_t>(gauge)].store(value, std::memory_order_relaxed);
+    }
+
+    static void addGauge(const Gauge gauge, const ssize_t delta) {
+        gauges[static_cast<size_t>(gauge)].fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] static ssize_t getGauge(Gauge gauge);
+
+    [[nodiscard]] static const char *getName(Metric metric);
+
+    [[nodiscard]] static const char *getName(Gauge gauge);
+
+    // sums of all threads since the start
+    [[nodiscard]] static Values getTotals();
+
+    // growth of every counter during the last full RESET_INTERVAL
+    [[nodiscard]] static const Values &getAllFullMetric();
 
-    static std::unordered_map<std::string, size_t>& getAllFullMetric();
+    [[nodiscard]] static size_t getFullMetric(Metric metric);
 
     static void resetMetrics();
 
@@ -0,0 +1,68 @@
+#ifndef REQUESTTIMING_H
+#define REQUESTTIMING_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+// moments in the life of a request, in the order they happen
+enum class RequestPhase : uint8_t {
+    ACCEPTED, // only set for the first request of a connection
+    FIRST_BYTE,
+    HEADERS_COMPLETE,
+    BODY_COMPLETE,
+    HANDLER_START,
+    FIRST_RESPONSE_BYTE,
+    LAST_BYTE,
+    COUNT
+};
+
+// Monotonic timestamps of the current request of a connection, every phase keeps the first time it was marked.
+struct RequestTiming {
+    typedef std::chrono::steady_clock Clock;
+
+    // the time between two neighbouring phases, named for the access log and the metrics
+    struct Span {
+        const char *name;
+        RequestPhase from;
+        RequestPhase to;
+    };
+
+    static constexpr std::array<Span, 6> SPANS = {{
+        {"accept", RequestPhase::ACCEPTED, RequestPhase::FIRST_BYTE},
+        {"headers", RequestPhase::FIRST_BYTE, RequestPhase::HEADERS_COMPLETE},
+        {"body", RequestPhase::HEADERS_COMPLETE, RequestPhase::BODY_COMPLETE},
+        {"dispatch", RequestPhase::BODY_COMPLETE, RequestPhase::HANDLER_START},
+        {"handler", RequestPhase::HANDLER_START, RequestPhase::FIRST_RESPONSE_BYTE},
+        {"send", RequestPhase::FIRST_RESPONSE_BYTE, RequestPhase::LAST_BYTE},
+    }};
+
+    std::array<Clock::time_point, static_cast<size_t>(RequestPhase::COUNT)> at{};
+
+    void mark(const RequestPhase phase) {
+        Clock::time_point &time = at[static_cast<size_t>(phase)];
+        if (time == Clock::time_point{})
+            time = Clock::now();
+    }
+
+    [[nodiscard]] bool has(const RequestPhase phase) const {
+        return at[static_cast<size_t>(phase)] != Clock::time_point{};
+    }
+
+    // microseconds between two marked phases
+    [[nodiscard]] uint64_t between(const RequestPhase from, const RequestPhase to) const {
+        const auto elapsed = at[static_cast<size_t>(to)] - at[static_cast<size_t>(from)];
+        return static_cast<uint64_t>(std::max<int64_t>(
+            0, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+    }
+
+    [[nodiscard]] bool has(const Span &span) const { return has(span.from) && has(span.to); }
+
+    [[nodiscard]] uint64_t between(const Span &span) const { return between(span.from, span.to); }
+
+    void reset() { at.fill(Clock::time_point{}); }
+};
+
+
+#endif //REQUESTTIMING_H
@@ -0,0 +1,107 @@
+#include "SlowRequestLog.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <sys/wait.h>
+#include <server/ClientConnection.h>
+#include <server/cgi/CgiProcess.h>
+#include "AccessLog.h"
+#include "MetricHandler.h"
+
+std::unique_ptr<LogWriter> SlowRequestLog::writer;
+size_t SlowRequestLog::defaultThreshold = 0;
+
+bool SlowRequestLog::start(const std::string &path, const size_t threshold,
+                           const std::vector<ServerConfigPtr> &configs) {
+    defaultThreshold = threshold;
+    bool enabled = threshold > 0;
+    for (const ServerConfigPtr &config: configs) {
+        for (const RouteConfig &route: config->routes)
+            enabled = enabled || route.slow_request_threshold.value_or(0) > 0;
+    }
+    if (!enabled)
+        return true;
+    writer = LogWriter::open(path);
+    return writer != nullptr;
+}
+
+void SlowRequestLog::cleanUp() {
+    writer.reset();
+}
+
+// exit code of the script, 128 + signal like a shell when it was killed
+static void appendExit(std::string &out, const int status) {
+    if (WIFEXITED(status))
+        out += std::to_string(WEXITSTATUS(status));
+    else if (WIFSIGNALED(status))
+        out += std::to_string(128 + WTERMSIG(status));
+    else
+        out += "null";
+    out += "}\n";
+}
+
+void SlowRequestLog::log(const ClientConnection &client, const int status, const LatencyMetrics::Target &target) {
+    if (!writer)
+        return;
+    const size_t threshold = client.route && client.route->slow_request_threshold
+                                 ? *client.route->slow_request_threshold
+                                 : defaultThreshold;
+    const uint64_t duration = client.timing.between(RequestPhase::FIRST_BYTE, RequestPhase::LAST_BYTE);
+    if (threshold == 0 || duration <= threshold * 1000)
+        return;
+    MetricHandler::incrementMetric(Metric::SLOW_REQUESTS, 1);
+
+    char address[INET_ADDRSTRLEN] = "";
+    inet_ntop(AF_INET, &client.clientAddr.sin_addr, address, sizeof(address));
+
+    std::string line;
+    line.reserve(512);
+    line += "{\"time\":";
+    AccessLog::appendTime(line);
+    line += ",\"client\":\"";
+    line += address;
+    line += "\",\"listener\":";
+    AccessLog::appendString(line, target.listener);
+    line += ",\"vhost\":";
+    AccessLog::appendString(line, target.vhost);
+    line += ",\"method\":";
+    AccessLog::appendString(line, client.request ? client.request->getMethodString() : "-");
+    line += ",\"uri\":";
+    AccessLog::appendString(line, client.request ? client.request->uri : "-");
+    line += ",\"location\":";
+    AccessLog::appendString(line, target.location);
+    line += ",\"status\":" + std::to_string(status);
+    line += ",\"duration_us\":" + std::to_string(duration);
+    line += ",\"threshold_us\":" + std::to_string(threshold * 1000);
+    line += ",\"body_bytes\":" + std::to_string(client.request ? client.request->totalBodySize : 0);
+    line += ",\"bytes_sent\":" + std::to_string(client.responseBytesSent);
+    line += ",\"phases\":";
+    AccessLog::appendPhases(line, client.timing);
+    line += ",\"cgi_pid\":";
+    if (client.cgiPid == -1) {
+        line += "null,\"cgi_exit\":null}\n";
+        writer->write(line);
+        return;
+    }
+    line += std::to_string(client.cgiPid) + ",\"cgi_exit\":";
+    // a pooled worker keeps running, a script was told to stop once its output ended and is reaped shortly
+    if (!client.cgiFromWorker && CgiProcess::onExit(client.cgiPid, [line](const int exitStatus) mutable {
+        appendExit(line, exitStatus);
+        if (writer)
+            writer->write(line);
+    }))
+        return;
+    line += "null}\n";
+    writer->write(line);
+}
+
+bool SlowRequestLog::parseThreshold(const std::string &text, size_t &milliseconds) {
+    const size_t digits = std::min(text.find_first_not_of("0123456789"), text.size());
+    if (digits == 0 || digits > 9)
+        return false;
+    const std::string unit = text.substr(digits);
+    if (unit != "" && unit != "s" && unit != "ms")
+        return false;
+    milliseconds = std::stoul(text.substr(0, digits)) * (unit == "ms" ? 1 : 1000);
+    return true;
+}
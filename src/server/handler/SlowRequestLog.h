@@ -0,0 +1,34 @@
+#ifndef SLOWREQUESTLOG_H
+#define SLOWREQUESTLOG_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <config/config.h>
+#include "LatencyMetrics.h"
+#include "LogWriter.h"
+
+class ClientConnection;
+
+// One JSON line for every request that took longer than its slow_request_threshold, with the request, its
+// location, body size, script process, bytes sent and phase breakdown. Lines go through a LogWriter;
+// a line whose script was not reaped yet waits for the exit status.
+class SlowRequestLog {
+private:
+    static std::unique_ptr<LogWriter> writer;
+    static size_t defaultThreshold; // milliseconds, locations without their own threshold use it
+
+public:
+    // opens the log only when the http block or a location sets a threshold
+    static bool start(const std::string &path, size_t threshold, const std::vector<ServerConfigPtr> &configs);
+
+    static void cleanUp();
+
+    static void log(const ClientConnection &client, int status, const LatencyMetrics::Target &target);
+
+    // "250ms", "2s" or seconds like the other time directives
+    [[nodiscard]] static bool parseThreshold(const std::string &text, size_t &milliseconds);
+};
+
+
+#endif //SLOWREQUESTLOG_H
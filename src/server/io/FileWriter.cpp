@@ -0,0 +1,89 @@
+#include "FileWriter.h"
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <common/Logger.h>
+#include <server/buffer/BufferPool.h>
+#include "IoPool.h"
+
+FileWriter::FileWriter(const int fd, std::string path, const off_t offset)
+    : fd(fd), path(std::move(path)), nextOffset(offset) {
+}
+
+FileWriter::~FileWriter() {
+    if (fd >= 0)
+        close(fd);
+}
+
+void FileWriter::write(const iovec *spans, const std::shared_ptr<char> *segments, const size_t spanCount) {
+    size_t length = 0;
+    for (size_t i = 0; i < spanCount; ++i)
+        length += spans[i].iov_len;
+    // nothing more is written once the file is known to be broken
+    if (length == 0 || error != 0)
+        return;
+
+    auto job = std::make_unique<IoPool::Write>();
+    job->fd = fd;
+    job->offset = nextOffset;
+    job->length = length;
+    job->spans.reserve(spanCount);
+    for (size_t i = 0; i < spanCount; ++i) {
+        if (spans[i].iov_len == 0)
+            continue;
+        if (segments && segments[i]) {
+            job->spans.push_back(spans[i]);
+            job->blocks.push_back(segments[i]);
+            continue;
+        }
+        std::shared_ptr<char> block = BufferPool::acquireShared(spans[i].iov_len);
+        std::memcpy(block.get(), spans[i].iov_base, spans[i].iov_len);
+        job->spans.push_back({block.get(), spans[i].iov_len});
+        job->blocks.push_back(std::move(block));
+    }
+    job->onComplete = [self = shared_from_this(), length](const size_t bytes, const int result) {
+        self->inFlight -= length;
+        self->written += bytes;
+        if (result != 0 && self->error == 0) {
+            self->error = result;
+            Logger::log(LogLevel::ERROR, "Failed to write to file " + self->path + ": " + strerror(result));
+        }
+    };
+
+    nextOffset += static_cast<off_t>(length);
+    inFlight += length;
+    IoPool::submit(std::move(job));
+}
+
+void FileWriter::write(const iovec *spans, const size_t spanCount) {
+    write(spans, nullptr, spanCount);
+}
+
+void FileWriter::write(const char *data, const size_t length) {
+    const iovec span = {const_cast<char *>(data), length};
+    write(&span, 1);
+}
+
+void FileWriter::sync() {
+    if (error != 0)
+        return;
+    auto job = std::make_unique<IoPool::Write>();
+    job->fd = fd;
+    job->offset = nextOffset;
+    job->length = 0;
+    job->sync = true;
+    job->onComplete = [self = shared_from_this()](const size_t, const int result) {
+        self->syncing = false;
+        if (result != 0 && self->error == 0) {
+            self->error = result;
+            Logger::log(LogLevel::ERROR, "Failed to sync file " + self->path + ": " + strerror(result));
+        }
+    };
+    syncing = true;
+    IoPool::submit(std::move(job));
+}
+
+bool FileWriter::isOutOfSpace() const {
+    return error == ENOSPC || error == EDQUOT;
+}
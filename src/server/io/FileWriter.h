@@ -0,0 +1,55 @@
+#ifndef FILEWRITER_H
+#define FILEWRITER_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
+#include <memory>
+
+// Writes one file through the IoPool. Each chunk goes to its own offset, so chunks may finish in any order.
+// Jobs keep the writer alive, the file is closed once the owner dropped it and the last write completed.
+class FileWriter : public std::enable_shared_from_this<FileWriter> {
+private:
+    int fd;
+    std::string path;
+    off_t nextOffset = 0;
+    size_t inFlight = 0; // bytes submitted and not completed yet
+    size_t written = 0;
+    int error = 0; // errno of the first failed write
+    bool syncing = false;
+
+public:
+    // takes ownership of fd, the first write lands at offset
+    FileWriter(int fd, std::string path, off_t offset = 0);
+
+    ~FileWriter();
+
+    FileWriter(const FileWriter &) = delete;
+
+    FileWriter &operator=(const FileWriter &) = delete;
+
+    // the job holds segments[i] to keep spans[i] alive until it is on disk, nothing is copied,
+    // spans without a segment (or all of them when segments is nullptr) are copied into a pool block,
+    // so the caller may reuse that memory right away
+    void write(const iovec *spans, const std::shared_ptr<char> *segments, size_t spanCount);
+
+    void write(const iovec *spans, size_t spanCount);
+
+    void write(const char *data, size_t length);
+
+    // flushes the file to disk through the pool, only call it once the writer is idle
+    void sync();
+
+    [[nodiscard]] size_t getInFlight() const { return inFlight; }
+    [[nodiscard]] size_t getWritten() const { return written; }
+    [[nodiscard]] int getError() const { return error; }
+    [[nodiscard]] bool isIdle() const { return inFlight == 0 && !syncing; }
+    [[nodiscard]] const std::string &getPath() const { return path; }
+    [[nodiscard]] int getFd() const { return fd; }
+
+    // the disk is full or over quota, as opposed to any other write error
+    [[nodiscard]] bool isOutOfSpace() const;
+};
+
+
+#endif //FILEWRITER_H
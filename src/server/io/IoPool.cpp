@@ -0,0 +1,164 @@
+#include "IoPool.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <common/Logger.h>
+#include <server/FdHandler.h>
+#include <server/handler/MetricHandler.h>
+
+std::vector<std::thread> IoPool::threads;
+std::mutex IoPool::mutex;
+std::condition_variable IoPool::wake;
+std::deque<std::unique_ptr<IoPool::Write> > IoPool::queued;
+std::deque<std::unique_ptr<IoPool::Write> > IoPool::completed;
+bool IoPool::stopping = false;
+int IoPool::completionPipe[2] = {-1, -1};
+
+bool IoPool::start(const size_t threadCount) {
+    if (pipe(completionPipe) == -1) {
+        Logger::log(LogLevel::ERROR, "Failed to create I/O completion pipe: " + std::string(strerror(errno)));
+        return false;
+    }
+    for (const int fd: completionPipe) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    FdHandler::addFd(completionPipe[0], POLLIN, [](const int fd, const short events) {
+        (void) events;
+        char drain[64];
+        while (read(fd, drain, sizeof(drain)) > 0) {
+        }
+        return deliverCompleted();
+    });
+
+    stopping = false;
+    for (size_t i = 0; i < threadCount; ++i)
+        threads.emplace_back(run);
+    Logger::log(LogLevel::INFO, "Started " + std::to_string(threadCount) + " I/O threads");
+    return true;
+}
+
+// retries short writes until all spans are on disk or the file system reports an error such as ENOSPC
+void IoPool::perform(Write &write) {
+    iovec *spans = write.spans.data();
+    size_t spanCount = write.spans.size();
+    while (write.written < write.length) {
+        const ssize_t result = pwritev(write.fd, spans, static_cast<int>(std::min<size_t>(spanCount, IOV_MAX)),
+                                       write.offset + static_cast<off_t>(write.written));
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0) {
+            write.error = result < 0 ? errno : EIO;
+            return;
+        }
+        write.written += result;
+
+        // the next pwritev starts where this one stopped
+        auto done = static_cast<size_t>(result);
+        while (spanCount > 0 && done >= spans->iov_len) {
+            done -= spans->iov_len;
+            ++spans;
+            --spanCount;
+        }
+        if (done > 0) {
+            spans->iov_base = static_cast<char *>(spans->iov_base) + done;
+            spans->iov_len -= done;
+        }
+    }
+    while (write.sync && fsync(write.fd) == -1) {
+        if (errno != EINTR) {
+            write.error = errno;
+            return;
+        }
+    }
+}
+
+// the pipe is only written when the loop has nothing to collect yet
+void IoPool::complete(std::unique_ptr<Write> write) {
+    std::lock_guard lock(mutex);
+    completed.push_back(std::move(write));
+    if (completed.size() == 1) {
+        const char signal = 1;
+        (void) ::write(completionPipe[1], &signal, 1);
+    }
+}
+
+void IoPool::run() {
+    // signals belong to the loop thread
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    while (true) {
+        std::unique_ptr<Write> write;
+        {
+            std::unique_lock lock(mutex);
+            wake.wait(lock, [] { return stopping || !queued.empty(); });
+            if (stopping)
+                return;
+            write = std::move(queued.front());
+            queued.pop_front();
+        }
+        perform(*write);
+        complete(std::move(write));
+    }
+}
+
+void IoPool::submit(std::unique_ptr<Write> write) {
+    MetricHandler::addGauge(Gauge::IO_WRITES_PENDING, 1);
+    MetricHandler::incrementMetric(Metric::IO_WRITES, 1);
+    if (threads.empty()) {
+        perform(*write);
+        complete(std::move(write));
+        return;
+    }
+    {
+        std::lock_guard lock(mutex);
+        queued.push_back(std::move(write));
+    }
+    wake.notify_one();
+}
+
+bool IoPool::deliverCompleted() {
+    std::deque<std::unique_ptr<Write> > finished;
+    {
+        std::lock_guard lock(mutex);
+        finished.swap(completed);
+    }
+    for (const std::unique_ptr<Write> &write: finished) {
+        MetricHandler::addGauge(Gauge::IO_WRITES_PENDING, -1);
+        MetricHandler::incrementMetric(Metric::IO_WRITE_BYTES, write->written);
+        if (write->error != 0)
+            MetricHandler::incrementMetric(Metric::IO_WRITE_ERRORS, 1);
+        write->onComplete(write->written, write->error);
+    }
+    return false;
+}
+
+void IoPool::cleanUp() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &thread: threads)
+        thread.join();
+    threads.clear();
+    queued.clear();
+    completed.clear();
+    MetricHandler::setGauge(Gauge::IO_WRITES_PENDING, 0);
+
+    for (int &fd: completionPipe) {
+        if (fd == -1)
+            continue;
+        FdHandler::removeFd(fd);
+        close(fd);
+        fd = -1;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef IOPOOL_H
+#define IOPOOL_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Runs blocking file writes on a few threads, so a slow disk stalls the writing request and not the event loop.
+// Finished writes come back through a pipe the loop polls and their callbacks run on the loop thread.
+// The threads only touch the job's fd and spans, everything else stays single threaded.
+class IoPool {
+public:
+    struct Write {
+        int fd;
+        off_t offset;
+        std::vector<iovec> spans; // written back to back from offset
+        std::vector<std::shared_ptr<char> > blocks; // BufferPool blocks the spans point into, released on the loop thread with the job
+        size_t length;
+        bool sync = false; // fsync the file once the data is written
+        std::function<void(size_t written, int error)> onComplete; // error is an errno, 0 on success
+        size_t written = 0;
+        int error = 0;
+    };
+
+private:
+    static std::vector<std::thread> threads;
+    static std::mutex mutex;
+    static std::condition_variable wake;
+    static std::deque<std::unique_ptr<Write> > queued;
+    static std::deque<std::unique_ptr<Write> > completed;
+    static bool stopping;
+    static int completionPipe[2];
+
+    static void run();
+
+    static void perform(Write &write);
+
+    static void complete(std::unique_ptr<Write> write);
+
+    static bool deliverCompleted();
+
+public:
+    // without threads every write runs on the loop thread, its callback still runs from the poll loop
+    static bool start(size_t threadCount);
+
+    static void submit(std::unique_ptr<Write> write);
+
+    [[nodiscard]] static size_t getThreadCount() { return threads.size(); }
+
+    // joins the threads, writes that did not complete yet are dropped
+    static void cleanUp();
+};
+
+
+#endif //IOPOOL_H
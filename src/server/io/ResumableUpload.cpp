@@ -0,0 +1,241 @@
+#include "ResumableUpload.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstdio>
+#include <cerrno>
+#include <sys/stat.h>
+#include <random>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <filesystem>
+#include <vector>
+#include <webserv.h>
+#include <common/Logger.h>
+#include <server/handler/MetricHandler.h>
+
+std::unordered_set<std::string> ResumableUpload::busy;
+std::unordered_set<std::string> ResumableUpload::directories;
+std::time_t ResumableUpload::lastSweep = 0;
+
+std::string ResumableUpload::generateId() {
+    static std::random_device rd;
+    static std::mt19937_64 eng(rd());
+    static std::uniform_int_distribution<uint64_t> dist;
+    // the id is all a client needs to write to the upload, so it has to be hard to guess
+    std::stringstream ss;
+    ss << std::hex << std::setfill('0') << std::setw(16) << dist(eng) << std::setw(16) << dist(eng);
+    return ss.str();
+}
+
+bool ResumableUpload::isValidId(const std::string &id) {
+    if (id.length() != 32)
+        return false;
+    for (const char c: id) {
+        if (!std::isxdigit(static_cast<unsigned char>(c)))
+            return false;
+    }
+    return true;
+}
+
+static std::string decodeBase64(const std::string &in) {
+    static const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    uint32_t bits = 0;
+    int bitCount = 0;
+    for (const char c: in) {
+        if (c == '=')
+            break;
+        const size_t value = alphabet.find(c);
+        if (value == std::string::npos)
+            return "";
+        bits = (bits << 6) | static_cast<uint32_t>(value);
+        bitCount += 6;
+        if (bitCount >= 8) {
+            bitCount -= 8;
+            out += static_cast<char>((bits >> bitCount) & 0xFF);
+        }
+    }
+    return out;
+}
+
+std::string ResumableUpload::filenameOf(const std::string &metadata) {
+    std::stringstream pairs(metadata);
+    std::string pair;
+    while (std::getline(pairs, pair, ',')) {
+        pair.erase(0, pair.find_first_not_of(' '));
+        const size_t space = pair.find(' ');
+        if (pair.substr(0, space) != "filename" || space == std::string::npos)
+            continue;
+
+        const std::string filename = decodeBase64(pair.substr(space + 1));
+        // only a plain name, it ends up in the upload directory and in the info file
+        if (filename.empty() || filename == "." || filename == ".." || filename[0] == '.' ||
+            filename.find('/') != std::string::npos)
+            return "";
+        for (const char c: filename) {
+            if (static_cast<unsigned char>(c) < 0x20)
+                return "";
+        }
+        return filename;
+    }
+    return "";
+}
+
+std::optional<ResumableUpload> ResumableUpload::load(const std::string &directory, const std::string &id) {
+    ResumableUpload upload;
+    upload.directory = directory;
+    upload.id = id;
+    std::ifstream file(upload.getInfoPath());
+    if (!file.is_open())
+        return std::nullopt;
+
+    std::string line;
+    bool hasLength = false;
+    bool hasOffset = false;
+    bool hasExpires = false;
+    while (std::getline(file, line)) {
+        const size_t space = line.find(' ');
+        if (space == std::string::npos)
+            continue;
+        const std::string key = line.substr(0, space);
+        const std::string value = line.substr(space + 1);
+        try {
+            if (key == "length") {
+                upload.length = std::stoull(value);
+                hasLength = true;
+            } else if (key == "offset") {
+                upload.offset = std::stoull(value);
+                hasOffset = true;
+            } else if (key == "filename")
+                upload.filename = value;
+            else if (key == "session")
+                upload.sessionId = value;
+            else if (key == "expires") {
+                upload.expires = static_cast<std::time_t>(std::stoll(value));
+                hasExpires = true;
+            }
+        } catch (...) {
+            break;
+        }
+    }
+    if (!hasLength || !hasOffset || upload.offset > upload.length || upload.filename.empty()) {
+        Logger::log(LogLevel::ERROR, "Invalid resumable upload info: " + upload.getInfoPath());
+        return std::nullopt;
+    }
+    // uploads from before expiration was stored get the default time after their last change
+    struct stat info{};
+    if (!hasExpires && stat(upload.getInfoPath().c_str(), &info) == 0)
+        upload.expires = info.st_mtime + DEFAULT_RESUMABLE_UPLOAD_EXPIRE;
+    return upload;
+}
+
+bool ResumableUpload::save() const {
+    const std::string tempPath = getInfoPath() + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::trunc);
+        file << "length " << length << "\n"
+                << "offset " << offset << "\n"
+                << "filename " << filename << "\n"
+                << "session " << sessionId << "\n"
+                << "expires " << expires << "\n";
+        if (!file.flush()) {
+            Logger::log(LogLevel::ERROR, "Failed to write resumable upload info: " + tempPath);
+            unlink(tempPath.c_str());
+            return false;
+        }
+    }
+    if (rename(tempPath.c_str(), getInfoPath().c_str()) == -1) {
+        unlink(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void ResumableUpload::remove() const {
+    unlink(getDataPath().c_str());
+    unlink(getInfoPath().c_str());
+}
+
+bool ResumableUpload::moveTo(const std::string &target) const {
+#ifdef RENAME_NOREPLACE
+    if (renameat2(AT_FDCWD, getDataPath().c_str(), AT_FDCWD, target.c_str(), RENAME_NOREPLACE) == 0)
+        return true;
+    if (errno != EINVAL && errno != ENOSYS)
+        return false;
+#endif
+    // a file system without RENAME_NOREPLACE, link() refuses an existing name just as well
+    if (link(getDataPath().c_str(), target.c_str()) == -1)
+        return false;
+    unlink(getDataPath().c_str());
+    return true;
+}
+
+std::string ResumableUpload::getDataPath() const {
+    return (std::filesystem::path(directory) / id).string();
+}
+
+std::string ResumableUpload::getInfoPath() const {
+    return (std::filesystem::path(directory) / (id + ".info")).string();
+}
+
+bool ResumableUpload::lock(const std::string &dataPath) {
+    return busy.insert(dataPath).second;
+}
+
+void ResumableUpload::unlock(const std::string &dataPath) {
+    busy.erase(dataPath);
+}
+
+std::string ResumableUpload::getExpiresHeader() const {
+    std::tm utc{};
+    gmtime_r(&expires, &utc);
+    char buffer[32];
+    const size_t length = std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &utc);
+    return std::string(buffer, length);
+}
+
+void ResumableUpload::watch(const std::string &directory) {
+    directories.insert(std::filesystem::path(directory).lexically_normal().string());
+}
+
+size_t ResumableUpload::sweepDirectory(const std::string &directory, const std::time_t now) {
+    std::vector<ResumableUpload> expired;
+    size_t unfinished = 0;
+    std::error_code error;
+    for (const auto &entry: std::filesystem::directory_iterator(directory, error)) {
+        // every upload has one info file named after its id
+        const std::string name = entry.path().filename().string();
+        if (name.length() != 37 || name.compare(32, 5, ".info") != 0 || !isValidId(name.substr(0, 32)))
+            continue;
+        const std::optional<ResumableUpload> upload = load(directory, name.substr(0, 32));
+        if (!upload)
+            continue;
+        if (upload->isExpired(now) && !busy.count(upload->getDataPath()))
+            expired.push_back(*upload);
+        else
+            ++unfinished;
+    }
+
+    for (const ResumableUpload &upload: expired) {
+        Logger::log(LogLevel::INFO, "Removing expired resumable upload " + upload.getDataPath());
+        upload.remove();
+    }
+    MetricHandler::incrementMetric(Metric::RESUMABLE_UPLOADS_EXPIRED, expired.size());
+    return unfinished;
+}
+
+void ResumableUpload::sweep() {
+    const std::time_t now = std::time(nullptr);
+    if (now - lastSweep < RESUMABLE_UPLOAD_SWEEP_INTERVAL)
+        return;
+    lastSweep = now;
+    for (const std::string &directory: directories)
+        (void) sweepDirectory(directory, now);
+}
+
+size_t ResumableUpload::countUnfinished(const std::string &directory) {
+    watch(directory);
+    return sweepDirectory(directory, std::time(nullptr));
+}
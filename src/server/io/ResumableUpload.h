@@ -0,0 +1,76 @@
+#ifndef RESUMABLEUPLOAD_H
+#define RESUMABLEUPLOAD_H
+
+#include <ctime>
+#include <string>
+#include <optional>
+#include <unordered_set>
+
+// A tus upload that is not complete yet. Its bytes go to <upload directory>/.uploads/<id>, <id>.info next to it
+// holds the declared length, the offset up to which the data is known to be on disk, the final file name,
+// the session that created it and when it expires. The info is replaced after every PATCH and after one that
+// was cut off, so only a crash of the server loses the PATCH in flight. Expired uploads are removed by a sweep over the .uploads directories seen so far.
+class ResumableUpload {
+public:
+    static constexpr const char *DIRECTORY = ".uploads";
+    static constexpr const char *VERSION = "1.0.0";
+
+    std::string directory; // the .uploads directory
+    std::string id;
+    size_t length = 0;
+    size_t offset = 0;
+    std::string filename; // name of the completed file in the upload directory
+    std::string sessionId;
+    std::time_t expires = 0; // 0 = never
+
+private:
+    static std::unordered_set<std::string> busy; // data files a PATCH is writing right now
+    static std::unordered_set<std::string> directories; // .uploads directories the sweep looks at
+    static std::time_t lastSweep;
+
+    // removes the expired uploads of one directory, returns how many unfinished ones are left
+    static size_t sweepDirectory(const std::string &directory, std::time_t now);
+
+public:
+    [[nodiscard]] static std::string generateId();
+
+    [[nodiscard]] static bool isValidId(const std::string &id);
+
+    // the "filename" entry of an Upload-Metadata header, empty when it is missing or not a plain file name
+    [[nodiscard]] static std::string filenameOf(const std::string &metadata);
+
+    [[nodiscard]] static std::optional<ResumableUpload> load(const std::string &directory, const std::string &id);
+
+    // writes the info to a temp file and renames it over the old one
+    [[nodiscard]] bool save() const;
+
+    void remove() const;
+
+    [[nodiscard]] std::string getDataPath() const;
+    [[nodiscard]] std::string getInfoPath() const;
+    [[nodiscard]] bool isComplete() const { return offset == length; }
+    [[nodiscard]] bool isExpired(const std::time_t now) const { return expires != 0 && now >= expires; }
+
+    // the Upload-Expires header value
+    [[nodiscard]] std::string getExpiresHeader() const;
+
+    // moves the complete data to its final name, fails with EEXIST instead of replacing a file
+    [[nodiscard]] bool moveTo(const std::string &target) const;
+
+    // makes the sweep look at an .uploads directory from now on
+    static void watch(const std::string &directory);
+
+    // removes expired uploads no PATCH is writing, at most once per RESUMABLE_UPLOAD_SWEEP_INTERVAL
+    static void sweep();
+
+    // unfinished uploads in an .uploads directory, after the expired ones are removed
+    [[nodiscard]] static size_t countUnfinished(const std::string &directory);
+
+    // one PATCH at a time, a second one would write at the same offset
+    [[nodiscard]] static bool lock(const std::string &dataPath);
+
+    static void unlock(const std::string &dataPath);
+};
+
+
+#endif //RESUMABLEUPLOAD_H
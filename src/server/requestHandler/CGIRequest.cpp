@@ -1,10 +1,16 @@
 #include <unistd.h>
-#include <sys/wait.h>
 #include <poll.h>
 #include <fcntl.h>
-#include <csignal>
+#include <sys/uio.h>
+#include <strings.h>
 #include <filesystem>
 #include <server/FdHandler.h>
+#include <server/buffer/BufferPool.h>
+#include <server/cgi/CgiWorkerPool.h>
+#include <server/cgi/CgiProcess.h>
+#include <server/handler/CallbackHandler.h>
+#include <server/handler/MetricHandler.h>
+#include <webserv.h>
 
 #include "common/Logger.h"
 #include "RequestHandler.h"
@@ -22,30 +28,33 @@ bool RequestHandler::validateCgiEnvironment() const {
     return true;
 }
 
+// close-on-exec keeps one request's pipes out of every other cgi process, the child gets its ends through dup2
 static bool setupPipes(int input_pipe[2], int output_pipe[2]) {
-    if (pipe(input_pipe) < 0 || pipe(output_pipe) < 0) {
-        Logger::log(LogLevel::ERROR, "Failed to create pipes for CGI");
+    if (pipe(input_pipe) < 0)
+        return false;
+    if (pipe(output_pipe) < 0) {
+        close(input_pipe[0]);
+        close(input_pipe[1]);
         return false;
     }
 
+    for (const int fd: {input_pipe[0], input_pipe[1], output_pipe[0], output_pipe[1]})
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(input_pipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(output_pipe[0], F_SETFL, O_NONBLOCK);
     return true;
 }
 
-void RequestHandler::configureCgiChildProcess(int input_pipe[2], int output_pipe[2]) const {
-    const std::string filePath = getFilePath();
-    dup2(input_pipe[0], STDIN_FILENO);
-    dup2(output_pipe[1], STDOUT_FILENO);
-    //int devNull = open("/dev/null", O_WRONLY);
-    //dup2(devNull, STDERR_FILENO);
-    //close(devNull);
-
+static void closePipes(const int input_pipe[2], const int output_pipe[2]) {
     close(input_pipe[0]);
     close(input_pipe[1]);
     close(output_pipe[0]);
     close(output_pipe[1]);
+}
 
+std::unordered_map<std::string, std::string> RequestHandler::buildCgiEnvironment() const {
     std::unordered_map<std::string, std::string> env;
-    std::string scriptFileName = std::filesystem::path(filePath).filename().string();
+    const std::string scriptFileName = std::filesystem::path(getFilePath()).filename().string();
 
     for (const auto &header: request->headers) {
         std::string name = header.first;
@@ -70,88 +79,155 @@ void RequestHandler::configureCgiChildProcess(int input_pipe[2], int output_pipe
     env["SERVER_PROTOCOL"] = "HTTP/1.1";
     env["SERVER_SOFTWARE"] = "Webserv/1.0";
     env["GATEWAY_INTERFACE"] = "CGI/1.1";
-    env["SERVER_NAME"] = serverConfig.host;
-    env["SERVER_PORT"] = std::to_string(serverConfig.port);
+    env["SERVER_NAME"] = serverConfig->host;
+    env["SERVER_PORT"] = std::to_string(serverConfig->port);
     env["PATH_INFO"] = request->getPath();
     env["SCRIPT_NAME"] = request->getPath();
     env["REQUEST_URI"] = request->getUri();
     env["SCRIPT_FILENAME"] = scriptFileName;
     env["REDIRECT_STATUS"] = "200";
+    return env;
+}
 
-
-    std::vector<char *> envp;
-    for (const auto &[fst, snd]: env) {
-        std::string envVar = fst + "=" + snd;
-        envp.push_back(strdup(envVar.data()));
+HttpResponse RequestHandler::buildCgiResponse(const CgiParser::CgiResult &result) {
+    HttpResponse response(HttpResponse::StatusCode::OK);
+    for (const auto &header: result.headers) {
+        if (strcasecmp(header.first.c_str(), "Status") == 0) {
+            const int statusCode = std::stoi(header.second.substr(0, 3));
+            response.setStatus(statusCode);
+        } else if (!header.first.empty())
+            response.setHeader(header.first, header.second);
     }
-    envp.push_back(nullptr);
-
-    std::filesystem::path path = filePath;
-    std::string parentPath = path.parent_path().string();
+    for (const auto &cookie: result.setCookies)
+        response.addSetCookie(cookie);
+    response.enableChunkedEncoding(result.body);
+    return response;
+}
 
-    chdir(parentPath.c_str());
+// the response goes out as soon as the headers are parsed, the body follows while the script is still running
+void RequestHandler::forwardCgiOutput(const char *data, const size_t length) {
+    cgiParser.parse(data, length);
+    if (cgiResponseStarted || !cgiParser.hasHeaders() || cgiParser.hasError() || client->hasPendingResponse())
+        return;
 
+    cgiResponseStarted = true;
+    cgiParser.getResult().body->setStreaming(true);
+    const std::time_t processStart = client->cgiProcessStart;
+    HttpResponse response = buildCgiResponse(cgiParser.getResult());
+    if (cgiCacheStatus)
+        response.setHeader("X-Cache-Status", cgiCacheStatus);
+    setResponse(response);
+    // the cgi timeout keeps watching the script while the body streams
+    client->cgiProcessStart = processStart;
+}
 
-    char *const argv[] = {const_cast<char *>(cgiPath.c_str()), const_cast<char *>(scriptFileName.c_str()), nullptr};
-    execve(cgiPath.c_str(), argv, envp.data());
+// false when the script never produced a valid response and the caller still has to answer the client
+bool RequestHandler::finishCgiOutput(const bool success) {
+    releaseCgiSlot();
+    finishCgiCacheFill(success);
+    if (cgiResponseStarted) {
+        cgiParser.getResult().body->setStreaming(false);
+        client->cgiProcessStart = 0;
+        // the headers are out already, a cut connection is the only way to tell the client the body is incomplete
+        if (!success)
+            client->shouldClose = true;
+        return true;
+    }
 
-    Logger::log(LogLevel::ERROR, "Failed to execute CGI script: " + scriptFileName + " with interpreter: " + cgiPath);
-    Logger::log(LogLevel::ERROR, strerror(errno));
-    _exit(EXIT_FAILURE);
+    // the cgi timeout already answered the client
+    return client->hasPendingResponse();
 }
 
-void RequestHandler::cleanupCgiProcess(const pid_t pid) const {
-    int status = 0;
-    const pid_t result = waitpid(pid, &status, WNOHANG);
+void RequestHandler::pauseCgiOutput() {
+    Logger::log(LogLevel::DEBUG, "Client is behind, pausing CGI output");
+    cgiResumeCallbackId = static_cast<ssize_t>(CallbackHandler::registerCallback([this]() {
+        if (cgiParser.getResult().body->getPendingSize() > CGI_OUTPUT_BACKLOG_LIMIT / 2)
+            return false;
+        cgiResumeCallbackId = -1;
+        FdHandler::addFd(cgiOutputFd, POLLIN, cgiOutputCallback);
+        return true;
+    }));
+}
 
-    if (result == 0) {
-        std::cout << pid << " exited with status " << WEXITSTATUS(status) << std::endl;
-        std::cout << "CGI process is still running, sending SIGTERM" << std::endl;
-        kill(pid, SIGTERM);
-        return;
+void RequestHandler::abortCgiOutput() {
+    if (cgiOutputFd != -1) {
+        cgiParser.getResult().body->clearSpliceSource();
+        FdHandler::removeFd(cgiOutputFd);
+        close(cgiOutputFd);
+        cgiOutputFd = -1;
     }
+    if (cgiProcessId != -1) {
+        CgiProcess::terminate(cgiProcessId);
+        cgiProcessId = -1;
+    }
+    if (finishCgiOutput(false))
+        return;
+    setResponse(bodyError(*request->body));
+}
 
-    if (WIFEXITED(status)) {
-        if (const int exitCode = WEXITSTATUS(status); exitCode == 1) {
-            Logger::log(LogLevel::ERROR, "CGI process exited with code: " + std::to_string(exitCode));
-            const HttpResponse response = HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
-                                                             "CGI Error: Process exited with code " + std::to_string(
-                                                                 exitCode));
-            setResponse(response);
-            return;
-        }
+// the header block has to be parsed and a body for the cache has to be kept, everything else needs no copy
+bool RequestHandler::canSpliceCgiOutput() const {
+#ifdef SPLICE_F_MOVE
+    return cgiResponseStarted && !cgiCacheFilling && !cgiParser.isComplete() && client->hasPendingResponse() &&
+           client->getResponse()->getBody() == cgiParser.getResult().body;
+#else
+    return false;
+#endif
+}
 
-        Logger::log(LogLevel::DEBUG, "CGI process exited successfully");
-    }
+// the client connection moves the rest of the body from the pipe into its socket as the socket drains
+void RequestHandler::spliceCgiOutput(const pid_t pid) {
+    Logger::log(LogLevel::DEBUG, "Splicing CGI output to the client");
+    cgiParser.getResult().body->setSpliceSource(cgiOutputFd, cgiParser.getRemainingBody(),
+                                                [this, pid](const bool complete) {
+                                                    close(cgiOutputFd);
+                                                    cgiOutputFd = -1;
+                                                    CgiProcess::terminate(pid);
+                                                    cgiProcessId = -1;
+                                                    if (!complete)
+                                                        Logger::log(LogLevel::ERROR,
+                                                                    "CGI output ended before its Content-Length");
+                                                    (void) finishCgiOutput(complete);
+                                                });
 }
 
 std::optional<HttpResponse> RequestHandler::handleCgi() {
+    // a warm worker skips fork and interpreter startup, a busy pool falls back to a process per request
+    if (const auto workers = matchedRoute->cgi_workers.find(getFileExtension(getFilePath()));
+        workers != matchedRoute->cgi_workers.end()) {
+        cgiWorker = CgiWorkerPool::acquire(cgiPath, workers->second);
+        if (cgiWorker)
+            return handleCgiWorker();
+    }
+
     int input_pipe[2]; // Parent -> Child
     int output_pipe[2]; // Child -> Parent
 
     if (!setupPipes(input_pipe, output_pipe)) {
+        Logger::log(LogLevel::ERROR, "Failed to create pipes for CGI: " + std::string(strerror(errno)));
         return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
                                   "CGI Error: Could not create pipes");
     }
 
-    const pid_t pid = fork();
+    // the environment is built here, the child only applies the file actions and execs
+    const std::string filePath = getFilePath();
+    CgiProcess::SpawnOptions options{
+        cgiPath, {cgiPath, std::filesystem::path(filePath).filename().string()}, {},
+        std::filesystem::path(filePath).parent_path().string(), input_pipe[0], output_pipe[1]
+    };
+    for (const auto &[name, value]: buildCgiEnvironment())
+        options.environment.push_back(name + "=" + value);
+
+    const pid_t pid = CgiProcess::spawn(options);
     if (pid < 0) {
-        close(input_pipe[0]);
-        close(input_pipe[1]);
-        close(output_pipe[0]);
-        close(output_pipe[1]);
-        Logger::log(LogLevel::ERROR, "Failed to fork process for CGI");
+        closePipes(input_pipe, output_pipe);
         return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
-                                  "CGI Error: Could not fork process");
-    }
-
-
-    if (pid == 0) {
-        configureCgiChildProcess(input_pipe, output_pipe);
+                                  "CGI Error: Could not start process");
     }
     Logger::log(LogLevel::DEBUG, "CGI started with PID: " + std::to_string(pid));
 
     cgiProcessId = pid;
+    client->cgiPid = pid;
 
     close(input_pipe[0]);
     close(output_pipe[1]);
@@ -159,12 +235,8 @@ std::optional<HttpResponse> RequestHandler::handleCgi() {
     cgiInputFd = input_pipe[1];
 
     Logger::log(LogLevel::DEBUG, "request->totalBodySize: " + std::to_string(request->totalBodySize) +
-                                 " request->body->getSize(): " + std::to_string(request->body->getSize()));
-
-    if (fcntl(cgiInputFd, F_SETFL, O_NONBLOCK) == -1) {
-        perror("fcntl F_SETFL");
-        return 1;
-    }
+                                 " request->body->getSize(): " +
+                                 std::to_string(request->body ? request->body->getSize() : 0));
 
     client->cgiProcessStart = std::time(nullptr);
 
@@ -177,30 +249,52 @@ std::optional<HttpResponse> RequestHandler::handleCgi() {
             return true;
         }
 
-        if (request->body->isStillWriting())
-            return false;
-
+        if (static_cast<size_t>(bytesWrittenToCgi) >= request->totalBodySize || !request->body) {
+            Logger::log(LogLevel::DEBUG, "Finished writing to CGI process");
+            close(fd);
+            cgiInputFd = -1;
+            return true;
+        }
 
-        // TODO: magic number, look at max bytes for pipes to write
-        request->body->read(30000);
+        // a spilled body goes from its file into the pipe without passing through user space
+        if (const ssize_t spliced = request->body->spliceTo(fd, CGI_PIPE_CHUNK_SIZE); spliced != 0) {
+            if (spliced < 0 && errno != EAGAIN) {
+                Logger::log(LogLevel::ERROR, "Failed to splice to CGI process: " + std::string(strerror(errno)));
+                close(fd);
+                cgiInputFd = -1;
+                // the script must not run on a truncated body when the spill file broke
+                if (request->body->hasFailed())
+                    abortCgiOutput();
+                return true;
+            }
+            if (spliced > 0) {
+                bytesWrittenToCgi += spliced;
+                MetricHandler::incrementMetric(Metric::BYTES_SPLICED, spliced);
+            }
+            return false;
+        }
 
-        if (static_cast<size_t>(bytesWrittenToCgi) >= request->totalBodySize) {
-            Logger::log(LogLevel::DEBUG, "Finished writing to CGI process");
+        request->body->read(CGI_PIPE_CHUNK_SIZE);
+        if (request->body->hasFailed()) {
+            Logger::log(LogLevel::ERROR, "Request body was lost before it reached the CGI process");
             close(fd);
+            cgiInputFd = -1;
+            abortCgiOutput();
             return true;
         }
 
-        const std::string readBuffer = request->body->getReadBuffer();
-        if (!readBuffer.empty()) {
-            const ssize_t written = write(fd, readBuffer.data(),
-                                          std::min(readBuffer.length(), static_cast<size_t>(60000)));
+        iovec spans[SmartBuffer::MAX_SPANS];
+        size_t spanCount = SmartBuffer::MAX_SPANS;
+        if (request->body->peek(spans, spanCount, CGI_PIPE_CHUNK_SIZE) > 0) {
+            const ssize_t written = writev(fd, spans, static_cast<int>(spanCount));
             if (written <= 0) {
                 Logger::log(LogLevel::ERROR, "Failed to write to CGI process: " + std::to_string(errno));
                 close(fd);
+                cgiInputFd = -1;
                 return true;
             }
             bytesWrittenToCgi += written;
-            request->body->cleanReadBuffer(written);
+            request->body->consume(written);
         }
 
 
@@ -208,61 +302,42 @@ std::optional<HttpResponse> RequestHandler::handleCgi() {
     });
     cgiOutputFd = output_pipe[0];
 
-    if (fcntl(cgiOutputFd, F_SETFL, O_NONBLOCK) == -1) {
-        perror("fcntl F_SETFL");
-        return 1;
-    }
-
-    FdHandler::addFd(output_pipe[0], POLLIN | POLLHUP, [pid, this](int fd, short events) {
+    cgiOutputCallback = [pid, this](const int fd, const short events) {
         (void) events;
 
-        ssize_t bytesRead = 0;
-        char buffer[60000];
-        bytesRead = read(fd, buffer, sizeof(buffer) - 1);
+        const BufferPool::Block block(CGI_PIPE_CHUNK_SIZE);
+        const ssize_t bytesRead = read(fd, block.data(), block.size());
         if (bytesRead == -1)
             return false;
-        if (bytesRead >= 0) {
-            buffer[bytesRead] = '\0';
-        }
-        if ((cgiParser.parse(buffer, bytesRead)) || bytesRead == 0) {
+        if (bytesRead > 0)
+            forwardCgiOutput(block.data(), bytesRead);
+
+        if (cgiParser.isComplete() || cgiParser.hasError() || bytesRead == 0) {
             close(fd);
-            const auto result = cgiParser.getResult();
-            HttpResponse response(HttpResponse::StatusCode::OK);
-            for (const auto &header: result.headers) {
-                if (header.first == "Status") {
-                    const int statusCode = std::stoi(header.second.substr(0, 3));
-                    response.setStatus(statusCode);
-                } else if (!header.first.empty())
-                    response.setHeader(header.first, header.second);
+            cgiOutputFd = -1;
+            // the script is done or broke its output, it is reaped once it exits
+            CgiProcess::terminate(pid);
+            cgiProcessId = -1;
+            if (!finishCgiOutput(!cgiParser.hasError())) {
+                Logger::log(LogLevel::ERROR, "CGI process error parsing error");
+                setResponse(HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
+                                               "CGI Error: Could not parse output"));
             }
-            for (const auto& cookie: result.setCookies)
-                response.addSetCookie(cookie);
-            response.enableChunkedEncoding(result.body);
-            setResponse(response);
-            cleanupCgiProcess(pid);
             return true;
         }
 
-        if (cgiParser.hasError()) {
-            close(fd);
-            cleanupCgiProcess(pid);
-            Logger::log(LogLevel::ERROR, "CGI process error parsing error");
-            const HttpResponse response = HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
-                                                             "CGI Error: Could not parse output");
-            setResponse(response);
+        if (canSpliceCgiOutput()) {
+            spliceCgiOutput(pid);
             return true;
         }
 
-
-        if (events & POLLHUP) {
-            Logger::log(LogLevel::ERROR, "CGI process error reading");
-            const HttpResponse response = HttpResponse::html(HttpResponse::StatusCode::OK,
-                                                             "CGI Error: Could not parse output");
-            setResponse(response);
+        // the pipe fills up and blocks the script until the client caught up
+        if (cgiResponseStarted && cgiParser.getResult().body->getPendingSize() >= CGI_OUTPUT_BACKLOG_LIMIT) {
+            pauseCgiOutput();
             return true;
         }
-
         return false;
-    });
+    };
+    FdHandler::addFd(cgiOutputFd, POLLIN, cgiOutputCallback);
     return std::nullopt;
 }
@@ -0,0 +1,84 @@
+#include <server/cgi/CgiCache.h>
+#include <webserv.h>
+
+#include "common/Logger.h"
+#include "RequestHandler.h"
+#include "server/ClientConnection.h"
+
+std::optional<HttpResponse> RequestHandler::handleCgiCache() {
+    // the response to an authorized request belongs to that client only
+    if ((request->method != GET && request->method != HEAD) || !request->getHeader("Authorization").empty())
+        return executeCgi();
+
+    cgiCacheKey = CgiCache::keyFor(*request, *serverConfig, matchedRoute->cgi_cache);
+    // a HEAD response has no body to cache, it only uses what a GET stored
+    auto [lookup, response] = CgiCache::lookup(cgiCacheKey, request->method == GET);
+    switch (lookup) {
+        case CgiCache::Lookup::HIT:
+        case CgiCache::Lookup::STALE:
+            return response;
+        case CgiCache::Lookup::WAIT:
+            Logger::log(LogLevel::DEBUG, "Waiting for the running CGI request to fill the cache");
+            // the cgi timeout also bounds the wait
+            client->cgiProcessStart = std::time(nullptr);
+            cgiCacheWaitId = CgiCache::wait(cgiCacheKey, [this](const bool stored) {
+                onCgiCacheFilled(stored);
+            });
+            return std::nullopt;
+        case CgiCache::Lookup::MISS:
+            cgiCacheStatus = "MISS";
+            cgiCacheFilling = true;
+            cgiParser.setBodyListener([this](const char *data, const size_t length) {
+                if (!cgiCacheFilling)
+                    return;
+                if (cgiCacheBody.size() + length > CGI_CACHE_MAX_ENTRY_SIZE) {
+                    Logger::log(LogLevel::DEBUG, "CGI response is too big for the cache");
+                    finishCgiCacheFill(false);
+                    return;
+                }
+                cgiCacheBody.append(data, length);
+            });
+            break;
+        case CgiCache::Lookup::BYPASS:
+            cgiCacheStatus = "BYPASS";
+            break;
+    }
+
+    auto result = executeCgi();
+    // the script never ran
+    if (result.has_value())
+        finishCgiCacheFill(false);
+    return result;
+}
+
+void RequestHandler::onCgiCacheFilled(const bool stored) {
+    cgiCacheWaitId = 0;
+    // the cgi timeout already answered the client
+    if (client->hasPendingResponse())
+        return;
+    client->cgiProcessStart = 0;
+
+    if (stored) {
+        if (auto [lookup, response] = CgiCache::lookup(cgiCacheKey, false); response.has_value()) {
+            setResponse(response.value());
+            return;
+        }
+    }
+
+    // the output could not be cached, every waiting request runs the script on its own
+    cgiCacheStatus = "BYPASS";
+    if (const auto response = executeCgi(); response.has_value())
+        setResponse(response.value());
+}
+
+void RequestHandler::finishCgiCacheFill(const bool success) {
+    if (!cgiCacheFilling)
+        return;
+    cgiCacheFilling = false;
+
+    const CgiParser::CgiResult &result = cgiParser.getResult();
+    if (!success || !cgiParser.hasHeaders() || cgiParser.hasError() ||
+        !CgiCache::store(cgiCacheKey, matchedRoute->cgi_cache, result.headers, result.setCookies, cgiCacheBody))
+        CgiCache::abandon(cgiCacheKey);
+    cgiCacheBody = std::string();
+}
@@ -0,0 +1,39 @@
+#include <filesystem>
+
+#include "common/Logger.h"
+#include "RequestHandler.h"
+#include "server/ClientConnection.h"
+
+std::optional<HttpResponse> RequestHandler::handleCgiWorker() {
+    if (!std::filesystem::is_regular_file(getFilePath())) {
+        cgiWorker.reset();
+        return HttpResponse::html(HttpResponse::StatusCode::NOT_FOUND);
+    }
+
+    // the worker changes into the script's directory itself, so it gets the absolute script path
+    auto env = buildCgiEnvironment();
+    env["SCRIPT_FILENAME"] = std::filesystem::absolute(getFilePath()).lexically_normal().string();
+
+    client->cgiProcessStart = std::time(nullptr);
+    client->cgiPid = cgiWorker->getPid();
+    client->cgiFromWorker = true;
+    cgiWorker->begin(env, request->body, request->totalBodySize, {
+                         .onStdout = [this](const char *data, const size_t length) {
+                             forwardCgiOutput(data, length);
+                         },
+                         .onComplete = [this](const bool success) {
+                             onCgiWorkerComplete(success);
+                         },
+                     });
+    return std::nullopt;
+}
+
+void RequestHandler::onCgiWorkerComplete(const bool success) {
+    cgiWorker.reset();
+
+    if (finishCgiOutput(success && !cgiParser.hasError()))
+        return;
+    Logger::log(LogLevel::ERROR, "CGI worker returned no valid response");
+    setResponse(HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
+                                   "CGI Error: Could not parse output"));
+}
@@ -0,0 +1,41 @@
+#include <filesystem>
+#include <server/fastcgi/FastCgiPool.h>
+
+#include "common/Logger.h"
+#include "RequestHandler.h"
+#include "server/ClientConnection.h"
+
+std::optional<HttpResponse> RequestHandler::handleFastCgi() {
+    if (!std::filesystem::is_regular_file(getFilePath()))
+        return HttpResponse::html(HttpResponse::StatusCode::NOT_FOUND);
+
+    fastCgiConnection = FastCgiPool::acquire(fastCgiAddress);
+    if (!fastCgiConnection)
+        return HttpResponse::html(HttpResponse::StatusCode::BAD_GATEWAY,
+                                  "FastCGI Error: Could not connect to upstream");
+
+    // the upstream does not share our working directory, so it gets the absolute script path
+    auto params = buildCgiEnvironment();
+    params["SCRIPT_FILENAME"] = std::filesystem::absolute(getFilePath()).lexically_normal().string();
+
+    client->cgiProcessStart = std::time(nullptr);
+    fastCgiConnection->begin(params, request->body, request->totalBodySize, {
+                                 .onStdout = [this](const char *data, const size_t length) {
+                                     forwardCgiOutput(data, length);
+                                 },
+                                 .onComplete = [this](const bool success) {
+                                     onFastCgiComplete(success);
+                                 },
+                             });
+    return std::nullopt;
+}
+
+void RequestHandler::onFastCgiComplete(const bool success) {
+    fastCgiConnection.reset();
+
+    if (finishCgiOutput(success && !cgiParser.hasError()))
+        return;
+    Logger::log(LogLevel::ERROR, "FastCGI upstream " + fastCgiAddress + " returned no valid response");
+    setResponse(HttpResponse::html(HttpResponse::StatusCode::BAD_GATEWAY,
+                                   "FastCGI Error: Invalid upstream response"));
+}
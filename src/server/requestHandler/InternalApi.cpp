@@ -12,8 +12,18 @@
 #endif
 #include <server/ServerPool.h>
 #include <server/handler/MetricHandler.h>
+#include <server/handler/LatencyMetrics.h>
+#include <server/buffer/BufferPool.h>
+#include <server/fastcgi/FastCgiPool.h>
+#include <server/cgi/CgiWorkerPool.h>
+#include <server/cgi/CgiProcess.h>
+#include <server/cgi/CgiCache.h>
+#include <server/cgi/CgiLimiter.h>
+#include <server/io/IoPool.h>
 #include <sys/statvfs.h>
+#include <charconv>
 #include <common/Logger.h>
+#include <common/SessionManager.h>
 
 HttpResponse metrics(std::shared_ptr<HttpRequest> request) {
     (void) request;
@@ -22,15 +32,56 @@ HttpResponse metrics(std::shared_ptr<HttpRequest> request) {
     response.setHeader("Content-Type", "application/json");
 
     JsonValue::JsonObject jsonObj;
-    jsonObj["connection_count"] = std::make_shared<JsonValue>(ServerPool::getClientCount());
-
     int uptimeSeconds = std::time(nullptr) - ServerPool::getStartTime();
     jsonObj["uptime"] = std::make_shared<JsonValue>(uptimeSeconds);
 
     jsonObj["last_update"] = std::make_shared<JsonValue>(MetricHandler::getLastResetTime());
 
-    for (const auto&[fst, snd] : MetricHandler::getAllFullMetric())
-        jsonObj[fst] = std::make_shared<JsonValue>(static_cast<ssize_t>(snd));
+    for (size_t i = 0; i < MetricHandler::METRIC_COUNT; ++i) {
+        const auto metric = static_cast<Metric>(i);
+        jsonObj[MetricHandler::getName(metric)] = std::make_shared<JsonValue>(
+            static_cast<ssize_t>(MetricHandler::getFullMetric(metric)));
+    }
+    for (size_t i = 0; i < MetricHandler::GAUGE_COUNT; ++i) {
+        const auto gauge = static_cast<Gauge>(i);
+        jsonObj[MetricHandler::getName(gauge)] = std::make_shared<JsonValue>(MetricHandler::getGauge(gauge));
+    }
+
+    if (const size_t requests = MetricHandler::getFullMetric(Metric::FASTCGI_REQUESTS); requests > 0) {
+        const size_t totalTime = MetricHandler::getFullMetric(Metric::FASTCGI_UPSTREAM_TIME_US);
+        jsonObj["fastcgi_upstream_latency_us"] = std::make_shared<JsonValue>(static_cast<ssize_t>(totalTime / requests));
+    }
+    jsonObj["fastcgi_idle_connections"] = std::make_shared<JsonValue>(static_cast<ssize_t>(FastCgiPool::getIdleCount()));
+    jsonObj["cgi_workers"] = std::make_shared<JsonValue>(static_cast<ssize_t>(CgiWorkerPool::getWorkerCount()));
+    jsonObj["cgi_workers_idle"] = std::make_shared<JsonValue>(static_cast<ssize_t>(CgiWorkerPool::getIdleCount()));
+    jsonObj["cgi_cache_entries"] = std::make_shared<JsonValue>(static_cast<ssize_t>(CgiCache::getEntryCount()));
+    jsonObj["cgi_cache_memory_bytes"] = std::make_shared<JsonValue>(static_cast<ssize_t>(CgiCache::getMemoryUsed()));
+    jsonObj["cgi_cache_disk_bytes"] = std::make_shared<JsonValue>(static_cast<ssize_t>(CgiCache::getDiskUsed()));
+    jsonObj["cgi_active"] = std::make_shared<JsonValue>(static_cast<ssize_t>(CgiLimiter::getActiveCount()));
+    jsonObj["cgi_queued"] = std::make_shared<JsonValue>(static_cast<ssize_t>(CgiLimiter::getQueuedCount()));
+    jsonObj["cgi_processes"] = std::make_shared<JsonValue>(static_cast<ssize_t>(CgiProcess::getRunningCount()));
+    const SessionManager::Stats sessionStats = SessionManager::getStats();
+    jsonObj["sessions"] = std::make_shared<JsonValue>(static_cast<ssize_t>(sessionStats.sessions));
+    jsonObj["session_files"] = std::make_shared<JsonValue>(static_cast<ssize_t>(sessionStats.files));
+    jsonObj["session_memory_bytes"] = std::make_shared<JsonValue>(static_cast<ssize_t>(sessionStats.memoryBytes));
+    jsonObj["sessions_expired"] = std::make_shared<JsonValue>(static_cast<ssize_t>(sessionStats.expired));
+    jsonObj["sessions_evicted"] = std::make_shared<JsonValue>(static_cast<ssize_t>(sessionStats.evicted));
+
+    JsonValue::JsonArray poolClasses;
+    for (const BufferPool::ClassStats &stats: BufferPool::getStats()) {
+        JsonValue::JsonObject classObj;
+        classObj["block_size"] = std::make_shared<JsonValue>(static_cast<ssize_t>(stats.blockSize));
+        classObj["blocks_total"] = std::make_shared<JsonValue>(static_cast<ssize_t>(stats.totalBlocks));
+        classObj["blocks_in_use"] = std::make_shared<JsonValue>(static_cast<ssize_t>(stats.totalBlocks - stats.freeBlocks));
+        classObj["acquires"] = std::make_shared<JsonValue>(static_cast<ssize_t>(stats.acquires));
+        classObj["releases"] = std::make_shared<JsonValue>(static_cast<ssize_t>(stats.releases));
+        poolClasses.push_back(std::make_shared<JsonValue>(classObj));
+    }
+    JsonValue::JsonObject poolObj;
+    poolObj["reserved_bytes"] = std::make_shared<JsonValue>(static_cast<ssize_t>(BufferPool::getReservedBytes()));
+    poolObj["classes"] = std::make_shared<JsonValue>(poolClasses);
+    poolObj["buffered_bytes"] = std::make_shared<JsonValue>(static_cast<ssize_t>(SmartBuffer::getResidentBytes()));
+    jsonObj["buffer_pool"] = std::make_shared<JsonValue>(poolObj);
 
 
     auto metricsObj = std::make_shared<JsonValue>(jsonObj);
@@ -41,6 +92,205 @@ HttpResponse metrics(std::shared_ptr<HttpRequest> request) {
     return response;
 }
 
+static std::string percentileName(const double percent) {
+    std::ostringstream name;
+    name << "p" << percent;
+    return name.str();
+}
+
+static JsonValue::JsonObject histogramObject(const LatencyHistogram &histogram, const std::vector<double> &percentiles) {
+    JsonValue::JsonObject histogramObj;
+    const uint64_t count = histogram.getCount();
+    histogramObj["mean"] = std::make_shared<JsonValue>(static_cast<ssize_t>(count ? histogram.getSum() / count : 0));
+    histogramObj["max"] = std::make_shared<JsonValue>(static_cast<ssize_t>(histogram.getMax()));
+    for (const double percent: percentiles)
+        histogramObj[percentileName(percent)] = std::make_shared<JsonValue>(
+            static_cast<ssize_t>(histogram.percentile(percent)));
+    return histogramObj;
+}
+
+// latencies in microseconds of the last window, ?percentiles=50,99.9 overrides latency_percentiles
+HttpResponse latency(std::shared_ptr<HttpRequest> request) {
+    std::vector<double> percentiles = ServerPool::getHttpConfig().latency_percentiles;
+    const std::string query = request->getQueryString();
+    const std::string key = "percentiles=";
+    if (const size_t pos = query.find(key); pos != std::string::npos && (pos == 0 || query[pos - 1] == '&')) {
+        percentiles.clear();
+        std::stringstream values(query.substr(pos + key.length(), query.find('&', pos) - pos - key.length()));
+        std::string value;
+        while (std::getline(values, value, ',')) {
+            double percent = 0;
+            if (!LatencyMetrics::parsePercentile(value, percent))
+                return HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST, "Invalid percentile: " + value);
+            percentiles.push_back(percent);
+        }
+    }
+
+    JsonValue::JsonArray series;
+    for (const auto &[key, target]: LatencyMetrics::getTargets()) {
+        for (size_t statusClass = 0; statusClass < LatencyMetrics::STATUS_CLASS_COUNT; ++statusClass) {
+            if (!target.statusClasses[statusClass] || target.statusClasses[statusClass]->lastWindow.total.getCount() == 0)
+                continue;
+            const LatencyMetrics::Series &entry = target.statusClasses[statusClass]->lastWindow;
+            JsonValue::JsonObject entryObj;
+            entryObj["listener"] = std::make_shared<JsonValue>(target.listener);
+            entryObj["vhost"] = std::make_shared<JsonValue>(target.vhost);
+            entryObj["location"] = std::make_shared<JsonValue>(target.location);
+            entryObj["status"] = std::make_shared<JsonValue>(std::to_string(statusClass + 1) + "xx");
+            entryObj["count"] = std::make_shared<JsonValue>(static_cast<ssize_t>(entry.total.getCount()));
+            entryObj["first_byte_us"] = std::make_shared<JsonValue>(histogramObject(entry.firstByte, percentiles));
+            entryObj["total_us"] = std::make_shared<JsonValue>(histogramObject(entry.total, percentiles));
+            series.push_back(std::make_shared<JsonValue>(entryObj));
+        }
+    }
+
+    // over every request, a span only counts the requests that went through it
+    JsonValue::JsonObject phases;
+    for (size_t i = 0; i < RequestTiming::SPANS.size(); ++i)
+        phases[RequestTiming::SPANS[i].name] = std::make_shared<JsonValue>(
+            histogramObject(LatencyMetrics::getPhases()[i].lastWindow, percentiles));
+
+    JsonValue::JsonObject jsonObj;
+    jsonObj["last_update"] = std::make_shared<JsonValue>(MetricHandler::getLastResetTime());
+    jsonObj["window_seconds"] = std::make_shared<JsonValue>(RESET_INTERVAL);
+    jsonObj["series"] = std::make_shared<JsonValue>(series);
+    jsonObj["phases"] = std::make_shared<JsonValue>(phases);
+
+    HttpResponse response(200);
+    response.setHeader("Content-Type", "application/json");
+    response.setBody(std::make_shared<JsonValue>(jsonObj)->toString());
+    response.setHeader("Access-Control-Allow-Origin", "*");
+    return response;
+}
+
+// Prometheus text exposition, written straight into one string
+static void appendNumber(std::string &out, const uint64_t value) {
+    char digits[24];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+static void appendSeconds(std::string &out, const uint64_t microseconds) {
+    appendNumber(out, microseconds / 1000000);
+    const std::string fraction = std::to_string(1000000 + microseconds % 1000000);
+    out += '.';
+    out.append(fraction, 1, std::string::npos);
+}
+
+static void appendLabelValue(std::string &out, const std::string &value) {
+    for (const char c: value) {
+        if (c == '\\' || c == '"')
+            out += '\\';
+        if (c == '\n')
+            out += "\\n";
+        else
+            out += c;
+    }
+}
+
+static void appendFamily(std::string &out, const std::string &name, const char *type, const char *help) {
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " " + type + "\n";
+}
+
+// bucket bounds in microseconds, each one is rounded down to the last histogram bucket that ends below it
+static constexpr std::array<uint64_t, 14> PROMETHEUS_BOUNDS = {
+    500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+static void appendHistogram(std::string &out, const std::string &name, const std::string &labels,
+                            const LatencyHistogram &merged, const LatencyHistogram &current) {
+    static const std::array<size_t, PROMETHEUS_BOUNDS.size()> lastBuckets = [] {
+        std::array<size_t, PROMETHEUS_BOUNDS.size()> buckets{};
+        for (size_t i = 0; i < PROMETHEUS_BOUNDS.size(); ++i) {
+            const size_t bucket = LatencyHistogram::bucketOf(PROMETHEUS_BOUNDS[i]);
+            buckets[i] = LatencyHistogram::upperBoundOf(bucket) == PROMETHEUS_BOUNDS[i] ? bucket : bucket - 1;
+        }
+        return buckets;
+    }();
+
+    uint64_t cumulative = 0;
+    size_t bucket = 0;
+    for (size_t i = 0; i < PROMETHEUS_BOUNDS.size(); ++i) {
+        for (; bucket <= lastBuckets[i]; ++bucket)
+            cumulative += merged.getBuckets()[bucket] + current.getBuckets()[bucket];
+        out += name + "_bucket{" + labels + ",le=\"";
+        appendSeconds(out, PROMETHEUS_BOUNDS[i]);
+        out += "\"} ";
+        appendNumber(out, cumulative);
+        out += '\n';
+    }
+    const uint64_t count = merged.getCount() + current.getCount();
+    out += name + "_bucket{" + labels + ",le=\"+Inf\"} ";
+    appendNumber(out, count);
+    out += "\n" + name + "_sum{" + labels + "} ";
+    appendSeconds(out, merged.getSum() + current.getSum());
+    out += "\n" + name + "_count{" + labels + "} ";
+    appendNumber(out, count);
+    out += '\n';
+}
+
+HttpResponse prometheus(std::shared_ptr<HttpRequest> request) {
+    (void) request;
+    std::string out;
+    out.reserve(64 * 1024);
+
+    const MetricHandler::Values totals = MetricHandler::getTotals();
+    for (size_t i = 0; i < MetricHandler::METRIC_COUNT; ++i) {
+        std::string name = std::string("webserv_") + MetricHandler::getName(static_cast<Metric>(i));
+        if (name.size() < 6 || name.compare(name.size() - 6, 6, "_total") != 0)
+            name += "_total";
+        out += "# TYPE " + name + " counter\n" + name + " ";
+        appendNumber(out, totals[i]);
+        out += '\n';
+    }
+    for (size_t i = 0; i < MetricHandler::GAUGE_COUNT; ++i) {
+        const auto gauge = static_cast<Gauge>(i);
+        const std::string name = std::string("webserv_") + MetricHandler::getName(gauge);
+        out += "# TYPE " + name + " gauge\n" + name + " " + std::to_string(MetricHandler::getGauge(gauge)) + "\n";
+    }
+    appendFamily(out, "webserv_uptime_seconds", "gauge", "Seconds since the server pool started.");
+    out += "webserv_uptime_seconds " + std::to_string(std::time(nullptr) - ServerPool::getStartTime()) + "\n";
+
+    // labels of every series, the same for both families
+    std::vector<std::pair<std::string, const LatencyMetrics::StatusClass *> > series;
+    for (const auto &[key, target]: LatencyMetrics::getTargets()) {
+        for (size_t statusClass = 0; statusClass < LatencyMetrics::STATUS_CLASS_COUNT; ++statusClass) {
+            if (!target.statusClasses[statusClass])
+                continue;
+            std::string labels = "listener=\"";
+            appendLabelValue(labels, target.listener);
+            labels += "\",vhost=\"";
+            appendLabelValue(labels, target.vhost);
+            labels += "\",location=\"";
+            appendLabelValue(labels, target.location);
+            labels += "\",status=\"" + std::to_string(statusClass + 1) + "xx\"";
+            series.emplace_back(std::move(labels), target.statusClasses[statusClass].get());
+        }
+    }
+    appendFamily(out, "webserv_response_first_byte_seconds", "histogram",
+                 "Time from the first byte of a request to the first byte of its response.");
+    for (const auto &[labels, statusClass]: series)
+        appendHistogram(out, "webserv_response_first_byte_seconds", labels, statusClass->merged.firstByte,
+                        statusClass->current.firstByte);
+    appendFamily(out, "webserv_response_duration_seconds", "histogram",
+                 "Time from the first byte of a request to the last byte of its response.");
+    for (const auto &[labels, statusClass]: series)
+        appendHistogram(out, "webserv_response_duration_seconds", labels, statusClass->merged.total,
+                        statusClass->current.total);
+    appendFamily(out, "webserv_request_phase_seconds", "histogram",
+                 "Time spent in each phase of a request, from accept to the last response byte.");
+    for (size_t i = 0; i < RequestTiming::SPANS.size(); ++i) {
+        const LatencyMetrics::Phase &phase = LatencyMetrics::getPhases()[i];
+        appendHistogram(out, "webserv_request_phase_seconds",
+                        std::string("phase=\"") + RequestTiming::SPANS[i].name + "\"", phase.merged, phase.current);
+    }
+
+    HttpResponse response(200);
+    response.setHeader("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+    response.setBody(out);
+    return response;
+}
 
 void InternalApi::registerRoutes(ServerConfig &serverConfig) {
     serverConfig.routes.push_back({
@@ -54,8 +304,63 @@ void InternalApi::registerRoutes(ServerConfig &serverConfig) {
         .error_pages = {},
         .deny_all = false,
         .cgi_params = {},
+        .fastcgi_pass = {},
+        .cgi_workers = {},
+        .cgi_cache = {},
+        .cgi_limit = {},
+        .put_fsync = false,
+        .resumable_upload_max_size = 0,
+        .resumable_upload_expire = 0,
+        .resumable_upload_max_count = 0,
+        .slow_request_threshold = std::nullopt,
         .return_directive = {-1, ""},
         .internalHandler = metrics,
 
     });
+    serverConfig.routes.push_back({
+        .location = "/metrics/latency",
+        .type = LocationType::PREFIX,
+        .allowedMethods = {GET},
+        .root = "",
+        .autoindex = false,
+        .index = "",
+        .alias = "",
+        .error_pages = {},
+        .deny_all = false,
+        .cgi_params = {},
+        .fastcgi_pass = {},
+        .cgi_workers = {},
+        .cgi_cache = {},
+        .cgi_limit = {},
+        .put_fsync = false,
+        .resumable_upload_max_size = 0,
+        .resumable_upload_expire = 0,
+        .resumable_upload_max_count = 0,
+        .slow_request_threshold = std::nullopt,
+        .return_directive = {-1, ""},
+        .internalHandler = latency,
+    });
+    serverConfig.routes.push_back({
+        .location = "/metrics/prometheus",
+        .type = LocationType::PREFIX,
+        .allowedMethods = {GET},
+        .root = "",
+        .autoindex = false,
+        .index = "",
+        .alias = "",
+        .error_pages = {},
+        .deny_all = false,
+        .cgi_params = {},
+        .fastcgi_pass = {},
+        .cgi_workers = {},
+        .cgi_cache = {},
+        .cgi_limit = {},
+        .put_fsync = false,
+        .resumable_upload_max_size = 0,
+        .resumable_upload_expire = 0,
+        .resumable_upload_max_count = 0,
+        .slow_request_threshold = std::nullopt,
+        .return_directive = {-1, ""},
+        .internalHandler = prometheus,
+    });
 }
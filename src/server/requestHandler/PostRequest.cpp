@@ -1,8 +1,8 @@
 #include "RequestHandler.h"
 
 #include <sys/stat.h>
+#include <algorithm>
 #include <fstream>
-#include <regex>
 #include <filesystem>
 #include <common/Logger.h>
 #include <server/ClientConnection.h>
@@ -10,6 +10,8 @@
 #include <unistd.h>
 #include <sys/poll.h>
 #include <fcntl.h>
+#include <sys/uio.h>
+#include <webserv.h>
 #include <common/SessionManager.h>
 #include <server/handler/CallbackHandler.h>
 
@@ -46,209 +48,255 @@ std::optional<HttpResponse> RequestHandler::handlePostTestFile() {
     const std::string filename = "test_file_" + std::to_string(std::time(nullptr)) + ".txt";
     const std::filesystem::path fullPath = std::filesystem::path(routePath) / filename;
 
-    fileWriteFd = open(fullPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
-                          S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-    if (fileWriteFd == -1) {
+    const int fd = open(fullPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                        S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+    if (fd == -1) {
         return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
                                   "Could not open file for writing");
     }
+    fileWriter = std::make_shared<FileWriter>(fd, fullPath.string());
 
     const std::string absolutePath = absolute(fullPath).lexically_normal().string();
     client->sessionId = SessionManager::getSessionId(request->getHeader("Cookie"), client->isNewSession);
     SessionManager::addUploadedFile(client->sessionId, absolutePath);
-    FdHandler::addFd(fileWriteFd,POLLOUT, [this, filename](const int fd, const short events) {
-        (void) events;
-        request->body->read(60000);
-
-        const std::string readBuffer = request->body->getReadBuffer();
-        if (!readBuffer.empty()) {
-            const ssize_t writen = write(fd, readBuffer.data(), readBuffer.length());
-
-            if (writen <= 0) {
-                Logger::log(LogLevel::ERROR, "Failed to write to file: " + std::to_string(fd) + ": " + strerror(errno));
-                setResponse(HttpResponse::html(HttpResponse::INTERNAL_SERVER_ERROR,
-                                                       "Failed to write to file"));
-                close(fileWriteFd);
-                fileWriteFd = -1;
+    postRequestCallbackId = CallbackHandler::registerCallback([this, filename]() {
+        if (fileWriter->getError() != 0) {
+            unlink(fileWriter->getPath().c_str());
+            setResponse(fileWriteError(*fileWriter));
+            return true;
+        }
+
+        if (!request->body->isDrained() && fileWriter->getInFlight() < UPLOAD_MAX_IN_FLIGHT) {
+            request->body->read(FILE_WRITE_CHUNK_SIZE);
+            if (request->body->hasFailed()) {
+                unlink(fileWriter->getPath().c_str());
+                setResponse(bodyError(*request->body));
                 return true;
             }
-            request->body->cleanReadBuffer(writen);
+            iovec spans[SmartBuffer::MAX_SPANS];
+            std::shared_ptr<char> segments[SmartBuffer::MAX_SPANS];
+            size_t spanCount = SmartBuffer::MAX_SPANS;
+            const size_t chunkLength = request->body->peekShared(spans, segments, spanCount, FILE_WRITE_CHUNK_SIZE);
+            fileWriter->write(spans, segments, spanCount);
+            request->body->consume(chunkLength);
         }
 
-        if (request->body->getReadPos() >= request->body->getSize()) {
-            setResponse(HttpResponse::html(HttpResponse::StatusCode::CREATED,
-                                                   "201 Created: " + filename + " file uploaded successfully"));
-            close(fileWriteFd);
-            fileWriteFd = -1;
-            return true;
-        }
-        return false;
+        if (!request->body->isDrained() || !fileWriter->isIdle())
+            return false;
+        setResponse(HttpResponse::html(HttpResponse::StatusCode::CREATED,
+                                       "201 Created: " + filename + " file uploaded successfully"));
+        return true;
     });
     return std::nullopt;
 }
 
-std::optional<HttpResponse> RequestHandler::handlePostMultipart(const std::string &contentType) {
-    std::smatch match;
-    std::regex boundaryRegex("boundary\\s*=\\s*([^;]+)");
-    if (!std::regex_search(contentType, match, boundaryRegex)) {
-        return HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST, "Missing boundary");
+HttpResponse RequestHandler::fileWriteError(const FileWriter &writer) {
+    if (writer.isOutOfSpace())
+        return HttpResponse::html(HttpResponse::StatusCode::INSUFFICIENT_STORAGE, "Not enough space to store the file");
+    return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Failed to write to file");
+}
+
+HttpResponse RequestHandler::bodyError(const SmartBuffer &body) {
+    if (body.isOutOfSpace())
+        return HttpResponse::html(HttpResponse::StatusCode::INSUFFICIENT_STORAGE, "Not enough space to buffer the body");
+    return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Failed to buffer the body");
+}
+
+// state of one multipart upload, owned by the callback that feeds the parser
+struct MultipartUpload {
+    std::unique_ptr<MultipartParser> parser;
+    std::shared_ptr<FileWriter> writer; // file of the part that is being read
+    std::vector<std::shared_ptr<FileWriter> > files; // temp file of every part, renamed once the body is complete
+    std::vector<std::string> targets; // where each of files goes
+    size_t moved = 0; // files already renamed to their target
+    std::vector<iovec> pending; // file payload of the last feed, still pointing into the body
+    std::vector<std::shared_ptr<char> > pendingSegments; // body segment of each pending span, null for parser carry
+    iovec fed[SmartBuffer::MAX_SPANS]; // the chunk that is being fed and the segments behind it
+    std::shared_ptr<char> fedSegments[SmartBuffer::MAX_SPANS];
+    size_t fedCount = 0;
+    std::string fieldName; // form field of the part that is being read
+    std::map<std::string, std::string> fields;
+    HttpResponse::StatusCode errorStatus = HttpResponse::StatusCode::BAD_REQUEST; // a malformed body by default
+    std::string error = "Malformed multipart body";
+
+    // makes the callback that reports it return false
+    bool fail(const HttpResponse::StatusCode status, const std::string &message) {
+        errorStatus = status;
+        error = message;
+        return false;
     }
 
-    std::string boundary = "--" + match[1].str();
-    std::string endBoundary = boundary + "--";
+    // payloads are handed out per fed span, the carried bytes the parser held back have no segment
+    [[nodiscard]] std::shared_ptr<char> segmentOf(const char *data, const size_t length) const {
+        for (size_t i = 0; i < fedCount; ++i) {
+            const char *base = static_cast<const char *>(fed[i].iov_base);
+            if (data >= base && data + length <= base + fed[i].iov_len)
+                return fedSegments[i];
+        }
+        return nullptr;
+    }
 
-    auto state = std::make_shared<MultipartParseState>();
-    state->boundary = boundary;
-    state->endBoundary = endBoundary;
-    state->uploadedFiles = 0;
-    state->fileNames = std::vector<std::string>();
-    state->currentState = MultipartParseStateEnum::LOOKING_FOR_BOUNDARY;
+    // one pool write per fed chunk instead of a write per span
+    void submitPending() {
+        if (writer && !pending.empty())
+            writer->write(pending.data(), pendingSegments.data(), pending.size());
+        pending.clear();
+        pendingSegments.clear();
+    }
 
-    state->parseBuffer = "";
+    [[nodiscard]] size_t getInFlight() const {
+        size_t inFlight = 0;
+        for (const auto &file: files)
+            inFlight += file->getInFlight();
+        return inFlight;
+    }
 
-    this->postRequestCallbackId = CallbackHandler::registerCallback([this, state]() {
-        // TODO: fix magic number 60000
-        request->body->read(60000);
-        std::string chunk = request->body->getReadBuffer();
+    [[nodiscard]] const FileWriter *getFailedFile() const {
+        for (const auto &file: files) {
+            if (file->getError() != 0)
+                return file.get();
+        }
+        return nullptr;
+    }
 
-        if (chunk.empty() && request->body->getReadPos() >= request->body->getSize()) {
-            if (state->fileWriteFd >= 0) {
-                close(state->fileWriteFd);
-                state->fileWriteFd = -1;
-            }
+    // a failed or abandoned upload only removes its own temp files, existing files stay untouched
+    ~MultipartUpload() {
+        for (size_t i = moved; i < files.size(); ++i)
+            unlink(files[i]->getPath().c_str());
+    }
+};
 
-            if (state->uploadedFiles == 0) {
-                setResponse(HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST,
-                                                       "No files found in request"));
-            } else {
-                setResponse(HttpResponse::html(HttpResponse::StatusCode::CREATED,
-                                                       "201 Created: " + std::to_string(state->uploadedFiles) +
-                                                       " file(s) uploaded successfully"));
-            }
+std::optional<HttpResponse> RequestHandler::handlePostMultipart(const std::string &contentType) {
+    const std::string boundary = MultipartParser::boundaryOf(contentType);
+    if (boundary.empty()) {
+        return HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST, "Missing boundary");
+    }
+
+    auto upload = std::make_shared<MultipartUpload>();
+    upload->parser = std::make_unique<MultipartParser>(boundary, multipartCallbacks(*upload));
 
+    // the body is parsed while earlier chunks are still being written, up to UPLOAD_MAX_IN_FLIGHT bytes
+    this->postRequestCallbackId = CallbackHandler::registerCallback([this, upload]() {
+        if (const FileWriter *failed = upload->getFailedFile()) {
+            setResponse(fileWriteError(*failed));
             return true;
         }
+        const size_t inFlight = upload->getInFlight();
+        if (inFlight >= UPLOAD_MAX_IN_FLIGHT)
+            return false;
 
-        state->parseBuffer.append(chunk);
-        request->body->cleanReadBuffer(chunk.length());
-
-        processMultipartBuffer(state);
+        request->body->read(FILE_WRITE_CHUNK_SIZE);
+        if (request->body->hasFailed()) {
+            setResponse(bodyError(*request->body));
+            return true;
+        }
+        if (request->body->isDrained() || upload->parser->isComplete()) {
+            if (inFlight > 0)
+                return false;
+            finishMultipartUpload(*upload);
+            return true;
+        }
 
+        upload->fedCount = SmartBuffer::MAX_SPANS;
+        const size_t chunkLength = request->body->peekShared(upload->fed, upload->fedSegments, upload->fedCount,
+                                                             FILE_WRITE_CHUNK_SIZE);
+        const bool valid = upload->parser->feed(upload->fed, upload->fedCount);
+        upload->submitPending();
+        upload->fedCount = 0;
+        std::fill(std::begin(upload->fedSegments), std::end(upload->fedSegments), nullptr);
+        request->body->consume(chunkLength);
+
+        if (!valid) {
+            setResponse(HttpResponse::html(upload->errorStatus, upload->error));
+            return true;
+        }
         return false;
     });
 
     return std::nullopt;
 }
 
-void RequestHandler::processMultipartBuffer(std::shared_ptr<MultipartParseState> state) {
-    while (!state->parseBuffer.empty()) {
-        switch (state->currentState) {
-            case MultipartParseStateEnum::LOOKING_FOR_BOUNDARY: {
-                size_t boundaryPos = state->parseBuffer.find(state->boundary);
-                if (boundaryPos == std::string::npos) {
-                    if (state->parseBuffer.size() > state->boundary.size()) {
-                        state->parseBuffer = state->parseBuffer.substr(
-                            state->parseBuffer.size() - state->boundary.size());
-                    }
-                    return;
-                }
-
-                if (boundaryPos + state->endBoundary.size() <= state->parseBuffer.size() &&
-                    state->parseBuffer.substr(boundaryPos, state->endBoundary.size()) == state->endBoundary) {
-                    state->parseBuffer.clear();
-                    return;
-                }
-
-                state->parseBuffer.erase(0, boundaryPos + state->boundary.size());
-
-                if (state->parseBuffer.size() >= 2 && state->parseBuffer.substr(0, 2) == "\r\n") {
-                    state->parseBuffer.erase(0, 2);
-                }
-
-                state->currentState = MultipartParseStateEnum::READING_HEADERS;
-                break;
-            }
+MultipartParser::Callbacks RequestHandler::multipartCallbacks(MultipartUpload &upload) {
+    MultipartParser::Callbacks callbacks;
+    callbacks.onPartBegin = [this, &upload](const MultipartParser::Part &part) {
+        if (part.filename.empty()) {
+            upload.writer.reset();
+            upload.fieldName = part.name;
+            upload.fields[part.name].clear();
+            return true;
+        }
 
-            case MultipartParseStateEnum::READING_HEADERS: {
-                size_t headersEnd = state->parseBuffer.find("\r\n\r\n");
-                if (headersEnd == std::string::npos) {
-                    return;
-                }
-
-                std::string headers = state->parseBuffer.substr(0, headersEnd);
-                state->parseBuffer.erase(0, headersEnd + 4);
-
-                std::smatch match;
-                std::regex filenameRegex("filename\\s*=\\s*\"([^\"]*)\"");
-                if (!std::regex_search(headers, match, filenameRegex) || match[1].str().empty()) {
-                    state->currentState = MultipartParseStateEnum::LOOKING_FOR_BOUNDARY;
-                    break;
-                }
-
-                std::string filename = match[1].str();
-                std::filesystem::path fullPath = std::filesystem::path(routePath) / filename;
-                state->fileNames.push_back(filename);
-
-                state->fileWriteFd = open(fullPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
-                                    S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-
-                std::string absolutePath = absolute(fullPath).lexically_normal().string();
-                client->sessionId = SessionManager::getSessionId(request->getHeader("Cookie"), client->isNewSession);
-                SessionManager::addUploadedFile(client->sessionId, absolutePath);
-                if (state->fileWriteFd == -1) {
-                    Logger::log(LogLevel::ERROR, "Failed to open file for writing: " + filename);
-                    state->currentState = MultipartParseStateEnum::LOOKING_FOR_BOUNDARY;
-                    break;
-                }
-
-                state->currentState = MultipartParseStateEnum::READING_FILE_CONTENT;
-                break;
-            }
+        // only the last path component of the client's file name is used
+        const std::string filename = std::filesystem::path(part.filename).filename().string();
+        if (filename.empty() || filename == "." || filename == "..")
+            return upload.fail(HttpResponse::StatusCode::BAD_REQUEST, "Invalid file name");
+        // like PUT the part goes to a temp file next to its target, rename() only is atomic within one file system
+        std::string tempPath = (std::filesystem::path(routePath) / ("." + filename + ".upload-XXXXXX")).string();
+        const int fd = mkostemp(tempPath.data(), O_CLOEXEC);
+        if (fd == -1) {
+            Logger::log(LogLevel::ERROR, "Failed to open file for writing: " + filename + ": " + strerror(errno));
+            return upload.fail(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Could not open file for writing");
+        }
+        // mkostemp creates the file 0600
+        fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        upload.writer = std::make_shared<FileWriter>(fd, tempPath);
+        upload.files.push_back(upload.writer);
+        upload.targets.push_back((std::filesystem::path(routePath) / filename).string());
+        return true;
+    };
+
+    callbacks.onPartData = [&upload](const char *data, const size_t length) {
+        if (!upload.writer) {
+            std::string &value = upload.fields[upload.fieldName];
+            if (value.size() + length > MULTIPART_MAX_FIELD_SIZE)
+                return upload.fail(HttpResponse::StatusCode::CONTENT_TOO_LARGE, "Form field too large");
+            value.append(data, length);
+            return true;
+        }
 
-            case MultipartParseStateEnum::READING_FILE_CONTENT: {
-                size_t nextBoundaryPos = state->parseBuffer.find(state->boundary);
-                if (nextBoundaryPos == std::string::npos) {
-                    size_t safeLength = state->parseBuffer.size() - state->boundary.size();
-                    if (safeLength > 0) {
-                        if (write(state->fileWriteFd, state->parseBuffer.data(), safeLength) <= 0) {
-                            Logger::log(LogLevel::ERROR, "Failed to write to file: " +
-                                                         std::to_string(state->fileWriteFd) + ": " + strerror(errno));
-                        }
-                        state->parseBuffer.erase(0, safeLength);
-                    }
-                    return;
-                }
-
-                size_t contentEnd = nextBoundaryPos;
-                if (contentEnd >= 2 && state->parseBuffer.substr(contentEnd - 2, 2) == "\r\n") {
-                    contentEnd -= 2;
-                }
-
-                if (contentEnd > 0) {
-                    pollfd pfd{};
-                    pfd.fd = state->fileWriteFd;
-                    pfd.events = POLLOUT;
-                    pfd.revents = 0;
-
-                    poll(&pfd, 1, 0);
-                    if (pfd.revents & POLLOUT) {
-                        if (write(state->fileWriteFd, state->parseBuffer.data(), contentEnd) <= 0) {
-                            Logger::log(LogLevel::ERROR, "Failed to write to file: " +
-                                                         std::to_string(state->fileWriteFd) + ": " + strerror(errno));
-                        }
-                    } else
-                        Logger::log(LogLevel::ERROR, "File descriptor not ready for writing: " +
-                                                     std::to_string(state->fileWriteFd));
-                }
-
-                close(state->fileWriteFd);
-                state->fileWriteFd = -1;
-                state->uploadedFiles++;
-
-                state->parseBuffer.erase(0, nextBoundaryPos);
-                state->currentState = MultipartParseStateEnum::LOOKING_FOR_BOUNDARY;
-                break;
-            }
+        upload.pending.push_back({const_cast<char *>(data), length});
+        upload.pendingSegments.push_back(upload.segmentOf(data, length));
+        return true;
+    };
+
+    callbacks.onPartEnd = [&upload]() {
+        upload.submitPending();
+        upload.writer.reset();
+        return true;
+    };
+    return callbacks;
+}
+
+void RequestHandler::finishMultipartUpload(MultipartUpload &upload) {
+    // the body ended before the closing delimiter
+    if (!upload.parser->isComplete()) {
+        setResponse(HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST, "Incomplete multipart body"));
+        return;
+    }
+
+    if (upload.files.empty()) {
+        setResponse(HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST,
+                                       "No files found in request"));
+        return;
+    }
+
+    // every part arrived, only now the files replace what is in their place
+    client->sessionId = SessionManager::getSessionId(request->getHeader("Cookie"), client->isNewSession);
+    for (; upload.moved < upload.files.size(); ++upload.moved) {
+        const std::string &target = upload.targets[upload.moved];
+        if (rename(upload.files[upload.moved]->getPath().c_str(), target.c_str()) == -1) {
+            Logger::log(LogLevel::ERROR, "Failed to move upload to " + target + ": " + strerror(errno));
+            setResponse(HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
+                                           "Could not store the uploaded files"));
+            return;
         }
+        const std::string absolutePath = std::filesystem::absolute(target).lexically_normal().string();
+        SessionManager::addUploadedFile(client->sessionId, absolutePath);
     }
+    for (const auto &[name, value]: upload.fields)
+        Logger::log(LogLevel::DEBUG, "Multipart field " + name + ": " + value.substr(0, 256));
+    setResponse(HttpResponse::html(HttpResponse::StatusCode::CREATED,
+                                   "201 Created: " + std::to_string(upload.files.size()) +
+                                   " file(s) uploaded successfully, " + std::to_string(upload.fields.size()) +
+                                   " field(s) received"));
 }
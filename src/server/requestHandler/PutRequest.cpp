@@ -1,29 +1,159 @@
 #include "RequestHandler.h"
-#include <fstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
 #include <filesystem>
-#include <sstream>
-// TODO: refactor to smart buffer
-HttpResponse RequestHandler::handlePut() const {
-    // raw filename from URI
-    /*
-    std::string raw = request.uri.substr(request.uri.find_last_of('/') + 1);
-    std::string name = urlDecode(raw);
-
-    namespace fs = std::filesystem;
-    fs::path route(routePath);
-    fs::path dir = route.parent_path();
-    fs::path out = dir / name;
-
-    std::ofstream ofs(out, std::ios::binary);
-    if (!ofs.is_open()) {
-        return HttpResponse(500);  // can’t open file
+#include <webserv.h>
+#include <common/Logger.h>
+#include <common/SessionManager.h>
+#include <server/ClientConnection.h>
+#include <server/handler/CallbackHandler.h>
+#include <server/handler/MetricHandler.h>
+
+// a PUT body is written to a temp file next to the target while it arrives, synced when put_fsync is on,
+// renamed over the target and finally the directory is synced, so readers see the old file or the complete new one
+enum class PutStage {
+    WRITING,
+    SYNCING,
+    SYNCING_DIRECTORY
+};
+
+std::optional<HttpResponse> RequestHandler::handlePut() {
+    if (routePath.empty() || routePath.back() == '/' || isDirectory)
+        return HttpResponse::html(HttpResponse::StatusCode::CONFLICT, "Cannot PUT to a directory");
+
+    const std::filesystem::path target(routePath);
+    const std::filesystem::path directory = target.has_parent_path() ? target.parent_path() : ".";
+    if (!std::filesystem::is_directory(directory))
+        return HttpResponse::html(HttpResponse::StatusCode::NOT_FOUND, "Target directory does not exist");
+
+    struct stat targetStat{};
+    const bool replaced = stat(routePath.c_str(), &targetStat) == 0;
+    if (replaced && !S_ISREG(targetStat.st_mode))
+        return HttpResponse::html(HttpResponse::StatusCode::CONFLICT, "Target is not a regular file");
+
+    if (access(directory.c_str(), W_OK) != 0)
+        return HttpResponse::html(HttpResponse::StatusCode::FORBIDDEN, "No write permission");
+
+    // the temp file lives next to the target, rename() only is atomic within one file system
+    std::string tempPath = (directory / ("." + target.filename().string() + ".put-XXXXXX")).string();
+    const int fd = mkostemp(tempPath.data(), O_CLOEXEC);
+    if (fd == -1) {
+        Logger::log(LogLevel::ERROR, "Failed to create temp file for " + routePath + ": " + strerror(errno));
+        return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
+                                  "Could not open file for writing");
     }
+    putTempPath = tempPath;
+    fileWriter = std::make_shared<FileWriter>(fd, tempPath);
+    // mkostemp creates the file 0600, a replaced file keeps its mode
+    fchmod(fd, replaced ? targetStat.st_mode & 07777 : S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    // Content-Length reserves the blocks in one go before the body arrives, a chunked body is only known once complete
+    const size_t expectedSize = isBodyArriving()
+                                    ? std::strtoull(request->getHeader("Content-Length").c_str(), nullptr, 10)
+                                    : request->totalBodySize;
+    if (expectedSize > 0 &&
+        fallocate(fd, 0, 0, static_cast<off_t>(expectedSize)) == -1 &&
+        (errno == ENOSPC || errno == EDQUOT))
+        return HttpResponse::html(HttpResponse::StatusCode::INSUFFICIENT_STORAGE,
+                                  "Not enough space to store the file");
+
+    client->sessionId = SessionManager::getSessionId(request->getHeader("Cookie"), client->isNewSession);
+    postRequestCallbackId = CallbackHandler::registerCallback([this, replaced, stage = PutStage::WRITING]() mutable {
+        if (stage == PutStage::SYNCING_DIRECTORY) {
+            if (!fileWriter->isIdle())
+                return false;
+            // the new file is already in place, a 500 would make the client retry an upload that succeeded
+            if (fileWriter->getError() != 0)
+                Logger::log(LogLevel::ERROR, "Failed to sync directory " + fileWriter->getPath() + ": " +
+                                             strerror(fileWriter->getError()));
+            fileWriter.reset();
+            setResponse(putStoredResponse(replaced));
+            return true;
+        }
 
-    ofs.write(request.body.data(), request.body.size());
-    if (ofs.fail()) {
-        return HttpResponse(500);  // write error
+        if (fileWriter->getError() != 0) {
+            setResponse(fileWriteError(*fileWriter));
+            return true;
+        }
+
+        if (request->body && !request->body->isDrained() && fileWriter->getInFlight() < UPLOAD_MAX_IN_FLIGHT) {
+            request->body->read(FILE_WRITE_CHUNK_SIZE);
+            if (request->body->hasFailed()) {
+                setResponse(bodyError(*request->body));
+                return true;
+            }
+            iovec spans[SmartBuffer::MAX_SPANS];
+            std::shared_ptr<char> segments[SmartBuffer::MAX_SPANS];
+            size_t spanCount = SmartBuffer::MAX_SPANS;
+            const size_t chunkLength = request->body->peekShared(spans, segments, spanCount, FILE_WRITE_CHUNK_SIZE);
+            fileWriter->write(spans, segments, spanCount);
+            request->body->consume(chunkLength);
+        }
+
+        if ((request->body && (!request->body->isDrained() || request->body->isStreaming())) ||
+            !fileWriter->isIdle())
+            return false;
+
+        if (stage == PutStage::WRITING) {
+            stage = PutStage::SYNCING;
+            if (matchedRoute->put_fsync) {
+                fileWriter->sync();
+                return false;
+            }
+        }
+
+        if (stage == PutStage::SYNCING) {
+            const std::optional<HttpResponse> response = finishPut();
+            if (response) {
+                setResponse(*response);
+                return true;
+            }
+            stage = PutStage::SYNCING_DIRECTORY;
+            if (fileWriter)
+                return false;
+        }
+
+        setResponse(putStoredResponse(replaced));
+        return true;
+    });
+    return std::nullopt;
+}
+
+HttpResponse RequestHandler::putStoredResponse(const bool replaced) const {
+    if (replaced)
+        return HttpResponse(HttpResponse::StatusCode::NO_CONTENT);
+    HttpResponse response = HttpResponse::html(HttpResponse::StatusCode::CREATED,
+                                               request->getPath() + " stored successfully");
+    response.setHeader("Location", request->getPath());
+    return response;
+}
+
+// renames the written temp file over the target, with put_fsync the directory entry is synced afterwards
+std::optional<HttpResponse> RequestHandler::finishPut() {
+    if (rename(putTempPath.c_str(), routePath.c_str()) == -1) {
+        Logger::log(LogLevel::ERROR, "Failed to rename " + putTempPath + " to " + routePath + ": " + strerror(errno));
+        return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Failed to store file");
     }
+    putTempPath.clear();
+    MetricHandler::incrementMetric(Metric::PUT_BYTES, request->totalBodySize);
 
-*/
-    return HttpResponse(201);  // Created
-}
\ No newline at end of file
+    const std::string absolutePath = std::filesystem::absolute(routePath).lexically_normal().string();
+    SessionManager::addUploadedFile(client->sessionId, absolutePath);
+
+    fileWriter.reset();
+    if (!matchedRoute->put_fsync)
+        return std::nullopt;
+    const std::filesystem::path directory = std::filesystem::path(routePath).parent_path();
+    const int fd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        Logger::log(LogLevel::ERROR, "Failed to open directory of " + routePath + ": " + strerror(errno));
+        return std::nullopt;
+    }
+    fileWriter = std::make_shared<FileWriter>(fd, directory.string());
+    fileWriter->sync();
+    return std::nullopt;
+}
@@ -19,6 +19,9 @@
 #include <arpa/inet.h>
 #include <server/handler/CallbackHandler.h>
 #include <server/FdHandler.h>
+#include <server/cgi/CgiProcess.h>
+#include <server/cgi/CgiCache.h>
+#include <server/cgi/CgiLimiter.h>
 #include <sys/poll.h>
 
 #include "common/Logger.h"
@@ -27,14 +30,14 @@
 
 
 RequestHandler::RequestHandler(ClientConnection *connection, const std::shared_ptr<HttpRequest> &request,
-
-                               ServerConfig &serverConfig): request(request), client(connection),
-                                                            serverConfig(serverConfig) {
+                               ServerConfigPtr serverConfig): request(request), client(connection),
+                                                              serverConfig(std::move(serverConfig)) {
     Logger::log(LogLevel::DEBUG,
                 " Port: " + std::to_string(ntohs(connection->clientAddr.sin_port)) + " request: " +
                 request->getMethodString() + " at " + request->uri);
 
     findRoute();
+    connection->route = matchedRoute;
     setRoutePath();
 }
 
@@ -45,42 +48,65 @@ RequestHandler::~RequestHandler() {
         cgiInputFd = -1;
     }
     if (cgiOutputFd != -1) {
+        // the body may outlive the handler in the response, it must not reach for the closed pipe
+        cgiParser.getResult().body->clearSpliceSource();
         FdHandler::removeFd(cgiOutputFd);
         close(cgiOutputFd);
         cgiOutputFd = -1;
     }
-    if (fileWriteFd != -1) {
-        FdHandler::removeFd(fileWriteFd);
-        close(fileWriteFd);
-        fileWriteFd = -1;
-    }
     if (cgiProcessId != -1) {
-        cleanupCgiProcess(cgiProcessId);
+        CgiProcess::terminate(cgiProcessId);
+        cgiProcessId = -1;
     }
     if (postRequestCallbackId != -1) {
         CallbackHandler::unregisterCallback(postRequestCallbackId);
         postRequestCallbackId = -1;
     }
+    if (!putTempPath.empty())
+        unlink(putTempPath.c_str());
+    if (unsavedPatch && fileWriter)
+        keepPatchProgress(*unsavedPatch, fileWriter, expiresFrom(std::time(nullptr)));
+    else if (!resumableUploadLock.empty())
+        ResumableUpload::unlock(resumableUploadLock);
+    if (cgiResumeCallbackId != -1) {
+        CallbackHandler::unregisterCallback(cgiResumeCallbackId);
+        cgiResumeCallbackId = -1;
+    }
+    if (fastCgiConnection) {
+        fastCgiConnection->abort();
+        fastCgiConnection.reset();
+    }
+    if (cgiWorker) {
+        cgiWorker->abort();
+        cgiWorker.reset();
+    }
+    if (cgiQueueTicket != 0)
+        CgiLimiter::cancel(matchedRoute, cgiQueueTicket);
+    releaseCgiSlot();
+    if (cgiCacheWaitId != 0)
+        CgiCache::cancelWait(cgiCacheKey, cgiCacheWaitId);
+    if (cgiCacheFilling)
+        CgiCache::abandon(cgiCacheKey);
 }
 
 
 void RequestHandler::findRoute() {
     size_t longestMatch = 0;
-    for (const RouteConfig &route: serverConfig.routes) {
+    for (const RouteConfig &route: serverConfig->routes) {
         if (route.type == LocationType::EXACT && request->getPath() == route.location) {
-            matchedRoute = route;
+            matchedRoute = &route;
             longestMatch = route.location.length();
             break;
         }
         if (route.type == LocationType::REGEX &&
             std::regex_match(request->getPath(), std::regex(route.location))) {
-            matchedRoute = route;
+            matchedRoute = &route;
             longestMatch = route.location.length();
             break;
         }
         if (route.type == LocationType::PREFIX && request->getPath().find(route.location) == 0) {
             if (route.location.length() > longestMatch) {
-                matchedRoute = route;
+                matchedRoute = &route;
                 longestMatch = route.location.length();
             }
         }
@@ -90,17 +116,17 @@ void RequestHandler::findRoute() {
         return;
     }
 
-    matchedRoute.reset();
+    matchedRoute = nullptr;
     Logger::log(LogLevel::WARNING, "No matching route found for URI: " + request->uri);
 }
 
 void RequestHandler::setRoutePath() {
-    if (!matchedRoute.has_value()) {
+    if (!matchedRoute) {
         routePath.clear();
         return;
     }
 
-    const RouteConfig &route = matchedRoute.value();
+    const RouteConfig &route = *matchedRoute;
     std::string basePath;
 
     if (!route.alias.empty()) {
@@ -108,7 +134,7 @@ void RequestHandler::setRoutePath() {
     } else if (!route.root.empty()) {
         basePath = route.root;
     } else {
-        basePath = serverConfig.root;
+        basePath = serverConfig->root;
     }
 
     std::string uriSuffix = request->getPath().substr(route.location.length());
@@ -129,17 +155,19 @@ void RequestHandler::validateTargetPath() {
 
     isDirectory = std::filesystem::is_directory(routePath);
     if (!isDirectory) {
-        Logger::log(LogLevel::ERROR, "Target path is neither a file nor a directory: " + routePath);
+        // a PUT creates its target
+        if (request->method != PUT)
+            Logger::log(LogLevel::ERROR, "Target path is neither a file nor a directory: " + routePath);
         return;
     }
 
-    const RouteConfig route = matchedRoute.value();
-    if (route.index.empty() && serverConfig.index.empty())
+    const RouteConfig &route = *matchedRoute;
+    if (route.index.empty() && serverConfig->index.empty())
         return;
 
     const std::string indexFilePath = std::filesystem::path(routePath) / (!route.index.empty()
                                                                               ? route.index
-                                                                              : serverConfig.index);
+                                                                              : serverConfig->index);
     hasValidIndexFile = std::filesystem::is_regular_file(indexFilePath);
 
     this->indexFilePath = indexFilePath;
@@ -165,15 +193,97 @@ bool RequestHandler::isCgiRequest() {
     return true;
 }
 
+bool RequestHandler::isFastCgiRequest() {
+    if (matchedRoute->fastcgi_pass.empty())
+        return false;
+
+    const auto it = matchedRoute->fastcgi_pass.find(getFileExtension(getFilePath()));
+    if (it == matchedRoute->fastcgi_pass.end())
+        return false;
+
+    fastCgiAddress = it->second;
+    return true;
+}
+
 void RequestHandler::execute() {
+    client->timing.mark(RequestPhase::HANDLER_START);
     const auto response = handleRequest();
     if (response.has_value()) {
         setResponse(response.value());
     }
 }
 
+// every script execution goes through the location's limiter, which also counts the running ones
+std::optional<HttpResponse> RequestHandler::executeCgi() {
+    switch (CgiLimiter::admit(matchedRoute, [this](const bool admitted) { onCgiSlot(admitted); }, cgiQueueTicket)) {
+        case CgiLimiter::Admission::QUEUED:
+            Logger::log(LogLevel::DEBUG, "Waiting for a free CGI slot");
+            return std::nullopt;
+        case CgiLimiter::Admission::REJECTED:
+            return cgiUnavailableResponse();
+        case CgiLimiter::Admission::RUN:
+            break;
+    }
+
+    cgiSlotHeld = true;
+    auto response = startCgi();
+    // the script never ran
+    if (response.has_value())
+        releaseCgiSlot();
+    return response;
+}
+
+void RequestHandler::onCgiSlot(const bool admitted) {
+    cgiQueueTicket = 0;
+    if (!admitted) {
+        setResponse(cgiUnavailableResponse());
+        finishCgiCacheFill(false);
+        return;
+    }
+
+    cgiSlotHeld = true;
+    if (const auto response = startCgi(); response.has_value()) {
+        releaseCgiSlot();
+        finishCgiCacheFill(false);
+        setResponse(response.value());
+    }
+}
+
+void RequestHandler::releaseCgiSlot() {
+    if (!cgiSlotHeld)
+        return;
+    cgiSlotHeld = false;
+    CgiLimiter::release(matchedRoute);
+}
+
+HttpResponse RequestHandler::cgiUnavailableResponse() const {
+    HttpResponse response = HttpResponse::html(HttpResponse::StatusCode::SERVICE_UNAVAILABLE,
+                                               "CGI Error: Too many requests, try again later");
+    response.setHeader("Retry-After", std::to_string(std::max<size_t>(matchedRoute->cgi_limit.queue_timeout, 1)));
+    return response;
+}
+
+std::optional<HttpResponse> RequestHandler::startCgi() {
+    if (!fastCgiAddress.empty()) {
+        Logger::log(LogLevel::DEBUG, "request is a FastCGI request");
+        return handleFastCgi();
+    }
+
+    Logger::log(LogLevel::DEBUG, "request is a CGI request");
+    if (!validateCgiEnvironment())
+        return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
+                                  "CGI Error: Invalid CGI environment");
+    return handleCgi();
+}
+
+std::optional<HttpResponse> RequestHandler::waitForBody() {
+    Logger::log(LogLevel::DEBUG, "Waiting for the whole body of " + request->uri);
+    waitingForBody = true;
+    return std::nullopt;
+}
+
 std::optional<HttpResponse> RequestHandler::handleRequest() {
-    if (!matchedRoute.has_value())
+    if (!matchedRoute)
         return HttpResponse::html(HttpResponse::NOT_FOUND);
 
     if (std::find(matchedRoute->allowedMethods.begin(), matchedRoute->allowedMethods.end(), request->method) ==
@@ -182,6 +292,8 @@ std::optional<HttpResponse> RequestHandler::handleRequest() {
     }
 
     if (matchedRoute->internalHandler != nullptr) {
+        if (isBodyArriving())
+            return waitForBody();
         Logger::log(LogLevel::DEBUG, "Handling internal request for URI: " + request->uri);
         return matchedRoute->internalHandler(request);
     }
@@ -205,12 +317,20 @@ std::optional<HttpResponse> RequestHandler::handleRequest() {
         return HttpResponse::html(HttpResponse::StatusCode::FORBIDDEN);
     }
 
-    if (isCgiRequest()) {
-        Logger::log(LogLevel::DEBUG, "request is a CGI request");
-        if (!validateCgiEnvironment())
-            return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
-                                      "CGI Error: Invalid CGI environment");
-        return handleCgi();
+    // a body that lost bytes while it was buffered must not be stored or handed to a script
+    if (request->body && request->body->hasFailed())
+        return bodyError(*request->body);
+
+    // a PATCH writes its body while it arrives, like a PUT
+    if (isResumableUploadRequest())
+        return isBodyArriving() && request->method != PATCH ? waitForBody() : handleResumableUpload();
+
+    if (isFastCgiRequest() || isCgiRequest()) {
+        if (isBodyArriving())
+            return waitForBody();
+        if (matchedRoute->cgi_cache.enabled)
+            return handleCgiCache();
+        return executeCgi();
     }
 
 
@@ -228,14 +348,14 @@ std::optional<HttpResponse> RequestHandler::handleRequest() {
     }
 }
 
-HttpResponse RequestHandler::handleCustomErrorPage(HttpResponse original, ServerConfig &serverConfig,
-                                                   std::optional<RouteConfig> matchedRoute) {
+HttpResponse RequestHandler::handleCustomErrorPage(HttpResponse original, const ServerConfig &serverConfig,
+                                                   const RouteConfig *matchedRoute) {
     std::string errorPagePath;
 
-    if (matchedRoute.has_value() && matchedRoute->error_pages.count(original.getStatus()))
-        errorPagePath = matchedRoute->error_pages[original.getStatus()];
+    if (matchedRoute && matchedRoute->error_pages.count(original.getStatus()))
+        errorPagePath = matchedRoute->error_pages.at(original.getStatus());
     else if (serverConfig.error_pages.count(original.getStatus()))
-        errorPagePath = serverConfig.error_pages[original.getStatus()];
+        errorPagePath = serverConfig.error_pages.at(original.getStatus());
     else
         return original;
 
@@ -265,5 +385,5 @@ std::string RequestHandler::getFilePath() const {
 }
 
 void RequestHandler::setResponse(const HttpResponse &response) const {
-    this->client->setResponse(handleCustomErrorPage(response, serverConfig, matchedRoute));
+    this->client->setResponse(handleCustomErrorPage(response, *serverConfig, matchedRoute));
 }
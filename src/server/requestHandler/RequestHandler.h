@@ -10,32 +10,23 @@
 #include <server/response/HttpResponse.h>
 #include <optional>
 #include <parser/cgi/CgiParser.h>
+#include <parser/multipart/MultipartParser.h>
+#include <server/fastcgi/FastCgiConnection.h>
+#include <server/cgi/CgiWorker.h>
+#include <server/io/FileWriter.h>
+#include <server/io/ResumableUpload.h>
 
 class ClientConnection;
 
-enum class MultipartParseStateEnum {
-    LOOKING_FOR_BOUNDARY,
-    READING_HEADERS,
-    READING_FILE_CONTENT
-};
-
-struct MultipartParseState {
-    std::string boundary;
-    std::string endBoundary;
-    std::string parseBuffer;
-    int fileWriteFd = -1;
-    int uploadedFiles;
-    std::vector<std::string> fileNames;
-    MultipartParseStateEnum currentState;
-};
-
+struct MultipartUpload;
 
 class RequestHandler {
 private:
-    std::optional<RouteConfig> matchedRoute;
+    // points into serverConfig->routes, which the handler keeps alive
+    const RouteConfig *matchedRoute = nullptr;
     const std::shared_ptr<HttpRequest> request;
     ClientConnection *client;
-    ServerConfig &serverConfig;
+    const ServerConfigPtr serverConfig;
     std::string routePath;
     std::string cgiPath;
     bool isFile = false;
@@ -49,13 +40,33 @@ private:
     int cgiOutputFd = -1;
     int cgiInputFd = -1;
     int cgiProcessId = -1;
-    int fileWriteFd = -1;
+    std::shared_ptr<FileWriter> fileWriter; // body of a test/file POST or PUT
+    std::string putTempPath; // a PUT body that is not renamed into place yet, removed with the handler
+    bool waitingForBody = false; // started early but only PUT and PATCH stream their body, the connection reruns it once complete
+    std::string resumableUploadLock; // data file of the resumable upload this PATCH writes
+    std::optional<ResumableUpload> unsavedPatch; // the upload while its .info does not count this PATCH's bytes yet
     ssize_t postRequestCallbackId = -1;
     CgiParser cgiParser;
+    bool cgiResponseStarted = false;
+    // re-registers the pipe once the client caught up with a paused cgi output
+    ssize_t cgiResumeCallbackId = -1;
+    std::function<bool(int, short)> cgiOutputCallback;
+    std::string fastCgiAddress;
+    std::shared_ptr<FastCgiConnection> fastCgiConnection;
+    std::shared_ptr<CgiWorker> cgiWorker;
+    // cgi_cache: key of the response, a copy of its body while this request fills the cache
+    std::string cgiCacheKey;
+    const char *cgiCacheStatus = nullptr;
+    bool cgiCacheFilling = false;
+    std::string cgiCacheBody;
+    size_t cgiCacheWaitId = 0;
+    // cgi_max_concurrency: a slot is held while the script runs, the ticket while the request waits for one
+    bool cgiSlotHeld = false;
+    size_t cgiQueueTicket = 0;
 
 public:
     RequestHandler(ClientConnection *connection, const std::shared_ptr<HttpRequest> &request,
-                   ServerConfig &serverConfig);
+                   ServerConfigPtr serverConfig);
 
     ~RequestHandler();
 
@@ -63,8 +74,10 @@ public:
 
     std::optional<HttpResponse> handleRequest();
 
-    static HttpResponse handleCustomErrorPage(HttpResponse original, ServerConfig &serverConfig,
-                                              std::optional<RouteConfig> matchedRoute);
+    [[nodiscard]] bool isWaitingForBody() const { return waitingForBody; }
+
+    static HttpResponse handleCustomErrorPage(HttpResponse original, const ServerConfig &serverConfig,
+                                              const RouteConfig *matchedRoute);
 
     static std::string getMimeType(const std::string &path);
 
@@ -81,6 +94,8 @@ private:
 
     bool isCgiRequest();
 
+    bool isFastCgiRequest();
+
     void setResponse(const HttpResponse &response) const;
 
     [[nodiscard]] std::string getFilePath() const;
@@ -91,25 +106,99 @@ private:
 
     [[nodiscard]] std::optional<HttpResponse> handlePostMultipart(const std::string &contentType);
 
-    void processMultipartBuffer(std::shared_ptr<MultipartParseState> state);
+    [[nodiscard]] MultipartParser::Callbacks multipartCallbacks(MultipartUpload &upload);
+
+    void finishMultipartUpload(MultipartUpload &upload);
+
+    // 507 when the disk is full, 500 for any other write error
+    [[nodiscard]] static HttpResponse fileWriteError(const FileWriter &writer);
+
+    // the request body lost bytes in its spill file, 507 when the disk is full, 500 otherwise
+    [[nodiscard]] static HttpResponse bodyError(const SmartBuffer &body);
+
+    // the body is still arriving, only handlePut() consumes it as it comes
+    [[nodiscard]] bool isBodyArriving() const { return request->body && request->body->isStreaming(); }
+
+    std::optional<HttpResponse> waitForBody();
 
     [[nodiscard]] std::optional<HttpResponse> handlePostTestFile();
 
-    HttpResponse handlePut() const;
+    [[nodiscard]] std::optional<HttpResponse> handlePut();
+
+    [[nodiscard]] std::optional<HttpResponse> finishPut();
+
+    // 204 for a replaced file, 201 with its Location for a new one
+    [[nodiscard]] HttpResponse putStoredResponse(bool replaced) const;
 
     [[nodiscard]] HttpResponse handleDelete() const;
 
-    void cleanupCgiProcess(pid_t pid) const;
+    [[nodiscard]] bool isResumableUploadRequest() const;
+
+    [[nodiscard]] static HttpResponse tusResponse(HttpResponse::StatusCode status, const std::string &message = "");
+
+    [[nodiscard]] std::optional<HttpResponse> handleResumableUpload();
+
+    // when an upload without further PATCHes expires, 0 when the location keeps them forever
+    [[nodiscard]] std::time_t expiresFrom(std::time_t now) const;
+
+    [[nodiscard]] HttpResponse createResumableUpload();
+
+    [[nodiscard]] std::optional<HttpResponse> patchResumableUpload(ResumableUpload upload);
+
+    // stores the offset a cut off PATCH reached once its last write is done, the upload stays locked until then
+    static void keepPatchProgress(ResumableUpload upload, std::shared_ptr<FileWriter> writer, std::time_t expires);
+
+    // an error response when the file could not be put in place
+    [[nodiscard]] std::optional<HttpResponse> finishResumableUpload(const ResumableUpload &upload);
+
+    [[nodiscard]] std::optional<HttpResponse> executeCgi();
+
+    [[nodiscard]] std::optional<HttpResponse> startCgi();
+
+    void onCgiSlot(bool admitted);
+
+    void releaseCgiSlot();
+
+    [[nodiscard]] HttpResponse cgiUnavailableResponse() const;
+
+    [[nodiscard]] std::optional<HttpResponse> handleCgiCache();
+
+    void onCgiCacheFilled(bool stored);
+
+    void finishCgiCacheFill(bool success);
 
     [[nodiscard]] std::optional<HttpResponse> handleCgi();
 
+    [[nodiscard]] std::optional<HttpResponse> handleFastCgi();
+
+    void onFastCgiComplete(bool success);
+
+    [[nodiscard]] std::optional<HttpResponse> handleCgiWorker();
+
+    void onCgiWorkerComplete(bool success);
+
+    [[nodiscard]] std::unordered_map<std::string, std::string> buildCgiEnvironment() const;
+
+    static HttpResponse buildCgiResponse(const CgiParser::CgiResult &result);
+
+    void forwardCgiOutput(const char *data, size_t length);
+
+    [[nodiscard]] bool finishCgiOutput(bool success);
+
+    void pauseCgiOutput();
+
+    // the request body broke while it was fed to the script, stops the script and answers for it
+    void abortCgiOutput();
+
+    [[nodiscard]] bool canSpliceCgiOutput() const;
+
+    void spliceCgiOutput(pid_t pid);
+
     HttpResponse handleAutoIndex(const std::string &path);
 
     bool writeRequestBodyToCgi(int pipe_fd, const std::string &body);
 
     [[nodiscard]] bool validateCgiEnvironment() const;
-
-    void configureCgiChildProcess(int input_pipe[2], int output_pipe[2]) const;
 };
 
 
@@ -0,0 +1,305 @@
+#include "RequestHandler.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <webserv.h>
+#include <common/Logger.h>
+#include <common/SessionManager.h>
+#include <server/ClientConnection.h>
+#include <server/handler/CallbackHandler.h>
+#include <server/handler/MetricHandler.h>
+
+// tus 1.0.0 core protocol with the creation, termination and expiration extensions:
+// POST on the upload directory creates an upload, HEAD on it returns the stored offset,
+// PATCH appends at that offset while its body arrives and DELETE drops it. When a PATCH is cut off,
+// the bytes that reached the file still count, the client resumes behind them. An upload without
+// a PATCH for resumable_upload_expire seconds is removed.
+bool RequestHandler::isResumableUploadRequest() const {
+    if (matchedRoute->resumable_upload_max_size == 0)
+        return false;
+    return request->method == OPTIONS || !request->getHeader("Tus-Resumable").empty() ||
+           std::filesystem::path(routePath).parent_path().filename() == ResumableUpload::DIRECTORY;
+}
+
+HttpResponse RequestHandler::tusResponse(const HttpResponse::StatusCode status, const std::string &message) {
+    HttpResponse response = message.empty() ? HttpResponse(status) : HttpResponse::html(status, message);
+    if (message.empty())
+        response.omitBody();
+    response.setHeader("Tus-Resumable", ResumableUpload::VERSION);
+    return response;
+}
+
+std::optional<HttpResponse> RequestHandler::handleResumableUpload() {
+    if (request->method == OPTIONS) {
+        HttpResponse response = tusResponse(HttpResponse::StatusCode::NO_CONTENT);
+        response.setHeader("Tus-Version", ResumableUpload::VERSION);
+        response.setHeader("Tus-Extension", "creation,termination,expiration");
+        response.setHeader("Tus-Max-Size", std::to_string(matchedRoute->resumable_upload_max_size));
+        return response;
+    }
+
+    const bool isUpload = std::filesystem::path(routePath).parent_path().filename() == ResumableUpload::DIRECTORY;
+    // the partial data is never served as a file
+    if (isUpload && request->method != HEAD && request->method != PATCH && request->method != DELETE)
+        return tusResponse(HttpResponse::StatusCode::METHOD_NOT_ALLOWED, "Uploads accept HEAD, PATCH and DELETE");
+    if (!isUpload && request->method != POST)
+        return tusResponse(HttpResponse::StatusCode::METHOD_NOT_ALLOWED, "Uploads are created with a POST");
+
+    if (request->getHeader("Tus-Resumable") != ResumableUpload::VERSION) {
+        HttpResponse response = tusResponse(HttpResponse::StatusCode::PRECONDITION_FAILED,
+                                            "Unsupported Tus-Resumable version");
+        response.setHeader("Tus-Version", ResumableUpload::VERSION);
+        return response;
+    }
+
+    if (!isUpload)
+        return createResumableUpload();
+
+    const std::filesystem::path uploadPath(routePath);
+    const std::string id = uploadPath.filename().string();
+    std::optional<ResumableUpload> upload;
+    if (ResumableUpload::isValidId(id))
+        upload = ResumableUpload::load(uploadPath.parent_path().string(), id);
+    if (!upload)
+        return tusResponse(HttpResponse::StatusCode::NOT_FOUND, "Upload does not exist");
+    ResumableUpload::watch(upload->directory);
+    // the sweep may not have come by yet
+    if (upload->isExpired(std::time(nullptr)) && ResumableUpload::lock(upload->getDataPath())) {
+        upload->remove();
+        ResumableUpload::unlock(upload->getDataPath());
+        MetricHandler::incrementMetric(Metric::RESUMABLE_UPLOADS_EXPIRED, 1);
+        return tusResponse(HttpResponse::StatusCode::NOT_FOUND, "Upload expired");
+    }
+
+    if (request->method == HEAD) {
+        HttpResponse response = tusResponse(HttpResponse::StatusCode::OK);
+        response.setHeader("Upload-Offset", std::to_string(upload->offset));
+        response.setHeader("Upload-Length", std::to_string(upload->length));
+        if (upload->expires != 0)
+            response.setHeader("Upload-Expires", upload->getExpiresHeader());
+        response.setHeader("Cache-Control", "no-store");
+        return response;
+    }
+
+    if (request->method == DELETE) {
+        if (!ResumableUpload::lock(upload->getDataPath()))
+            return tusResponse(HttpResponse::StatusCode::CONFLICT, "Upload is being written");
+        upload->remove();
+        ResumableUpload::unlock(upload->getDataPath());
+        return tusResponse(HttpResponse::StatusCode::NO_CONTENT);
+    }
+    return patchResumableUpload(*upload);
+}
+
+std::time_t RequestHandler::expiresFrom(const std::time_t now) const {
+    if (matchedRoute->resumable_upload_expire == 0)
+        return 0;
+    return now + static_cast<std::time_t>(matchedRoute->resumable_upload_expire);
+}
+
+HttpResponse RequestHandler::createResumableUpload() {
+    if (!isDirectory)
+        return tusResponse(HttpResponse::StatusCode::NOT_FOUND, "Target directory does not exist");
+    if (request->totalBodySize > 0)
+        return tusResponse(HttpResponse::StatusCode::BAD_REQUEST, "Upload data belongs in a PATCH");
+
+    const std::string lengthHeader = request->getHeader("Upload-Length");
+    if (lengthHeader.empty() || lengthHeader.find_first_not_of("0123456789") != std::string::npos ||
+        lengthHeader.length() > 19)
+        return tusResponse(HttpResponse::StatusCode::BAD_REQUEST, "Missing or invalid Upload-Length");
+    const size_t length = std::stoull(lengthHeader);
+    if (length > matchedRoute->resumable_upload_max_size) {
+        HttpResponse response = tusResponse(HttpResponse::StatusCode::CONTENT_TOO_LARGE, "Upload is too large");
+        response.setHeader("Tus-Max-Size", std::to_string(matchedRoute->resumable_upload_max_size));
+        return response;
+    }
+
+    ResumableUpload upload;
+    upload.directory = (std::filesystem::path(routePath) / ResumableUpload::DIRECTORY).string();
+    upload.id = ResumableUpload::generateId();
+    upload.length = length;
+    upload.filename = ResumableUpload::filenameOf(request->getHeader("Upload-Metadata"));
+    if (upload.filename.empty())
+        upload.filename = upload.id;
+    // checked again when the upload completes, this only spares the client sending a file that can not be stored
+    if (std::filesystem::exists(std::filesystem::path(routePath) / upload.filename))
+        return tusResponse(HttpResponse::StatusCode::CONFLICT, "A file with this name already exists");
+
+    if (mkdir(upload.directory.c_str(), S_IRWXU) == -1 && errno != EEXIST) {
+        Logger::log(LogLevel::ERROR, "Failed to create " + upload.directory + ": " + strerror(errno));
+        return tusResponse(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Could not create upload");
+    }
+    // creating costs no disk space, the count keeps clients from piling up uploads they never finish
+    if (matchedRoute->resumable_upload_max_count != 0 &&
+        ResumableUpload::countUnfinished(upload.directory) >= matchedRoute->resumable_upload_max_count) {
+        HttpResponse response = tusResponse(HttpResponse::StatusCode::SERVICE_UNAVAILABLE,
+                                            "Too many unfinished uploads");
+        response.setHeader("Retry-After", std::to_string(RESUMABLE_UPLOAD_SWEEP_INTERVAL));
+        return response;
+    }
+    const int fd = open(upload.getDataPath().c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                        S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        Logger::log(LogLevel::ERROR, "Failed to create " + upload.getDataPath() + ": " + strerror(errno));
+        return tusResponse(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Could not create upload");
+    }
+    close(fd);
+
+    client->sessionId = SessionManager::getSessionId(request->getHeader("Cookie"), client->isNewSession);
+    upload.sessionId = client->sessionId;
+    upload.expires = expiresFrom(std::time(nullptr));
+    if (!upload.save()) {
+        upload.remove();
+        return tusResponse(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Could not create upload");
+    }
+    // an empty upload is complete right away
+    if (upload.isComplete()) {
+        if (const std::optional<HttpResponse> error = finishResumableUpload(upload))
+            return *error;
+    }
+
+    std::string location = request->getPath();
+    if (location.back() != '/')
+        location += '/';
+    HttpResponse response = tusResponse(HttpResponse::StatusCode::CREATED);
+    response.setHeader("Location", location + ResumableUpload::DIRECTORY + "/" + upload.id);
+    response.setHeader("Upload-Offset", "0");
+    if (upload.expires != 0 && !upload.isComplete())
+        response.setHeader("Upload-Expires", upload.getExpiresHeader());
+    return response;
+}
+
+std::optional<HttpResponse> RequestHandler::patchResumableUpload(ResumableUpload upload) {
+    if (request->getHeader("Content-Type") != "application/offset+octet-stream")
+        return tusResponse(HttpResponse::StatusCode::UNSUPPORTED_MEDIA_TYPE,
+                           "PATCH needs Content-Type application/offset+octet-stream");
+
+    const std::string offsetHeader = request->getHeader("Upload-Offset");
+    if (offsetHeader.empty() || offsetHeader.find_first_not_of("0123456789") != std::string::npos ||
+        offsetHeader.length() > 19)
+        return tusResponse(HttpResponse::StatusCode::BAD_REQUEST, "Missing or invalid Upload-Offset");
+    // the client resumes from a HEAD after a conflict
+    if (std::stoull(offsetHeader) != upload.offset)
+        return tusResponse(HttpResponse::StatusCode::CONFLICT, "Upload-Offset does not match the stored offset");
+    // a streamed body announces its size in Content-Length, a chunked one is checked while it arrives
+    const size_t expectedSize = isBodyArriving()
+                                    ? std::strtoull(request->getHeader("Content-Length").c_str(), nullptr, 10)
+                                    : request->totalBodySize;
+    if (expectedSize > upload.length - upload.offset)
+        return tusResponse(HttpResponse::StatusCode::BAD_REQUEST, "PATCH exceeds the Upload-Length");
+
+    if (!ResumableUpload::lock(upload.getDataPath()))
+        return tusResponse(HttpResponse::StatusCode::CONFLICT, "Upload is being written");
+    resumableUploadLock = upload.getDataPath();
+
+    const int fd = open(upload.getDataPath().c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        Logger::log(LogLevel::ERROR, "Failed to open " + upload.getDataPath() + ": " + strerror(errno));
+        return tusResponse(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Could not open upload");
+    }
+    // only the blocks of this PATCH are reserved, an abandoned upload holds no more space than it received
+    if (expectedSize > 0 &&
+        fallocate(fd, 0, static_cast<off_t>(upload.offset), static_cast<off_t>(expectedSize)) == -1 &&
+        (errno == ENOSPC || errno == EDQUOT)) {
+        close(fd);
+        return tusResponse(HttpResponse::StatusCode::INSUFFICIENT_STORAGE, "Not enough space to store the file");
+    }
+    fileWriter = std::make_shared<FileWriter>(fd, upload.getDataPath(), static_cast<off_t>(upload.offset));
+    unsavedPatch = upload;
+
+    postRequestCallbackId = CallbackHandler::registerCallback([this, upload]() mutable {
+        // the stored offset stays where it was, the client resends from there
+        if (fileWriter->getError() != 0) {
+            setResponse(fileWriteError(*fileWriter));
+            return true;
+        }
+
+        if (request->body && !request->body->isDrained() && fileWriter->getInFlight() < UPLOAD_MAX_IN_FLIGHT) {
+            request->body->read(FILE_WRITE_CHUNK_SIZE);
+            if (request->body->hasFailed()) {
+                setResponse(bodyError(*request->body));
+                return true;
+            }
+            iovec spans[SmartBuffer::MAX_SPANS];
+            std::shared_ptr<char> segments[SmartBuffer::MAX_SPANS];
+            size_t spanCount = SmartBuffer::MAX_SPANS;
+            const size_t chunkLength = request->body->peekShared(spans, segments, spanCount, FILE_WRITE_CHUNK_SIZE);
+            // the bytes up to the Upload-Length are kept, the client learns the offset from a HEAD
+            if (fileWriter->getWritten() + fileWriter->getInFlight() + chunkLength > upload.length - upload.offset) {
+                setResponse(tusResponse(HttpResponse::StatusCode::BAD_REQUEST, "PATCH exceeds the Upload-Length"));
+                return true;
+            }
+            fileWriter->write(spans, segments, spanCount);
+            request->body->consume(chunkLength);
+        }
+
+        if ((request->body && (!request->body->isDrained() || request->body->isStreaming())) ||
+            !fileWriter->isIdle())
+            return false;
+
+        unsavedPatch.reset();
+        upload.offset += fileWriter->getWritten();
+        upload.expires = expiresFrom(std::time(nullptr));
+        MetricHandler::incrementMetric(Metric::RESUMABLE_UPLOAD_BYTES, fileWriter->getWritten());
+        if (!upload.save()) {
+            setResponse(tusResponse(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Could not store the offset"));
+            return true;
+        }
+        if (upload.isComplete()) {
+            if (const std::optional<HttpResponse> error = finishResumableUpload(upload)) {
+                setResponse(*error);
+                return true;
+            }
+        }
+
+        HttpResponse response = tusResponse(HttpResponse::StatusCode::NO_CONTENT);
+        response.setHeader("Upload-Offset", std::to_string(upload.offset));
+        if (upload.expires != 0 && !upload.isComplete())
+            response.setHeader("Upload-Expires", upload.getExpiresHeader());
+        setResponse(response);
+        return true;
+    });
+    return std::nullopt;
+}
+
+void RequestHandler::keepPatchProgress(ResumableUpload upload, std::shared_ptr<FileWriter> writer,
+                                       const std::time_t expires) {
+    CallbackHandler::registerCallback([upload, writer, expires]() mutable {
+        if (!writer->isIdle())
+            return false;
+        // the writes went out in order, once none is left the written bytes follow the stored offset without a gap
+        if (writer->getError() == 0 && writer->getWritten() > 0) {
+            upload.offset += writer->getWritten();
+            upload.expires = expires;
+            if (upload.save())
+                MetricHandler::incrementMetric(Metric::RESUMABLE_UPLOAD_BYTES, writer->getWritten());
+            else
+                Logger::log(LogLevel::ERROR, "Failed to store the offset of " + upload.getDataPath());
+        }
+        ResumableUpload::unlock(upload.getDataPath());
+        return true;
+    });
+}
+
+// moves the complete data next to the other uploads and hands it to the session that created it,
+// a file that appeared under the same name in the meantime is never replaced
+std::optional<HttpResponse> RequestHandler::finishResumableUpload(const ResumableUpload &upload) {
+    const std::filesystem::path target = std::filesystem::path(upload.directory).parent_path() / upload.filename;
+    if (!upload.moveTo(target.string())) {
+        if (errno == EEXIST)
+            return tusResponse(HttpResponse::StatusCode::CONFLICT, "A file with this name already exists");
+        Logger::log(LogLevel::ERROR, "Failed to rename " + upload.getDataPath() + " to " + target.string() + ": " +
+                                     strerror(errno));
+        return tusResponse(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Failed to store file");
+    }
+    unlink(upload.getInfoPath().c_str());
+    MetricHandler::incrementMetric(Metric::RESUMABLE_UPLOADS, 1);
+
+    const std::string absolutePath = std::filesystem::absolute(target).lexically_normal().string();
+    SessionManager::addUploadedFile(upload.sessionId, absolutePath);
+    return std::nullopt;
+}
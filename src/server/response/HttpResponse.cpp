@@ -5,10 +5,22 @@
 #include "HttpResponse.h"
 #include <iostream>
 #include <utility>
+#include <strings.h>
 #include <parser/http/HttpParser.h>
 
 #include "NotFoundImage.h"
 
+// header names from a script keep the case it sent them in
+template<typename Map>
+static void eraseHeader(Map &headers, const std::string &name) {
+    for (auto it = headers.begin(); it != headers.end();) {
+        if (strcasecmp(it->first.c_str(), name.c_str()) == 0)
+            it = headers.erase(it);
+        else
+            ++it;
+    }
+}
+
 HttpResponse::HttpResponse(const int statusCode)
     : statusCode(statusCode),
       chunkedEncoding(true) {
@@ -40,7 +52,15 @@ void HttpResponse::setBody(const std::string &body) {
 void HttpResponse::enableChunkedEncoding(std::shared_ptr<SmartBuffer> body) {
     this->body = std::move(body);
     chunkedEncoding = true;
-    headers.erase("Content-Length");
+    eraseHeader(headers, "Content-Length");
+}
+
+void HttpResponse::omitBody() {
+    bodyOmitted = true;
+    eraseHeader(headers, "Transfer-Encoding");
+    // a 204 must not carry a length, anything else needs one to keep the connection usable
+    if (statusCode != NO_CONTENT)
+        headers["Content-Length"] = "0";
 }
 
 bool HttpResponse::isChunkedEncoding() const {
@@ -89,8 +109,12 @@ std::string HttpResponse::getStatusMessage(const int code) {
         case NOT_IMPLEMENTED: return "Not Implemented";
         case FORBIDDEN: return "Forbidden";
         case CONFLICT: return "Conflict";
+        case PRECONDITION_FAILED: return "Precondition Failed";
         case UNSUPPORTED_MEDIA_TYPE: return "Unsupported Media Type";
+        case BAD_GATEWAY: return "Bad Gateway";
+        case SERVICE_UNAVAILABLE: return "Service Unavailable";
         case GATEWAY_TIMEOUT: return "Gateway Timeout";
+        case INSUFFICIENT_STORAGE: return "Insufficient Storage";
         default: return "Unknown";
     }
 }
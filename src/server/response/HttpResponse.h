@@ -21,6 +21,7 @@ private:
     std::shared_ptr<SmartBuffer> body;
     std::vector<std::string> setCookies;
     bool chunkedEncoding;;
+    bool bodyOmitted = false;
 
 public:
     // only used for chunked encoding, because there we have to send the header and body separately
@@ -39,13 +40,17 @@ public:
         NOT_FOUND = 404,
         REQUEST_TIMEOUT = 408,
         CONFLICT = 409,
+        PRECONDITION_FAILED = 412,
         CONTENT_TOO_LARGE = 413,
         REQUEST_URI_TOO_LONG = 414,
         UNSUPPORTED_MEDIA_TYPE = 415,
         METHOD_NOT_ALLOWED = 405,
         INTERNAL_SERVER_ERROR = 500,
         NOT_IMPLEMENTED = 501,
+        BAD_GATEWAY = 502,
+        SERVICE_UNAVAILABLE = 503,
         GATEWAY_TIMEOUT = 504,
+        INSUFFICIENT_STORAGE = 507,
     };
 
     HttpResponse() = delete;
@@ -65,6 +70,11 @@ public:
     // this is only used for sending files
     void enableChunkedEncoding(std::shared_ptr<SmartBuffer> body);
 
+    // headers only, without the chunked framing, for HEAD and 204 responses
+    void omitBody();
+
+    [[nodiscard]] bool isBodyOmitted() const { return bodyOmitted; }
+
     [[nodiscard]] std::string toString() const;
 
     [[nodiscard]] std::string toHeaderString() const;
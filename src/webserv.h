@@ -17,7 +17,39 @@
 #define CGI_TIMEOUT 1000
 #define SERVER_NAME "webserv"
 #define TEMP_DIR_NAME ".tmp"
-#define SESSION_SAVE_FILE ".sessions.bin"
+#define SESSION_SNAPSHOT_FILE ".sessions.snapshot"
+#define SESSION_JOURNAL_FILE ".sessions.journal"
+#define SESSION_COMPACTING_FILE ".sessions.journal.compacting" // a rotated journal on its way into the snapshot
+#define SESSION_JOURNAL_COMPACT_SIZE (4 * 1024 * 1024)
+#define SESSION_LEGACY_FILE ".sessions.bin" // full dump of older versions, imported once
+#define LOG_BUFFER_SIZE (4 * 1024 * 1024) // log bytes waiting for the disk before lines are dropped
+#define DEFAULT_SLOW_REQUEST_LOG "slow_requests.log"
+#define DEFAULT_SESSION_IDLE_TIMEOUT (24 * 60 * 60)
+#define DEFAULT_SESSION_LIFETIME (30 * 24 * 60 * 60)
+#define DEFAULT_SESSION_MAX_COUNT 100000
+#define DEFAULT_LISTEN_BACKLOG 5024
+#define READ_BUFFER_SIZE 65536
+#define DEFAULT_CLIENT_BODY_BUFFER_SIZE 65536
+#define DEFAULT_BUFFER_MEMORY_BUDGET (64 * 1024 * 1024)
+#define SEND_CHUNK_SIZE 65536
+#define CGI_PIPE_CHUNK_SIZE 65536
+#define CGI_OUTPUT_BACKLOG_LIMIT (4 * CGI_PIPE_CHUNK_SIZE)
+#define FILE_WRITE_CHUNK_SIZE 65536
+#define MULTIPART_MAX_FIELD_SIZE 65536
+#define UPLOAD_MAX_IN_FLIGHT (16 * FILE_WRITE_CHUNK_SIZE) // bytes a request may have queued for the disk
+#define DEFAULT_IO_THREADS 4
+#define FASTCGI_MAX_IDLE_CONNECTIONS 16
+#define CGI_WORKER_MAX_REQUESTS 1000
+#define CGI_WORKER_RETRY_DELAY 1 // seconds a broken worker pool waits before it spawns again, doubled per failure
+#define CGI_WORKER_MAX_RETRY_DELAY 300
+#define DEFAULT_CGI_CACHE_MEMORY_SIZE (16 * 1024 * 1024)
+#define DEFAULT_CGI_CACHE_DISK_SIZE (256 * 1024 * 1024)
+#define CGI_CACHE_MEMORY_ENTRY_LIMIT 65536
+#define CGI_CACHE_MAX_ENTRY_SIZE (8 * 1024 * 1024)
+#define DEFAULT_CGI_QUEUE_TIMEOUT 5
+#define DEFAULT_RESUMABLE_UPLOAD_EXPIRE 86400 // seconds an unfinished tus upload is kept after its last PATCH
+#define DEFAULT_RESUMABLE_UPLOAD_MAX_COUNT 100 // unfinished tus uploads per upload directory
+#define RESUMABLE_UPLOAD_SWEEP_INTERVAL 60
 
 #if defined(__APPLE__)
 #ifndef MSG_NOSIGNAL
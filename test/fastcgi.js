@@ -0,0 +1,103 @@
+// Minimal FastCGI responder standing in for php-fpm.
+// usage: node fastcgi.js 9000            (tcp on 127.0.0.1)
+//        node fastcgi.js /tmp/fcgi.sock  (unix socket)
+// location: fastcgi_pass .php 127.0.0.1:9000;
+const net = require('net');
+const fs = require('fs');
+
+const BEGIN_REQUEST = 1, END_REQUEST = 3, PARAMS = 4, STDIN = 5, STDOUT = 6;
+
+function record(type, requestId, content) {
+    const header = Buffer.alloc(8);
+    header[0] = 1;
+    header[1] = type;
+    header.writeUInt16BE(requestId, 2);
+    header.writeUInt16BE(content.length, 4);
+    return Buffer.concat([header, content]);
+}
+
+function parseParams(buffer) {
+    const params = {};
+    let offset = 0;
+    const readLength = () => {
+        if (buffer[offset] & 0x80) {
+            const length = buffer.readUInt32BE(offset) & 0x7fffffff;
+            offset += 4;
+            return length;
+        }
+        return buffer[offset++];
+    };
+    while (offset < buffer.length) {
+        const nameLength = readLength();
+        const valueLength = readLength();
+        const name = buffer.toString('utf8', offset, offset + nameLength);
+        offset += nameLength;
+        params[name] = buffer.toString('utf8', offset, offset + valueLength);
+        offset += valueLength;
+    }
+    return params;
+}
+
+function respond(socket, requestId, request) {
+    const params = parseParams(Buffer.concat(request.params));
+    const stdin = Buffer.concat(request.stdin);
+    const body = Buffer.from(
+        `script: ${params.SCRIPT_FILENAME}\n` +
+        `method: ${params.REQUEST_METHOD}\n` +
+        `query: ${params.QUERY_STRING}\n` +
+        `stdin: ${stdin.length}\n`);
+    const head = Buffer.from('Status: 200 OK\r\nContent-Type: text/plain\r\n\r\n');
+
+    socket.write(record(STDOUT, requestId, head));
+    for (let offset = 0; offset < body.length; offset += 65535)
+        socket.write(record(STDOUT, requestId, body.subarray(offset, offset + 65535)));
+    socket.write(record(STDOUT, requestId, Buffer.alloc(0)));
+    socket.write(record(END_REQUEST, requestId, Buffer.alloc(8)));
+    if (!request.keepConnection)
+        socket.end();
+}
+
+const server = net.createServer((socket) => {
+    const requests = new Map();
+    let pending = Buffer.alloc(0);
+    socket.setNoDelay(true);
+
+    socket.on('data', (data) => {
+        pending = Buffer.concat([pending, data]);
+        while (pending.length >= 8) {
+            const type = pending[1];
+            const requestId = pending.readUInt16BE(2);
+            const contentLength = pending.readUInt16BE(4);
+            const total = 8 + contentLength + pending[6];
+            if (pending.length < total)
+                break;
+            const content = pending.subarray(8, 8 + contentLength);
+            pending = pending.subarray(total);
+
+            if (type === BEGIN_REQUEST)
+                requests.set(requestId, {params: [], stdin: [], keepConnection: (content[2] & 1) === 1});
+            const request = requests.get(requestId);
+            if (!request)
+                continue;
+            if (type === PARAMS)
+                request.params.push(content);
+            if (type === STDIN && contentLength > 0)
+                request.stdin.push(content);
+            if (type === STDIN && contentLength === 0) {
+                requests.delete(requestId);
+                respond(socket, requestId, request);
+            }
+        }
+    });
+    socket.on('error', () => {});
+});
+
+const target = process.argv[2] || '9000';
+if (/^\d+$/.test(target)) {
+    server.listen(Number(target), '127.0.0.1');
+} else {
+    if (fs.existsSync(target))
+        fs.unlinkSync(target);
+    server.listen(target);
+}
+console.log('FastCGI stand-in listening on ' + target);